@@ -33,6 +33,8 @@
 
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/OptionsTest.o" =>
     "test/cxx/Core/ApplicationPool/OptionsTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/ProcessExitWatcherTest.o" =>
+    "test/cxx/Core/ApplicationPool/ProcessExitWatcherTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/ProcessTest.o" =>
     "test/cxx/Core/ApplicationPool/ProcessTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/ApplicationPool/PoolTest.o" =>
@@ -41,6 +43,12 @@
     "test/cxx/Core/SpawningKit/DirectSpawnerTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/SmartSpawnerTest.o" =>
     "test/cxx/Core/SpawningKit/SmartSpawnerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/ProcessReaperTest.o" =>
+    "test/cxx/Core/SpawningKit/ProcessReaperTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/SpawnerTest.o" =>
+    "test/cxx/Core/SpawningKit/SpawnerTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Core/SpawningKit/NegotiationTest.o" =>
+    "test/cxx/Core/SpawningKit/NegotiationTest.cpp",
 
   "#{TEST_OUTPUT_DIR}cxx/Core/UnionStationTest.o" =>
     "test/cxx/Core/UnionStationTest.cpp",
@@ -71,10 +79,18 @@
     "test/cxx/MemoryKit/MbufTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/MemoryKit/PallocTest.o" =>
     "test/cxx/MemoryKit/PallocTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Algorithms/AdaptiveConcurrencyLimitTest.o" =>
+    "test/cxx/Algorithms/AdaptiveConcurrencyLimitTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Algorithms/DemandPredictorTest.o" =>
+    "test/cxx/Algorithms/DemandPredictorTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/Algorithms/HistogramTest.o" =>
+    "test/cxx/Algorithms/HistogramTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/DataStructures/LStringTest.o" =>
     "test/cxx/DataStructures/LStringTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/DataStructures/StringKeyTableTest.o" =>
     "test/cxx/DataStructures/StringKeyTableTest.cpp",
+  "#{TEST_OUTPUT_DIR}cxx/DataStructures/TournamentTreeTest.o" =>
+    "test/cxx/DataStructures/TournamentTreeTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/MessageReadersWritersTest.o" =>
     "test/cxx/MessageReadersWritersTest.cpp",
   "#{TEST_OUTPUT_DIR}cxx/StaticStringTest.o" =>
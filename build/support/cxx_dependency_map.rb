@@ -25,9 +25,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -38,12 +41,17 @@
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApiServerUtils.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -97,6 +105,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -142,9 +151,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -154,6 +166,7 @@
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -162,6 +175,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -172,9 +186,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -202,9 +218,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -214,6 +233,7 @@
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -222,6 +242,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -236,6 +257,7 @@
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -304,9 +326,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -315,6 +340,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -323,6 +349,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -333,9 +360,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -408,9 +437,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -419,10 +451,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -431,6 +469,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -446,6 +485,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -487,9 +527,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -498,10 +541,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -510,6 +559,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -525,6 +575,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -566,9 +617,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -577,10 +631,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -589,6 +649,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -604,6 +665,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -645,9 +707,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -656,10 +721,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -668,6 +739,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -683,6 +755,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -724,9 +797,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -735,10 +811,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -747,6 +829,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -762,6 +845,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -803,9 +887,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -814,10 +901,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -827,6 +920,7 @@
    "src/cxx_supportlib/MessageReadersWriters.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -842,6 +936,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -877,15 +972,19 @@
    "src/agent/Core/ApplicationPool/Group.h",
    "src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/ApplicationPool/Process.h",
+   "src/agent/Core/ApplicationPool/ProcessExitWatcher.h",
    "src/agent/Core/ApplicationPool/Session.h",
    "src/agent/Core/ApplicationPool/Socket.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -894,10 +993,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -906,6 +1011,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -921,6 +1027,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -962,9 +1069,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -973,10 +1083,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -985,6 +1101,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -1000,6 +1117,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -1041,9 +1159,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1052,18 +1173,26 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
    "src/cxx_supportlib/Logging.h",
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/MemoryKit/palloc.h",
+   "src/cxx_supportlib/MessageReadersWriters.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -1079,6 +1208,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -1120,9 +1250,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1131,10 +1264,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1143,6 +1282,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -1158,6 +1298,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -1199,9 +1340,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1210,10 +1354,16 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1222,6 +1372,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -1237,6 +1388,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -1291,16 +1443,21 @@
    "src/agent/Core/ApplicationPool/Pool/Miscellaneous.cpp",
    "src/agent/Core/ApplicationPool/Pool/ProcessUtils.cpp",
    "src/agent/Core/ApplicationPool/Pool/StateInspection.cpp",
+   "src/agent/Core/ApplicationPool/Pool/StateSnapshotPublishing.cpp",
    "src/agent/Core/ApplicationPool/Process.h",
+   "src/agent/Core/ApplicationPool/ProcessExitWatcher.h",
    "src/agent/Core/ApplicationPool/Session.h",
    "src/agent/Core/ApplicationPool/Socket.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1310,10 +1467,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1323,6 +1486,7 @@
    "src/cxx_supportlib/MessageReadersWriters.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1340,6 +1504,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1421,9 +1586,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1433,10 +1601,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1445,6 +1619,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1462,6 +1637,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1506,9 +1682,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1518,10 +1697,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1530,6 +1715,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1547,6 +1733,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1591,9 +1778,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1603,10 +1793,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1615,6 +1811,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1632,6 +1829,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1676,9 +1874,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1688,10 +1889,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1700,6 +1907,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1717,6 +1925,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1761,9 +1970,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1773,10 +1985,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1785,6 +2003,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1802,6 +2021,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1846,9 +2066,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1858,10 +2081,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1870,6 +2099,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1887,6 +2117,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -1931,9 +2162,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -1943,10 +2177,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -1955,6 +2195,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -1972,6 +2213,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2016,9 +2258,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2028,10 +2273,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2040,6 +2291,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -2057,6 +2309,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2101,9 +2354,108 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
+   "src/agent/Core/SpawningKit/Options.h",
+   "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
+   "src/agent/Core/SpawningKit/Result.h",
+   "src/agent/Core/SpawningKit/SmartSpawner.h",
+   "src/agent/Core/SpawningKit/Spawner.h",
+   "src/agent/Core/SpawningKit/UserSwitchingRules.h",
+   "src/agent/Core/UnionStation/Connection.h",
+   "src/agent/Core/UnionStation/Context.h",
+   "src/agent/Core/UnionStation/StopwatchLog.h",
+   "src/agent/Core/UnionStation/Transaction.h",
+   "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
+   "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/DataStructures/HashedStaticString.h",
+   "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/Hooks.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/LveLoggingDecorator.h",
+   "src/cxx_supportlib/MemoryKit/palloc.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/AnsiColorConstants.h",
+   "src/cxx_supportlib/Utils/BufferedIO.h",
+   "src/cxx_supportlib/Utils/CachedFileStat.hpp",
+   "src/cxx_supportlib/Utils/ClassUtils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/HashMap.h",
+   "src/cxx_supportlib/Utils/Hasher.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/Lock.h",
+   "src/cxx_supportlib/Utils/MemZeroGuard.h",
+   "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
+   "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
+   "src/cxx_supportlib/Utils/ScopeGuard.h",
+   "src/cxx_supportlib/Utils/SpeedMeter.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/StringMap.h",
+   "src/cxx_supportlib/Utils/StringScanning.h",
+   "src/cxx_supportlib/Utils/SystemMetricsCollector.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/Utils/VariantMap.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../macros.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/spin_lock_darwin.hpp",
+   "src/cxx_supportlib/oxt/detail/spin_lock_gcc_x86.hpp",
+   "src/cxx_supportlib/oxt/detail/spin_lock_portable.hpp",
+   "src/cxx_supportlib/oxt/detail/spin_lock_pthreads.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/dynamic_thread_group.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/spin_lock.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp"],
+ "src/agent/Core/ApplicationPool/Pool/StateSnapshotPublishing.cpp"=>
+  ["src/agent/Core/ApplicationPool/AbstractSession.h",
+   "src/agent/Core/ApplicationPool/BasicGroupInfo.h",
+   "src/agent/Core/ApplicationPool/BasicProcessInfo.h",
+   "src/agent/Core/ApplicationPool/Common.h",
+   "src/agent/Core/ApplicationPool/Context.h",
+   "src/agent/Core/ApplicationPool/Group.h",
+   "src/agent/Core/ApplicationPool/Options.h",
+   "src/agent/Core/ApplicationPool/Pool.h",
+   "src/agent/Core/ApplicationPool/Process.h",
+   "src/agent/Core/ApplicationPool/Session.h",
+   "src/agent/Core/ApplicationPool/Socket.h",
+   "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
+   "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/DirectSpawner.h",
+   "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2113,10 +2465,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2125,6 +2483,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -2142,6 +2501,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2183,9 +2543,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2194,7 +2557,10 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
@@ -2205,6 +2571,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -2220,6 +2587,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -2245,6 +2613,25 @@
    "src/cxx_supportlib/oxt/system_calls.hpp",
    "src/cxx_supportlib/oxt/thread.hpp",
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
+ "src/agent/Core/ApplicationPool/ProcessExitWatcher.h"=>
+  ["src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/agent/Core/ApplicationPool/Session.h"=>
   ["src/agent/Core/ApplicationPool/AbstractSession.h",
    "src/agent/Core/ApplicationPool/BasicGroupInfo.h",
@@ -2257,9 +2644,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2269,6 +2659,7 @@
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
@@ -2279,6 +2670,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -2294,6 +2686,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -2398,9 +2791,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2410,12 +2806,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2469,6 +2870,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2565,9 +2967,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2577,12 +2982,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2636,6 +3046,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2688,9 +3099,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2700,12 +3114,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2759,6 +3178,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2806,9 +3226,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2818,11 +3241,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2865,6 +3294,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -2916,9 +3346,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -2928,12 +3361,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -2987,6 +3425,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3039,9 +3478,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3051,12 +3493,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3110,6 +3557,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3172,9 +3620,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3184,12 +3635,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3243,6 +3699,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3295,9 +3752,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3307,12 +3767,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3366,6 +3831,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3418,9 +3884,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3430,12 +3899,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3489,6 +3963,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3541,9 +4016,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3553,12 +4031,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3612,6 +4095,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3664,9 +4148,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3676,12 +4163,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3735,6 +4227,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3781,9 +4274,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3793,11 +4289,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3839,6 +4341,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -3890,9 +4393,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -3902,12 +4408,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -3961,6 +4472,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -4013,9 +4525,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -4025,12 +4540,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -4084,6 +4604,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -4176,9 +4697,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -4190,6 +4714,9 @@
    "src/agent/Shared/ApiServerUtils.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
    "src/agent/Shared/Base.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.cpp",
@@ -4199,6 +4726,7 @@
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -4255,6 +4783,7 @@
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
    "src/cxx_supportlib/Utils/OptionParsing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -4346,9 +4875,13 @@
    "src/cxx_supportlib/oxt/thread.hpp",
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/agent/Core/SpawningKit/BackgroundIOCapturer.h"=>
-  ["src/cxx_supportlib/Exceptions.h",
+  ["src/agent/Core/SpawningKit/EventLoop.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/FastStringStream.h",
@@ -4402,7 +4935,10 @@
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/Spawner.h",
    "src/agent/Core/SpawningKit/UserSwitchingRules.h",
@@ -4410,6 +4946,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -4418,6 +4955,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -4427,9 +4965,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -4453,6 +4993,8 @@
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -4461,6 +5003,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -4468,6 +5011,7 @@
    "src/cxx_supportlib/Logging.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -4477,9 +5021,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -4499,14 +5045,28 @@
    "src/cxx_supportlib/oxt/system_calls.hpp",
    "src/cxx_supportlib/oxt/thread.hpp",
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
+ "src/agent/Core/SpawningKit/EventLoop.h"=>
+  ["src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp"],
  "src/agent/Core/SpawningKit/Factory.h"=>
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -4515,6 +5075,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -4523,6 +5084,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -4532,9 +5094,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -4554,6 +5118,33 @@
    "src/cxx_supportlib/oxt/system_calls.hpp",
    "src/cxx_supportlib/oxt/thread.hpp",
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
+ "src/agent/Core/SpawningKit/Negotiation.h"=>
+  ["src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/agent/Core/SpawningKit/Options.h"=>
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/UnionStation/Connection.h",
@@ -4597,12 +5188,14 @@
    "src/agent/Core/UnionStation/Connection.h",
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Logging.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/FastStringStream.h",
@@ -4626,12 +5219,34 @@
    "src/cxx_supportlib/oxt/system_calls.hpp",
    "src/cxx_supportlib/oxt/thread.hpp",
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
- "src/agent/Core/SpawningKit/Result.h"=>
-  ["src/cxx_supportlib/Exceptions.h",
+ "src/agent/Core/SpawningKit/ProcessReaper.h"=>
+  ["src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/Utils/FastStringStream.h",
-   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/Utils/PidFd.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp"],
+ "src/agent/Core/SpawningKit/Result.h"=>
+  ["src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
    "src/cxx_supportlib/oxt/detail/context.hpp",
    "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
    "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
@@ -4643,6 +5258,8 @@
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
    "src/agent/Core/SpawningKit/Result.h",
@@ -4652,6 +5269,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -4660,6 +5278,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -4669,9 +5288,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -4695,6 +5316,8 @@
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/UserSwitchingRules.h",
@@ -4702,6 +5325,7 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/Exceptions.h",
@@ -4709,6 +5333,7 @@
    "src/cxx_supportlib/Logging.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -4718,9 +5343,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -4893,9 +5520,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -4905,12 +5535,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -4950,6 +5585,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -5106,9 +5742,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -5126,12 +5765,17 @@
    "src/agent/UstRouter/RemoteSender.h",
    "src/agent/UstRouter/RemoteSink.h",
    "src/agent/UstRouter/Transaction.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -5185,6 +5829,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ReleaseableScopedPointer.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
@@ -5502,9 +6147,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -5525,6 +6173,9 @@
    "src/agent/UstRouter/RemoteSender.h",
    "src/agent/UstRouter/RemoteSink.h",
    "src/agent/UstRouter/Transaction.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
@@ -5532,6 +6183,7 @@
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -5586,6 +6238,7 @@
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
    "src/cxx_supportlib/Utils/OptionParsing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ReleaseableScopedPointer.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
@@ -5633,9 +6286,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -5646,12 +6302,17 @@
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApiServerUtils.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -5701,6 +6362,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -5752,9 +6414,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -5772,6 +6437,9 @@
    "src/agent/Watchdog/CoreWatcher.cpp",
    "src/agent/Watchdog/InstanceDirToucher.cpp",
    "src/agent/Watchdog/UstRouterWatcher.cpp",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
@@ -5779,6 +6447,7 @@
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -5830,6 +6499,7 @@
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
    "src/cxx_supportlib/Utils/OptionParsing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -6048,6 +6718,14 @@
  "src/apache2_module/mod_passenger.c"=>
   ["src/apache2_module/Configuration.h",
    "src/apache2_module/Hooks.h"],
+ "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h"=>
+  ["src/cxx_supportlib/Algorithms/MovingAverage.h",
+   "src/cxx_supportlib/oxt/macros.hpp"],
+ "src/cxx_supportlib/Algorithms/DemandPredictor.h"=>
+  ["src/cxx_supportlib/Algorithms/MovingAverage.h",
+   "src/cxx_supportlib/oxt/macros.hpp"],
+ "src/cxx_supportlib/Algorithms/Histogram.h"=>
+  [],
  "src/cxx_supportlib/Algorithms/MovingAverage.h"=>
   ["src/cxx_supportlib/oxt/macros.hpp"],
  "src/cxx_supportlib/AppTypes.cpp"=>
@@ -6167,6 +6845,8 @@
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/oxt/macros.hpp"],
+ "src/cxx_supportlib/DataStructures/TournamentTree.h"=>
+  [],
  "src/cxx_supportlib/Exceptions.cpp"=>
   ["src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
@@ -7144,6 +7824,21 @@
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/cxx_supportlib/Utils/OptionParsing.h"=>
   [],
+ "src/cxx_supportlib/Utils/PidFd.h"=>
+  ["src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/cxx_supportlib/Utils/ProcessMetricsCollector.h"=>
   ["src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
@@ -7588,6 +8283,92 @@
    "src/cxx_supportlib/oxt/tracable_exception.hpp"],
  "src/ruby_native_extension/passenger_native_support.c"=>
   [],
+ "test/cxx/Algorithms/AdaptiveConcurrencyLimitTest.cpp"=>
+  ["src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
+ "test/cxx/Algorithms/DemandPredictorTest.cpp"=>
+  ["src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
+ "test/cxx/Algorithms/HistogramTest.cpp"=>
+  ["src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
  "test/cxx/Base64DecodingTest.cpp"=>
   ["src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
@@ -7688,9 +8469,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -7699,6 +8483,8 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
@@ -7712,6 +8498,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -7727,6 +8514,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -7770,9 +8558,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -7782,11 +8573,16 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -7797,6 +8593,7 @@
    "src/cxx_supportlib/MessageReadersWriters.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/AnsiColorConstants.h",
@@ -7814,6 +8611,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -7844,6 +8642,40 @@
    "src/cxx_supportlib/oxt/tracable_exception.hpp",
    "test/cxx/../tut/tut.h",
    "test/cxx/TestSupport.h"],
+ "test/cxx/Core/ApplicationPool/ProcessExitWatcherTest.cpp"=>
+  ["src/agent/Core/ApplicationPool/ProcessExitWatcher.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
  "test/cxx/Core/ApplicationPool/ProcessTest.cpp"=>
   ["src/agent/Core/ApplicationPool/AbstractSession.h",
    "src/agent/Core/ApplicationPool/BasicGroupInfo.h",
@@ -7858,9 +8690,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -7869,6 +8704,8 @@
    "src/agent/Core/UnionStation/Context.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
@@ -7882,6 +8719,7 @@
    "src/cxx_supportlib/MemoryKit/palloc.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -7897,6 +8735,7 @@
    "src/cxx_supportlib/Utils/Lock.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -7948,9 +8787,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -7960,6 +8802,9 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
@@ -7967,6 +8812,7 @@
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -8021,6 +8867,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -8075,9 +8922,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -8087,6 +8937,9 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
    "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
@@ -8094,6 +8947,7 @@
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -8148,6 +9002,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -8198,9 +9053,12 @@
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
    "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
    "src/agent/Core/SpawningKit/Factory.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/SmartSpawner.h",
    "src/agent/Core/SpawningKit/Spawner.h",
@@ -8210,12 +9068,17 @@
    "src/agent/Core/UnionStation/StopwatchLog.h",
    "src/agent/Core/UnionStation/Transaction.h",
    "src/agent/Shared/ApplicationPoolApiKey.h",
+   "src/cxx_supportlib/Algorithms/AdaptiveConcurrencyLimit.h",
+   "src/cxx_supportlib/Algorithms/DemandPredictor.h",
+   "src/cxx_supportlib/Algorithms/Histogram.h",
+   "src/cxx_supportlib/Algorithms/MovingAverage.h",
    "src/cxx_supportlib/AppTypes.h",
    "src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
    "src/cxx_supportlib/DataStructures/HashedStaticString.h",
    "src/cxx_supportlib/DataStructures/LString.h",
    "src/cxx_supportlib/DataStructures/StringKeyTable.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
    "src/cxx_supportlib/Exceptions.h",
    "src/cxx_supportlib/FileDescriptor.h",
    "src/cxx_supportlib/Hooks.h",
@@ -8260,6 +9123,7 @@
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
    "src/cxx_supportlib/Utils/MessagePassing.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/SpeedMeter.h",
@@ -8328,7 +9192,10 @@
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
    "src/agent/Core/SpawningKit/DirectSpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
+   "src/agent/Core/SpawningKit/ProcessReaper.h",
    "src/agent/Core/SpawningKit/Result.h",
    "src/agent/Core/SpawningKit/Spawner.h",
    "src/agent/Core/SpawningKit/UserSwitchingRules.h",
@@ -8346,6 +9213,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -8355,9 +9223,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -8380,10 +9250,81 @@
    "test/cxx/../tut/tut.h",
    "test/cxx/Core/SpawningKit/SpawnerTestCases.cpp",
    "test/cxx/TestSupport.h"],
+ "test/cxx/Core/SpawningKit/NegotiationTest.cpp"=>
+  ["src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
+ "test/cxx/Core/SpawningKit/ProcessReaperTest.cpp"=>
+  ["src/agent/Core/SpawningKit/ProcessReaper.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
+   "src/cxx_supportlib/Utils/ScopeGuard.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
  "test/cxx/Core/SpawningKit/SmartSpawnerTest.cpp"=>
   ["src/agent/Core/ApplicationPool/Options.h",
    "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
    "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
    "src/agent/Core/SpawningKit/Options.h",
    "src/agent/Core/SpawningKit/PipeWatcher.h",
    "src/agent/Core/SpawningKit/Result.h",
@@ -8404,6 +9345,7 @@
    "src/cxx_supportlib/LveLoggingDecorator.h",
    "src/cxx_supportlib/RandomGenerator.h",
    "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
    "src/cxx_supportlib/StaticString.h",
    "src/cxx_supportlib/Utils.h",
    "src/cxx_supportlib/Utils/BufferedIO.h",
@@ -8413,9 +9355,11 @@
    "src/cxx_supportlib/Utils/Hasher.h",
    "src/cxx_supportlib/Utils/IOUtils.h",
    "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
    "src/cxx_supportlib/Utils/LargeFiles.h",
    "src/cxx_supportlib/Utils/MemZeroGuard.h",
    "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
    "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
    "src/cxx_supportlib/Utils/ScopeGuard.h",
    "src/cxx_supportlib/Utils/StrIntUtils.h",
@@ -8438,6 +9382,66 @@
    "test/cxx/../tut/tut.h",
    "test/cxx/Core/SpawningKit/SpawnerTestCases.cpp",
    "test/cxx/TestSupport.h"],
+ "test/cxx/Core/SpawningKit/SpawnerTest.cpp"=>
+  ["src/agent/Core/ApplicationPool/Options.h",
+   "src/agent/Core/SpawningKit/BackgroundIOCapturer.h",
+   "src/agent/Core/SpawningKit/Config.h",
+   "src/agent/Core/SpawningKit/DummySpawner.h",
+   "src/agent/Core/SpawningKit/EventLoop.h",
+   "src/agent/Core/SpawningKit/Negotiation.h",
+   "src/agent/Core/SpawningKit/Options.h",
+   "src/agent/Core/SpawningKit/Result.h",
+   "src/agent/Core/SpawningKit/Spawner.h",
+   "src/agent/Core/SpawningKit/UserSwitchingRules.h",
+   "src/agent/Core/UnionStation/Connection.h",
+   "src/agent/Core/UnionStation/Context.h",
+   "src/agent/Core/UnionStation/Transaction.h",
+   "src/cxx_supportlib/AppTypes.h",
+   "src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/DataStructures/HashedStaticString.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/SafeLibev.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/BufferedIO.h",
+   "src/cxx_supportlib/Utils/CachedFileStat.hpp",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/HashMap.h",
+   "src/cxx_supportlib/Utils/Hasher.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/JsonUtils.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/MemZeroGuard.h",
+   "src/cxx_supportlib/Utils/MessageIO.h",
+   "src/cxx_supportlib/Utils/PidFd.h",
+   "src/cxx_supportlib/Utils/ProcessMetricsCollector.h",
+   "src/cxx_supportlib/Utils/ScopeGuard.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/StringMap.h",
+   "src/cxx_supportlib/Utils/StringScanning.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/Utils/Timer.h",
+   "src/cxx_supportlib/Utils/VariantMap.h",
+   "src/cxx_supportlib/oxt/backtrace.hpp",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/backtrace_enabled.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
  "test/cxx/Core/SpawningKit/SpawnerTestCases.cpp"=>
   [],
  "test/cxx/Core/UnionStationTest.cpp"=>
@@ -8611,6 +9615,34 @@
    "src/cxx_supportlib/oxt/tracable_exception.hpp",
    "test/cxx/../tut/tut.h",
    "test/cxx/TestSupport.h"],
+ "test/cxx/DataStructures/TournamentTreeTest.cpp"=>
+  ["src/cxx_supportlib/BackgroundEventLoop.h",
+   "src/cxx_supportlib/Constants.h",
+   "src/cxx_supportlib/DataStructures/TournamentTree.h",
+   "src/cxx_supportlib/Exceptions.h",
+   "src/cxx_supportlib/FileDescriptor.h",
+   "src/cxx_supportlib/InstanceDirectory.h",
+   "src/cxx_supportlib/Logging.h",
+   "src/cxx_supportlib/RandomGenerator.h",
+   "src/cxx_supportlib/ResourceLocator.h",
+   "src/cxx_supportlib/StaticString.h",
+   "src/cxx_supportlib/Utils.h",
+   "src/cxx_supportlib/Utils/FastStringStream.h",
+   "src/cxx_supportlib/Utils/IOUtils.h",
+   "src/cxx_supportlib/Utils/IniFile.h",
+   "src/cxx_supportlib/Utils/LargeFiles.h",
+   "src/cxx_supportlib/Utils/StrIntUtils.h",
+   "src/cxx_supportlib/Utils/SystemTime.h",
+   "src/cxx_supportlib/oxt/detail/../spin_lock.hpp",
+   "src/cxx_supportlib/oxt/detail/context.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_disabled.hpp",
+   "src/cxx_supportlib/oxt/detail/tracable_exception_enabled.hpp",
+   "src/cxx_supportlib/oxt/macros.hpp",
+   "src/cxx_supportlib/oxt/system_calls.hpp",
+   "src/cxx_supportlib/oxt/thread.hpp",
+   "src/cxx_supportlib/oxt/tracable_exception.hpp",
+   "test/cxx/../tut/tut.h",
+   "test/cxx/TestSupport.h"],
  "test/cxx/DateParsingTest.cpp"=>
   ["src/cxx_supportlib/BackgroundEventLoop.h",
    "src/cxx_supportlib/Constants.h",
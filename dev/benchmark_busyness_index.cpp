@@ -0,0 +1,169 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures how long it takes to route a request to the least busy of 8, 64,
+ * 256 and 1024 processes and to close a session, with the TournamentTree
+ * that Group uses to index busyness levels and with the linear scan that
+ * findEnabledProcessWithLowestBusyness() used to do. Half of the processes
+ * are kept busy: every routed request closes the oldest open session.
+ *
+ * Compile and run this from the source root:
+ *
+ *   g++ -O2 -Isrc/cxx_supportlib -Isrc/cxx_supportlib/vendor-modified \
+ *     dev/benchmark_busyness_index.cpp -o /tmp/benchmark_busyness_index
+ *   /tmp/benchmark_busyness_index
+ */
+
+#include <sys/time.h>
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+#include <DataStructures/TournamentTree.h>
+
+using namespace std;
+using namespace Passenger;
+
+static const int ITERATIONS = 10;
+static const unsigned int REQUESTS = 1000000;
+
+static unsigned long long
+getUsec() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+struct LinearScan {
+	vector<int> busyness;
+
+	LinearScan(unsigned int count)
+		: busyness(count, 0)
+		{ }
+
+	unsigned int minIndex() const {
+		unsigned int result = 0;
+		int lowest = busyness[0];
+		for (unsigned int i = 1; i < busyness.size(); i++) {
+			if (busyness[i] < lowest) {
+				result = i;
+				lowest = busyness[i];
+			}
+		}
+		return result;
+	}
+
+	int get(unsigned int index) const {
+		return busyness[index];
+	}
+
+	void set(unsigned int index, int value) {
+		busyness[index] = value;
+	}
+};
+
+struct Indexed {
+	TournamentTree<int> busyness;
+
+	Indexed(unsigned int count) {
+		for (unsigned int i = 0; i < count; i++) {
+			busyness.push_back(0);
+		}
+	}
+
+	unsigned int minIndex() const {
+		return busyness.minIndex();
+	}
+
+	int get(unsigned int index) const {
+		return busyness[index];
+	}
+
+	void set(unsigned int index, int value) {
+		busyness.set(index, value);
+	}
+};
+
+/**
+ * Returns a checksum of the routing decisions, so that the compiler
+ * can't optimize the work away and so that both methods can be checked
+ * for making the same decisions.
+ */
+template<typename Index>
+static unsigned long long
+simulate(unsigned int count, unsigned long long &duration) {
+	Index index(count);
+	deque<unsigned int> openSessions;
+	unsigned long long checksum = 0;
+
+	unsigned long long startTime = getUsec();
+	for (unsigned int i = 0; i < REQUESTS; i++) {
+		unsigned int process = index.minIndex();
+		index.set(process, index.get(process) + 1);
+		openSessions.push_back(process);
+		checksum += process;
+
+		if (openSessions.size() > count / 2) {
+			unsigned int closed = openSessions.front();
+			openSessions.pop_front();
+			index.set(closed, index.get(closed) - 1);
+		}
+	}
+	duration += getUsec() - startTime;
+	return checksum;
+}
+
+static void
+benchmark(unsigned int count) {
+	unsigned long long scanTime = 0, indexedTime = 0;
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		unsigned long long scanChecksum = simulate<LinearScan>(count, scanTime);
+		unsigned long long indexedChecksum = simulate<Indexed>(count, indexedTime);
+		if (scanChecksum != indexedChecksum) {
+			fprintf(stderr, "The linear scan and the tournament tree routed "
+				"requests differently!\n");
+			return;
+		}
+	}
+
+	printf("%4u processes: linear scan %7.1f ns/request, tournament tree %7.1f ns/request "
+		"(average of %d runs)\n",
+		count,
+		scanTime * 1000.0 / REQUESTS / ITERATIONS,
+		indexedTime * 1000.0 / REQUESTS / ITERATIONS,
+		ITERATIONS);
+}
+
+int
+main() {
+	benchmark(8);
+	benchmark(64);
+	benchmark(256);
+	benchmark(1024);
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures how many sessions per second 1 to 16 threads can check out of
+ * an ApplicationPool and close again, when all threads use the same group
+ * and when each thread uses its own group. Processes are spawned by the
+ * dummy spawner and have unlimited concurrency, so every checkout can be
+ * satisfied immediately.
+ *
+ * Each case is run in two modes:
+ *
+ *  - exclusive: every checkout takes the pool lock exclusively, like all
+ *    checkouts did before the shared-lock fast path existed.
+ *  - fast path: Pool::asyncGet(), which only takes the pool lock in shared
+ *    mode plus the group's routing lock.
+ *
+ * Build Passenger first (`rake test:cxx` or `rake nginx`), then compile and
+ * run this from the source root:
+ *
+ *   g++ -std=gnu++03 -O2 -Isrc/agent -Isrc/cxx_supportlib \
+ *     -Isrc/cxx_supportlib/vendor-copy \
+ *     -Isrc/cxx_supportlib/vendor-modified \
+ *     -Isrc/cxx_supportlib/vendor-modified/libev \
+ *     -Isrc/cxx_supportlib/vendor-copy/libuv/include \
+ *     dev/benchmark_pool_lock_contention.cpp \
+ *     $(ls buildout/support-binaries/*.o | grep -v AgentMain.o) \
+ *     $(find buildout/common/libpassenger_common -name '*.o') \
+ *     buildout/common/libboost_oxt.a buildout/libev/.libs/libev.a \
+ *     buildout/libuv/.libs/libuv.a -lcurl -lz -lcrypto -lpthread -lrt -ldl \
+ *     -o /tmp/benchmark_pool_lock_contention
+ *   /tmp/benchmark_pool_lock_contention
+ */
+
+#include <boost/thread.hpp>
+#include <boost/make_shared.hpp>
+#include <oxt/initialize.hpp>
+#include <oxt/system_calls.hpp>
+#include <unistd.h>
+#include <limits.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Core/ApplicationPool/Pool.h>
+#include <ResourceLocator.h>
+#include <Logging.h>
+#include <Utils/SystemTime.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+
+static const int ITERATIONS = 20000;
+static const unsigned int MAX_THREADS = 16;
+
+struct Worker {
+	SessionPtr session;
+
+	static void callback(const AbstractSessionPtr &session, const ExceptionPtr &e,
+		void *userData)
+	{
+		Worker *self = (Worker *) userData;
+		self->session = static_pointer_cast<Session>(session);
+	}
+};
+
+static vector<string> groupNames;
+
+static Options
+createOptions(unsigned int group) {
+	Options options;
+	options.spawnMethod = "dummy";
+	options.appRoot = "/tmp/benchmark_pool_lock_contention";
+	options.appGroupName = groupNames[group];
+	options.startCommand = "ruby\t" "start.rb";
+	options.startupFile = "start.rb";
+	options.loadShellEnvvars = false;
+	options.minProcesses = 2;
+	return options;
+}
+
+static void
+work(PoolPtr pool, Options options, bool exclusive, boost::barrier *barrier) {
+	Worker worker;
+	GetCallback callback;
+	callback.func = Worker::callback;
+	callback.userData = &worker;
+
+	barrier->wait();
+	for (int i = 0; i < ITERATIONS; i++) {
+		if (exclusive) {
+			boost::unique_lock<boost::shared_mutex> l(pool->syncher);
+			pool->asyncGet(options, callback, false);
+		} else {
+			pool->asyncGet(options, callback);
+		}
+		if (worker.session == NULL) {
+			fprintf(stderr, "A checkout was not satisfied immediately\n");
+			_exit(1);
+		}
+		// Closes the session, outside the pool lock.
+		worker.session.reset();
+	}
+}
+
+static double
+run(const PoolPtr &pool, unsigned int threads, bool groupPerThread, bool exclusive) {
+	boost::thread_group group;
+	boost::barrier barrier(threads + 1);
+
+	for (unsigned int i = 0; i < threads; i++) {
+		group.create_thread(boost::bind(work, pool,
+			createOptions(groupPerThread ? i : 0), exclusive, &barrier));
+	}
+	barrier.wait();
+	unsigned long long startTime = SystemTime::getUsec();
+	group.join_all();
+	unsigned long long duration = SystemTime::getUsec() - startTime;
+	return (double) threads * ITERATIONS / (duration / 1000000.0);
+}
+
+static void
+benchmark(const PoolPtr &pool, unsigned int threads, bool groupPerThread) {
+	double exclusive = run(pool, threads, groupPerThread, true);
+	double fastPath = run(pool, threads, groupPerThread, false);
+	printf("%2u threads, %-16s: exclusive %10.0f sessions/sec, "
+		"fast path %10.0f sessions/sec\n",
+		threads, groupPerThread ? "group per thread" : "one group",
+		exclusive, fastPath);
+}
+
+int
+main() {
+	oxt::initialize();
+	oxt::setup_syscall_interruption_support();
+	SystemTime::initialize();
+	setLogLevel(LVL_ERROR);
+
+	char path[PATH_MAX + 1];
+	if (getcwd(path, PATH_MAX) == NULL) {
+		perror("getcwd");
+		return 1;
+	}
+	ResourceLocator resourceLocator(path);
+	for (unsigned int i = 0; i < MAX_THREADS; i++) {
+		groupNames.push_back("group" + toString(i));
+	}
+
+	SpawningKit::ConfigPtr config = boost::make_shared<SpawningKit::Config>();
+	config->resourceLocator = &resourceLocator;
+	config->concurrency = 0;
+	config->finalize();
+	SpawningKit::FactoryPtr factory = boost::make_shared<SpawningKit::Factory>(config);
+	PoolPtr pool = boost::make_shared<Pool>(factory);
+	pool->initialize();
+	pool->setMax(MAX_THREADS * 2);
+
+	// Create all groups and wait until their processes have been spawned.
+	for (unsigned int i = 0; i < MAX_THREADS; i++) {
+		Ticket ticket;
+		pool->get(createOptions(i), &ticket);
+	}
+	while (pool->getProcessCount() < MAX_THREADS * 2) {
+		syscalls::usleep(10000);
+	}
+
+	for (unsigned int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		benchmark(pool, threads, false);
+	}
+	for (unsigned int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		benchmark(pool, threads, true);
+	}
+
+	pool->destroy();
+	pool.reset();
+	oxt::shutdown();
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures how long ProcessMetricsCollector takes to collect the metrics of
+ * 1, 50 and 500 processes, with `ps`, with /proc, and with collect() (which
+ * picks /proc when it is available).
+ *
+ * Build Passenger first (`rake test:cxx` or `rake nginx`), then compile and
+ * run this from the source root:
+ *
+ *   g++ -O2 -Isrc/cxx_supportlib -Isrc/cxx_supportlib/vendor-copy \
+ *     -Isrc/cxx_supportlib/vendor-modified \
+ *     dev/benchmark_process_metrics_collector.cpp \
+ *     $(find buildout/common/libpassenger_common -name '*.o') \
+ *     buildout/common/libboost_oxt.a -lcrypto -lpthread -lrt -ldl \
+ *     -o /tmp/benchmark_process_metrics_collector
+ *   /tmp/benchmark_process_metrics_collector
+ */
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdio>
+#include <vector>
+
+#include <Utils/ProcessMetricsCollector.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+
+static const int ITERATIONS = 10;
+
+static vector<pid_t>
+spawnChildren(unsigned int count) {
+	vector<pid_t> pids;
+	for (unsigned int i = 0; i < count; i++) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			pause();
+			_exit(0);
+		} else if (pid == -1) {
+			perror("fork");
+			break;
+		}
+		pids.push_back(pid);
+	}
+	return pids;
+}
+
+static void
+killChildren(const vector<pid_t> &pids) {
+	for (unsigned int i = 0; i < pids.size(); i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+}
+
+static void
+benchmark(unsigned int count) {
+	ProcessMetricsCollector collector;
+	vector<pid_t> pids = spawnChildren(count);
+	unsigned long long psTime = 0, procTime = 0, collectTime = 0;
+
+	for (int i = 0; i < ITERATIONS; i++) {
+		unsigned long long t0 = SystemTime::getUsec();
+		collector.collectFromPs(pids);
+		unsigned long long t1 = SystemTime::getUsec();
+		collector.collectFromProc(pids);
+		unsigned long long t2 = SystemTime::getUsec();
+		collector.collect(pids);
+		unsigned long long t3 = SystemTime::getUsec();
+		psTime += t1 - t0;
+		procTime += t2 - t1;
+		collectTime += t3 - t2;
+	}
+
+	printf("%4u PIDs: ps %8.2f ms, /proc %8.2f ms, collect() %8.2f ms "
+		"(average of %d runs)\n",
+		(unsigned int) pids.size(),
+		psTime / 1000.0 / ITERATIONS,
+		procTime / 1000.0 / ITERATIONS,
+		collectTime / 1000.0 / ITERATIONS,
+		ITERATIONS);
+	killChildren(pids);
+}
+
+int
+main() {
+	if (!ProcessMetricsCollector::procAvailable()) {
+		fprintf(stderr, "/proc is not available on this system.\n");
+		return 1;
+	}
+	benchmark(1);
+	benchmark(50);
+	benchmark(500);
+	return 0;
+}
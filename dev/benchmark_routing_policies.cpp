@@ -0,0 +1,293 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Compares the p50 and p99 latency of the least_busy, least_latency and
+ * power_of_two_choices routing policies by replaying the same request trace
+ * against a group of 8 processes with heterogeneous latencies: 2 of them are
+ * 4 times as slow as the others, like processes on an overloaded host or with
+ * a cold cache. The trace has Poisson arrivals and exponentially distributed
+ * service times, and is replayed at several loads.
+ *
+ * The requests are routed by a real ApplicationPool with processes spawned by
+ * the dummy spawner, but time is simulated with SystemTime::forceAll(), so the
+ * results are reproducible and don't depend on the speed of this machine.
+ * Every process can handle 4 requests concurrently, each at its own speed.
+ * A request that arrives while all processes are totally busy waits in the
+ * group's get waitlist; its latency includes that wait.
+ *
+ * Build Passenger first (`rake test:cxx` or `rake nginx`), then compile and
+ * run this from the source root:
+ *
+ *   g++ -std=gnu++03 -O2 -Isrc/agent -Isrc/cxx_supportlib \
+ *     -Isrc/cxx_supportlib/vendor-copy \
+ *     -Isrc/cxx_supportlib/vendor-modified \
+ *     -Isrc/cxx_supportlib/vendor-modified/libev \
+ *     -Isrc/cxx_supportlib/vendor-copy/libuv/include \
+ *     dev/benchmark_routing_policies.cpp \
+ *     $(ls buildout/support-binaries/*.o | grep -v AgentMain.o) \
+ *     $(find buildout/common/libpassenger_common -name '*.o') \
+ *     buildout/common/libboost_oxt.a buildout/libev/.libs/libev.a \
+ *     buildout/libuv/.libs/libuv.a -lcurl -lz -lcrypto -lpthread -lrt -ldl \
+ *     -o /tmp/benchmark_routing_policies
+ *   /tmp/benchmark_routing_policies
+ */
+
+#include <boost/make_shared.hpp>
+#include <oxt/initialize.hpp>
+#include <oxt/system_calls.hpp>
+#include <unistd.h>
+#include <limits.h>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <Core/ApplicationPool/Pool.h>
+#include <ResourceLocator.h>
+#include <Logging.h>
+#include <Utils/SystemTime.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+
+static const unsigned int REQUESTS = 200000;
+static const unsigned int PROCESSES = 8;
+static const unsigned int CONCURRENCY = 4;
+static const unsigned int SLOWDOWN = 4;
+/** Mean service time of a request on a fast process, in microseconds. */
+static const double MEAN_SERVICE_TIME = 10000;
+
+static ResourceLocator *resourceLocator;
+
+struct Request {
+	unsigned long long arrivalTime;
+	unsigned long long serviceTime;
+	unsigned long long finishTime;
+	SessionPtr session;
+};
+
+typedef pair<unsigned long long, unsigned int> Completion;
+
+struct Simulation {
+	vector<Request> requests;
+	priority_queue< Completion, vector<Completion>, greater<Completion> > completions;
+	unsigned long long now;
+
+	static bool isSlow(pid_t pid) {
+		// The dummy spawner numbers its processes 1, 2, 3, ..., so this
+		// spreads the slow processes over the group.
+		return pid % (PROCESSES / 2) == 0;
+	}
+
+	/**
+	 * Called when a request has been routed to a process, either right
+	 * away or when it leaves the get waitlist.
+	 */
+	static void routed(const AbstractSessionPtr &session, const ExceptionPtr &e,
+		void *userData)
+	{
+		pair<Simulation *, unsigned int> *context =
+			(pair<Simulation *, unsigned int> *) userData;
+		Simulation *self = context->first;
+		unsigned int index = context->second;
+		Request &request = self->requests[index];
+
+		if (session == NULL) {
+			fprintf(stderr, "A request could not be routed\n");
+			_exit(1);
+		}
+		request.session = static_pointer_cast<Session>(session);
+		request.finishTime = self->now + request.serviceTime
+			* (isSlow(session->getPid()) ? SLOWDOWN : 1);
+		self->completions.push(Completion(request.finishTime, index));
+		delete context;
+	}
+
+	void setTime(unsigned long long time) {
+		now = time;
+		SystemTime::forceAll(now);
+	}
+};
+
+/**
+ * A xorshift pseudo random number generator, so that every policy and
+ * every run replays exactly the same trace.
+ */
+static double
+nextRandom(unsigned int &state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state + 1.0) / (UINT_MAX + 2.0);
+}
+
+static vector<Request>
+createTrace(double load, unsigned long long startTime) {
+	// Fast processes handle CONCURRENCY / MEAN_SERVICE_TIME requests per
+	// microsecond, slow processes SLOWDOWN times fewer.
+	double capacity = CONCURRENCY / MEAN_SERVICE_TIME
+		* (PROCESSES * 3 / 4 + PROCESSES / 4.0 / SLOWDOWN);
+	double meanInterarrivalTime = 1 / (capacity * load);
+	unsigned int state = 2463534242u;
+	vector<Request> trace(REQUESTS);
+	unsigned long long time = startTime;
+
+	for (unsigned int i = 0; i < REQUESTS; i++) {
+		time += (unsigned long long) (-log(nextRandom(state)) * meanInterarrivalTime);
+		trace[i].arrivalTime = time;
+		trace[i].serviceTime = (unsigned long long)
+			(-log(nextRandom(state)) * MEAN_SERVICE_TIME) + 1;
+		trace[i].finishTime = 0;
+	}
+	return trace;
+}
+
+static Options
+createOptions(const char *routingPolicy) {
+	Options options;
+	options.spawnMethod = "dummy";
+	options.appRoot = "/tmp/benchmark_routing_policies";
+	options.appGroupName = "benchmark";
+	options.startCommand = "ruby\t" "start.rb";
+	options.startupFile = "start.rb";
+	options.loadShellEnvvars = false;
+	options.minProcesses = PROCESSES;
+	options.maxRequestQueueSize = 0;
+	options.routingPolicy = routingPolicy;
+	return options;
+}
+
+static void
+simulate(const char *routingPolicy, double load, vector<unsigned long long> &latencies) {
+	SpawningKit::ConfigPtr config = boost::make_shared<SpawningKit::Config>();
+	config->resourceLocator = resourceLocator;
+	config->concurrency = CONCURRENCY;
+	config->finalize();
+	SpawningKit::FactoryPtr factory = boost::make_shared<SpawningKit::Factory>(config);
+	PoolPtr pool = boost::make_shared<Pool>(factory);
+	pool->initialize();
+	pool->setMax(PROCESSES);
+
+	// Start at the same moment for every policy, so that the random number
+	// generator used by power_of_two_choices is seeded identically.
+	unsigned long long startTime = 1500000000ull * 1000000;
+	Simulation simulation;
+	Options options = createOptions(routingPolicy);
+	simulation.setTime(startTime);
+	simulation.requests = createTrace(load, startTime);
+
+	// Create the group and wait until all its processes have been spawned.
+	{
+		Ticket ticket;
+		pool->get(options, &ticket);
+	}
+	while (pool->getProcessCount() < PROCESSES) {
+		syscalls::usleep(10000);
+	}
+
+	unsigned int next = 0;
+	while (next < REQUESTS || !simulation.completions.empty()) {
+		if (next == REQUESTS || (!simulation.completions.empty()
+			&& simulation.completions.top().first <= simulation.requests[next].arrivalTime))
+		{
+			unsigned int index = simulation.completions.top().second;
+			Request &request = simulation.requests[index];
+			simulation.completions.pop();
+			simulation.setTime(request.finishTime);
+			latencies.push_back(request.finishTime - request.arrivalTime);
+			// Closes the session, which may route a waiting request to
+			// the process.
+			request.session.reset();
+		} else {
+			GetCallback callback;
+			callback.func = Simulation::routed;
+			callback.userData = new pair<Simulation *, unsigned int>(&simulation, next);
+			simulation.setTime(simulation.requests[next].arrivalTime);
+			next++;
+			pool->asyncGet(options, callback);
+		}
+	}
+
+	SystemTime::releaseAll();
+	pool->destroy();
+	pool.reset();
+}
+
+static double
+percentile(const vector<unsigned long long> &sortedLatencies, double p) {
+	return sortedLatencies[(size_t) (p * (sortedLatencies.size() - 1))] / 1000.0;
+}
+
+static void
+benchmark(const char *routingPolicy, double load) {
+	vector<unsigned long long> latencies;
+	latencies.reserve(REQUESTS);
+	simulate(routingPolicy, load, latencies);
+	sort(latencies.begin(), latencies.end());
+
+	double total = 0;
+	for (unsigned int i = 0; i < latencies.size(); i++) {
+		total += latencies[i];
+	}
+	printf("load %3.0f%%, %-20s: mean %7.2f ms, p50 %7.2f ms, p99 %8.2f ms\n",
+		load * 100, routingPolicy,
+		total / latencies.size() / 1000.0,
+		percentile(latencies, 0.5),
+		percentile(latencies, 0.99));
+}
+
+int
+main() {
+	oxt::initialize();
+	oxt::setup_syscall_interruption_support();
+	SystemTime::initialize();
+	setLogLevel(LVL_ERROR);
+
+	char path[PATH_MAX + 1];
+	if (getcwd(path, PATH_MAX) == NULL) {
+		perror("getcwd");
+		return 1;
+	}
+	ResourceLocator locator(path);
+	resourceLocator = &locator;
+
+	const double loads[] = { 0.5, 0.8, 0.9, 0.95 };
+	for (unsigned int i = 0; i < sizeof(loads) / sizeof(double); i++) {
+		benchmark("least_busy", loads[i]);
+		benchmark("least_latency", loads[i]);
+		benchmark("power_of_two_choices", loads[i]);
+		printf("\n");
+	}
+
+	oxt::shutdown();
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+
+/*
+ * Measures how many connections per second 1 to 16 threads can check out
+ * of a single application socket's idle connection pool and check back in,
+ * like event loop threads that all send requests to the same process.
+ * Compares ApplicationPool2::Socket's lock-free pool with the mutex-protected
+ * vector that it used to have, which is reproduced below.
+ *
+ * Build Passenger first (`rake test:cxx` or `rake nginx`), then compile and
+ * run this from the source root:
+ *
+ *   g++ -std=gnu++03 -O2 -Isrc/agent -Isrc/cxx_supportlib \
+ *     -Isrc/cxx_supportlib/vendor-copy \
+ *     -Isrc/cxx_supportlib/vendor-modified \
+ *     dev/benchmark_socket_connection_pool.cpp \
+ *     $(find buildout/common/libpassenger_common -name '*.o') \
+ *     buildout/common/libboost_oxt.a -lcrypto -lpthread -lrt -ldl \
+ *     -o /tmp/benchmark_socket_connection_pool
+ *   /tmp/benchmark_socket_connection_pool
+ */
+
+#include <boost/thread.hpp>
+#include <oxt/initialize.hpp>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <Core/ApplicationPool/Socket.h>
+#include <Utils/SystemTime.h>
+#include <Utils/StrIntUtils.h>
+
+using namespace std;
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+
+static const int ITERATIONS = 100000;
+static const unsigned int MAX_THREADS = 16;
+
+/**
+ * The connection pool of Socket before it became lock-free: a vector of
+ * idle connections protected by a mutex, including the staleness check.
+ */
+class MutexConnectionPool {
+private:
+	boost::mutex connectionPoolLock;
+	vector<Connection> idleConnections;
+	string address;
+	int limit;
+	int totalConnections;
+	int totalIdleConnections;
+
+	static bool isStale(const Connection &connection) {
+		struct pollfd pfd;
+		pfd.fd = connection.fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		return poll(&pfd, 1, 0) != 0;
+	}
+
+public:
+	MutexConnectionPool(const string &_address, int _limit)
+		: address(_address),
+		  limit(_limit),
+		  totalConnections(0),
+		  totalIdleConnections(0)
+		{ }
+
+	~MutexConnectionPool() {
+		for (unsigned int i = 0; i < idleConnections.size(); i++) {
+			idleConnections[i].close();
+		}
+	}
+
+	Connection checkoutConnection() {
+		boost::unique_lock<boost::mutex> l(connectionPoolLock);
+
+		while (!idleConnections.empty()) {
+			Connection connection = idleConnections.back();
+			idleConnections.pop_back();
+			totalIdleConnections--;
+			if (OXT_UNLIKELY(isStale(connection))) {
+				totalConnections--;
+				connection.close();
+				continue;
+			}
+			return connection;
+		}
+
+		Connection connection;
+		l.unlock();
+		connection.fd = connectToServer(address, __FILE__, __LINE__);
+		connection.fail = true;
+		l.lock();
+		totalConnections++;
+		return connection;
+	}
+
+	void checkinConnection(Connection &connection) {
+		boost::unique_lock<boost::mutex> l(connectionPoolLock);
+
+		if (connection.fail || !connection.wantKeepAlive
+		 || totalIdleConnections >= limit)
+		{
+			totalConnections--;
+			l.unlock();
+			connection.close();
+		} else {
+			idleConnections.push_back(connection);
+			totalIdleConnections++;
+		}
+	}
+};
+
+template<typename Pool>
+static void
+work(Pool *pool, boost::barrier *barrier) {
+	barrier->wait();
+	for (int i = 0; i < ITERATIONS; i++) {
+		Connection connection = pool->checkoutConnection();
+		// What a session does after a successful request.
+		connection.fail = false;
+		connection.wantKeepAlive = true;
+		pool->checkinConnection(connection);
+	}
+}
+
+template<typename Pool>
+static double
+run(Pool *pool, unsigned int threads) {
+	boost::thread_group group;
+	boost::barrier barrier(threads + 1);
+
+	for (unsigned int i = 0; i < threads; i++) {
+		group.create_thread(boost::bind(work<Pool>, pool, &barrier));
+	}
+	barrier.wait();
+	unsigned long long startTime = SystemTime::getUsec();
+	group.join_all();
+	unsigned long long duration = SystemTime::getUsec() - startTime;
+	return (double) threads * ITERATIONS / (duration / 1000000.0);
+}
+
+static void
+benchmark(const string &address, unsigned int threads) {
+	MutexConnectionPool mutexPool(address, MAX_THREADS);
+	Socket socket(getpid(), "main", address, "session", MAX_THREADS);
+
+	double mutexRate = run(&mutexPool, threads);
+	double lockFreeRate = run(&socket, threads);
+	socket.closeAllConnections();
+
+	printf("%2u threads: mutex %10.0f checkouts/sec, lock-free %10.0f checkouts/sec\n",
+		threads, mutexRate, lockFreeRate);
+}
+
+int
+main() {
+	oxt::initialize();
+	SystemTime::initialize();
+
+	// Connections are never accepted; the kernel completes them as long as
+	// the backlog has room, which is enough for one connection per thread.
+	string address = "unix:/tmp/benchmark_socket_connection_pool." + toString(getpid());
+	int serverFd = createServer(address, MAX_THREADS * 4, true, __FILE__, __LINE__);
+
+	for (unsigned int threads = 1; threads <= MAX_THREADS; threads *= 2) {
+		benchmark(address, threads);
+	}
+
+	close(serverFd);
+	unlink(parseUnixSocketAddress(address).c_str());
+	oxt::shutdown();
+	return 0;
+}
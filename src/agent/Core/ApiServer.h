@@ -105,6 +105,8 @@ private:
 			processPoolStatusXml(client, req);
 		} else if (path == P_STATIC_STRING("/pool.txt")) {
 			processPoolStatusTxt(client, req);
+		} else if (path == P_STATIC_STRING("/pool/spawn_timings.json")) {
+			processPoolSpawnTimings(client, req);
 		} else if (path == P_STATIC_STRING("/pool/restart_app_group.json")) {
 			processPoolRestartAppGroup(client, req);
 		} else if (path == P_STATIC_STRING("/pool/detach_process.json")) {
@@ -241,7 +243,7 @@ private:
 			HeaderTable headers;
 			headers.insert(req->pool, "Content-Type", "text/xml");
 			writeSimpleResponse(client, 200, &headers,
-				psg_pstrdup(req->pool, appPool->toXml(options)));
+				psg_pstrdup(req->pool, appPool->toXmlFromSnapshot(options)));
 			if (!req->ended()) {
 				endRequest(&client, &req);
 			}
@@ -273,7 +275,7 @@ private:
 			HeaderTable headers;
 			headers.insert(req->pool, "Content-Type", "text/plain");
 			writeSimpleResponse(client, 200, &headers,
-				psg_pstrdup(req->pool, appPool->inspect(options)));
+				psg_pstrdup(req->pool, appPool->inspectFromSnapshot(options)));
 			if (!req->ended()) {
 				endRequest(&client, &req);
 			}
@@ -294,6 +296,25 @@ private:
 		}
 	}
 
+	void processPoolSpawnTimings(Client *client, Request *req) {
+		Authorization auth(authorize(this, client, req));
+		if (auth.canReadPool) {
+			ApplicationPool2::Pool::AuthenticationOptions options;
+			options.uid = auth.uid;
+			options.apiKey = auth.apiKey;
+
+			HeaderTable headers;
+			headers.insert(req->pool, "Content-Type", "application/json");
+			writeSimpleResponse(client, 200, &headers,
+				psg_pstrdup(req->pool, appPool->spawnTimingsToJsonFromSnapshot(options)));
+			if (!req->ended()) {
+				endRequest(&client, &req);
+			}
+		} else {
+			apiServerRespondWith401(this, client, req);
+		}
+	}
+
 	void processPoolRestartAppGroup(Client *client, Request *req) {
 		Authorization auth(authorize(this, client, req));
 		if (!auth.canModifyPool) {
@@ -37,6 +37,7 @@
 #include <MemoryKit/palloc.h>
 #include <DataStructures/StringKeyTable.h>
 #include <Utils/VariantMap.h>
+#include <Utils/SystemTime.h>
 #include <Core/ApplicationPool/Options.h>
 #include <Core/SpawningKit/Config.h>
 #include <Core/UnionStation/Context.h>
@@ -86,7 +87,11 @@ enum SpawnResult {
 	// Unable to spawn a new process: the pool is at full capacity. Pool capacity is
 	// checked after checking the group upper bound limits, so if you get this result
 	// then it is guaranteed that the group upper bound limits have not been reached.
-	SR_ERR_POOL_AT_FULL_CAPACITY
+	SR_ERR_POOL_AT_FULL_CAPACITY,
+
+	// Spawning failed repeatedly, so the group's circuit breaker is open and spawning
+	// is suspended until its backoff time has passed.
+	SR_ERR_CIRCUIT_OPEN
 };
 
 /**
@@ -162,6 +167,22 @@ enum RestartMethod {
 	RM_ROLLING
 };
 
+/**
+ * Determines how Group::route() chooses among the enabled processes of a group.
+ * Sticky session routing and routing to disabling processes are not affected.
+ */
+enum RoutingPolicy {
+	// Route to the process with the lowest busyness. This is the default.
+	RP_LEAST_BUSY,
+	// Route to the process with the lowest expected latency, i.e. the number of
+	// outstanding requests weighted by an exponential moving average of the
+	// process's response time.
+	RP_LEAST_LATENCY,
+	// Pick two random processes and route to the least busy one of them.
+	// Avoids scanning all processes in large groups.
+	RP_POWER_OF_TWO_CHOICES
+};
+
 typedef boost::shared_ptr<Pool> PoolPtr;
 typedef boost::shared_ptr<Group> GroupPtr;
 typedef boost::intrusive_ptr<Process> ProcessPtr;
@@ -188,12 +209,28 @@ struct GetCallback {
 struct GetWaiter {
 	Options options;
 	GetCallback callback;
+	/** The time (in microseconds) at which this waiter is dropped because it
+	 * waited too long, or 0 if it may wait indefinitely.
+	 * See `Options::maxRequestQueueTime`.
+	 */
+	unsigned long long deadline;
 
 	GetWaiter(const Options &o, const GetCallback &cb)
 		: options(o),
-		  callback(cb)
+		  callback(cb),
+		  deadline(0)
 	{
 		options.persist(o);
+		if (o.maxRequestQueueTime > 0) {
+			unsigned long long startTime = (o.currentTime != 0)
+				? o.currentTime
+				: SystemTime::getUsec();
+			deadline = startTime + o.maxRequestQueueTime * 1000ull;
+		}
+	}
+
+	bool expired(unsigned long long now) const {
+		return deadline != 0 && now >= deadline;
 	}
 };
 
@@ -209,6 +246,8 @@ void rethrowException(const ExceptionPtr &e);
 void processAndLogNewSpawnException(SpawnException &e, const Options &options,
 	const SpawningKit::ConfigPtr &config);
 void recreateString(psg_pool_t *pool, StaticString &str);
+RoutingPolicy parseRoutingPolicy(const StaticString &name);
+const char *getRoutingPolicyName(RoutingPolicy policy);
 
 } // namespace ApplicationPool2
 } // namespace Passenger
@@ -45,6 +45,9 @@
 #include <cstdlib>
 #include <cassert>
 #include <SmallVector.h>
+#include <DataStructures/TournamentTree.h>
+#include <Algorithms/DemandPredictor.h>
+#include <Algorithms/Histogram.h>
 #include <MemoryKit/palloc.h>
 #include <Hooks.h>
 #include <Utils.h>
@@ -77,6 +80,7 @@ public:
 	struct GetAction {
 		GetCallback callback;
 		SessionPtr session;
+		ExceptionPtr exception;
 	};
 
 	struct DisableWaiter {
@@ -89,6 +93,32 @@ public:
 			{ }
 	};
 
+	/**
+	 * Aggregated timing of a batch of detached processes that were shut down,
+	 * e.g. because of a restart. A batch starts when the detached processes
+	 * checker is started and ends when there are no detached processes left.
+	 * Times are in usec.
+	 */
+	struct ShutdownBatch {
+		MonotonicTimeUsec startTime;
+		MonotonicTimeUsec endTime;
+		/** The number of processes that have been shut down. */
+		unsigned int processes;
+		/** The number of processes that didn't exit within
+		 * PROCESS_SHUTDOWN_TIMEOUT and had to be killed. */
+		unsigned int killed;
+		/** The longest time between triggering a process's shutdown and its exit. */
+		MonotonicTimeUsec slowestShutdown;
+
+		ShutdownBatch()
+			: startTime(0),
+			  endTime(0),
+			  processes(0),
+			  killed(0),
+			  slowestShutdown(0)
+			{ }
+	};
+
 	struct RouteResult {
 		Process *process;
 		bool finished;
@@ -134,7 +164,9 @@ public:
 	 */
 	unsigned int restartsInitiated;
 	/**
-	 * The number of processes that are being spawned right now.
+	 * The number of processes that are being spawned right now. Each spawner
+	 * thread spawns one process at a time. There may be up to
+	 * `options.spawnConcurrency` spawner threads.
 	 *
 	 * Invariant:
 	 *     if processesBeingSpawned > 0: m_spawning
@@ -154,9 +186,9 @@ public:
 	 */
 	boost::atomic<boost::uint8_t> lifeStatus;
 	/**
-	 * Whether the spawner thread is currently working. Note that even
+	 * Whether any spawner thread is currently working. Note that even
 	 * if it's working, it doesn't necessarily mean that processes are
-	 * being spawned (i.e. that processesBeingSpawned > 0). After the
+	 * being spawned (i.e. that processesBeingSpawned > 0). After a
 	 * thread is done spawning a process, it will attempt to attach
 	 * the newly-spawned process to the group. During that time it's not
 	 * technically spawning anything.
@@ -182,13 +214,30 @@ public:
 	string alwaysRestartFile;
 	ProcessPtr nullProcess;
 
-	/** This timer scans `detachedProcesses` periodically to see
-	 * whether any of the Processes can be shut down.
+	/** This thread scans `detachedProcesses` to see whether any of the
+	 * Processes can be shut down. It is woken up when a process is detached,
+	 * when a detached process's last session closes, and (through the
+	 * ProcessExitWatcher) when a detached process exits. Processes without
+	 * a pidfd are polled.
 	 */
 	bool detachedProcessesCheckerActive;
-	boost::condition_variable detachedProcessesCheckerCond;
+	/** Set, under the pool lock, when the checker must scan again before it
+	 * goes to sleep. Wakeups that arrive while it's scanning aren't lost. */
+	bool detachedProcessesCheckerWakeupPending;
+	boost::condition_variable_any detachedProcessesCheckerCond;
+	/** The batch that the detached processes checker is working on, and the
+	 * last one that it finished. */
+	ShutdownBatch currentShutdownBatch;
+	ShutdownBatch lastShutdownBatch;
 	Callback shutdownCallback;
 	GroupPtr selfPointer;
+	/**
+	 * Serializes session checkouts and session closes that are performed while
+	 * the pool lock is only held in shared mode. See the documentation for
+	 * `Pool::syncher`. Code that holds the pool lock exclusively does not need
+	 * to lock this.
+	 */
+	boost::mutex routingSyncher;
 
 
 	/****** Initialization and shutdown ******/
@@ -203,9 +252,13 @@ public:
 
 	RouteResult route(const Options &options) const;
 	SessionPtr newSession(Process *process, unsigned long long now = 0);
+	SessionPtr getQuickly(const Options &newOptions);
 	static void _onSessionInitiateFailure(Session *session);
 	static void _onSessionClose(Session *session);
 	OXT_FORCE_INLINE void onSessionInitiateFailure(Process *process, Session *session);
+	OXT_FORCE_INLINE void updateStatisticsOnSessionClose(Process *process, Session *session);
+	OXT_FORCE_INLINE void updateTotallyBusyCount(bool wasTotallyBusy, bool isTotallyBusy);
+	OXT_FORCE_INLINE bool onSessionCloseQuickly(Process *process, Session *session);
 	OXT_FORCE_INLINE void onSessionClose(Process *process, Session *session);
 
 	/****** Spawning and restarting ******/
@@ -214,6 +267,17 @@ public:
 		unsigned int restartsInitiated);
 	void spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner, const Options &options,
 		unsigned int restartsInitiated);
+	void warmUpProcess(Process *process, const Options &options);
+	void startSpawnThread();
+	void startParallelSpawnThreads();
+	bool shouldSpawnInParallel() const;
+	bool shouldPreSpawn() const;
+	void countPredictiveSpawn();
+	bool circuitHalfOpen() const;
+	void recordSpawnSuccess();
+	void recordSpawnFailure(const ExceptionPtr &exception);
+	void recordSpawnTimeline(const Json::Value &timeline, bool failed = false);
+	void resetCircuitBreaker();
 	void finalizeRestart(GroupPtr self, Options oldOptions, Options newOptions,
 		RestartMethod method, SpawningKit::FactoryPtr spawningKitFactory,
 		unsigned int restartsInitiated, boost::container::vector<Callback> postLockActions);
@@ -224,6 +288,9 @@ public:
 	Process *findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const;
 	Process *findProcessWithLowestBusyness(const ProcessList &processes) const;
 	Process *findEnabledProcessWithLowestBusyness() const;
+	Process *findEnabledProcessWithLowestLatency() const;
+	Process *findEnabledProcessByPowerOfTwoChoices() const;
+	unsigned int nextRoutingRandomNumber() const;
 
 	void addProcessToList(const ProcessPtr &process, ProcessList &destination);
 	void removeProcessFromList(const ProcessPtr &process, ProcessList &source);
@@ -235,6 +302,9 @@ public:
 
 	void startCheckingDetachedProcesses(bool immediately);
 	void detachedProcessesCheckerMain(GroupPtr self);
+	static void wakeUpDetachedProcessesChecker(boost::weak_ptr<Group> weakSelf);
+	void recordDetachedProcessShutdown(const ProcessPtr &process);
+	void finishShutdownBatch();
 
 	/****** Out-of-band work ******/
 
@@ -254,6 +324,7 @@ public:
 
 	void resetOptions(const Options &newOptions, Options *destination = NULL);
 	void mergeOptions(const Options &other);
+	bool mergeableOptionsChanged(const Options &other) const;
 
 	bool prepareHookScriptOptions(HookScriptOptions &hsOptions, const char *name);
 	void runAttachHooks(const ProcessPtr process) const;
@@ -269,6 +340,7 @@ public:
 	Group *findOtherGroupWaitingForCapacity() const;
 	bool pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 		boost::container::vector<Callback> &postLockActions);
+	deque<GetWaiter>::iterator findGetWaiterInsertionPoint(const Options &newOptions);
 	template<typename Lock> void assignSessionsToGetWaitersQuickly(Lock &lock);
 	void assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions);
 	bool testOverflowRequestQueue() const;
@@ -342,10 +414,13 @@ public:
 	 *       process.isAlive()
 	 *       process.oobwStatus == Process::OOBW_NOT_ACTIVE || process.oobwStatus == Process::OOBW_IN_PROGRESS
 	 */
-	int enabledCount;
+	/* `enabledCount` and `nEnabledProcessesTotallyBusy` are atomic so that
+	 * hasRoutableProcessesHint() can read them without holding any lock.
+	 */
+	boost::atomic<int> enabledCount;
 	int disablingCount;
 	int disabledCount;
-	int nEnabledProcessesTotallyBusy;
+	boost::atomic<int> nEnabledProcessesTotallyBusy;
 	ProcessList enabledProcesses;
 	ProcessList disablingProcesses;
 	ProcessList disabledProcesses;
@@ -360,11 +435,77 @@ public:
 	ProcessList detachedProcesses;
 
 	/**
-	 * A cache of the processes' busyness. It's in a compact structure
-	 * so that `findProcessWithLowestBusyness()` can work very quickly
-	 * when there are a large number of processes.
+	 * A cache of the enabled processes' busyness, indexed like `enabledProcesses`.
+	 * It keeps track of the least busy process so that
+	 * `findEnabledProcessWithLowestBusyness()` does not have to scan all
+	 * processes, and updating a process's busyness is O(log n).
 	 */
-	boost::container::vector<int> enabledProcessBusynessLevels;
+	TournamentTree<int> enabledProcessBusynessLevels;
+
+	/** The routing policy from `options.routingPolicy`, parsed by resetOptions(). */
+	RoutingPolicy routingPolicy;
+	/** State of the random number generator used by RP_POWER_OF_TWO_CHOICES.
+	 * Only accessed by route(), so it is protected in the same way.
+	 */
+	mutable unsigned int routingRandomState;
+	/**
+	 * Caches `SpawningKit::prepareUserSwitching(options)`, which queries the
+	 * user database. Reset by resetOptions(). Only accessed through
+	 * `boost::atomic_load()` and `boost::atomic_store()`, because state
+	 * snapshots are created while the pool lock is held in shared mode.
+	 */
+	mutable boost::shared_ptr<const SpawningKit::UserSwitchingInfo> userSwitchingInfo;
+
+	/**
+	 * Forecasts how many sessions this group will have to handle concurrently,
+	 * when `options.predictiveSpawning` is enabled. Fed by newSession() and by
+	 * session closes, so it is protected in the same way as the processes'
+	 * session counts.
+	 */
+	DemandPredictor demandPredictor;
+	/** The number of processes spawned only because `demandPredictor` asked for it. */
+	unsigned int predictiveSpawns;
+	/** The number of times that the garbage collector kept an idle process
+	 * alive because `demandPredictor` expects it to be needed.
+	 */
+	unsigned int idleProcessesKept;
+
+	/**
+	 * Circuit breaker state, only used if `options.circuitBreakerThreshold` > 0.
+	 *
+	 * `spawnFailures` is the number of consecutive spawn failures. Once it
+	 * reaches the threshold, the circuit opens: spawn() refuses to spawn until
+	 * `circuitOpenUntil` (in usec), and get() actions that would have to wait
+	 * for a process fail immediately with `circuitBreakerException`. After
+	 * that the circuit is half-open: a single probe spawn is allowed. If it
+	 * succeeds then the circuit closes, otherwise the circuit opens again
+	 * with `circuitBreakerBackoff` doubled, up to `maxCircuitBreakerBackoff()`.
+	 */
+	unsigned int spawnFailures;
+	unsigned long long circuitOpenUntil;
+	unsigned long long circuitBreakerBackoff;
+	ExceptionPtr circuitBreakerException;
+
+	/**
+	 * The last time (in usec) at which the preloader was restarted because
+	 * the processes' memory sharing dropped below `options.repreloadThreshold`,
+	 * or 0 if that never happened. Processes spawned before this time are
+	 * replaced one by one, so that they are forked off the new preloader.
+	 */
+	unsigned long long lastRepreloadTime;
+
+	/**
+	 * How long the phases of spawns took, keyed by phase name (see
+	 * `SpawningKit::Result`), plus "warmup" and the totals: "total" for
+	 * spawns that had to start a process, "reserve_total" for processes
+	 * taken from the SmartSpawner's reserve, and "failed_total" for spawns
+	 * that failed. Tells whether spawning is slow because of the app or
+	 * because of Passenger. `lastSpawnTimeline` is the timeline of the last
+	 * spawn, and `lastSpawnFailed` whether that spawn failed.
+	 */
+	map<string, Histogram> spawnPhaseHistograms;
+	Json::Value lastSpawnTimeline;
+	bool lastSpawnFailed;
 
 	/**
 	 * get() requests for this group that cannot be immediately satisfied are
@@ -447,12 +588,26 @@ public:
 	void restart(const Options &options, RestartMethod method = RM_DEFAULT);
 	bool restarting() const;
 	bool needsRestart(const Options &options);
+	bool restartFileCheckDue(const Options &options) const;
 
 	SpawnResult spawn();
 	bool spawning() const;
 	bool shouldSpawn() const;
 	bool shouldSpawnForGetAction() const;
 	bool allowSpawn() const;
+	bool circuitOpen(unsigned long long now = 0) const;
+
+	static BOOST_CONSTEXPR unsigned long long minCircuitBreakerBackoff() {
+		return 1000000;
+	}
+
+	static BOOST_CONSTEXPR unsigned long long maxCircuitBreakerBackoff() {
+		return 5 * 60 * 1000000ull;
+	}
+
+	static BOOST_CONSTEXPR unsigned long long minRepreloadInterval() {
+		return 10 * 60 * 1000000ull;
+	}
 
 	/****** Process list management ******/
 
@@ -472,12 +627,16 @@ public:
 	bool processLowerLimitsSatisfied() const;
 	bool processUpperLimitsReached() const;
 	bool allEnabledProcessesAreTotallyBusy() const;
+	bool hasRoutableProcessesHint() const;
 
 	unsigned int capacityUsed() const;
+	unsigned int getReservedProcessCount() const;
+	unsigned int predictedProcessCount(double headroom) const;
 	bool isWaitingForCapacity() const;
 	bool garbageCollectable(unsigned long long now = 0) const;
 
 	void inspectXml(std::ostream &stream, bool includeSecrets = true) const;
+	Json::Value inspectSpawnTimingsAsJson() const;
 
 	/****** Out-of-band work ******/
 
@@ -486,6 +645,7 @@ public:
 	/****** Miscellaneous ******/
 
 	void cleanupSpawner(boost::container::vector<Callback> &postLockActions);
+	boost::shared_ptr<const SpawningKit::UserSwitchingInfo> getUserSwitchingInfo() const;
 	bool authorizeByUid(uid_t uid) const;
 	bool authorizeByApiKey(const ApiKey &key) const;
 };
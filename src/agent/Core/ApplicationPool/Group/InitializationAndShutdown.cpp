@@ -109,6 +109,14 @@ Group::Group(Pool *_pool, const Options &_options)
 	disablingCount = 0;
 	disabledCount  = 0;
 	nEnabledProcessesTotallyBusy = 0;
+	routingRandomState = (unsigned int) SystemTime::getUsec() | 1;
+	predictiveSpawns = 0;
+	idleProcessesKept = 0;
+	spawnFailures  = 0;
+	circuitOpenUntil = 0;
+	circuitBreakerBackoff = 0;
+	lastRepreloadTime = 0;
+	lastSpawnFailed = false;
 	spawner        = getContext()->getSpawningKitFactory()->create(options);
 	restartsInitiated = 0;
 	processesBeingSpawned = 0;
@@ -130,6 +138,7 @@ Group::Group(Pool *_pool, const Options &_options)
 	}
 
 	detachedProcessesCheckerActive = false;
+	detachedProcessesCheckerWakeupPending = false;
 }
 
 Group::~Group() {
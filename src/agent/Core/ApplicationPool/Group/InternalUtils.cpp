@@ -77,6 +77,11 @@ Group::resetOptions(const Options &newOptions, Options *destination) {
 	destination->clearPerRequestFields();
 	destination->apiKey    = getApiKey().toStaticString();
 	destination->groupUuid = uuid;
+	if (destination == &this->options) {
+		routingPolicy = parseRoutingPolicy(options.routingPolicy);
+		boost::atomic_store(&userSwitchingInfo,
+			boost::shared_ptr<const SpawningKit::UserSwitchingInfo>());
+	}
 }
 
 /**
@@ -90,6 +95,17 @@ Group::mergeOptions(const Options &other) {
 	options.maxPreloaderIdleTime = other.maxPreloaderIdleTime;
 }
 
+/**
+ * Returns whether mergeOptions() would change anything.
+ */
+bool
+Group::mergeableOptionsChanged(const Options &other) const {
+	return options.maxRequests != other.maxRequests
+		|| options.minProcesses != other.minProcesses
+		|| options.statThrottleRate != other.statThrottleRate
+		|| options.maxPreloaderIdleTime != other.maxPreloaderIdleTime;
+}
+
 /* Given a hook name like "queue_full_error", we return HookScriptOptions filled in with this name and a spec
  * (user settings that can be queried from agentsOptions using the external hook name that is prefixed with "hook_")
  *
@@ -222,9 +238,20 @@ Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 		&& (newOptions.maxRequestQueueSize == 0
 		    || getWaitlist.size() < newOptions.maxRequestQueueSize)))
 	{
-		getWaitlist.push_back(GetWaiter(
+		GetWaiter waiter(
 			newOptions.copyAndPersist().detachFromUnionStationTransaction(),
-			callback));
+			callback);
+		if (waiter.deadline != 0) {
+			// Have the garbage collector drop the waiter once it has
+			// waited for too long.
+			getPool()->wakeupGarbageCollectorBefore(waiter.deadline);
+		}
+		getWaitlist.insert(findGetWaiterInsertionPoint(newOptions), waiter);
+		// get() starts spawning before it knows that this request has to
+		// wait, so the spawn threads that were started then didn't count it.
+		if (m_spawning) {
+			startParallelSpawnThreads();
+		}
 		return true;
 	} else {
 		postLockActions.push_back(boost::bind(GetCallback::call,
@@ -240,6 +267,31 @@ Group::pushGetWaiter(const Options &newOptions, const GetCallback &callback,
 	}
 }
 
+/**
+ * Determines where in getWaitlist a waiter for `newOptions` should go. The
+ * queue is ordered by descending priority. Within a priority class it is
+ * FIFO, but if adaptive LIFO is enabled and the queue is at least half full,
+ * new waiters are put in front of the waiters with the same priority.
+ */
+deque<GetWaiter>::iterator
+Group::findGetWaiterInsertionPoint(const Options &newOptions) {
+	bool lifo = newOptions.adaptiveLifo
+		&& newOptions.maxRequestQueueSize > 0
+		&& getWaitlist.size() >= newOptions.maxRequestQueueSize / 2;
+	deque<GetWaiter>::iterator it = getWaitlist.end();
+
+	while (it != getWaitlist.begin()) {
+		const GetWaiter &prev = *(it - 1);
+		if (prev.options.priority > newOptions.priority
+		 || (prev.options.priority == newOptions.priority && !lifo))
+		{
+			break;
+		}
+		it--;
+	}
+	return it;
+}
+
 template<typename Lock>
 void
 Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
@@ -250,6 +302,7 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	}
 
 	SmallVector<GetAction, 8> actions;
+	unsigned long long now = SystemTime::getUsec();
 	unsigned int i = 0;
 	bool done = false;
 
@@ -257,6 +310,16 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 
 	while (!done && i < getWaitlist.size()) {
 		const GetWaiter &waiter = getWaitlist[i];
+		if (OXT_UNLIKELY(waiter.expired(now))) {
+			GetAction action;
+			action.callback  = waiter.callback;
+			action.exception = boost::make_shared<RequestQueueTimeoutException>(
+				waiter.options.maxRequestQueueTime);
+			getWaitlist.erase(getWaitlist.begin() + i);
+			actions.push_back(action);
+			continue;
+		}
+
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
 			GetAction action;
@@ -276,17 +339,29 @@ Group::assignSessionsToGetWaitersQuickly(Lock &lock) {
 	lock.unlock();
 	SmallVector<GetAction, 50>::const_iterator it, end = actions.end();
 	for (it = actions.begin(); it != end; it++) {
-		it->callback(it->session, ExceptionPtr());
+		it->callback(it->session, it->exception);
 	}
 }
 
 void
 Group::assignSessionsToGetWaiters(boost::container::vector<Callback> &postLockActions) {
+	unsigned long long now = SystemTime::getUsec();
 	unsigned int i = 0;
 	bool done = false;
 
 	while (!done && i < getWaitlist.size()) {
 		const GetWaiter &waiter = getWaitlist[i];
+		if (OXT_UNLIKELY(waiter.expired(now))) {
+			postLockActions.push_back(boost::bind(
+				GetCallback::call,
+				waiter.callback,
+				SessionPtr(),
+				boost::make_shared<RequestQueueTimeoutException>(
+					waiter.options.maxRequestQueueTime)));
+			getWaitlist.erase(getWaitlist.begin() + i);
+			continue;
+		}
+
 		RouteResult result = route(waiter.options);
 		if (result.process != NULL) {
 			postLockActions.push_back(boost::bind(
@@ -51,9 +51,29 @@ Group::cleanupSpawner(boost::container::vector<Callback> &postLockActions) {
 	postLockActions.push_back(boost::bind(doCleanupSpawner, spawner));
 }
 
+/**
+ * Returns the result of `SpawningKit::prepareUserSwitching()` for this
+ * group's options. It is computed once and then cached until the options
+ * are reset.
+ *
+ * @throws RuntimeException
+ * @throws SystemException
+ */
+boost::shared_ptr<const SpawningKit::UserSwitchingInfo>
+Group::getUserSwitchingInfo() const {
+	boost::shared_ptr<const SpawningKit::UserSwitchingInfo> info =
+		boost::atomic_load(&userSwitchingInfo);
+	if (info == NULL) {
+		info = boost::make_shared<SpawningKit::UserSwitchingInfo>(
+			SpawningKit::prepareUserSwitching(options));
+		boost::atomic_store(&userSwitchingInfo, info);
+	}
+	return info;
+}
+
 bool
 Group::authorizeByUid(uid_t uid) const {
-	return uid == 0 || SpawningKit::prepareUserSwitching(options).uid == uid;
+	return uid == 0 || getUserSwitchingInfo()->uid == uid;
 }
 
 bool
@@ -88,7 +88,7 @@ Group::lockAndMaybeInitiateOobw(const ProcessPtr &process, DisableResult result,
 
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
-	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 	if (OXT_UNLIKELY(!process->isAlive() || !isAlive())) {
 		return;
 	}
@@ -189,7 +189,7 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 	UPDATE_TRACE_POINT();
 	{
 		// Standard resource management boilerplate stuff...
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
+		boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 		if (OXT_UNLIKELY(!process->isAlive()
 			|| process->enabled == Process::DETACHED
 			|| !isAlive()))
@@ -260,7 +260,7 @@ Group::spawnThreadOOBWRequest(GroupPtr self, ProcessPtr process) {
 	{
 		// Standard resource management boilerplate stuff...
 		Pool *pool = getPool();
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
+		boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 		if (OXT_UNLIKELY(!process->isAlive() || !isAlive())) {
 			return;
 		}
@@ -313,7 +313,7 @@ void
 Group::requestOOBW(const ProcessPtr &process) {
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
-	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 	if (isAlive() && process->isAlive() && process->oobwStatus == Process::OOBW_NOT_ACTIVE) {
 		process->oobwStatus = Process::OOBW_REQUESTED;
 	}
@@ -24,6 +24,7 @@
  *  THE SOFTWARE.
  */
 #include <Core/ApplicationPool/Group.h>
+#include <Core/ApplicationPool/ProcessExitWatcher.h>
 
 /*************************************************************************
  *
@@ -59,25 +60,11 @@ Group::findProcessWithStickySessionId(unsigned int id) const {
 
 Process *
 Group::findProcessWithStickySessionIdOrLowestBusyness(unsigned int id) const {
-	int leastBusyProcessIndex = -1;
-	int lowestBusyness = 0;
-	unsigned int i, size = enabledProcessBusynessLevels.size();
-	const int *enabledProcessBusynessLevels = &this->enabledProcessBusynessLevels[0];
-
-	for (i = 0; i < size; i++) {
-		Process *process = enabledProcesses[i].get();
-		if (process->getStickySessionId() == id) {
-			return process;
-		} else if (leastBusyProcessIndex == -1 || enabledProcessBusynessLevels[i] < lowestBusyness) {
-			leastBusyProcessIndex = i;
-			lowestBusyness = enabledProcessBusynessLevels[i];
-		}
-	}
-
-	if (leastBusyProcessIndex == -1) {
-		return NULL;
+	Process *process = findProcessWithStickySessionId(id);
+	if (process != NULL) {
+		return process;
 	} else {
-		return enabledProcesses[leastBusyProcessIndex].get();
+		return findEnabledProcessWithLowestBusyness();
 	}
 }
 
@@ -103,26 +90,117 @@ Group::findProcessWithLowestBusyness(const ProcessList &processes) const {
 }
 
 /**
- * Cache-optimized version of findProcessWithLowestBusyness() for the common case.
+ * O(1) version of findProcessWithLowestBusyness() for the common case.
  */
 Process *
 Group::findEnabledProcessWithLowestBusyness() const {
+	if (enabledProcesses.empty()) {
+		return NULL;
+	} else {
+		return enabledProcesses[enabledProcessBusynessLevels.minIndex()].get();
+	}
+}
+
+/**
+ * Used by the RP_LEAST_LATENCY routing policy. Returns the enabled process
+ * with the lowest expected latency, which is the number of sessions that a
+ * new request has to share the process with, multiplied by the process's
+ * average response time. Processes for which no response time is known yet
+ * are assumed to be as fast as the fastest known process, so that they
+ * quickly get traffic. The latency of processes that are warming up is
+ * inflated according to their routing weight. Falls back to findEnabledProcessWithLowestBusyness()
+ * if all enabled processes are totally busy.
+ */
+Process *
+Group::findEnabledProcessWithLowestLatency() const {
 	if (enabledProcesses.empty()) {
 		return NULL;
 	}
 
-	int leastBusyProcessIndex = -1;
-	int lowestBusyness = 0;
-	unsigned int i, size = enabledProcessBusynessLevels.size();
-	const int *enabledProcessBusynessLevels = &this->enabledProcessBusynessLevels[0];
+	unsigned int i, size = enabledProcesses.size();
+	double lowestAverage = -1;
 
 	for (i = 0; i < size; i++) {
-		if (leastBusyProcessIndex == -1 || enabledProcessBusynessLevels[i] < lowestBusyness) {
-			leastBusyProcessIndex = i;
-			lowestBusyness = enabledProcessBusynessLevels[i];
+		const Process *process = enabledProcesses[i].get();
+		if (process->responseTimeAverage.available()) {
+			double average = process->responseTimeAverage.average();
+			if (lowestAverage < 0 || average < lowestAverage) {
+				lowestAverage = average;
+			}
+		}
+	}
+	if (lowestAverage <= 0) {
+		lowestAverage = 1;
+	}
+
+	Process *bestProcess = NULL;
+	double lowestCost = 0;
+
+	for (i = 0; i < size; i++) {
+		Process *process = enabledProcesses[i].get();
+		if (process->isTotallyBusy()) {
+			continue;
 		}
+
+		double average = process->responseTimeAverage.available()
+			? process->responseTimeAverage.average()
+			: lowestAverage;
+		double cost = (process->sessions + 1) * average / process->routingWeight;
+		if (bestProcess == NULL || cost < lowestCost) {
+			bestProcess = process;
+			lowestCost = cost;
+		}
+	}
+
+	if (bestProcess == NULL) {
+		return findEnabledProcessWithLowestBusyness();
+	} else {
+		return bestProcess;
 	}
-	return enabledProcesses[leastBusyProcessIndex].get();
+}
+
+/**
+ * Used by the RP_POWER_OF_TWO_CHOICES routing policy. Picks two random
+ * enabled processes and returns the least busy one. Falls back to
+ * findEnabledProcessWithLowestBusyness() if both are totally busy, so that
+ * a request is only left unrouted when all enabled processes are totally busy.
+ */
+Process *
+Group::findEnabledProcessByPowerOfTwoChoices() const {
+	unsigned int size = enabledProcessBusynessLevels.size();
+	if (size <= 2) {
+		return findEnabledProcessWithLowestBusyness();
+	}
+
+	unsigned int i = nextRoutingRandomNumber() % size;
+	unsigned int j = nextRoutingRandomNumber() % (size - 1);
+	if (j >= i) {
+		j++;
+	}
+	if (enabledProcessBusynessLevels[j] < enabledProcessBusynessLevels[i]) {
+		i = j;
+	}
+
+	Process *process = enabledProcesses[i].get();
+	if (process->isTotallyBusy()) {
+		return findEnabledProcessWithLowestBusyness();
+	} else {
+		return process;
+	}
+}
+
+/**
+ * A xorshift pseudo random number generator. It only needs to spread load,
+ * so it is optimized for speed rather than quality.
+ */
+unsigned int
+Group::nextRoutingRandomNumber() const {
+	unsigned int x = routingRandomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	routingRandomState = x;
+	return x;
 }
 
 /**
@@ -157,7 +235,7 @@ Group::addProcessToList(const ProcessPtr &process, ProcessList &destination) {
 			// When Passenger is not allowed to abort websockets the application needs a way to know graceful shutdown
 			// is in progress. The solution for the most common use (Node.js) is to send a SIGINT. This is the general
 			// termination signal for Node; later versions of pm2 also use it (with a 1.6 sec grace period, Passenger just waits)
-			kill(process->getPid(), SIGINT);
+			process->kill(SIGINT);
 		}
 		callAbortLongRunningConnectionsCallback(process);
 	} else {
@@ -285,7 +363,10 @@ Group::startCheckingDetachedProcesses(bool immediately) {
 			POOL_HELPER_THREAD_STACK_SIZE
 		);
 		detachedProcessesCheckerActive = true;
+		currentShutdownBatch = ShutdownBatch();
+		currentShutdownBatch.startTime = SystemTime::getMonotonicUsec();
 	} else if (detachedProcessesCheckerActive && immediately) {
+		detachedProcessesCheckerWakeupPending = true;
 		detachedProcessesCheckerCond.notify_all();
 	}
 }
@@ -301,7 +382,7 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 		debug->messages->recv("Proceed with starting detached processes checker");
 	}
 
-	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 	while (true) {
 		assert(detachedProcessesCheckerActive);
 
@@ -312,6 +393,13 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 			break;
 		}
 
+		// This scan handles every wakeup that was requested before it.
+		detachedProcessesCheckerWakeupPending = false;
+
+		// Processes that are shutting down but whose exit we won't be
+		// notified of have to be polled.
+		bool mustPoll = false;
+
 		UPDATE_TRACE_POINT();
 		if (!detachedProcesses.empty()) {
 			P_TRACE(2, "Checking whether any of the " << detachedProcesses.size() <<
@@ -328,6 +416,13 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 							" has 0 active sessions now. Triggering shutdown.");
 						process->triggerShutdown();
 						assert(process->getLifeStatus() == Process::SHUTDOWN_TRIGGERED);
+						if (process->hasPidFd()) {
+							ProcessExitWatcher::getInstance().watch(process->getPidFd(),
+								boost::bind(wakeUpDetachedProcessesChecker,
+									boost::weak_ptr<Group>(shared_from_this())));
+						} else {
+							mustPoll = true;
+						}
 					}
 					break;
 				case Process::SHUTDOWN_TRIGGERED:
@@ -335,12 +430,20 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 						P_DEBUG("Detached process " << process->inspect() << " has shut down. Cleaning up associated resources.");
 						process->cleanup();
 						assert(process->getLifeStatus() == Process::DEAD);
+						recordDetachedProcessShutdown(process);
 						processesToRemove.push_back(process);
 					} else if (process->shutdownTimeoutExpired()) {
 						P_WARN("Detached process " << process->inspect() <<
 							" didn't shut down within " PROCESS_SHUTDOWN_TIMEOUT_DISPLAY
 							". Forcefully killing it with SIGKILL.");
-						kill(process->getPid(), SIGKILL);
+						process->kill(SIGKILL);
+						if (!process->forcefullyKilled) {
+							process->forcefullyKilled = true;
+							currentShutdownBatch.killed++;
+						}
+						mustPoll = true;
+					} else if (!process->hasPidFd()) {
+						mustPoll = true;
 					}
 					break;
 				default:
@@ -360,6 +463,7 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 			UPDATE_TRACE_POINT();
 			P_DEBUG("Stopping detached processes checker");
 			detachedProcessesCheckerActive = false;
+			finishShutdownBatch();
 
 			boost::container::vector<Callback> actions;
 			if (shutdownCanFinish()) {
@@ -380,13 +484,62 @@ Group::detachedProcessesCheckerMain(GroupPtr self) {
 		}
 
 		// Not all processes can be shut down yet. Sleep for a while unless
-		// someone wakes us up.
+		// someone wakes us up. If we'll be woken up for everything that we're
+		// waiting for, then the timeout only serves as a safety net, and to
+		// enforce PROCESS_SHUTDOWN_TIMEOUT.
 		UPDATE_TRACE_POINT();
-		detachedProcessesCheckerCond.timed_wait(lock,
-			posix_time::milliseconds(100));
+		if (!detachedProcessesCheckerWakeupPending) {
+			detachedProcessesCheckerCond.timed_wait(lock,
+				posix_time::milliseconds(mustPoll ? 100 : 1000));
+		}
 	}
 }
 
+/**
+ * Called by the ProcessExitWatcher when a detached process has exited.
+ * The pool lock is taken so that the wakeup can't fall between the
+ * checker's scan and its wait.
+ */
+void
+Group::wakeUpDetachedProcessesChecker(boost::weak_ptr<Group> weakSelf) {
+	GroupPtr self = weakSelf.lock();
+	if (self != NULL) {
+		boost::unique_lock<boost::shared_mutex> lock(self->getPool()->syncher);
+		self->detachedProcessesCheckerWakeupPending = true;
+		self->detachedProcessesCheckerCond.notify_all();
+	}
+}
+
+void
+Group::recordDetachedProcessShutdown(const ProcessPtr &process) {
+	MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+	MonotonicTimeUsec startTime = process->getShutdownStartMonotonicTime();
+	MonotonicTimeUsec duration = (now > startTime) ? now - startTime : 0;
+
+	currentShutdownBatch.processes++;
+	currentShutdownBatch.slowestShutdown = std::max(
+		currentShutdownBatch.slowestShutdown, duration);
+}
+
+/**
+ * Called when there are no detached processes left. Instead of logging the
+ * shutdown of every process, logs how long the whole batch took.
+ */
+void
+Group::finishShutdownBatch() {
+	if (currentShutdownBatch.processes == 0) {
+		return;
+	}
+
+	currentShutdownBatch.endTime = SystemTime::getMonotonicUsec();
+	lastShutdownBatch = currentShutdownBatch;
+	P_INFO("Shut down " << lastShutdownBatch.processes << " detached process(es) of group "
+		<< info.name << " in "
+		<< (lastShutdownBatch.endTime - lastShutdownBatch.startTime) / 1000
+		<< " msec (slowest: " << lastShutdownBatch.slowestShutdown / 1000 << " msec, killed: "
+		<< lastShutdownBatch.killed << ")");
+}
+
 
 /****************************
  *
@@ -421,6 +574,18 @@ Group::attach(const ProcessPtr &process,
 	if (options.forceMaxConcurrentRequestsPerProcess != -1) {
 		process->forceMaxConcurrency(options.forceMaxConcurrentRequestsPerProcess);
 	}
+	if (options.adaptiveConcurrency) {
+		process->enableAdaptiveConcurrency();
+	}
+	if (options.warmupRequests > 0 || options.warmupTime > 0) {
+		process->startWarmup(options.warmupInitialWeight / 100.0,
+			options.warmupRequests,
+			(unsigned long long) options.warmupTime * 1000000,
+			SystemTime::getUsec());
+	}
+	if (options.predictiveSpawning && process->getSpawnDuration() > 0) {
+		demandPredictor.registerLeadTime(process->getSpawnDuration());
+	}
 
 	P_DEBUG("Attaching process " << process->inspect());
 	addProcessToList(process, enabledProcesses);
@@ -497,7 +662,8 @@ Group::detach(const ProcessPtr &process, boost::container::vector<Callback> &pos
 	}
 
 	addProcessToList(process, detachedProcesses);
-	startCheckingDetachedProcesses(false);
+	startCheckingDetachedProcesses(true);
+	getPool()->updateSpawnReserveLimits();
 
 	postLockActions.push_back(boost::bind(&Group::runDetachHooks, this, process));
 }
@@ -530,7 +696,8 @@ Group::detachAll(boost::container::vector<Callback> &postLockActions) {
 	disabledCount = 0;
 	nEnabledProcessesTotallyBusy = 0;
 	clearDisableWaitlist(DR_NOOP, postLockActions);
-	startCheckingDetachedProcesses(false);
+	startCheckingDetachedProcesses(true);
+	getPool()->updateSpawnReserveLimits();
 }
 
 /**
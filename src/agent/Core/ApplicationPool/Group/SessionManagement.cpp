@@ -58,7 +58,18 @@ Group::RouteResult
 Group::route(const Options &options) const {
 	if (OXT_LIKELY(enabledCount > 0)) {
 		if (options.stickySessionId == 0) {
-			Process *process = findEnabledProcessWithLowestBusyness();
+			Process *process;
+			switch (routingPolicy) {
+			case RP_LEAST_LATENCY:
+				process = findEnabledProcessWithLowestLatency();
+				break;
+			case RP_POWER_OF_TWO_CHOICES:
+				process = findEnabledProcessByPowerOfTwoChoices();
+				break;
+			default:
+				process = findEnabledProcessWithLowestBusyness();
+				break;
+			}
 			if (process->canBeRoutedTo()) {
 				return RouteResult(process);
 			} else {
@@ -93,8 +104,11 @@ Group::newSession(Process *process, unsigned long long now) {
 	SessionPtr session = process->newSession(now);
 	session->onInitiateFailure = _onSessionInitiateFailure;
 	session->onClose   = _onSessionClose;
+	if (options.predictiveSpawning) {
+		demandPredictor.registerArrival(session->startTime);
+	}
 	if (process->enabled == Process::ENABLED) {
-		enabledProcessBusynessLevels[process->getIndex()] = process->busyness();
+		enabledProcessBusynessLevels.set(process->getIndex(), process->busyness());
 		if (!wasTotallyBusy && process->isTotallyBusy()) {
 			nEnabledProcessesTotallyBusy++;
 		}
@@ -109,11 +123,45 @@ Group::_onSessionInitiateFailure(Session *session) {
 	process->getGroup()->onSessionInitiateFailure(process, session);
 }
 
+/* A variant of get() for the common case, called by
+ * `Pool::asyncGetFromExistingGroupQuickly()` while the pool lock is held in
+ * shared mode and `routingSyncher` is held. It only checks out a session if
+ * that does not require spawning, restarting or putting the action on a wait
+ * list. Otherwise it returns NULL so that the caller can retry with get()
+ * while holding the pool lock exclusively.
+ */
+SessionPtr
+Group::getQuickly(const Options &newOptions) {
+	// mergeOptions() writes to `options`, which must not happen while
+	// other threads may be reading it, so leave that to get().
+	if (OXT_UNLIKELY(!isAlive() || restarting() || newOptions.noop
+		|| restartFileCheckDue(newOptions)
+		|| mergeableOptionsChanged(newOptions)))
+	{
+		return SessionPtr();
+	}
+
+	if (OXT_UNLIKELY(shouldSpawnForGetAction())) {
+		return SessionPtr();
+	}
+
+	RouteResult result = route(newOptions);
+	if (result.process == NULL) {
+		return SessionPtr();
+	} else {
+		P_DEBUG("Session checked out from process " << result.process->inspect());
+		return newSession(result.process, newOptions.currentTime);
+	}
+}
+
 void
 Group::_onSessionClose(Session *session) {
 	Process *process = session->getProcess();
 	assert(process != NULL);
-	process->getGroup()->onSessionClose(process, session);
+	Group *group = process->getGroup();
+	if (!group->onSessionCloseQuickly(process, session)) {
+		group->onSessionClose(process, session);
+	}
 }
 
 OXT_FORCE_INLINE void
@@ -123,7 +171,7 @@ Group::onSessionInitiateFailure(Process *process, Session *session) {
 	TRACE_POINT();
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
-	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 	assert(process->isAlive());
 	assert(isAlive() || getLifeStatus() == SHUTTING_DOWN);
 
@@ -138,12 +186,86 @@ Group::onSessionInitiateFailure(Process *process, Session *session) {
 	runAllActions(actions);
 }
 
+/* Updates the process's session count, response time statistics, adaptive
+ * concurrency limit and warm-up after one of its sessions has been closed.
+ */
+OXT_FORCE_INLINE void
+Group::updateStatisticsOnSessionClose(Process *process, Session *session) {
+	if (routingPolicy == RP_LEAST_LATENCY || process->adaptiveConcurrency
+		|| options.predictiveSpawning || process->warmingUp())
+	{
+		unsigned long long now = SystemTime::getUsec();
+		if (routingPolicy == RP_LEAST_LATENCY) {
+			process->recordResponseTime(session, now);
+		}
+		if (options.predictiveSpawning && now > session->startTime) {
+			demandPredictor.registerHoldTime(now - session->startTime);
+		}
+		process->sessionClosed(session);
+		process->adaptConcurrencyLimit(session, now);
+		process->updateWarmup(now);
+	} else {
+		process->sessionClosed(session);
+	}
+}
+
+/* Keeps `nEnabledProcessesTotallyBusy` up to date after the busyness
+ * of an enabled process has changed.
+ */
+OXT_FORCE_INLINE void
+Group::updateTotallyBusyCount(bool wasTotallyBusy, bool isTotallyBusy) {
+	if (wasTotallyBusy && !isTotallyBusy) {
+		assert(nEnabledProcessesTotallyBusy >= 1);
+		nEnabledProcessesTotallyBusy--;
+	} else if (!wasTotallyBusy && isTotallyBusy) {
+		nEnabledProcessesTotallyBusy++;
+	}
+}
+
+/* Handles the common case of a session close while only holding the pool
+ * lock in shared mode, plus `routingSyncher`: the one where the process stays
+ * enabled, and no get waiters or out-of-band work have to be taken care of.
+ * Returns false without changing anything if onSessionClose() must be
+ * called instead.
+ */
+OXT_FORCE_INLINE bool
+Group::onSessionCloseQuickly(Process *process, Session *session) {
+	TRACE_POINT();
+	Pool *pool = getPool();
+	SharedScopedLock lock(pool->syncher);
+	LockGuard l(routingSyncher);
+	assert(process->isAlive());
+
+	if (OXT_UNLIKELY(!isAlive()
+		|| process->enabled != Process::ENABLED
+		|| process->oobwStatus == Process::OOBW_REQUESTED
+		|| !getWaitlist.empty()
+		|| (options.maxRequests > 0 && process->processed + 1 >= options.maxRequests)))
+	{
+		return false;
+	}
+	if (process->sessions == 1
+		&& (!pool->getWaitlist.empty() || anotherGroupIsWaitingForCapacity()))
+	{
+		// The process will become idle and may have to be detached
+		// in order to free capacity.
+		return false;
+	}
+
+	P_TRACE(2, "Session closed for process " << process->inspect());
+	bool wasTotallyBusy = process->isTotallyBusy();
+	updateStatisticsOnSessionClose(process, session);
+	enabledProcessBusynessLevels.set(process->getIndex(), process->busyness());
+	updateTotallyBusyCount(wasTotallyBusy, process->isTotallyBusy());
+	return true;
+}
+
 OXT_FORCE_INLINE void
 Group::onSessionClose(Process *process, Session *session) {
 	TRACE_POINT();
 	// Standard resource management boilerplate stuff...
 	Pool *pool = getPool();
-	boost::unique_lock<boost::mutex> lock(pool->syncher);
+	boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 	assert(process->isAlive());
 	assert(isAlive() || getLifeStatus() == SHUTTING_DOWN);
 
@@ -153,23 +275,22 @@ Group::onSessionClose(Process *process, Session *session) {
 
 	/* Update statistics. */
 	bool wasTotallyBusy = process->isTotallyBusy();
-	process->sessionClosed(session);
+	updateStatisticsOnSessionClose(process, session);
 	assert(process->getLifeStatus() == Process::ALIVE);
 	assert(process->enabled == Process::ENABLED
 		|| process->enabled == Process::DISABLING
 		|| process->enabled == Process::DETACHED);
 	if (process->enabled == Process::ENABLED) {
-		enabledProcessBusynessLevels[process->getIndex()] = process->busyness();
-		if (wasTotallyBusy) {
-			assert(nEnabledProcessesTotallyBusy >= 1);
-			nEnabledProcessesTotallyBusy--;
-		}
+		enabledProcessBusynessLevels.set(process->getIndex(), process->busyness());
+		updateTotallyBusyCount(wasTotallyBusy, process->isTotallyBusy());
+	} else if (process->enabled == Process::DETACHED && process->sessions == 0) {
+		// The detached processes checker can shut it down now.
+		startCheckingDetachedProcesses(true);
 	}
 
-	/* This group now has a process that's guaranteed to be not
-	 * totally busy.
+	/* This group now usually has a process that's not totally busy,
+	 * unless the process's adaptive concurrency limit was just lowered.
 	 */
-	assert(!process->isTotallyBusy());
 
 	bool detachingBecauseOfMaxRequests = false;
 	bool detachingBecauseCapacityNeeded = false;
@@ -301,7 +422,8 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 		 * after a process has been spawned or has failed to spawn, or
 		 * when a disabling process becomes available.
 		 */
-		assert(m_spawning || restarting() || poolAtFullCapacity());
+		assert(m_spawning || restarting() || poolAtFullCapacity()
+			|| circuitOpen(newOptions.currentTime));
 
 		if (disablingCount > 0 && !restarting()) {
 			Process *process = findProcessWithLowestBusyness(disablingProcesses);
@@ -311,6 +433,18 @@ Group::get(const Options &newOptions, const GetCallback &callback,
 			}
 		}
 
+		if (OXT_UNLIKELY(!m_spawning && !restarting()
+			&& circuitOpen(newOptions.currentTime)))
+		{
+			/* Spawning keeps failing, so no process is on the way. Fail
+			 * immediately instead of letting the request wait.
+			 */
+			P_DEBUG("No session checked out: circuit breaker is open");
+			postLockActions.push_back(boost::bind(GetCallback::call,
+				callback, SessionPtr(), circuitBreakerException));
+			return SessionPtr();
+		}
+
 		if (pushGetWaiter(newOptions, callback, postLockActions)) {
 			P_DEBUG("No session checked out yet: group is spawning or restarting");
 		}
@@ -24,6 +24,7 @@
  *  THE SOFTWARE.
  */
 #include <Core/ApplicationPool/Group.h>
+#include <MessageReadersWriters.h>
 
 /*************************************************************************
  *
@@ -45,6 +46,104 @@ using namespace boost;
  ****************************/
 
 
+static void
+appendWarmupHeader(string &data, const StaticString &key, const StaticString &value) {
+	data.append(key.data(), key.size());
+	data.append(1, '\0');
+	data.append(value.data(), value.size());
+	data.append(1, '\0');
+}
+
+/**
+ * Sends a GET request for each of the URIs in `options.warmupUrls` to the
+ * given process, which has just been spawned and is not attached yet, and
+ * waits for the responses. The responses themselves are not looked at.
+ * Errors are logged, but do not prevent the process from being attached.
+ */
+void
+Group::warmUpProcess(Process *process, const Options &options) {
+	TRACE_POINT();
+	Socket *socket = process->findSessionSocketWithLowestBusyness();
+	if (socket == NULL) {
+		return;
+	}
+
+	vector<string> uris;
+	split(options.warmupUrls, ' ', uris);
+	unsigned long long startTime = SystemTime::getUsec();
+
+	foreach (const string &uri, uris) {
+		if (uri.empty()) {
+			continue;
+		}
+
+		UPDATE_TRACE_POINT();
+		P_DEBUG("Warming up process " << process->inspect() << ": GET " << uri);
+		unsigned long long timeout = (unsigned long long) options.startTimeout * 1000;
+		try {
+			// Like OOBW requests, the connection is closed afterwards so
+			// that it is never reused in the middle of a response.
+			Connection connection = socket->checkoutConnection();
+			connection.fail = true;
+			ScopeGuard guard(boost::bind(&Socket::checkinConnection, socket, connection));
+
+			string::size_type pos = uri.find('?');
+			StaticString path = StaticString(uri).substr(0, pos);
+			StaticString query = (pos == string::npos)
+				? StaticString()
+				: StaticString(uri).substr(pos + 1);
+
+			if (socket->protocol == "session") {
+				string data;
+				data.append(4, '\0');
+				appendWarmupHeader(data, "REQUEST_METHOD", "GET");
+				appendWarmupHeader(data, "REQUEST_URI", uri);
+				appendWarmupHeader(data, "PATH_INFO", path);
+				appendWarmupHeader(data, "SCRIPT_NAME", "");
+				appendWarmupHeader(data, "QUERY_STRING", query);
+				appendWarmupHeader(data, "SERVER_NAME", "localhost");
+				appendWarmupHeader(data, "SERVER_PORT", "80");
+				appendWarmupHeader(data, "SERVER_PROTOCOL", "HTTP/1.1");
+				appendWarmupHeader(data, "REMOTE_ADDR", "127.0.0.1");
+				appendWarmupHeader(data, "REMOTE_PORT", "0");
+				appendWarmupHeader(data, "HTTP_HOST", "localhost");
+				appendWarmupHeader(data, "HTTP_USER_AGENT", PROGRAM_NAME " warm-up");
+				appendWarmupHeader(data, "PASSENGER_CONNECT_PASSWORD",
+					getApiKey().toStaticString());
+				Uint32Message::generate(&data[0], data.size() - 4);
+				writeExact(connection.fd, data, &timeout);
+			} else {
+				writeExact(connection.fd, "GET " + uri + " HTTP/1.1\r\n"
+					"Host: localhost\r\n"
+					"User-Agent: " PROGRAM_NAME " warm-up\r\n"
+					"Connection: close\r\n\r\n",
+					&timeout);
+			}
+			syscalls::shutdown(connection.fd, SHUT_WR);
+
+			char buf[1024 * 16];
+			ssize_t ret;
+			do {
+				waitUntilReadable(connection.fd, &timeout);
+				ret = syscalls::read(connection.fd, buf, sizeof(buf));
+				if (ret == -1) {
+					int e = errno;
+					throw SystemException("Cannot read warm-up response", e);
+				}
+			} while (ret > 0);
+		} catch (const SystemException &e) {
+			P_WARN("Error warming up process " << process->inspect() <<
+				" with " << uri << ": " << e.what());
+		} catch (const TimeoutException &e) {
+			P_WARN("Timeout warming up process " << process->inspect() <<
+				" with " << uri);
+		}
+	}
+
+	P_DEBUG("Process " << process->inspect() << " warmed up in " <<
+		(SystemTime::getUsec() - startTime) / 1000 << " msec");
+}
+
 // The 'self' parameter is for keeping the current Group object alive while this thread is running.
 void
 Group::spawnThreadMain(GroupPtr self, SpawningKit::SpawnerPtr spawner,
@@ -91,6 +190,7 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 
 		ProcessPtr process;
 		ExceptionPtr exception;
+		Json::Value spawnTimeline;
 		try {
 			UPDATE_TRACE_POINT();
 			boost::this_thread::restore_interruption ri(di);
@@ -100,19 +200,44 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 				processAndLogNewSpawnException(e, options, pool->getSpawningKitConfig());
 				throw e;
 			} else {
-				process = createProcessObject(spawner->spawn(options));
+				{
+					pool->acquireSpawnSlot();
+					ScopeGuard slotGuard(boost::bind(&Pool::releaseSpawnSlot, pool));
+					SpawningKit::Result spawnResult = spawner->spawn(options);
+					spawnTimeline = spawnResult["spawn_timeline"];
+					process = createProcessObject(spawnResult);
+				}
+				if (!options.warmupUrls.empty() && !process->isDummy()) {
+					MonotonicTimeUsec warmupStartTime = SystemTime::getMonotonicUsec();
+					warmUpProcess(process.get(), options);
+					Json::Value phase;
+					phase["phase"] = "warmup";
+					phase["start_time"] = (Json::UInt64) warmupStartTime;
+					phase["end_time"] = (Json::UInt64) SystemTime::getMonotonicUsec();
+					spawnTimeline.append(phase);
+				}
 			}
 		} catch (const thread_interrupted &) {
 			break;
 		} catch (const tracable_exception &e) {
 			exception = copyException(e);
+			const SpawnException *spawnException =
+				dynamic_cast<const SpawnException *>(&e);
+			if (spawnException != NULL) {
+				Json::Reader reader;
+				if (!reader.parse(spawnException->get("spawn_timeline"),
+					spawnTimeline, false))
+				{
+					spawnTimeline = Json::Value();
+				}
+			}
 			// Let other (unexpected) exceptions crash the program so
 			// gdb can generate a backtrace.
 		}
 
 		UPDATE_TRACE_POINT();
 		ScopeGuard guard(boost::bind(Process::forceTriggerShutdownAndCleanup, process));
-		boost::unique_lock<boost::mutex> lock(pool->syncher);
+		boost::unique_lock<boost::shared_mutex> lock(pool->syncher);
 
 		if (!isAlive()) {
 			if (process != NULL) {
@@ -145,11 +270,13 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 		assert(processesBeingSpawned > 0);
 
 		processesBeingSpawned--;
-		assert(processesBeingSpawned == 0);
+		assert(processesBeingSpawned >= 0);
 
 		UPDATE_TRACE_POINT();
 		boost::container::vector<Callback> actions;
 		if (process != NULL) {
+			recordSpawnSuccess();
+			recordSpawnTimeline(spawnTimeline);
 			AttachResult result = attach(process, actions);
 			if (result == AR_OK) {
 				guard.clear();
@@ -173,24 +300,37 @@ Group::spawnThreadRealMain(const SpawningKit::SpawnerPtr &spawner,
 			if (enabledCount == 0) {
 				enableAllDisablingProcesses(actions);
 			}
+			recordSpawnFailure(exception);
+			recordSpawnTimeline(spawnTimeline, true);
 			Pool::assignExceptionToGetWaiters(getWaitlist, exception, actions);
 			pool->assignSessionsToGetWaiters(actions);
 			done = true;
 		}
 
-		done = done
-			|| (processLowerLimitsSatisfied() && getWaitlist.empty())
-			|| processUpperLimitsReached()
-			|| pool->atFullCapacityUnlocked();
-		m_spawning = !done;
+		if (!done) {
+			if (processesBeingSpawned == 0) {
+				done = (processLowerLimitsSatisfied() && getWaitlist.empty()
+						&& !shouldPreSpawn())
+					|| processUpperLimitsReached()
+					|| pool->atFullCapacityUnlocked();
+			} else {
+				// Other spawner threads are still at work. Only keep
+				// this one going if that much parallelism is still useful.
+				done = !shouldSpawnInParallel();
+			}
+		}
+		m_spawning = !done || processesBeingSpawned > 0;
 		if (done) {
 			P_DEBUG("Spawn loop done");
 		} else {
+			countPredictiveSpawn();
 			processesBeingSpawned++;
 			P_DEBUG("Continue spawning");
+			startParallelSpawnThreads();
 		}
 
 		UPDATE_TRACE_POINT();
+		pool->updateSpawnReserveLimits();
 		pool->fullVerifyInvariants();
 		lock.unlock();
 		UPDATE_TRACE_POINT();
@@ -238,7 +378,7 @@ Group::finalizeRestart(GroupPtr self,
 		debug->messages->recv("Finish restarting");
 	}
 
-	ScopedLock l(pool->syncher);
+	ExclusiveScopedLock l(pool->syncher);
 	if (!isAlive()) {
 		P_DEBUG("Group " << getName() << " is shutting down, so aborting restart");
 		return;
@@ -310,6 +450,7 @@ Group::restart(const Options &options, RestartMethod method) {
 	m_spawning   = false;
 	m_restarting = true;
 	uuid         = generateUuid(pool);
+	resetCircuitBreaker();
 	detachAll(actions);
 	getPool()->interruptableThreads.create_thread(
 		boost::bind(&Group::finalizeRestart, this, shared_from_this(),
@@ -407,6 +548,26 @@ Group::needsRestart(const Options &options) {
 	}
 }
 
+/**
+ * Whether a needsRestart() call with the given options would check the
+ * restart files, and could thus return true. Unlike needsRestart(),
+ * this method has no side effects.
+ */
+bool
+Group::restartFileCheckDue(const Options &options) const {
+	time_t now;
+
+	if (options.currentTime != 0) {
+		now = options.currentTime / 1000000;
+	} else {
+		now = SystemTime::get();
+	}
+
+	return lastRestartFileCheckTime == 0
+		|| lastRestartFileCheckTime <= now - (time_t) options.statThrottleRate
+		|| alwaysRestartFileExists;
+}
+
 /**
  * Attempts to increase the number of processes by one, while respecting the
  * resource limits. That is, this method will ensure that there are at least
@@ -417,28 +578,218 @@ SpawnResult
 Group::spawn() {
 	assert(isAlive());
 	if (m_spawning) {
+		startParallelSpawnThreads();
 		return SR_IN_PROGRESS;
 	} else if (restarting()) {
 		return SR_ERR_RESTARTING;
+	} else if (circuitOpen() && (enabledCount > 0 || (disablingCount == 0 && getWaitlist.empty()))) {
+		// Spawning is suspended, unless the group would otherwise be left
+		// without a way to serve the requests that it has already accepted.
+		return SR_ERR_CIRCUIT_OPEN;
 	} else if (processUpperLimitsReached()) {
 		return SR_ERR_GROUP_UPPER_LIMITS_REACHED;
 	} else if (poolAtFullCapacity()) {
 		return SR_ERR_POOL_AT_FULL_CAPACITY;
 	} else {
 		P_DEBUG("Requested spawning of new process for group " << info.name);
-		interruptableThreads.create_thread(
-			boost::bind(&Group::spawnThreadMain,
-				this, shared_from_this(), spawner,
-				options.copyAndPersist().clearPerRequestFields(),
-				restartsInitiated),
-			"Group process spawner: " + info.name,
-			POOL_HELPER_THREAD_STACK_SIZE);
-		m_spawning = true;
-		processesBeingSpawned++;
+		startSpawnThread();
+		startParallelSpawnThreads();
 		return SR_OK;
 	}
 }
 
+/**
+ * Starts a spawner thread, which spawns processes one at a time until
+ * the group has enough of them.
+ */
+void
+Group::startSpawnThread() {
+	interruptableThreads.create_thread(
+		boost::bind(&Group::spawnThreadMain,
+			this, shared_from_this(), spawner,
+			options.copyAndPersist().clearPerRequestFields(),
+			restartsInitiated),
+		"Group process spawner: " + info.name,
+		POOL_HELPER_THREAD_STACK_SIZE);
+	countPredictiveSpawn();
+	m_spawning = true;
+	processesBeingSpawned++;
+	getPool()->updateSpawnReserveLimits();
+}
+
+/**
+ * While spawning is in progress, starts additional spawner threads
+ * as long as `shouldSpawnInParallel()` says so.
+ */
+void
+Group::startParallelSpawnThreads() {
+	assert(m_spawning);
+	while (shouldSpawnInParallel()) {
+		P_DEBUG("Spawning another process in parallel for group " << info.name);
+		startSpawnThread();
+	}
+}
+
+/**
+ * Whether, on top of the processes that are already being spawned, another one
+ * should be spawned in parallel. This is the case if `options.spawnConcurrency`
+ * allows it, and if that process would be needed to satisfy `minProcesses`,
+ * to serve a get waiter that the processes being spawned won't serve, or to
+ * meet the predicted demand.
+ */
+bool
+Group::shouldSpawnInParallel() const {
+	return processesBeingSpawned > 0
+		&& processesBeingSpawned < (int) std::max(1u, options.spawnConcurrency)
+		&& !restarting()
+		&& !circuitHalfOpen()
+		&& allowSpawn()
+		&& (!processLowerLimitsSatisfied()
+			|| getWaitlist.size() > (unsigned int) processesBeingSpawned
+			|| shouldPreSpawn());
+}
+
+/**
+ * Whether more processes should be spawned ahead of time in order to
+ * meet the demand that `demandPredictor` forecasts, i.e. before requests
+ * have to be put on the wait list. Asks for 20% more capacity than the
+ * predicted demand, to absorb bursts, once that adds up to a whole process.
+ */
+bool
+Group::shouldPreSpawn() const {
+	return predictedProcessCount(1.2) > capacityUsed();
+}
+
+/**
+ * Must be called right before another process is going to be spawned.
+ * Keeps track of the spawns that nothing but `shouldPreSpawn()` asked for.
+ */
+void
+Group::countPredictiveSpawn() {
+	if (processLowerLimitsSatisfied()
+	 && getWaitlist.empty()
+	 && !allEnabledProcessesAreTotallyBusy()
+	 && shouldPreSpawn())
+	{
+		P_DEBUG("Spawning ahead of predicted demand for group " << info.name);
+		predictiveSpawns++;
+	}
+}
+
+/**
+ * Whether the circuit breaker is open, i.e. whether spawning is suspended
+ * because the last `options.circuitBreakerThreshold` spawn attempts failed.
+ */
+bool
+Group::circuitOpen(unsigned long long now) const {
+	if (circuitOpenUntil == 0) {
+		return false;
+	}
+	if (now == 0) {
+		now = SystemTime::getUsec();
+	}
+	return now < circuitOpenUntil;
+}
+
+/**
+ * Whether the circuit breaker's backoff time has passed, but no spawn attempt
+ * has succeeded since it opened. In this state only a single process may be
+ * spawned at a time, which probes whether spawning works again.
+ */
+bool
+Group::circuitHalfOpen() const {
+	return circuitOpenUntil != 0 && !circuitOpen();
+}
+
+/**
+ * Adds the phases of a spawn (see `SpawningKit::Result`) to
+ * `spawnPhaseHistograms`. A process taken from the SmartSpawner's reserve
+ * was spawned in the background, so its timeline only says how long the
+ * caller waited for it: its total goes into "reserve_total" rather than
+ * "total". The total of a failed spawn goes into "failed_total".
+ */
+void
+Group::recordSpawnTimeline(const Json::Value &timeline, bool failed) {
+	if (!timeline.isArray() || timeline.empty()) {
+		return;
+	}
+
+	Json::Value::const_iterator it, end = timeline.end();
+	for (it = timeline.begin(); it != end; it++) {
+		const Json::Value &phase = *it;
+		unsigned long long startTime = phase["start_time"].asUInt64();
+		unsigned long long endTime = phase["end_time"].asUInt64();
+		spawnPhaseHistograms[phase["phase"].asString()].add(
+			(endTime > startTime) ? endTime - startTime : 0);
+	}
+
+	const char *totalName;
+	if (failed) {
+		totalName = "failed_total";
+	} else if (timeline[0u]["phase"].asString() == "reserve") {
+		totalName = "reserve_total";
+	} else {
+		totalName = "total";
+	}
+	unsigned long long startTime = timeline[0u]["start_time"].asUInt64();
+	unsigned long long endTime = timeline[timeline.size() - 1]["end_time"].asUInt64();
+	spawnPhaseHistograms[totalName].add((endTime > startTime) ? endTime - startTime : 0);
+	lastSpawnTimeline = timeline;
+	lastSpawnFailed = failed;
+}
+
+void
+Group::recordSpawnSuccess() {
+	if (circuitOpenUntil != 0) {
+		P_NOTICE("Spawning succeeded again for group " << info.name <<
+			", closing its circuit breaker");
+	}
+	resetCircuitBreaker();
+}
+
+/**
+ * Must be called when a spawn attempt failed. Opens the circuit breaker once
+ * `options.circuitBreakerThreshold` consecutive attempts have failed, or
+ * reopens it with a doubled backoff time if this was a half-open probe.
+ */
+void
+Group::recordSpawnFailure(const ExceptionPtr &exception) {
+	spawnFailures++;
+	if (options.circuitBreakerThreshold == 0
+	 || spawnFailures < options.circuitBreakerThreshold
+	 || circuitOpen())
+	{
+		return;
+	}
+
+	if (circuitBreakerBackoff == 0) {
+		circuitBreakerBackoff = minCircuitBreakerBackoff();
+	} else {
+		circuitBreakerBackoff = std::min(circuitBreakerBackoff * 2,
+			maxCircuitBreakerBackoff());
+	}
+	circuitOpenUntil = SystemTime::getUsec() + circuitBreakerBackoff;
+
+	boost::shared_ptr<SpawnException> spawnException =
+		dynamic_pointer_cast<SpawnException>(exception);
+	if (spawnException == NULL) {
+		spawnException = boost::make_shared<SpawnException>(exception->what());
+	}
+	circuitBreakerException = boost::make_shared<SpawnCircuitOpenException>(
+		*spawnException, spawnFailures, circuitBreakerBackoff);
+	P_WARN("The last " << spawnFailures << " attempts to spawn a process for group " <<
+		info.name << " failed. Opening its circuit breaker: not spawning for " <<
+		circuitBreakerBackoff / 1000 << " msec");
+}
+
+void
+Group::resetCircuitBreaker() {
+	spawnFailures = 0;
+	circuitOpenUntil = 0;
+	circuitBreakerBackoff = 0;
+	circuitBreakerException.reset();
+}
+
 bool
 Group::spawning() const {
 	return m_spawning;
@@ -452,6 +803,7 @@ Group::shouldSpawn() const {
 			!processLowerLimitsSatisfied()
 			|| allEnabledProcessesAreTotallyBusy()
 			|| !getWaitlist.empty()
+			|| shouldPreSpawn()
 		);
 }
 
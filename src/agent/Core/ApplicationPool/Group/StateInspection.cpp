@@ -80,6 +80,20 @@ Group::allEnabledProcessesAreTotallyBusy() const {
 	return nEnabledProcessesTotallyBusy == enabledCount;
 }
 
+/**
+ * Returns whether there is an enabled process that is not totally busy, i.e.
+ * whether a get() action could be satisfied without waiting. Unlike
+ * most other methods, this may be called without holding the pool lock. The
+ * result is then only a hint that may already be outdated, which is good
+ * enough to decide whether `Pool::asyncGetFromGroupQuickly()` is worth
+ * trying at all.
+ */
+bool
+Group::hasRoutableProcessesHint() const {
+	return nEnabledProcessesTotallyBusy.load(boost::memory_order_relaxed)
+		< enabledCount.load(boost::memory_order_relaxed);
+}
+
 /**
  * Returns the number of processes in this group that should be part of the
  * ApplicationPool process limits calculations.
@@ -89,6 +103,41 @@ Group::capacityUsed() const {
 	return enabledCount + disablingCount + disabledCount + processesBeingSpawned;
 }
 
+/**
+ * Returns the number of processes that this group's spawner keeps in reserve.
+ * They don't count towards `capacityUsed()`, but `Pool::updateSpawnReserveLimits()`
+ * keeps them within the remaining pool capacity.
+ */
+unsigned int
+Group::getReservedProcessCount() const {
+	if (spawner != NULL) {
+		return spawner->getReserveSize();
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Returns how many processes this group needs in order to handle the demand
+ * that `demandPredictor` forecasts, with `headroom` more capacity in whole
+ * processes (see DemandPredictor::predictServerCount()). Assumes that all
+ * processes can handle as many concurrent sessions as the first enabled one.
+ * Returns 0 if predictive spawning is disabled, or if no prediction can be
+ * made because there are no enabled processes or because processes have
+ * unlimited concurrency.
+ */
+unsigned int
+Group::predictedProcessCount(double headroom) const {
+	if (!options.predictiveSpawning || enabledCount == 0) {
+		return 0;
+	}
+	int concurrency = enabledProcesses[0]->concurrencyLimit;
+	if (concurrency <= 0) {
+		return 0;
+	}
+	return demandPredictor.predictServerCount(concurrency, headroom);
+}
+
 /**
  * Checks whether this group is waiting for capacity on the pool to
  * become available before it can continue processing requests.
@@ -115,6 +164,29 @@ Group::garbageCollectable(unsigned long long now) const {
 	return false;
 }
 
+/**
+ * Returns `spawnPhaseHistograms`, `lastSpawnTimeline` and `lastSpawnFailed`.
+ * Histogram values are in microseconds.
+ */
+Json::Value
+Group::inspectSpawnTimingsAsJson() const {
+	Json::Value doc;
+	Json::Value phases(Json::objectValue);
+	map<string, Histogram>::const_iterator it, end = spawnPhaseHistograms.end();
+
+	for (it = spawnPhaseHistograms.begin(); it != end; it++) {
+		phases[it->first] = it->second.toJson();
+	}
+	doc["phases"] = phases;
+	if (lastSpawnTimeline.isNull()) {
+		doc["last_spawn_timeline"] = Json::Value(Json::arrayValue);
+	} else {
+		doc["last_spawn_timeline"] = lastSpawnTimeline;
+	}
+	doc["last_spawn_failed"] = lastSpawnFailed;
+	return doc;
+}
+
 void
 Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	ProcessList::const_iterator it;
@@ -132,6 +204,39 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 	stream << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
 	stream << "<disable_wait_list_size>" << disableWaitlist.size() << "</disable_wait_list_size>";
 	stream << "<processes_being_spawned>" << processesBeingSpawned << "</processes_being_spawned>";
+	stream << "<reserved_process_count>" << getReservedProcessCount() << "</reserved_process_count>";
+	stream << "<routing_policy>" << getRoutingPolicyName(routingPolicy) << "</routing_policy>";
+	if (options.predictiveSpawning) {
+		stream << "<predictive_spawning>";
+		stream << "<arrival_rate>" << demandPredictor.getArrivalRate() << "</arrival_rate>";
+		stream << "<arrival_rate_trend>" << demandPredictor.getArrivalRateTrend() << "</arrival_rate_trend>";
+		stream << "<session_hold_time>" << (unsigned long long) demandPredictor.getHoldTime() << "</session_hold_time>";
+		stream << "<spawn_time>" << (unsigned long long) demandPredictor.getLeadTime() << "</spawn_time>";
+		stream << "<predicted_demand>" << demandPredictor.predictDemand() << "</predicted_demand>";
+		stream << "<desired_process_count>" << predictedProcessCount(1.2) << "</desired_process_count>";
+		stream << "<predictive_spawns>" << predictiveSpawns << "</predictive_spawns>";
+		stream << "<idle_processes_kept>" << idleProcessesKept << "</idle_processes_kept>";
+		stream << "</predictive_spawning>";
+	}
+	if (circuitOpenUntil != 0) {
+		stream << "<circuit_breaker>";
+		stream << "<state>" << (circuitOpen() ? "open" : "half_open") << "</state>";
+		stream << "<spawn_failures>" << spawnFailures << "</spawn_failures>";
+		stream << "<backoff>" << circuitBreakerBackoff << "</backoff>";
+		stream << "<open_until>" << circuitOpenUntil << "</open_until>";
+		stream << "</circuit_breaker>";
+	}
+	if (lastRepreloadTime != 0) {
+		stream << "<last_repreload_time>" << lastRepreloadTime << "</last_repreload_time>";
+	}
+	if (lastShutdownBatch.processes > 0) {
+		stream << "<last_shutdown_batch>";
+		stream << "<processes>" << lastShutdownBatch.processes << "</processes>";
+		stream << "<killed>" << lastShutdownBatch.killed << "</killed>";
+		stream << "<duration>" << lastShutdownBatch.endTime - lastShutdownBatch.startTime << "</duration>";
+		stream << "<slowest_shutdown>" << lastShutdownBatch.slowestShutdown << "</slowest_shutdown>";
+		stream << "</last_shutdown_batch>";
+	}
 	if (m_spawning) {
 		stream << "<spawning/>";
 	}
@@ -157,11 +262,11 @@ Group::inspectXml(std::ostream &stream, bool includeSecrets) const {
 		P_BUG("Unknown 'lifeStatus' state " << lifeStatus);
 	}
 
-	SpawningKit::UserSwitchingInfo usInfo(SpawningKit::prepareUserSwitching(options));
-	stream << "<user>" << escapeForXml(usInfo.username) << "</user>";
-	stream << "<uid>" << usInfo.uid << "</uid>";
-	stream << "<group>" << escapeForXml(usInfo.groupname) << "</group>";
-	stream << "<gid>" << usInfo.gid << "</gid>";
+	boost::shared_ptr<const SpawningKit::UserSwitchingInfo> usInfo = getUserSwitchingInfo();
+	stream << "<user>" << escapeForXml(usInfo->username) << "</user>";
+	stream << "<uid>" << usInfo->uid << "</uid>";
+	stream << "<group>" << escapeForXml(usInfo->groupname) << "</group>";
+	stream << "<gid>" << usInfo->gid << "</gid>";
 
 	stream << "<options>";
 	options.toXml(stream, getResourceLocator());
@@ -49,6 +49,7 @@
 #include <Core/ApplicationPool/Pool/InitializationAndShutdown.cpp>
 #include <Core/ApplicationPool/Pool/AnalyticsCollection.cpp>
 #include <Core/ApplicationPool/Pool/GarbageCollection.cpp>
+#include <Core/ApplicationPool/Pool/StateSnapshotPublishing.cpp>
 #include <Core/ApplicationPool/Pool/GeneralUtils.cpp>
 #include <Core/ApplicationPool/Pool/GroupUtils.cpp>
 #include <Core/ApplicationPool/Pool/ProcessUtils.cpp>
@@ -93,7 +94,9 @@ copyException(const tracable_exception &e) {
 	TRY_COPY_EXCEPTION(ConfigurationException);
 
 	TRY_COPY_EXCEPTION(RequestQueueFullException);
+	TRY_COPY_EXCEPTION(RequestQueueTimeoutException);
 	TRY_COPY_EXCEPTION(GetAbortedException);
+	TRY_COPY_EXCEPTION(SpawnCircuitOpenException);
 	TRY_COPY_EXCEPTION(SpawnException);
 
 	TRY_COPY_EXCEPTION(InvalidModeStringException);
@@ -134,8 +137,10 @@ rethrowException(const ExceptionPtr &e) {
 
 	TRY_RETHROW_EXCEPTION(ConfigurationException);
 
+	TRY_RETHROW_EXCEPTION(SpawnCircuitOpenException);
 	TRY_RETHROW_EXCEPTION(SpawnException);
 	TRY_RETHROW_EXCEPTION(RequestQueueFullException);
+	TRY_RETHROW_EXCEPTION(RequestQueueTimeoutException);
 	TRY_RETHROW_EXCEPTION(GetAbortedException);
 
 	TRY_RETHROW_EXCEPTION(InvalidModeStringException);
@@ -323,6 +328,35 @@ recreateString(psg_pool_t *pool, StaticString &str) {
 	str = psg_pstrdup(pool, str);
 }
 
+RoutingPolicy
+parseRoutingPolicy(const StaticString &name) {
+	if (name.empty() || name == P_STATIC_STRING("least_busy")) {
+		return RP_LEAST_BUSY;
+	} else if (name == P_STATIC_STRING("least_latency")) {
+		return RP_LEAST_LATENCY;
+	} else if (name == P_STATIC_STRING("power_of_two_choices")) {
+		return RP_POWER_OF_TWO_CHOICES;
+	} else {
+		P_WARN("Unknown routing policy '" << name << "', using 'least_busy' instead");
+		return RP_LEAST_BUSY;
+	}
+}
+
+const char *
+getRoutingPolicyName(RoutingPolicy policy) {
+	switch (policy) {
+	case RP_LEAST_BUSY:
+		return "least_busy";
+	case RP_LEAST_LATENCY:
+		return "least_latency";
+	case RP_POWER_OF_TWO_CHOICES:
+		return "power_of_two_choices";
+	default:
+		P_BUG("Unknown routing policy " << (int) policy);
+		return NULL;
+	}
+}
+
 
 void
 Session::requestOOBW() {
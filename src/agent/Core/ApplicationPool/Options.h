@@ -117,6 +117,8 @@ private:
 		result.push_back(&options.hostName);
 		result.push_back(&options.uri);
 		result.push_back(&options.unionStationKey);
+		result.push_back(&options.routingPolicy);
+		result.push_back(&options.warmupUrls);
 
 		return result;
 	}
@@ -358,18 +360,116 @@ public:
 	 */
 	unsigned int maxOutOfBandWorkInstances;
 
+	/**
+	 * The maximum number of processes inside a group that may be spawned
+	 * at the same time. The pool may impose a lower limit; see
+	 * `Pool::setMaxConcurrentSpawns()`.
+	 */
+	unsigned int spawnConcurrency;
+
 	/**
 	 * The maximum number of requests that may live in the Group.getWaitlist queue.
 	 * A value of 0 means unlimited.
 	 */
 	unsigned int maxRequestQueueSize;
 
+	/**
+	 * The maximum time (in milliseconds) that a request may wait in the
+	 * getWaitlist queues, counted from `currentTime`. Requests that wait longer
+	 * are dropped with a RequestQueueTimeoutException.
+	 * A value of 0 means unlimited.
+	 */
+	unsigned int maxRequestQueueTime;
+
+	/**
+	 * Whether the Group.getWaitlist queue should switch from FIFO to LIFO
+	 * (within a priority class) while it's at least half full. Under overload,
+	 * this serves fresh requests before requests whose clients have probably
+	 * given up already. Only has effect if `maxRequestQueueSize` is non-zero.
+	 */
+	bool adaptiveLifo;
+
 	/**
 	 * Whether websocket connections should be aborted on process shutdown
 	 * or restart.
 	 */
 	bool abortWebsocketsOnProcessShutdown;
 
+	/**
+	 * Whether the number of concurrent requests that each process is given
+	 * should adapt to the process's response times, instead of always being
+	 * the concurrency that the process reported. See
+	 * `Process::enableAdaptiveConcurrency()`.
+	 */
+	bool adaptiveConcurrency;
+
+	/**
+	 * Whether to spawn processes ahead of time, based on a forecast of the
+	 * request arrival rate and of how long requests hold on to a process,
+	 * instead of only when requests would otherwise have to queue.
+	 * See `Group::predictedProcessCount()`.
+	 */
+	bool predictiveSpawning;
+
+	/**
+	 * Newly spawned processes start with a routing weight of
+	 * `warmupInitialWeight` percent, which increases to 100% over the course of
+	 * `warmupRequests` requests or `warmupTime` seconds, whichever comes first.
+	 * Warm-up is disabled if both are 0. See `Process::startWarmup()`.
+	 */
+	unsigned int warmupRequests;
+	unsigned int warmupTime;
+	unsigned int warmupInitialWeight;
+
+	/**
+	 * A space-separated list of URIs (paths plus optional query strings)
+	 * that are requested from every newly spawned process before it is
+	 * attached to the group, in order to warm it up.
+	 */
+	StaticString warmupUrls;
+
+	/**
+	 * The maximum amount of real memory (see `ProcessMetrics::realMemory()`)
+	 * in MB that a process may use. Processes that use more are gracefully
+	 * disabled and replaced. 0 means unlimited.
+	 */
+	unsigned int memoryLimit;
+
+	/**
+	 * After this many consecutive spawn failures, the group's circuit breaker
+	 * opens: spawning is suspended for an exponentially increasing amount of
+	 * time, and requests that would have to wait for a process fail
+	 * immediately with the last spawn error instead. 0 disables the circuit
+	 * breaker.
+	 */
+	unsigned int circuitBreakerThreshold;
+
+	/**
+	 * The number of fully initialized processes that a smart spawner keeps
+	 * forked off its preloader, idle, so that spawn requests can be
+	 * satisfied without waiting for a fork and a startup negotiation.
+	 * The reserve is refilled in the background. 0 disables the reserve.
+	 * Only has effect for smart spawning.
+	 */
+	unsigned int spawnReserveSize;
+
+	/**
+	 * Processes forked off a preloader share memory with it until they
+	 * write to it. If the average percentage of shared memory of a group's
+	 * processes drops below this value, then the preloader is restarted and
+	 * the existing processes are gradually replaced by processes forked off
+	 * the new preloader. 0 disables re-preloading. Only has effect for
+	 * smart spawning.
+	 */
+	unsigned int repreloadThreshold;
+
+	/**
+	 * The policy that Group uses for choosing which enabled process to route
+	 * a request to: "least_busy", "least_latency" or "power_of_two_choices".
+	 * See `RoutingPolicy` for details. An empty value means "least_busy".
+	 */
+	StaticString routingPolicy;
+
 	/**
 	 * The Union Station key to use in case analytics logging is enabled.
 	 * It is used by Pool::collectAnalytics() and other administrative
@@ -415,6 +515,13 @@ public:
 	 */
 	unsigned int stickySessionId;
 
+	/**
+	 * The priority class of this request. If the request has to wait in
+	 * Group.getWaitlist, then it is served before all waiting requests
+	 * with a lower priority.
+	 */
+	int priority;
+
 	/**
 	 * A throttling rate for file stats. When set to a non-zero value N,
 	 * restart.txt and other files which are usually stat()ted on every
@@ -494,10 +601,23 @@ public:
 		  maxProcesses(0),
 		  maxPreloaderIdleTime(-1),
 		  maxOutOfBandWorkInstances(1),
+		  spawnConcurrency(1),
 		  maxRequestQueueSize(100),
+		  maxRequestQueueTime(0),
+		  adaptiveLifo(false),
 		  abortWebsocketsOnProcessShutdown(true),
+		  adaptiveConcurrency(false),
+		  predictiveSpawning(false),
+		  warmupRequests(0),
+		  warmupTime(0),
+		  warmupInitialWeight(10),
+		  memoryLimit(0),
+		  circuitBreakerThreshold(0),
+		  spawnReserveSize(0),
+		  repreloadThreshold(0),
 
 		  stickySessionId(0),
+		  priority(0),
 		  statThrottleRate(DEFAULT_STAT_THROTTLE_RATE),
 		  maxRequests(0),
 		  currentTime(0),
@@ -571,6 +691,7 @@ public:
 		hostName = StaticString();
 		uri      = StaticString();
 		stickySessionId = 0;
+		priority        = 0;
 		currentTime     = 0;
 		noop     = false;
 		return detachFromUnionStationTransaction();
@@ -633,6 +754,18 @@ public:
 			appendKeyValue3(vec, "max_processes",       maxProcesses);
 			appendKeyValue2(vec, "max_preloader_idle_time", maxPreloaderIdleTime);
 			appendKeyValue3(vec, "max_out_of_band_work_instances", maxOutOfBandWorkInstances);
+			appendKeyValue3(vec, "spawn_concurrency",   spawnConcurrency);
+			appendKeyValue (vec, "routing_policy",      routingPolicy);
+			appendKeyValue4(vec, "adaptive_concurrency", adaptiveConcurrency);
+			appendKeyValue4(vec, "predictive_spawning", predictiveSpawning);
+			appendKeyValue3(vec, "warmup_requests",     warmupRequests);
+			appendKeyValue3(vec, "warmup_time",         warmupTime);
+			appendKeyValue3(vec, "warmup_initial_weight", warmupInitialWeight);
+			appendKeyValue (vec, "warmup_urls",         warmupUrls);
+			appendKeyValue3(vec, "memory_limit",        memoryLimit);
+			appendKeyValue3(vec, "circuit_breaker_threshold", circuitBreakerThreshold);
+			appendKeyValue3(vec, "spawn_reserve_size",  spawnReserveSize);
+			appendKeyValue3(vec, "repreload_threshold", repreloadThreshold);
 		}
 		if ((fields & SPAWN_OPTIONS) || (fields & PER_GROUP_POOL_OPTIONS)) {
 			appendKeyValue (vec, "union_station_key",   unionStationKey);
@@ -670,7 +803,8 @@ public:
 
 	string getStartCommand(const ResourceLocator &resourceLocator) const {
 		if (appType == P_STATIC_STRING("rack")) {
-			return ruby + "\t" + resourceLocator.getHelperScriptsDir() + "/rack-loader.rb";
+			return ruby + "\t" + resourceLocator.getHelperScriptsDir() + "/rack-loader.rb"
+				+ "\t" + resourceLocator.getRubyLibDir();
 		} else if (appType == P_STATIC_STRING("wsgi")) {
 			return python + "\t" + resourceLocator.getHelperScriptsDir() + "/wsgi-loader.py";
 		} else if (appType == P_STATIC_STRING("node")) {
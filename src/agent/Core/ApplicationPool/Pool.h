@@ -151,6 +151,66 @@ public:
 		}
 	};
 
+	/** The renderings of the group state that a StateSnapshot may contain. */
+	enum StateSnapshotVariant {
+		SSV_TEXT = 1,
+		SSV_VERBOSE_TEXT = 2,
+		SSV_XML = 4,
+		SSV_XML_WITH_SECRETS = 8,
+		SSV_SPAWN_TIMINGS = 16,
+		SSV_COLORIZED_TEXT = 32,
+		SSV_COLORIZED_VERBOSE_TEXT = 64
+	};
+
+	/**
+	 * An immutable copy of the state that `inspect()` and `toXml()` output.
+	 * The groups are rendered when the snapshot is created, in the variants
+	 * given by `variants`, so that rendering the snapshot for a particular
+	 * client only involves authorization checks and concatenation.
+	 *
+	 * The pool publishes snapshots on behalf of the ApiServer, see
+	 * `getStateSnapshot()`.
+	 */
+	struct StateSnapshot {
+		struct GroupState {
+			string name;
+			uid_t uid;
+			ApiKey apiKey;
+			string text;
+			string verboseText;
+			string colorizedText;
+			string colorizedVerboseText;
+			string xml;
+			string xmlWithSecrets;
+			Json::Value spawnTimings;
+
+			bool authorizeByUid(uid_t uid) const;
+			bool authorizeByApiKey(const ApiKey &key) const;
+			const string &textFor(const InspectOptions &options) const;
+		};
+
+		/** Increases with every published snapshot. 0 if not published. */
+		unsigned long long version;
+		/** When the creation of this snapshot started. */
+		unsigned long long time;
+		unsigned int variants;
+		unsigned int max;
+		unsigned int processCount;
+		unsigned int capacityUsed;
+		vector<string> getWaitlist;
+		vector<GroupState> groups;
+
+		static unsigned int variantFor(const InspectOptions &options);
+		static unsigned int variantFor(const ToXmlOptions &options);
+		bool authorizeByUid(uid_t uid) const;
+		bool authorizeByApiKey(const ApiKey &key) const;
+		string inspect(const InspectOptions &options) const;
+		string toXml(const ToXmlOptions &options) const;
+		string spawnTimingsToJson(const AuthenticationOptions &options) const;
+	};
+
+	typedef boost::shared_ptr<const StateSnapshot> StateSnapshotPtr;
+
 
 // Actually private, but marked public so that unit tests can access the fields.
 public:
@@ -158,7 +218,20 @@ public:
 	friend class Process;
 	friend struct tut::ApplicationPool2_PoolTest;
 
-	mutable boost::mutex syncher;
+	/**
+	 * Protects all pool state. Anything that changes the structure of the pool
+	 * (creating or detaching groups, attaching or detaching processes, spawning,
+	 * restarting, get wait lists) locks it exclusively.
+	 *
+	 * Checking out a session from an existing group, and closing a session, are
+	 * by far the most frequent operations. When they don't require structural
+	 * changes they only lock `syncher` in shared mode, in combination with the
+	 * group's `routingSyncher`. See `getFromGroupQuickly()` and
+	 * `Group::onSessionCloseQuickly()`. So requests for different groups are
+	 * routed concurrently, and requests for the same group only contend on that
+	 * group's lock.
+	 */
+	mutable boost::shared_mutex syncher;
 	unsigned int max;
 	unsigned long long maxIdleTime;
 	bool selfchecking;
@@ -225,6 +298,20 @@ public:
 	 */
 	vector<GetWaiter> getWaitlist;
 
+	/**
+	 * Limits the number of processes that may be spawned at the same time,
+	 * over all groups, so that groups that spawn in parallel (see
+	 * `Options::spawnConcurrency`) can't overload the machine. A
+	 * `maxConcurrentSpawns` of 0 means unlimited.
+	 *
+	 * These fields are protected by `spawnSlotsSyncher` instead of `syncher`,
+	 * because spawner threads wait for a slot without holding the pool lock.
+	 */
+	boost::mutex spawnSlotsSyncher;
+	boost::condition_variable spawnSlotsCond;
+	unsigned int maxConcurrentSpawns;
+	unsigned int concurrentSpawns;
+
 	const VariantMap *agentsOptions;
 
 // Actually private, but marked public so that unit tests can access the fields.
@@ -279,10 +366,27 @@ public:
 
 	void initializeAnalyticsCollection();
 	static void collectAnalytics(PoolPtr self);
-	static void collectPids(const ProcessList &processes, vector<pid_t> &pids);
+	static bool shouldCollectProcessMetrics(const Process *process,
+		unsigned long long now);
+	static void collectPids(const ProcessList &processes, vector<pid_t> &pids,
+		unsigned long long now);
 	static void updateProcessMetrics(const ProcessList &processes,
-		const ProcessMetricMap &allMetrics,
+		const ProcessMetricMap &allMetrics, unsigned long long now,
+		vector<ProcessPtr> &processesToDetach,
+		vector<ProcessPtr> &processesOverMemoryLimit);
+	void disableProcessOverMemoryLimit(const ProcessPtr &process,
 		vector<ProcessPtr> &processesToDetach);
+	static void discardReservedProcessesOverMemoryLimit(const GroupPtr &group,
+		const ProcessMetricMap &allMetrics);
+	void maybeRepreload(const GroupPtr &group, unsigned long long now,
+		vector<ProcessPtr> &processesToReplace,
+		boost::container::vector<Callback> &actions);
+	void replaceProcessForRepreload(const ProcessPtr &process,
+		vector<ProcessPtr> &processesToDetach);
+	DisableResult disableAndDetachProcess(const ProcessPtr &process,
+		vector<ProcessPtr> &processesToDetach);
+	void lockAndDetachDisabledProcess(const ProcessPtr &process,
+		DisableResult result, PoolPtr self);
 	void prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntries,
 		const GroupPtr &group) const;
 	void prepareUnionStationSystemMetricsLogs(vector<UnionStationLogEntry> &logEntries,
@@ -298,11 +402,14 @@ public:
 		boost::container::vector<Callback> actions;
 	};
 
-	boost::condition_variable garbageCollectionCond;
+	boost::condition_variable_any garbageCollectionCond;
+	/** When the garbage collector runs next, in microseconds, or 0 if it
+	 * hasn't been scheduled yet. Protected by `syncher`. */
+	unsigned long long nextGarbageCollectionTime;
 
 	void initializeGarbageCollection();
 	static void garbageCollect(PoolPtr self);
-	void maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candidate);
+	void maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long long candidate);
 	void checkWhetherProcessCanBeGarbageCollected(GarbageCollectorState &state,
 		const GroupPtr &group, const ProcessPtr &process, ProcessList &output);
 	void garbageCollectProcessesInGroup(GarbageCollectorState &state,
@@ -310,6 +417,7 @@ public:
 	void maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group);
 	unsigned long long realGarbageCollect();
 	void wakeupGarbageCollector();
+	void wakeupGarbageCollectorBefore(unsigned long long time);
 
 
 	/****** General utilities ******/
@@ -327,8 +435,19 @@ public:
 	template<typename Queue> static void assignExceptionToGetWaiters(Queue &getWaitlist,
 		const ExceptionPtr &exception,
 		boost::container::vector<Callback> &postLockActions);
+	template<typename Queue> static unsigned long long dropExpiredGetWaiters(
+		Queue &getWaitlist, unsigned long long now,
+		boost::container::vector<Callback> &postLockActions);
 	static void syncGetCallback(const AbstractSessionPtr &session, const ExceptionPtr &e,
 		void *userData);
+	SessionPtr getFromGroupQuickly(Group *group, const Options &options,
+		UnionStation::StopwatchLog **stopwatchLog);
+	bool asyncGetFromExistingGroupQuickly(const Options &options, const GetCallback &callback,
+		UnionStation::StopwatchLog **stopwatchLog);
+	UnionStation::StopwatchLog *createGetStopwatchLog(const Options &options,
+		const Group *existingGroup) const;
+	void acquireSpawnSlot();
+	void releaseSpawnSlot();
 
 
 	/****** Group data structure utilities ******/
@@ -383,8 +502,39 @@ public:
 
 	unsigned int capacityUsedUnlocked() const;
 	bool atFullCapacityUnlocked() const;
+	void updateSpawnReserveLimits();
 	void inspectProcessList(const InspectOptions &options, stringstream &result,
 		const Group *group, const ProcessList &processes) const;
+	void inspectGroup(const InspectOptions &options, stringstream &result,
+		const Group *group) const;
+	void groupToXml(const ToXmlOptions &options, stringstream &result,
+		const Group *group) const;
+	boost::shared_ptr<StateSnapshot> createStateSnapshot(unsigned int variants,
+		bool lock) const;
+
+
+	/****** State snapshot publishing ******/
+
+	/**
+	 * Protects the fields below, except `stateSnapshot`. These are not
+	 * protected by `syncher` so that ApiServer clients never have to wait
+	 * for the pool lock.
+	 */
+	boost::mutex stateSnapshotSyncher;
+	boost::condition_variable stateSnapshotCond;
+	/** The last published snapshot. Only accessed through
+	 * `boost::atomic_load()` and `boost::atomic_store()`. */
+	StateSnapshotPtr stateSnapshot;
+	/** The variants that have ever been requested. Every published
+	 * snapshot contains all of them. */
+	unsigned int stateSnapshotVariants;
+	bool stateSnapshotRequested;
+	/** Snapshots that are younger than this (in microseconds) are handed
+	 * out without publishing a new one. */
+	unsigned long long stateSnapshotMaxAge;
+
+	void initializeStateSnapshotPublishing();
+	static void publishStateSnapshots(PoolPtr self);
 
 public:
 	typedef void (*AbortLongRunningConnectionsCallback)(const ProcessPtr &process);
@@ -413,6 +563,7 @@ public:
 	/****** Group manipulation ******/
 
 	GroupPtr findOrCreateGroup(const Options &options);
+	GroupPtr findGroupByName(const StaticString &name) const;
 	GroupPtr findGroupByApiKey(const StaticString &value, bool lock = true) const;
 	bool detachGroupByName(const HashedStaticString &name);
 	bool detachGroupByApiKey(const StaticString &value);
@@ -445,14 +596,21 @@ public:
 		bool lock = true) const;
 	string toXml(const ToXmlOptions &options = ToXmlOptions::makeAuthorized(),
 		bool lock = true) const;
+	StateSnapshotPtr getStateSnapshot(unsigned int variants);
+	string inspectFromSnapshot(const InspectOptions &options);
+	string toXmlFromSnapshot(const ToXmlOptions &options);
+	string spawnTimingsToJsonFromSnapshot(const AuthenticationOptions &options);
 
 
 	/****** Miscellaneous ******/
 
 	void asyncGet(const Options &options, const GetCallback &callback, bool lockNow = true, UnionStation::StopwatchLog **stopwatchLog = NULL);
+	bool asyncGetFromGroupQuickly(const GroupPtr &group, const Options &options,
+		const GetCallback &callback, UnionStation::StopwatchLog **stopwatchLog = NULL);
 	SessionPtr get(const Options &options, Ticket *ticket);
 	void setMax(unsigned int max);
 	void setMaxIdleTime(unsigned long long value);
+	void setMaxConcurrentSpawns(unsigned int value);
 	void enableSelfChecking(bool enabled);
 	bool isSpawning(bool lock = true) const;
 	bool authorizeByApiKey(const ApiKey &key, bool lock = true) const;
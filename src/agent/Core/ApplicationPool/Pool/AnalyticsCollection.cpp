@@ -77,23 +77,57 @@ Pool::collectAnalytics(PoolPtr self) {
 	}
 }
 
+/**
+ * Sampling every process on every run is expensive on servers with hundreds
+ * of processes, so we only sample the ones that may have changed since the
+ * last time: those that handled requests in the meantime or that are still
+ * handling requests. Idle processes are refreshed once a minute.
+ */
+bool
+Pool::shouldCollectProcessMetrics(const Process *process, unsigned long long now) {
+	return !process->metrics.isValid()
+		|| process->processed != process->metricsCollectionProcessed
+		|| process->sessions > 0
+		|| now >= process->metricsCollectionTime + 60 * 1000000;
+}
+
 void
-Pool::collectPids(const ProcessList &processes, vector<pid_t> &pids) {
+Pool::collectPids(const ProcessList &processes, vector<pid_t> &pids,
+	unsigned long long now)
+{
 	foreach (const ProcessPtr &process, processes) {
-		pids.push_back(process->getPid());
+		if (shouldCollectProcessMetrics(process.get(), now)) {
+			process->metricsCollectionTime = now;
+			process->metricsCollectionProcessed = process->processed;
+			pids.push_back(process->getPid());
+		}
 	}
 }
 
 void
 Pool::updateProcessMetrics(const ProcessList &processes,
-	const ProcessMetricMap &allMetrics,
-	vector<ProcessPtr> &processesToDetach)
+	const ProcessMetricMap &allMetrics, unsigned long long now,
+	vector<ProcessPtr> &processesToDetach,
+	vector<ProcessPtr> &processesOverMemoryLimit)
 {
 	foreach (const ProcessPtr &process, processes) {
+		if (process->metricsCollectionTime != now) {
+			// Not sampled during this run.
+			continue;
+		}
+
 		ProcessMetricMap::const_iterator metrics_it =
 			allMetrics.find(process->getPid());
 		if (metrics_it != allMetrics.end()) {
+			const Options &options = process->getGroup()->options;
 			process->metrics = metrics_it->second;
+			if (options.memoryLimit > 0
+			 && process->enabled == Process::ENABLED
+			 && !process->isDummy()
+			 && process->metrics.realMemory() > (size_t) options.memoryLimit * 1024)
+			{
+				processesOverMemoryLimit.push_back(process);
+			}
 		// If the process is missing from 'allMetrics' then either 'ps'
 		// failed or the process really is gone. We double check by sending
 		// it a signal.
@@ -105,6 +139,193 @@ Pool::updateProcessMetrics(const ProcessList &processes,
 	}
 }
 
+/**
+ * Gracefully replaces a process that uses more memory than the memory limit.
+ */
+void
+Pool::disableProcessOverMemoryLimit(const ProcessPtr &process,
+	vector<ProcessPtr> &processesToDetach)
+{
+	Group *group = process->getGroup();
+
+	P_WARN("Process " << process->inspect() << " uses " <<
+		process->metrics.realMemory() / 1024 << " MB of memory, which exceeds " <<
+		"the memory limit of " << group->options.memoryLimit << " MB. " <<
+		"Shutting it down gracefully.");
+	DisableResult result = disableAndDetachProcess(process, processesToDetach);
+	if (result == DR_ERROR || result == DR_NOOP) {
+		P_WARN("Process " << process->inspect() << " could not be disabled; " <<
+			"it will not be shut down despite exceeding the memory limit");
+	}
+}
+
+/**
+ * Processes in the spawn reserve aren't part of the group yet, so they can't
+ * be disabled gracefully. They don't handle requests either, so they're
+ * simply removed from the reserve and shut down.
+ */
+void
+Pool::discardReservedProcessesOverMemoryLimit(const GroupPtr &group,
+	const ProcessMetricMap &allMetrics)
+{
+	const Options &options = group->options;
+	if (group->spawner == NULL || options.memoryLimit == 0) {
+		return;
+	}
+
+	vector<pid_t> reservedPids;
+	group->spawner->getReservedPids(reservedPids);
+	foreach (pid_t pid, reservedPids) {
+		ProcessMetricMap::const_iterator metrics_it = allMetrics.find(pid);
+		if (metrics_it != allMetrics.end()
+		 && metrics_it->second.realMemory() > (size_t) options.memoryLimit * 1024)
+		{
+			P_WARN("Process " << pid << " in the spawn reserve of group " <<
+				group->getName() << " uses " << metrics_it->second.realMemory() / 1024 <<
+				" MB of memory, which exceeds the memory limit of " <<
+				options.memoryLimit << " MB. Shutting it down.");
+			group->spawner->discardFromReserve(pid);
+		}
+	}
+}
+
+/**
+ * Processes forked off a preloader share memory with it until they write to
+ * it, so sharing degrades as they age. If the average shared percentage of
+ * the group's enabled processes drops below `options.repreloadThreshold`,
+ * then the preloader is restarted, at most once every
+ * `Group::minRepreloadInterval()`. On subsequent runs, processes that were
+ * spawned before the restart and that are below the threshold are added
+ * to `processesToReplace`, worst first, one per run, so that the group
+ * doesn't lose all its capacity at once.
+ */
+void
+Pool::maybeRepreload(const GroupPtr &group, unsigned long long now,
+	vector<ProcessPtr> &processesToReplace,
+	boost::container::vector<Callback> &actions)
+{
+	const Options &options = group->options;
+	if (options.repreloadThreshold == 0 || !group->spawner->cleanable()) {
+		return;
+	}
+
+	unsigned long long totalPercentage = 0;
+	unsigned int count = 0;
+	ProcessPtr worstStaleProcess;
+	int worstStalePercentage = 0;
+
+	foreach (const ProcessPtr &process, group->enabledProcesses) {
+		int percentage = process->metrics.sharedPercentage();
+		if (percentage == -1) {
+			continue;
+		}
+		totalPercentage += percentage;
+		count++;
+		if (process->getSpawnStartTime() < group->lastRepreloadTime
+		 && percentage < (int) options.repreloadThreshold
+		 && (worstStaleProcess == NULL || percentage < worstStalePercentage))
+		{
+			worstStaleProcess = process;
+			worstStalePercentage = percentage;
+		}
+	}
+	if (count == 0) {
+		return;
+	}
+
+	unsigned int averagePercentage = totalPercentage / count;
+	if (averagePercentage < options.repreloadThreshold
+	 && (group->lastRepreloadTime == 0
+	  || now >= group->lastRepreloadTime + Group::minRepreloadInterval()))
+	{
+		P_NOTICE("The processes of group " << group->getName() << " share " <<
+			averagePercentage << "% of their memory on average, which is less " <<
+			"than the re-preload threshold of " << options.repreloadThreshold <<
+			"%. Restarting the preloader.");
+		group->lastRepreloadTime = now;
+		group->cleanupSpawner(actions);
+	} else if (worstStaleProcess != NULL) {
+		processesToReplace.push_back(worstStaleProcess);
+	}
+}
+
+/**
+ * Gracefully replaces a process that was spawned before its group's
+ * preloader was restarted by maybeRepreload().
+ */
+void
+Pool::replaceProcessForRepreload(const ProcessPtr &process,
+	vector<ProcessPtr> &processesToDetach)
+{
+	if (process->enabled != Process::ENABLED) {
+		// Already being replaced, e.g. because of the memory limit.
+		return;
+	}
+
+	P_INFO("Process " << process->inspect() << " shares " <<
+		process->metrics.sharedPercentage() << "% of its memory and was " <<
+		"spawned before the preloader was restarted. Shutting it down " <<
+		"gracefully so that it's replaced by a process forked off the " <<
+		"new preloader.");
+	disableAndDetachProcess(process, processesToDetach);
+}
+
+/**
+ * Disables a process so that it can finish its current requests, and then
+ * detaches it. Detaching it causes a replacement to be spawned if necessary.
+ * If the process could be disabled immediately then it's added to
+ * `processesToDetach`, otherwise it's detached once disabling has finished.
+ */
+DisableResult
+Pool::disableAndDetachProcess(const ProcessPtr &process,
+	vector<ProcessPtr> &processesToDetach)
+{
+	DisableResult result = process->getGroup()->disable(process,
+		boost::bind(&Pool::lockAndDetachDisabledProcess, this,
+			_1, _2, shared_from_this()));
+	switch (result) {
+	case DR_SUCCESS:
+		processesToDetach.push_back(process);
+		break;
+	case DR_DEFERRED:
+		// lockAndDetachDisabledProcess() will eventually be called.
+		break;
+	case DR_ERROR:
+	case DR_NOOP:
+		break;
+	default:
+		P_BUG("Unexpected disable() result " << result);
+	}
+	return result;
+}
+
+// The 'self' parameter is for keeping the current Pool object alive
+void
+Pool::lockAndDetachDisabledProcess(const ProcessPtr &process,
+	DisableResult result, PoolPtr self)
+{
+	TRACE_POINT();
+	boost::container::vector<Callback> actions;
+	ExclusiveScopedLock l(syncher);
+
+	if (OXT_UNLIKELY(!process->isAlive() || !process->getGroup()->isAlive())) {
+		return;
+	}
+
+	if (result == DR_SUCCESS && process->enabled == Process::DISABLED) {
+		P_DEBUG("Process " << process->inspect() << " disabled; detaching it");
+		detachProcessUnlocked(process, actions);
+	} else {
+		// We do not detach the process because it's likely that the
+		// administrator has explicitly changed the state.
+		P_DEBUG("Graceful shutdown of process " << process->inspect() <<
+			" aborted because the process was not disabled");
+	}
+
+	l.unlock();
+	runAllActions(actions);
+}
+
 void
 Pool::prepareUnionStationProcessStateLogs(vector<UnionStationLogEntry> &logEntries,
 	const GroupPtr &group) const
@@ -153,25 +374,29 @@ Pool::realCollectAnalytics() {
 	boost::this_thread::disable_syscall_interruption dsi;
 	vector<pid_t> pids;
 	unsigned int max;
+	unsigned long long now = SystemTime::getUsec();
 
 	P_DEBUG("Analytics collection time...");
 	// Collect all the PIDs.
 	{
 		UPDATE_TRACE_POINT();
-		LockGuard l(syncher);
+		ExclusiveLockGuard l(syncher);
 		max = this->max;
 	}
 	pids.reserve(max);
 	{
 		UPDATE_TRACE_POINT();
-		LockGuard l(syncher);
+		ExclusiveLockGuard l(syncher);
 		GroupMap::ConstIterator g_it(groups);
 
 		while (*g_it != NULL) {
 			const GroupPtr &group = g_it.getValue();
-			collectPids(group->enabledProcesses, pids);
-			collectPids(group->disablingProcesses, pids);
-			collectPids(group->disabledProcesses, pids);
+			collectPids(group->enabledProcesses, pids, now);
+			collectPids(group->disablingProcesses, pids, now);
+			collectPids(group->disabledProcesses, pids, now);
+			if (group->spawner != NULL && group->options.memoryLimit > 0) {
+				group->spawner->getReservedPids(pids);
+			}
 			g_it.next();
 		}
 	}
@@ -181,8 +406,9 @@ Pool::realCollectAnalytics() {
 	ProcessMetricMap processMetrics;
 	try {
 		UPDATE_TRACE_POINT();
-		P_DEBUG("Collecting process metrics");
-		processMetrics = ProcessMetricsCollector().collect(pids);
+		P_DEBUG("Collecting metrics of " << pids.size() << " processes");
+		ProcessMetricsCollector collector;
+		processMetrics = collector.collect(pids);
 	} catch (const ParseException &) {
 		P_WARN("Unable to collect process metrics: cannot parse 'ps' output.");
 		return;
@@ -200,21 +426,36 @@ Pool::realCollectAnalytics() {
 		UPDATE_TRACE_POINT();
 		vector<UnionStationLogEntry> logEntries;
 		vector<ProcessPtr> processesToDetach;
+		vector<ProcessPtr> processesOverMemoryLimit;
+		vector<ProcessPtr> processesToReplace;
 		boost::container::vector<Callback> actions;
-		ScopedLock l(syncher);
+		ExclusiveScopedLock l(syncher);
 		GroupMap::ConstIterator g_it(groups);
 
 		UPDATE_TRACE_POINT();
 		while (*g_it != NULL) {
 			const GroupPtr &group = g_it.getValue();
-			updateProcessMetrics(group->enabledProcesses, processMetrics, processesToDetach);
-			updateProcessMetrics(group->disablingProcesses, processMetrics, processesToDetach);
-			updateProcessMetrics(group->disabledProcesses, processMetrics, processesToDetach);
+			updateProcessMetrics(group->enabledProcesses, processMetrics, now,
+				processesToDetach, processesOverMemoryLimit);
+			updateProcessMetrics(group->disablingProcesses, processMetrics, now,
+				processesToDetach, processesOverMemoryLimit);
+			updateProcessMetrics(group->disabledProcesses, processMetrics, now,
+				processesToDetach, processesOverMemoryLimit);
+			discardReservedProcessesOverMemoryLimit(group, processMetrics);
+			maybeRepreload(group, now, processesToReplace, actions);
 			prepareUnionStationProcessStateLogs(logEntries, group);
 			prepareUnionStationSystemMetricsLogs(logEntries, group);
 			g_it.next();
 		}
 
+		UPDATE_TRACE_POINT();
+		foreach (const ProcessPtr &process, processesOverMemoryLimit) {
+			disableProcessOverMemoryLimit(process, processesToDetach);
+		}
+		foreach (const ProcessPtr &process, processesToReplace) {
+			replaceProcessForRepreload(process, processesToDetach);
+		}
+
 		UPDATE_TRACE_POINT();
 		foreach (const ProcessPtr process, processesToDetach) {
 			detachProcessUnlocked(process, actions);
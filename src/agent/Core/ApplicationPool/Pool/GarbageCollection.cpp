@@ -51,18 +51,31 @@ void
 Pool::garbageCollect(PoolPtr self) {
 	TRACE_POINT();
 	{
-		ScopedLock lock(self->syncher);
-		self->garbageCollectionCond.timed_wait(lock,
-			posix_time::seconds(5));
+		ExclusiveScopedLock lock(self->syncher);
+		unsigned long long now = SystemTime::getUsec();
+		if (self->nextGarbageCollectionTime == 0
+		 || self->nextGarbageCollectionTime > now + 5000000)
+		{
+			self->nextGarbageCollectionTime = now + 5000000;
+		}
+		if (self->nextGarbageCollectionTime > now) {
+			self->garbageCollectionCond.timed_wait(lock,
+				posix_time::microseconds(self->nextGarbageCollectionTime - now));
+		}
 	}
 	while (!this_thread::interruption_requested()) {
 		try {
 			UPDATE_TRACE_POINT();
-			unsigned long long sleepTime = self->realGarbageCollect();
+			self->realGarbageCollect();
 			UPDATE_TRACE_POINT();
-			ScopedLock lock(self->syncher);
-			self->garbageCollectionCond.timed_wait(lock,
-				posix_time::microseconds(sleepTime));
+			ExclusiveScopedLock lock(self->syncher);
+			// Someone may have moved the next run forward while we
+			// didn't hold the lock.
+			unsigned long long now = SystemTime::getUsec();
+			if (self->nextGarbageCollectionTime > now) {
+				self->garbageCollectionCond.timed_wait(lock,
+					posix_time::microseconds(self->nextGarbageCollectionTime - now));
+			}
 		} catch (const thread_interrupted &) {
 			break;
 		} catch (const tracable_exception &e) {
@@ -72,7 +85,7 @@ Pool::garbageCollect(PoolPtr self) {
 }
 
 void
-Pool::maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long candidate) {
+Pool::maybeUpdateNextGcRuntime(GarbageCollectorState &state, unsigned long long candidate) {
 	if (state.nextGcRunTime == 0 || candidate < state.nextGcRunTime) {
 		state.nextGcRunTime = candidate;
 	}
@@ -110,10 +123,19 @@ Pool::garbageCollectProcessesInGroup(GarbageCollectorState &state,
 			processesToGc);
 	}
 
+	/* Keep the processes that the predicted demand calls for. This asks
+	 * for more headroom than Group::shouldPreSpawn(), so that processes
+	 * spawned ahead of time aren't garbage collected as soon as the
+	 * demand dips a little.
+	 */
+	group->demandPredictor.tick(state.now);
+	unsigned long minProcesses = std::max<unsigned long>(group->options.minProcesses,
+		group->predictedProcessCount(1.5));
+
 	p_it  = processesToGc.begin();
 	p_end = processesToGc.end();
 	while (p_it != p_end
-	 && (unsigned long) group->getProcessCount() > group->options.minProcesses)
+	 && (unsigned long) group->getProcessCount() > minProcesses)
 	{
 		ProcessPtr process = *p_it;
 		P_DEBUG("Garbage collect idle process: " << process->inspect() <<
@@ -121,6 +143,16 @@ Pool::garbageCollectProcessesInGroup(GarbageCollectorState &state,
 		group->detach(process, state.actions);
 		p_it++;
 	}
+	unsigned long kept = 0;
+	while (p_it != p_end
+	 && (unsigned long) group->getProcessCount() - kept > group->options.minProcesses)
+	{
+		P_DEBUG("Keeping idle process " << (*p_it)->inspect() <<
+			" because of the predicted demand, group=" << group->getName());
+		group->idleProcessesKept++;
+		kept++;
+		p_it++;
+	}
 }
 
 void
@@ -141,7 +173,7 @@ Pool::maybeCleanPreloader(GarbageCollectorState &state, const GroupPtr &group) {
 unsigned long long
 Pool::realGarbageCollect() {
 	TRACE_POINT();
-	ScopedLock lock(syncher);
+	ExclusiveScopedLock lock(syncher);
 	GroupMap::ConstIterator g_it(groups);
 	GarbageCollectorState state;
 	state.now = SystemTime::getUsec();
@@ -150,10 +182,24 @@ Pool::realGarbageCollect() {
 	P_DEBUG("Garbage collection time...");
 	verifyInvariants();
 
+	// Drop requests that have waited for too long...
+	unsigned long long nextDeadline = dropExpiredGetWaiters(getWaitlist,
+		state.now, state.actions);
+	if (nextDeadline != 0) {
+		maybeUpdateNextGcRuntime(state, nextDeadline);
+	}
+
 	// For all groups...
 	while (*g_it != NULL) {
 		const GroupPtr group = g_it.getValue();
 
+		// ...drop requests that have waited for too long.
+		nextDeadline = dropExpiredGetWaiters(group->getWaitlist,
+			state.now, state.actions);
+		if (nextDeadline != 0) {
+			maybeUpdateNextGcRuntime(state, nextDeadline);
+		}
+
 		if (maxIdleTime > 0) {
 			// ...detach processes that have been idle for more than maxIdleTime.
 			garbageCollectProcessesInGroup(state, group);
@@ -168,7 +214,6 @@ Pool::realGarbageCollect() {
 	}
 
 	verifyInvariants();
-	lock.unlock();
 
 	// Schedule next garbage collection run.
 	unsigned long long sleepTime;
@@ -181,6 +226,9 @@ Pool::realGarbageCollect() {
 	} else {
 		sleepTime = state.nextGcRunTime - state.now;
 	}
+	nextGarbageCollectionTime = state.now + sleepTime;
+	lock.unlock();
+
 	P_DEBUG("Garbage collection done; next garbage collect in " <<
 		std::fixed << std::setprecision(3) << (sleepTime / 1000000.0) << " sec");
 
@@ -196,6 +244,19 @@ Pool::wakeupGarbageCollector() {
 	garbageCollectionCond.notify_all();
 }
 
+/**
+ * Wakes up the garbage collector unless it's already going to run at or
+ * before the given time (in microseconds), e.g. because a get waiter must be
+ * dropped at that time. The pool lock must be held exclusively.
+ */
+void
+Pool::wakeupGarbageCollectorBefore(unsigned long long time) {
+	if (nextGarbageCollectionTime == 0 || time < nextGarbageCollectionTime) {
+		nextGarbageCollectionTime = time;
+		garbageCollectionCond.notify_all();
+	}
+}
+
 
 } // namespace ApplicationPool2
 } // namespace Passenger
@@ -195,6 +195,36 @@ Pool::assignExceptionToGetWaiters(Queue &getWaitlist,
 	}
 }
 
+/**
+ * Removes the waiters whose deadline has passed from the given queue, and fails
+ * them with a RequestQueueTimeoutException. Returns the earliest deadline of
+ * the remaining waiters, or 0 if none of them has a deadline.
+ */
+template<typename Queue>
+unsigned long long
+Pool::dropExpiredGetWaiters(Queue &getWaitlist, unsigned long long now,
+	boost::container::vector<Callback> &postLockActions)
+{
+	typename Queue::iterator it = getWaitlist.begin();
+	unsigned long long nextDeadline = 0;
+
+	while (it != getWaitlist.end()) {
+		if (it->expired(now)) {
+			postLockActions.push_back(boost::bind(GetCallback::call,
+				it->callback, SessionPtr(),
+				boost::make_shared<RequestQueueTimeoutException>(
+					it->options.maxRequestQueueTime)));
+			it = getWaitlist.erase(it);
+		} else {
+			if (it->deadline != 0 && (nextDeadline == 0 || it->deadline < nextDeadline)) {
+				nextDeadline = it->deadline;
+			}
+			it++;
+		}
+	}
+	return nextDeadline;
+}
+
 void
 Pool::syncGetCallback(const AbstractSessionPtr &session, const ExceptionPtr &e,
 	void *userData)
@@ -238,5 +268,28 @@ Pool::getRandomGenerator() const {
 }
 
 
+/**
+ * Blocks until less than `maxConcurrentSpawns` processes are being spawned,
+ * then claims a spawn slot. Must not be called with `syncher` locked.
+ * This is an interruption point.
+ */
+void
+Pool::acquireSpawnSlot() {
+	boost::unique_lock<boost::mutex> l(spawnSlotsSyncher);
+	while (maxConcurrentSpawns != 0 && concurrentSpawns >= maxConcurrentSpawns) {
+		spawnSlotsCond.wait(l);
+	}
+	concurrentSpawns++;
+}
+
+void
+Pool::releaseSpawnSlot() {
+	boost::lock_guard<boost::mutex> l(spawnSlotsSyncher);
+	assert(concurrentSpawns > 0);
+	concurrentSpawns--;
+	spawnSlotsCond.notify_one();
+}
+
+
 } // namespace ApplicationPool2
 } // namespace Passenger
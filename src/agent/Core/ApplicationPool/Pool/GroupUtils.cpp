@@ -113,6 +113,7 @@ Pool::forceDetachGroup(const GroupPtr &group,
 	assert(removed);
 	(void) removed; // Shut up compiler warning.
 	group->shutdown(callback, postLockActions);
+	updateSpawnReserveLimits();
 }
 
 void
@@ -145,7 +146,7 @@ Pool::findOrCreateGroup(const Options &options) {
 
 	Ticket ticket;
 	{
-		LockGuard l(syncher);
+		ExclusiveLockGuard l(syncher);
 		GroupPtr *group;
 		if (!groups.lookup(options.getAppGroupName(), &group)) {
 			// Forcefully create Group, don't care whether resource limits
@@ -156,9 +157,20 @@ Pool::findOrCreateGroup(const Options &options) {
 	return get(options2, &ticket)->getGroup()->shared_from_this();
 }
 
+GroupPtr
+Pool::findGroupByName(const StaticString &name) const {
+	SharedScopedLock l(syncher);
+	const GroupPtr *group;
+	if (groups.lookup(name, &group)) {
+		return *group;
+	} else {
+		return GroupPtr();
+	}
+}
+
 GroupPtr
 Pool::findGroupByApiKey(const StaticString &value, bool lock) const {
-	DynamicScopedLock l(syncher, lock);
+	DynamicExclusiveScopedLock l(syncher, lock);
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
@@ -173,7 +185,7 @@ Pool::findGroupByApiKey(const StaticString &value, bool lock) const {
 bool
 Pool::detachGroupByName(const HashedStaticString &name) {
 	TRACE_POINT();
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	GroupPtr group = groups.lookupCopy(name);
 
 	if (OXT_LIKELY(group != NULL)) {
@@ -216,7 +228,7 @@ Pool::detachGroupByName(const HashedStaticString &name) {
 
 bool
 Pool::detachGroupByApiKey(const StaticString &value) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	GroupPtr group = findGroupByApiKey(value, false);
 	if (group != NULL) {
 		string name = group->getName();
@@ -230,7 +242,7 @@ Pool::detachGroupByApiKey(const StaticString &value) {
 
 bool
 Pool::restartGroupByName(const StaticString &name, const RestartOptions &options) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
@@ -253,7 +265,7 @@ Pool::restartGroupByName(const StaticString &name, const RestartOptions &options
 
 unsigned int
 Pool::restartGroupsByAppRoot(const StaticString &appRoot, const RestartOptions &options) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	GroupMap::ConstIterator g_it(groups);
 	unsigned int result = 0;
 
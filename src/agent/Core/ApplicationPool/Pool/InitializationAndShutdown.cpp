@@ -56,6 +56,12 @@ Pool::Pool(const SpawningKit::FactoryPtr &spawningKitFactory,
 	lifeStatus   = ALIVE;
 	max          = 6;
 	maxIdleTime  = 60 * 1000000;
+	maxConcurrentSpawns = 0;
+	concurrentSpawns = 0;
+	stateSnapshotVariants = 0;
+	stateSnapshotRequested = false;
+	stateSnapshotMaxAge = 1000000;
+	nextGarbageCollectionTime = 0;
 	selfchecking = true;
 	palloc       = psg_create_pool(PSG_DEFAULT_POOL_SIZE);
 
@@ -76,14 +82,15 @@ Pool::~Pool() {
 /** Must be called right after construction. */
 void
 Pool::initialize() {
-	LockGuard l(syncher);
+	ExclusiveLockGuard l(syncher);
 	initializeAnalyticsCollection();
 	initializeGarbageCollection();
+	initializeStateSnapshotPublishing();
 }
 
 void
 Pool::initDebugging() {
-	LockGuard l(syncher);
+	ExclusiveLockGuard l(syncher);
 	debugSupport = boost::make_shared<DebugSupport>();
 }
 
@@ -97,7 +104,7 @@ Pool::initDebugging() {
 void
 Pool::prepareForShutdown() {
 	TRACE_POINT();
-	ScopedLock lock(syncher);
+	ExclusiveScopedLock lock(syncher);
 	assert(lifeStatus == ALIVE);
 	lifeStatus = PREPARED_FOR_SHUTDOWN;
 	if (abortLongRunningConnectionsCallback != NULL) {
@@ -114,22 +121,50 @@ Pool::prepareForShutdown() {
 void
 Pool::destroy() {
 	TRACE_POINT();
-	ScopedLock lock(syncher);
+	ExclusiveScopedLock lock(syncher);
 	assert(lifeStatus == ALIVE || lifeStatus == PREPARED_FOR_SHUTDOWN);
 
 	lifeStatus = SHUTTING_DOWN;
 
+	// Shut down all groups at the same time instead of one after another,
+	// so that their processes exit in parallel.
+	MonotonicTimeUsec startTime = SystemTime::getMonotonicUsec();
+	unsigned int groupCount = groups.size();
+	boost::container::vector<Callback> actions;
+	vector< boost::shared_ptr<DetachGroupWaitTicket> > tickets;
+	ExceptionPtr exception = copyException(
+		GetAbortedException("The containing Group was detached."));
+
 	while (!groups.empty()) {
 		GroupPtr *group;
 		groups.lookupRandom(NULL, &group);
-		string name = group->get()->getName().toString();
-		lock.unlock();
-		detachGroupByName(name);
-		lock.lock();
+		GroupPtr group2 = *group;
+		boost::shared_ptr<DetachGroupWaitTicket> ticket =
+			boost::make_shared<DetachGroupWaitTicket>();
+		tickets.push_back(ticket);
+		assignExceptionToGetWaiters(group2->getWaitlist,
+			exception, actions);
+		forceDetachGroup(group2,
+			boost::bind(syncDetachGroupCallback, ticket),
+			actions);
 	}
 
+	verifyInvariants();
+	verifyExpensiveInvariants();
+
 	UPDATE_TRACE_POINT();
 	lock.unlock();
+	runAllActions(actions);
+	actions.clear();
+	foreach (const boost::shared_ptr<DetachGroupWaitTicket> &ticket, tickets) {
+		waitDetachGroupCallback(ticket);
+	}
+	if (groupCount > 0) {
+		P_DEBUG("Shut down " << groupCount << " group(s) in " <<
+			(SystemTime::getMonotonicUsec() - startTime) / 1000 << " msec");
+	}
+
+	UPDATE_TRACE_POINT();
 	P_DEBUG("Shutting down ApplicationPool background threads...");
 	interruptableThreads.interrupt_and_join_all();
 	nonInterruptableThreads.join_all();
@@ -38,11 +38,91 @@ using namespace std;
 using namespace boost;
 
 
+UnionStation::StopwatchLog *
+Pool::createGetStopwatchLog(const Options &options, const Group *existingGroup) const {
+	// Log some essentials stats about what this request is facing in its upcoming journey through the queue:
+	// 1) position in the queue upon entry, and 2) whether spawning activity is occurring (which takes cycles
+	// but also indicates the server has headroom to handle the load).
+	Json::Value data;
+	if (!existingGroup) {
+		data["message"] = "spawning.."; // the first of this group, so keep it simple (also: we don't know maxQ yet)
+	} else {
+		char queueMaxStr[10];
+		int queueMax = existingGroup->options.maxRequestQueueSize;
+		if (queueMax > 0) {
+			snprintf(queueMaxStr, sizeof(queueMaxStr), "%d", queueMax);
+		}
+		char message[50];
+		snprintf(message, sizeof(message), "queue: %zu / %s, spawning: %s", existingGroup->getWaitlist.size(),
+				(queueMax == 0 ? "inf" : queueMaxStr),
+				(existingGroup->processesBeingSpawned == 0 ? "no" : "yes"));
+		data["message"] = message;
+	}
+	Json::Value json;
+	json["data"] = data;
+	json["data_type"] = "generic";
+	json["name"] = "Await available process";
+
+	return new UnionStation::StopwatchLog(options.transaction, "Pool::asyncGet", stringifyJson(json).c_str());
+}
+
+/* Tries to check out a session from the given group while only holding
+ * `syncher` in shared mode (which the caller must have locked) plus the
+ * group's `routingSyncher`. Returns NULL, without having changed anything,
+ * if the get action requires changes to the pool's structure (spawning,
+ * restarting or putting the action on a wait list). The caller must then
+ * fall back to the exclusively locked path.
+ */
+SessionPtr
+Pool::getFromGroupQuickly(Group *group, const Options &options,
+	UnionStation::StopwatchLog **stopwatchLog)
+{
+	if (OXT_UNLIKELY(lifeStatus != ALIVE || !group->hasRoutableProcessesHint())) {
+		return SessionPtr();
+	}
+
+	LockGuard l(group->routingSyncher);
+	SessionPtr session = group->getQuickly(options);
+	if (session != NULL) {
+		P_TRACE(2, "asyncGet(appGroupName=" << options.getAppGroupName() <<
+			"): session checked out without exclusive pool lock");
+		if (stopwatchLog != NULL) {
+			*stopwatchLog = createGetStopwatchLog(options, group);
+		}
+	}
+	return session;
+}
+
+bool
+Pool::asyncGetFromExistingGroupQuickly(const Options &options, const GetCallback &callback,
+	UnionStation::StopwatchLog **stopwatchLog)
+{
+	SessionPtr session;
+	{
+		SharedScopedLock lock(syncher);
+		Group *existingGroup = findMatchingGroup(options);
+		if (OXT_UNLIKELY(existingGroup == NULL)) {
+			return false;
+		}
+		session = getFromGroupQuickly(existingGroup, options, stopwatchLog);
+	}
+	if (session != NULL) {
+		callback(session, ExceptionPtr());
+		return true;
+	} else {
+		return false;
+	}
+}
+
 // 'lockNow == false' may only be used during unit tests. Normally we
 // should never call the callback while holding the lock.
 void
 Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow, UnionStation::StopwatchLog **stopwatchLog) {
-	DynamicScopedLock lock(syncher, lockNow);
+	if (OXT_LIKELY(lockNow) && asyncGetFromExistingGroupQuickly(options, callback, stopwatchLog)) {
+		return;
+	}
+
+	DynamicExclusiveScopedLock lock(syncher, lockNow);
 
 	assert(lifeStatus == ALIVE || lifeStatus == PREPARED_FOR_SHUTDOWN);
 	verifyInvariants();
@@ -51,30 +131,7 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 
 	Group *existingGroup = findMatchingGroup(options);
 	if (stopwatchLog != NULL) {
-		// Log some essentials stats about what this request is facing in its upcoming journey through the queue:
-		// 1) position in the queue upon entry, and 2) whether spawning activity is occurring (which takes cycles
-		// but also indicates the server has headroom to handle the load).
-		Json::Value data;
-		if (!existingGroup) {
-			data["message"] = "spawning.."; // the first of this group, so keep it simple (also: we don't know maxQ yet)
-		} else {
-			char queueMaxStr[10];
-			int queueMax = existingGroup->options.maxRequestQueueSize;
-			if (queueMax > 0) {
-				snprintf(queueMaxStr, sizeof(queueMaxStr), "%d", queueMax);
-			}
-			char message[50];
-			snprintf(message, sizeof(message), "queue: %zu / %s, spawning: %s", existingGroup->getWaitlist.size(),
-					(queueMax == 0 ? "inf" : queueMaxStr),
-					(existingGroup->processesBeingSpawned == 0 ? "no" : "yes"));
-			data["message"] = message;
-		}
-		Json::Value json;
-		json["data"] = data;
-		json["data_type"] = "generic";
-		json["name"] = "Await available process";
-
-		*stopwatchLog = new UnionStation::StopwatchLog(options.transaction, "Pool::asyncGet", stringifyJson(json).c_str());
+		*stopwatchLog = createGetStopwatchLog(options, existingGroup);
 	}
 
 	if (OXT_LIKELY(existingGroup != NULL)) {
@@ -118,9 +175,13 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 			 * become available.
 			 */
 			P_DEBUG("Could not free a process; putting request to top-level getWaitlist");
-			getWaitlist.push_back(GetWaiter(
+			GetWaiter waiter(
 				options.copyAndPersist().detachFromUnionStationTransaction(),
-				callback));
+				callback);
+			if (waiter.deadline != 0) {
+				wakeupGarbageCollectorBefore(waiter.deadline);
+			}
+			getWaitlist.push_back(waiter);
 		} else {
 			/* Now that a process has been trashed we can create
 			 * the missing Group.
@@ -164,6 +225,34 @@ Pool::asyncGet(const Options &options, const GetCallback &callback, bool lockNow
 	}
 }
 
+/**
+ * Checks out a session from the given group, which the caller already holds
+ * a handle to (e.g. the Controller in single-app mode), without looking it
+ * up. Only succeeds if this can be done without the exclusive pool lock, in
+ * which case the callback is called immediately and true is returned.
+ * Otherwise nothing is changed and false is returned; the caller should then
+ * call asyncGet().
+ */
+bool
+Pool::asyncGetFromGroupQuickly(const GroupPtr &group, const Options &options,
+	const GetCallback &callback, UnionStation::StopwatchLog **stopwatchLog)
+{
+	SessionPtr session;
+	{
+		SharedScopedLock lock(syncher);
+		if (OXT_UNLIKELY(group->pool != this || !group->isAlive())) {
+			return false;
+		}
+		session = getFromGroupQuickly(group.get(), options, stopwatchLog);
+	}
+	if (session != NULL) {
+		callback(session, ExceptionPtr());
+		return true;
+	} else {
+		return false;
+	}
+}
+
 // TODO: 'ticket' should be a boost::shared_ptr for interruption-safety.
 SessionPtr
 Pool::get(const Options &options, Ticket *ticket) {
@@ -193,7 +282,7 @@ Pool::get(const Options &options, Ticket *ticket) {
 
 void
 Pool::setMax(unsigned int max) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	assert(max > 0);
 	fullVerifyInvariants();
 	bool bigger = max > this->max;
@@ -222,14 +311,21 @@ Pool::setMax(unsigned int max) {
 
 void
 Pool::setMaxIdleTime(unsigned long long value) {
-	LockGuard l(syncher);
+	ExclusiveLockGuard l(syncher);
 	maxIdleTime = value;
 	wakeupGarbageCollector();
 }
 
+void
+Pool::setMaxConcurrentSpawns(unsigned int value) {
+	boost::lock_guard<boost::mutex> l(spawnSlotsSyncher);
+	maxConcurrentSpawns = value;
+	spawnSlotsCond.notify_all();
+}
+
 void
 Pool::enableSelfChecking(bool enabled) {
-	LockGuard l(syncher);
+	ExclusiveLockGuard l(syncher);
 	selfchecking = enabled;
 }
 
@@ -238,7 +334,7 @@ Pool::enableSelfChecking(bool enabled) {
  */
 bool
 Pool::isSpawning(bool lock) const {
-	DynamicScopedLock l(syncher, lock);
+	DynamicExclusiveScopedLock l(syncher, lock);
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
@@ -261,7 +357,7 @@ Pool::authorizeByUid(uid_t uid, bool lock) const {
 		return true;
 	}
 
-	DynamicScopedLock l(syncher, lock);
+	DynamicExclusiveScopedLock l(syncher, lock);
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
 		const GroupPtr &group = g_it.getValue();
@@ -194,7 +194,7 @@ Pool::possiblySpawnMoreProcessesForExistingGroups() {
 
 vector<ProcessPtr>
 Pool::getProcesses(bool lock) const {
-	DynamicScopedLock l(syncher, lock);
+	DynamicExclusiveScopedLock l(syncher, lock);
 	vector<ProcessPtr> result;
 	GroupMap::ConstIterator g_it(groups);
 	while (*g_it != NULL) {
@@ -244,7 +244,7 @@ Pool::findProcessByPid(pid_t pid, bool lock) const {
 
 bool
 Pool::detachProcess(const ProcessPtr &process) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	boost::container::vector<Callback> actions;
 	bool result = detachProcessUnlocked(process, actions);
 	fullVerifyInvariants();
@@ -255,7 +255,7 @@ Pool::detachProcess(const ProcessPtr &process) {
 
 bool
 Pool::detachProcess(pid_t pid, const AuthenticationOptions &options) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	ProcessPtr process = findProcessByPid(pid, false);
 	if (process != NULL) {
 		const Group *group = process->getGroup();
@@ -278,7 +278,7 @@ Pool::detachProcess(pid_t pid, const AuthenticationOptions &options) {
 
 bool
 Pool::detachProcess(const string &gupid, const AuthenticationOptions &options) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	ProcessPtr process = findProcessByGupid(gupid, false);
 	if (process != NULL) {
 		const Group *group = process->getGroup();
@@ -301,7 +301,7 @@ Pool::detachProcess(const string &gupid, const AuthenticationOptions &options) {
 
 DisableResult
 Pool::disableProcess(const StaticString &gupid) {
-	ScopedLock l(syncher);
+	ExclusiveScopedLock l(syncher);
 	ProcessPtr process = findProcessByGupid(gupid, false);
 	if (process != NULL) {
 		Group *group = process->getGroup();
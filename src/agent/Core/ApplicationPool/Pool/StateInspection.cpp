@@ -68,6 +68,50 @@ Pool::atFullCapacityUnlocked() const {
 	return capacityUsedUnlocked() >= max;
 }
 
+/**
+ * Processes in a SmartSpawner's reserve aren't part of any group, so they
+ * don't count towards `capacityUsedUnlocked()`. Instead, this limits each
+ * group's reserve to the capacity that is left after all processes and all
+ * other groups' reserves and spawns. A group's own spawns are not subtracted
+ * because they are normally satisfied from its reserve. Must be called
+ * whenever the capacity used may have changed, so that reserves shrink when
+ * capacity is taken and grow again when it is freed.
+ */
+void
+Pool::updateSpawnReserveLimits() {
+	unsigned int used = 0;
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		used += group->capacityUsed() + group->getReservedProcessCount();
+		g_it.next();
+	}
+
+	GroupMap::ConstIterator g_it2(groups);
+	while (*g_it2 != NULL) {
+		const GroupPtr &group = g_it2.getValue();
+		if (group->spawner != NULL && group->options.spawnReserveSize > 0) {
+			unsigned int ownProcesses = group->capacityUsed()
+				- (unsigned int) group->processesBeingSpawned;
+			unsigned int othersUsed = used - group->capacityUsed()
+				- group->getReservedProcessCount();
+			unsigned int limit = 0;
+			if (max > othersUsed + ownProcesses) {
+				limit = max - othersUsed - ownProcesses;
+			}
+			if (group->options.maxProcesses != 0) {
+				if (group->options.maxProcesses > ownProcesses) {
+					limit = std::min(limit, group->options.maxProcesses - ownProcesses);
+				} else {
+					limit = 0;
+				}
+			}
+			group->spawner->setReserveLimit(limit);
+		}
+		g_it2.next();
+	}
+}
+
 void
 Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 	const Group *group, const ProcessList &processes) const
@@ -99,6 +143,15 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 			distanceOfTimeInWords(process->lastUsed / 1000000).c_str());
 		result << buf << endl;
 
+		if (process->metrics.isValid() && process->metrics.sharedPercentage() != -1) {
+			snprintf(buf, sizeof(buf),
+				"    Shared memory: %luM (%d%%)   Private memory: %luM",
+				(unsigned long) (process->metrics.shared / 1024),
+				process->metrics.sharedPercentage(),
+				(unsigned long) (process->metrics.privateMemory / 1024));
+			result << buf << endl;
+		}
+
 		if (process->enabled == Process::DISABLING) {
 			result << "    Disabling..." << endl;
 		} else if (process->enabled == Process::DISABLED) {
@@ -115,6 +168,156 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 	}
 }
 
+void
+Pool::inspectGroup(const InspectOptions &options, stringstream &result,
+	const Group *group) const
+{
+	result << group->getName() << ":" << endl;
+	result << "  App root: " << group->options.appRoot << endl;
+	if (group->restarting()) {
+		result << "  (restarting...)" << endl;
+	}
+	if (group->spawning()) {
+		if (group->processesBeingSpawned == 0) {
+			result << "  (spawning...)" << endl;
+		} else {
+			result << "  (spawning " << group->processesBeingSpawned << " new " <<
+				maybePluralize(group->processesBeingSpawned, "process", "processes") <<
+				"...)" << endl;
+		}
+	}
+	if (group->circuitOpenUntil != 0) {
+		unsigned long long now = SystemTime::getUsec();
+		if (group->circuitOpen(now)) {
+			result << "  (not spawning for " << (group->circuitOpenUntil - now) / 1000 <<
+				" msec after " << group->spawnFailures << " failed spawn attempts)" << endl;
+		} else {
+			result << "  (retrying to spawn after " << group->spawnFailures <<
+				" failed spawn attempts)" << endl;
+		}
+	}
+	result << "  Requests in queue: " << group->getWaitlist.size() << endl;
+	unsigned int reserved = group->getReservedProcessCount();
+	if (reserved > 0) {
+		result << "  Processes in spawn reserve: " << reserved << endl;
+	}
+	if (group->options.predictiveSpawning) {
+		unsigned int desired = group->predictedProcessCount(1.2);
+		result << "  Predicted demand: " << desired << " " <<
+			maybePluralize(desired, "process", "processes") << " (" <<
+			(unsigned int) round(group->demandPredictor.getArrivalRate()) <<
+			" requests/sec)" << endl;
+	}
+	inspectProcessList(options, result, group, group->enabledProcesses);
+	inspectProcessList(options, result, group, group->disablingProcesses);
+	inspectProcessList(options, result, group, group->disabledProcesses);
+	inspectProcessList(options, result, group, group->detachedProcesses);
+	result << endl;
+}
+
+void
+Pool::groupToXml(const ToXmlOptions &options, stringstream &result,
+	const Group *group) const
+{
+	result << "<supergroup>";
+	result << "<name>" << escapeForXml(group->getName()) << "</name>";
+	result << "<state>READY</state>";
+	result << "<get_wait_list_size>0</get_wait_list_size>";
+	result << "<capacity_used>" << group->capacityUsed() << "</capacity_used>";
+	if (options.secrets) {
+		result << "<secret>" << escapeForXml(group->getApiKey().toStaticString()) << "</secret>";
+	}
+
+	result << "<group default=\"true\">";
+	group->inspectXml(result, options.secrets);
+	result << "</group>";
+
+	result << "</supergroup>";
+}
+
+/**
+ * Creates a snapshot of the pool state. If `lock` is true then `syncher` is
+ * only locked in shared mode, and every group's `routingSyncher` is locked
+ * while that group is being rendered. That is enough for a consistent view
+ * of the group, see the documentation for `syncher`.
+ */
+boost::shared_ptr<Pool::StateSnapshot>
+Pool::createStateSnapshot(unsigned int variants, bool lock) const {
+	boost::shared_ptr<StateSnapshot> snapshot = boost::make_shared<StateSnapshot>();
+	snapshot->version = 0;
+	snapshot->time = SystemTime::getUsec();
+	snapshot->variants = variants;
+
+	DynamicSharedScopedLock l(syncher, lock);
+	snapshot->max = max;
+	snapshot->processCount = getProcessCount(false);
+	snapshot->capacityUsed = capacityUsedUnlocked();
+	snapshot->getWaitlist.reserve(getWaitlist.size());
+	foreach (const GetWaiter &waiter, getWaitlist) {
+		snapshot->getWaitlist.push_back(waiter.options.getAppGroupName());
+	}
+
+	InspectOptions textOptions, verboseTextOptions;
+	InspectOptions colorizedTextOptions, colorizedVerboseTextOptions;
+	ToXmlOptions xmlOptions, xmlWithSecretsOptions;
+	verboseTextOptions.verbose = true;
+	colorizedTextOptions.colorize = true;
+	colorizedVerboseTextOptions.colorize = true;
+	colorizedVerboseTextOptions.verbose = true;
+	xmlOptions.secrets = false;
+
+	snapshot->groups.reserve(groups.size());
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		DynamicScopedLock gl(group->routingSyncher, lock);
+		StateSnapshot::GroupState state;
+
+		state.name = group->getName();
+		state.uid = group->getUserSwitchingInfo()->uid;
+		state.apiKey = group->getApiKey();
+		if (variants & SSV_TEXT) {
+			stringstream stream;
+			inspectGroup(textOptions, stream, group.get());
+			state.text = stream.str();
+		}
+		if (variants & SSV_VERBOSE_TEXT) {
+			stringstream stream;
+			inspectGroup(verboseTextOptions, stream, group.get());
+			state.verboseText = stream.str();
+		}
+		if (variants & SSV_COLORIZED_TEXT) {
+			stringstream stream;
+			inspectGroup(colorizedTextOptions, stream, group.get());
+			state.colorizedText = stream.str();
+		}
+		if (variants & SSV_COLORIZED_VERBOSE_TEXT) {
+			stringstream stream;
+			inspectGroup(colorizedVerboseTextOptions, stream, group.get());
+			state.colorizedVerboseText = stream.str();
+		}
+		if (variants & SSV_XML) {
+			stringstream stream;
+			groupToXml(xmlOptions, stream, group.get());
+			state.xml = stream.str();
+		}
+		if (variants & SSV_XML_WITH_SECRETS) {
+			stringstream stream;
+			groupToXml(xmlWithSecretsOptions, stream, group.get());
+			state.xmlWithSecrets = stream.str();
+		}
+		if (variants & SSV_SPAWN_TIMINGS) {
+			state.spawnTimings = group->inspectSpawnTimingsAsJson();
+		}
+
+		gl.unlock();
+		snapshot->groups.push_back(state);
+		g_it.next();
+	}
+
+	return snapshot;
+}
+
 
 /****************************
  *
@@ -125,80 +328,215 @@ Pool::inspectProcessList(const InspectOptions &options, stringstream &result,
 
 string
 Pool::inspect(const InspectOptions &options, bool lock) const {
-	DynamicScopedLock l(syncher, lock);
+	return createStateSnapshot(StateSnapshot::variantFor(options), lock)->inspect(options);
+}
+
+string
+Pool::toXml(const ToXmlOptions &options, bool lock) const {
+	return createStateSnapshot(StateSnapshot::variantFor(options), lock)->toXml(options);
+}
+
+/**
+ * Returns a recently published snapshot that contains the given variants,
+ * without locking `syncher`. If the last published snapshot is older than
+ * `stateSnapshotMaxAge`, then this method asks the publisher thread for a
+ * new one and waits for it. The publisher only locks `syncher` in shared
+ * mode, so it doesn't block request routing for existing groups.
+ */
+Pool::StateSnapshotPtr
+Pool::getStateSnapshot(unsigned int variants) {
+	unsigned long long now = SystemTime::getUsec();
+	StateSnapshotPtr snapshot = boost::atomic_load(&stateSnapshot);
+	if (snapshot != NULL
+	 && (snapshot->variants & variants) == variants
+	 && now < snapshot->time + stateSnapshotMaxAge)
+	{
+		return snapshot;
+	}
+
+	ScopedLock l(stateSnapshotSyncher);
+	stateSnapshotVariants |= variants;
+	stateSnapshotRequested = true;
+	stateSnapshotCond.notify_all();
+	while (true) {
+		snapshot = boost::atomic_load(&stateSnapshot);
+		if (snapshot != NULL
+		 && (snapshot->variants & variants) == variants
+		 && snapshot->time >= now)
+		{
+			return snapshot;
+		}
+		if (!stateSnapshotCond.timed_wait(l, posix_time::seconds(5))) {
+			break;
+		}
+	}
+
+	// The publisher thread isn't running, e.g. because the pool is
+	// shutting down.
+	l.unlock();
+	return createStateSnapshot(variants, true);
+}
+
+string
+Pool::inspectFromSnapshot(const InspectOptions &options) {
+	return getStateSnapshot(StateSnapshot::variantFor(options))->inspect(options);
+}
+
+string
+Pool::toXmlFromSnapshot(const ToXmlOptions &options) {
+	return getStateSnapshot(StateSnapshot::variantFor(options))->toXml(options);
+}
+
+string
+Pool::spawnTimingsToJsonFromSnapshot(const AuthenticationOptions &options) {
+	return getStateSnapshot(SSV_SPAWN_TIMINGS)->spawnTimingsToJson(options);
+}
+
+
+unsigned int
+Pool::capacityUsed() const {
+	ExclusiveLockGuard l(syncher);
+	return capacityUsedUnlocked();
+}
+
+bool
+Pool::atFullCapacity() const {
+	ExclusiveLockGuard l(syncher);
+	return atFullCapacityUnlocked();
+}
+
+/**
+ * Returns the total number of processes in the pool, including all disabling and
+ * disabled processes, but excluding processes that are shutting down and excluding
+ * processes that are being spawned.
+ */
+unsigned int
+Pool::getProcessCount(bool lock) const {
+	DynamicExclusiveScopedLock l(syncher, lock);
+	unsigned int result = 0;
+	GroupMap::ConstIterator g_it(groups);
+	while (*g_it != NULL) {
+		const GroupPtr &group = g_it.getValue();
+		result += group->getProcessCount();
+		g_it.next();
+	}
+	return result;
+}
+
+unsigned int
+Pool::getGroupCount() const {
+	ExclusiveLockGuard l(syncher);
+	return groups.size();
+}
+
+
+
+/****************************
+ *
+ * StateSnapshot methods
+ *
+ ****************************/
+
+
+bool
+Pool::StateSnapshot::GroupState::authorizeByUid(uid_t uid) const {
+	return uid == 0 || this->uid == uid;
+}
+
+bool
+Pool::StateSnapshot::GroupState::authorizeByApiKey(const ApiKey &key) const {
+	return key.isSuper() || key == apiKey;
+}
+
+const string &
+Pool::StateSnapshot::GroupState::textFor(const InspectOptions &options) const {
+	if (options.colorize) {
+		return options.verbose ? colorizedVerboseText : colorizedText;
+	} else {
+		return options.verbose ? verboseText : text;
+	}
+}
+
+unsigned int
+Pool::StateSnapshot::variantFor(const InspectOptions &options) {
+	if (options.colorize) {
+		return options.verbose ? SSV_COLORIZED_VERBOSE_TEXT : SSV_COLORIZED_TEXT;
+	} else {
+		return options.verbose ? SSV_VERBOSE_TEXT : SSV_TEXT;
+	}
+}
+
+unsigned int
+Pool::StateSnapshot::variantFor(const ToXmlOptions &options) {
+	return options.secrets ? SSV_XML_WITH_SECRETS : SSV_XML;
+}
+
+/** Like `Pool::authorizeByUid()`, but as of the time of the snapshot. */
+bool
+Pool::StateSnapshot::authorizeByUid(uid_t uid) const {
+	if (uid == 0 || uid == geteuid()) {
+		return true;
+	}
+	foreach (const GroupState &group, groups) {
+		if (group.authorizeByUid(uid)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Like `Pool::authorizeByApiKey()`, but as of the time of the snapshot. */
+bool
+Pool::StateSnapshot::authorizeByApiKey(const ApiKey &key) const {
+	if (key.isSuper()) {
+		return true;
+	}
+	foreach (const GroupState &group, groups) {
+		if (key == group.apiKey) {
+			return true;
+		}
+	}
+	return false;
+}
+
+string
+Pool::StateSnapshot::inspect(const InspectOptions &options) const {
 	stringstream result;
 	const char *headerColor = maybeColorize(options, ANSI_COLOR_YELLOW ANSI_COLOR_BLUE_BG ANSI_COLOR_BOLD);
 	const char *resetColor  = maybeColorize(options, ANSI_COLOR_RESET);
 
-	if (!authorizeByUid(options.uid, false)
-	 && !authorizeByApiKey(options.apiKey, false))
-	{
+	assert(variants & variantFor(options));
+	if (!authorizeByUid(options.uid) && !authorizeByApiKey(options.apiKey)) {
 		throw SecurityException("Operation unauthorized");
 	}
 
 	result << headerColor << "----------- General information -----------" << resetColor << endl;
 	result << "Max pool size : " << max << endl;
 	result << "App groups    : " << groups.size() << endl;
-	result << "Processes     : " << getProcessCount(false) << endl;
+	result << "Processes     : " << processCount << endl;
 	result << "Requests in top-level queue : " << getWaitlist.size() << endl;
 	if (options.verbose) {
-		unsigned int i = 0;
-		foreach (const GetWaiter &waiter, getWaitlist) {
-			result << "  " << i << ": " << waiter.options.getAppGroupName() << endl;
-			i++;
+		for (unsigned int i = 0; i < getWaitlist.size(); i++) {
+			result << "  " << i << ": " << getWaitlist[i] << endl;
 		}
 	}
 	result << endl;
 
 	result << headerColor << "----------- Application groups -----------" << resetColor << endl;
-	GroupMap::ConstIterator g_it(groups);
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		if (!group->authorizeByUid(options.uid)
-		 && !group->authorizeByApiKey(options.apiKey))
-		{
-			g_it.next();
-			continue;
+	foreach (const GroupState &group, groups) {
+		if (group.authorizeByUid(options.uid) || group.authorizeByApiKey(options.apiKey)) {
+			result << group.textFor(options);
 		}
-
-		ProcessList::const_iterator p_it;
-
-		result << group->getName() << ":" << endl;
-		result << "  App root: " << group->options.appRoot << endl;
-		if (group->restarting()) {
-			result << "  (restarting...)" << endl;
-		}
-		if (group->spawning()) {
-			if (group->processesBeingSpawned == 0) {
-				result << "  (spawning...)" << endl;
-			} else {
-				result << "  (spawning " << group->processesBeingSpawned << " new " <<
-					maybePluralize(group->processesBeingSpawned, "process", "processes") <<
-					"...)" << endl;
-			}
-		}
-		result << "  Requests in queue: " << group->getWaitlist.size() << endl;
-		inspectProcessList(options, result, group.get(), group->enabledProcesses);
-		inspectProcessList(options, result, group.get(), group->disablingProcesses);
-		inspectProcessList(options, result, group.get(), group->disabledProcesses);
-		inspectProcessList(options, result, group.get(), group->detachedProcesses);
-		result << endl;
-
-		g_it.next();
 	}
 	return result.str();
 }
 
 string
-Pool::toXml(const ToXmlOptions &options, bool lock) const {
-	DynamicScopedLock l(syncher, lock);
+Pool::StateSnapshot::toXml(const ToXmlOptions &options) const {
 	stringstream result;
-	GroupMap::ConstIterator g_it(groups);
-	ProcessList::const_iterator p_it;
 
-	if (!authorizeByUid(options.uid, false)
-	 && !authorizeByApiKey(options.apiKey, false))
-	{
+	assert(variants & variantFor(options));
+	if (!authorizeByUid(options.uid) && !authorizeByApiKey(options.apiKey)) {
 		throw SecurityException("Operation unauthorized");
 	}
 
@@ -207,50 +545,26 @@ Pool::toXml(const ToXmlOptions &options, bool lock) const {
 
 	result << "<passenger_version>" << PASSENGER_VERSION << "</passenger_version>";
 	result << "<group_count>" << groups.size() << "</group_count>";
-	result << "<process_count>" << getProcessCount(false) << "</process_count>";
+	result << "<process_count>" << processCount << "</process_count>";
 	result << "<max>" << max << "</max>";
-	result << "<capacity_used>" << capacityUsedUnlocked() << "</capacity_used>";
+	result << "<capacity_used>" << capacityUsed << "</capacity_used>";
 	result << "<get_wait_list_size>" << getWaitlist.size() << "</get_wait_list_size>";
 
 	if (options.secrets) {
-		vector<GetWaiter>::const_iterator w_it, w_end = getWaitlist.end();
-
 		result << "<get_wait_list>";
-		for (w_it = getWaitlist.begin(); w_it != w_end; w_it++) {
-			const GetWaiter &waiter = *w_it;
+		foreach (const string &appGroupName, getWaitlist) {
 			result << "<item>";
-			result << "<app_group_name>" << escapeForXml(waiter.options.getAppGroupName()) << "</app_group_name>";
+			result << "<app_group_name>" << escapeForXml(appGroupName) << "</app_group_name>";
 			result << "</item>";
 		}
 		result << "</get_wait_list>";
 	}
 
 	result << "<supergroups>";
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		if (!group->authorizeByUid(options.uid)
-		 && !group->authorizeByApiKey(options.apiKey))
-		{
-			g_it.next();
-			continue;
-		}
-
-		result << "<supergroup>";
-		result << "<name>" << escapeForXml(group->getName()) << "</name>";
-		result << "<state>READY</state>";
-		result << "<get_wait_list_size>0</get_wait_list_size>";
-		result << "<capacity_used>" << group->capacityUsed() << "</capacity_used>";
-		if (options.secrets) {
-			result << "<secret>" << escapeForXml(group->getApiKey().toStaticString()) << "</secret>";
+	foreach (const GroupState &group, groups) {
+		if (group.authorizeByUid(options.uid) || group.authorizeByApiKey(options.apiKey)) {
+			result << (options.secrets ? group.xmlWithSecrets : group.xml);
 		}
-
-		result << "<group default=\"true\">";
-		group->inspectXml(result, options.secrets);
-		result << "</group>";
-
-		result << "</supergroup>";
-
-		g_it.next();
 	}
 	result << "</supergroups>";
 
@@ -258,41 +572,28 @@ Pool::toXml(const ToXmlOptions &options, bool lock) const {
 	return result.str();
 }
 
-
-unsigned int
-Pool::capacityUsed() const {
-	LockGuard l(syncher);
-	return capacityUsedUnlocked();
-}
-
-bool
-Pool::atFullCapacity() const {
-	LockGuard l(syncher);
-	return atFullCapacityUnlocked();
-}
-
 /**
- * Returns the total number of processes in the pool, including all disabling and
- * disabled processes, but excluding processes that are shutting down and excluding
- * processes that are being spawned.
+ * Returns, for every group, histograms of how long the phases of its
+ * spawns took, and the timeline of its last spawn. See
+ * `Group::inspectSpawnTimingsAsJson()`.
  */
-unsigned int
-Pool::getProcessCount(bool lock) const {
-	DynamicScopedLock l(syncher, lock);
-	unsigned int result = 0;
-	GroupMap::ConstIterator g_it(groups);
-	while (*g_it != NULL) {
-		const GroupPtr &group = g_it.getValue();
-		result += group->getProcessCount();
-		g_it.next();
+string
+Pool::StateSnapshot::spawnTimingsToJson(const AuthenticationOptions &options) const {
+	Json::Value doc;
+	Json::Value groupsDoc(Json::objectValue);
+
+	assert(variants & SSV_SPAWN_TIMINGS);
+	if (!authorizeByUid(options.uid) && !authorizeByApiKey(options.apiKey)) {
+		throw SecurityException("Operation unauthorized");
 	}
-	return result;
-}
 
-unsigned int
-Pool::getGroupCount() const {
-	LockGuard l(syncher);
-	return groups.size();
+	foreach (const GroupState &group, groups) {
+		if (group.authorizeByUid(options.uid) || group.authorizeByApiKey(options.apiKey)) {
+			groupsDoc[group.name] = group.spawnTimings;
+		}
+	}
+	doc["groups"] = groupsDoc;
+	return doc.toStyledString();
 }
 
 
@@ -0,0 +1,93 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#include <Core/ApplicationPool/Pool.h>
+
+/*************************************************************************
+ *
+ * State snapshot publishing functions for ApplicationPool2::Pool
+ *
+ *************************************************************************/
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+using namespace boost;
+
+
+void
+Pool::initializeStateSnapshotPublishing() {
+	interruptableThreads.create_thread(
+		boost::bind(publishStateSnapshots, shared_from_this()),
+		"Pool state snapshot publisher",
+		POOL_HELPER_THREAD_STACK_SIZE
+	);
+}
+
+/**
+ * Publishes a new state snapshot whenever `getStateSnapshot()` asks for one.
+ * Creating the snapshot happens in this thread instead of in the caller, so
+ * that callers never lock `syncher` themselves.
+ */
+void
+Pool::publishStateSnapshots(PoolPtr self) {
+	TRACE_POINT();
+	unsigned long long version = 0;
+
+	while (!boost::this_thread::interruption_requested()) {
+		try {
+			unsigned int variants;
+
+			UPDATE_TRACE_POINT();
+			{
+				ScopedLock l(self->stateSnapshotSyncher);
+				while (!self->stateSnapshotRequested) {
+					self->stateSnapshotCond.wait(l);
+				}
+				self->stateSnapshotRequested = false;
+				variants = self->stateSnapshotVariants;
+			}
+
+			UPDATE_TRACE_POINT();
+			boost::shared_ptr<StateSnapshot> snapshot =
+				self->createStateSnapshot(variants, true);
+			snapshot->version = ++version;
+
+			UPDATE_TRACE_POINT();
+			ScopedLock l(self->stateSnapshotSyncher);
+			boost::atomic_store(&self->stateSnapshot, StateSnapshotPtr(snapshot));
+			self->stateSnapshotCond.notify_all();
+		} catch (const thread_interrupted &) {
+			break;
+		} catch (const tracable_exception &e) {
+			P_WARN("ERROR: " << e.what() << "\n  Backtrace:\n" << e.backtrace());
+		}
+	}
+}
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
@@ -47,6 +47,9 @@
 #include <Utils/StrIntUtils.h>
 #include <Utils/Lock.h>
 #include <Utils/ProcessMetricsCollector.h>
+#include <Utils/PidFd.h>
+#include <Algorithms/MovingAverage.h>
+#include <Algorithms/AdaptiveConcurrencyLimit.h>
 #include <Core/ApplicationPool/Common.h>
 #include <Core/ApplicationPool/Socket.h>
 #include <Core/ApplicationPool/Session.h>
@@ -103,6 +106,10 @@ typedef boost::container::vector<ProcessPtr> ProcessList;
 class Process {
 public:
 	static const unsigned int MAX_SESSION_SOCKETS = 3;
+	/** The initial and maximum adaptive concurrency limit of processes
+	 * with unlimited concurrency. See `enableAdaptiveConcurrency()`. */
+	static const unsigned int UNLIMITED_INITIAL_ADAPTIVE_CONCURRENCY = 20;
+	static const unsigned int UNLIMITED_MAX_ADAPTIVE_CONCURRENCY = 1000;
 
 private:
 	/*************************************************************
@@ -137,6 +144,16 @@ private:
 	 */
 	FileDescriptor errorPipe;
 
+	/**
+	 * A pidfd for the OS process, or -1 if pidfds are not supported or if
+	 * this is a dummy process. Allows checking for the OS process's existence
+	 * and signalling it without the risk of hitting another process that
+	 * reused its PID. Processes spawned by SmartSpawner are not our children,
+	 * but pidfds work for them too. Taken from `SpawningKit::Result::pidFd`
+	 * if the spawner opened one.
+	 */
+	FileDescriptor pidFd;
+
 	/**
 	 * The code revision of the application, inferred through various means.
 	 * See Spawner::prepareSpawn() to learn how this is determined.
@@ -368,6 +385,32 @@ public:
 	int sessions;
 	/** Number of sessions opened so far. */
 	unsigned int processed;
+	/**
+	 * The number of concurrent sessions that routing allows for this process.
+	 * 0 means unlimited. This is equal to `concurrency`, unless adaptive
+	 * concurrency is enabled, in which case it's `concurrencyLimiter.getLimit()`.
+	 */
+	int concurrencyLimit;
+	/** Only used if `adaptiveConcurrency` is true. */
+	AdaptiveConcurrencyLimit concurrencyLimiter;
+	bool adaptiveConcurrency;
+	/**
+	 * How much traffic routing should give this process relative to the
+	 * other processes, in (0, 1]. Lower than 1 while the process is warming
+	 * up, see `startWarmup()`.
+	 */
+	double routingWeight;
+	/** The warm-up parameters; only used while `routingWeight < 1`. */
+	double warmupInitialWeight;
+	unsigned int warmupRequests;
+	unsigned long long warmupDuration;
+	unsigned long long warmupStartTime;
+	/**
+	 * Moving average of the time (in microseconds) between opening and
+	 * closing a session. Only maintained when the Group uses the
+	 * RP_LEAST_LATENCY routing policy.
+	 */
+	DiscExpMovingAverage<500, 1000000, 10 * 1000000> responseTimeAverage;
 	/** Do not access directly, always use `isAlive()`/`isDead()`/`getLifeStatus()` or
 	 * through `lifetimeSyncher`. */
 	enum LifeStatus {
@@ -419,10 +462,20 @@ public:
 	/** Caches whether or not the OS process still exists. */
 	mutable bool m_osProcessExists: 1;
 	bool longRunningConnectionsAborted: 1;
+	/** Whether the process was sent SIGKILL because it didn't shut down
+	 * within PROCESS_SHUTDOWN_TIMEOUT. */
+	bool forcefullyKilled: 1;
 	/** Time at which shutdown began. */
 	time_t shutdownStartTime;
+	/** Same as `shutdownStartTime`, but on the monotonic clock, for measuring
+	 * how long shutting down took. */
+	MonotonicTimeUsec shutdownStartMonotonicTime;
 	/** Collected by Pool::collectAnalytics(). */
 	ProcessMetrics metrics;
+	/** When `metrics` was last sampled, and the value of `processed` at that
+	 * time. Used by Pool::collectAnalytics() to skip idle processes. */
+	unsigned long long metricsCollectionTime;
+	unsigned int metricsCollectionProcessed;
 
 
 	Process(const BasicGroupInfo *groupInfo, const Json::Value &json)
@@ -438,32 +491,47 @@ public:
 		  lastUsed(spawnEndTime),
 		  sessions(0),
 		  processed(0),
+		  adaptiveConcurrency(false),
+		  routingWeight(1),
+		  warmupInitialWeight(1),
+		  warmupRequests(0),
+		  warmupDuration(0),
+		  warmupStartTime(0),
 		  lifeStatus(ALIVE),
 		  enabled(ENABLED),
 		  oobwStatus(OOBW_NOT_ACTIVE),
 		  m_osProcessExists(true),
 		  longRunningConnectionsAborted(false),
-		  shutdownStartTime(0)
+		  forcefullyKilled(false),
+		  shutdownStartTime(0),
+		  shutdownStartMonotonicTime(0),
+		  metricsCollectionTime(0),
+		  metricsCollectionProcessed(0)
 	{
 		initializeSocketsAndStringFields(json);
 		indexSessionSockets();
+		concurrencyLimit = concurrency;
 
 		const SpawningKit::Result *skResult = dynamic_cast<const SpawningKit::Result *>(&json);
+		if (skResult != NULL && skResult->pidFd != -1) {
+			pidFd = skResult->pidFd;
+		} else if (!dummy) {
+			pidFd = FileDescriptor(openPidFd(info.pid), __FILE__, __LINE__);
+		}
 		if (skResult != NULL) {
 			adminSocket = skResult->adminSocket;
 			errorPipe = skResult->errorPipe;
-
+		}
+		if (skResult != NULL && !skResult->outputWatched) {
 			if (adminSocket != -1) {
 				SpawningKit::PipeWatcherPtr watcher = boost::make_shared<SpawningKit::PipeWatcher>(
 					getContext()->getSpawningKitConfig(), adminSocket, "stdout", info.pid);
-				watcher->initialize();
 				watcher->start();
 			}
 
 			if (errorPipe != -1) {
 				SpawningKit::PipeWatcherPtr watcher = boost::make_shared<SpawningKit::PipeWatcher>(
 					getContext()->getSpawningKitConfig(), errorPipe, "stderr", info.pid);
-				watcher->initialize();
 				watcher->start();
 			}
 		}
@@ -483,8 +551,73 @@ public:
 	void forceMaxConcurrency(int value) {
 		assert(value >= 0);
 		concurrency = value;
+		concurrencyLimit = value;
 		for (unsigned i = 0; i < sessionSocketCount; i++) {
-			sessionSockets[i]->concurrency = concurrency;
+			sessionSockets[i]->setConcurrency(concurrency);
+		}
+	}
+
+	/**
+	 * Lets the number of concurrent sessions that this process accepts adapt
+	 * to its response times, between 1 and `concurrency`, so that requests
+	 * are queued in the Group instead of inside the process. Processes
+	 * with unlimited concurrency get an upper bound of
+	 * UNLIMITED_MAX_ADAPTIVE_CONCURRENCY.
+	 */
+	void enableAdaptiveConcurrency() {
+		if (concurrency == 0) {
+			concurrencyLimiter = AdaptiveConcurrencyLimit(
+				UNLIMITED_INITIAL_ADAPTIVE_CONCURRENCY, 1,
+				UNLIMITED_MAX_ADAPTIVE_CONCURRENCY);
+		} else {
+			concurrencyLimiter = AdaptiveConcurrencyLimit(concurrency, 1, concurrency);
+		}
+		concurrencyLimit = concurrencyLimiter.getLimit();
+		adaptiveConcurrency = true;
+	}
+
+	/**
+	 * Lets this process start with a routing weight of `initialWeight`, which
+	 * then increases linearly to 1 over the course of `requests` processed
+	 * requests or `duration` microseconds, whichever comes first. A value
+	 * of 0 disables the respective criterion. This gives the process time
+	 * to fill its caches (and JIT) before it gets its full share of traffic.
+	 */
+	void startWarmup(double initialWeight, unsigned int requests,
+		unsigned long long duration, unsigned long long now)
+	{
+		if (initialWeight >= 1 || (requests == 0 && duration == 0)) {
+			return;
+		}
+		warmupInitialWeight = std::max(0.01, initialWeight);
+		warmupRequests = requests;
+		warmupDuration = duration;
+		warmupStartTime = now;
+		routingWeight = warmupInitialWeight;
+	}
+
+	bool warmingUp() const {
+		return routingWeight < 1;
+	}
+
+	/** Recalculates `routingWeight`. */
+	void updateWarmup(unsigned long long now) {
+		if (OXT_LIKELY(!warmingUp())) {
+			return;
+		}
+
+		double progress = 0;
+		if (warmupRequests > 0) {
+			progress = processed / (double) warmupRequests;
+		}
+		if (warmupDuration > 0 && now > warmupStartTime) {
+			progress = std::max(progress,
+				(now - warmupStartTime) / (double) warmupDuration);
+		}
+		if (progress >= 1) {
+			routingWeight = 1;
+		} else {
+			routingWeight = warmupInitialWeight + (1 - warmupInitialWeight) * progress;
 		}
 	}
 
@@ -552,10 +685,12 @@ public:
 		assert(canTriggerShutdown());
 		{
 			time_t now = SystemTime::get();
+			MonotonicTimeUsec monotonicNow = SystemTime::getMonotonicUsec();
 			oxt::spin_lock::scoped_lock lock(lifetimeSyncher);
 			assert(lifeStatus == ALIVE);
 			lifeStatus = SHUTDOWN_TRIGGERED;
 			shutdownStartTime = now;
+			shutdownStartMonotonicTime = monotonicNow;
 		}
 		if (!dummy) {
 			syscalls::shutdown(adminSocket, SHUT_WR);
@@ -566,6 +701,10 @@ public:
 		return SystemTime::get() >= shutdownStartTime + PROCESS_SHUTDOWN_TIMEOUT;
 	}
 
+	MonotonicTimeUsec getShutdownStartMonotonicTime() const {
+		return shutdownStartMonotonicTime;
+	}
+
 	bool canCleanup() const {
 		return getLifeStatus() == SHUTDOWN_TRIGGERED && !osProcessExists();
 	}
@@ -617,6 +756,15 @@ public:
 		return info.pid;
 	}
 
+	/** Whether the OS process is tracked through a pidfd. See `pidFd`. */
+	bool hasPidFd() const {
+		return pidFd != -1;
+	}
+
+	const FileDescriptor &getPidFd() const {
+		return pidFd;
+	}
+
 	StaticString getGupid() const {
 		return StaticString(info.gupid, info.gupidSize);
 	}
@@ -629,6 +777,19 @@ public:
 		return spawnerCreationTime;
 	}
 
+	unsigned long long getSpawnStartTime() const {
+		return spawnStartTime;
+	}
+
+	/** How long it took to spawn this process, in microseconds. */
+	unsigned long long getSpawnDuration() const {
+		if (spawnEndTime > spawnStartTime) {
+			return spawnEndTime - spawnStartTime;
+		} else {
+			return 0;
+		}
+	}
+
 	bool isDummy() const {
 		return dummy;
 	}
@@ -675,7 +836,13 @@ public:
 	 */
 	bool osProcessExists() const {
 		if (!dummy && m_osProcessExists) {
-			if (syscalls::kill(getPid(), 0) == 0) {
+			int exited;
+			if (pidFd != -1) {
+				m_osProcessExists = !pidFdProcessExited(pidFd);
+			} else if ((exited = childProcessExited(getPid())) != -1) {
+				// Our own child, e.g. spawned directly.
+				m_osProcessExists = !exited;
+			} else if (syscalls::kill(getPid(), 0) == 0) {
 				/* On some environments, e.g. Heroku, the init process does
 				 * not properly reap adopted zombie processes, which can interfere
 				 * with our process existance check. To work around this, we
@@ -693,10 +860,12 @@ public:
 
 	/** Kill the OS process with the given signal. */
 	int kill(int signo) {
-		if (osProcessExists()) {
-			return syscalls::kill(getPid(), signo);
-		} else {
+		if (!osProcessExists()) {
 			return 0;
+		} else if (pidFd != -1) {
+			return signalPidFd(pidFd, signo);
+		} else {
+			return syscalls::kill(getPid(), signo);
 		}
 	}
 
@@ -711,11 +880,34 @@ public:
 		 * in [0..INT_MAX] instead of [0..1]. That way, the busyness value
 		 * of processes with concurrency > 0 is usually higher than that of processes
 		 * with concurrency == 0.
+		 * Lowering the adaptive concurrency limit may leave us with more
+		 * sessions than the limit, in which case we're simply at 100%.
+		 *
+		 * A process that is warming up counts its sessions, plus the session
+		 * that would be added, as more than they are, so that it is only
+		 * picked when the other processes are proportionally busier.
+		 * It is never made totally busy by that.
 		 */
-		if (concurrency == 0) {
+		if (OXT_UNLIKELY(warmingUp())) {
+			return warmingUpBusyness();
+		} else if (concurrencyLimit == 0) {
 			return sessions;
+		} else if (sessions >= concurrencyLimit) {
+			return INT_MAX;
+		} else {
+			return (int) (((long long) sessions * INT_MAX) / (double) concurrencyLimit);
+		}
+	}
+
+	int warmingUpBusyness() const {
+		double weightedSessions = (sessions + 1) / routingWeight - 1;
+		if (concurrencyLimit == 0) {
+			return (int) std::min<double>(INT_MAX - 1, weightedSessions);
+		} else if (sessions >= concurrencyLimit) {
+			return INT_MAX;
 		} else {
-			return (int) (((long long) sessions * INT_MAX) / (double) concurrency);
+			return (int) std::min<double>(INT_MAX - 1,
+				weightedSessions * INT_MAX / concurrencyLimit);
 		}
 	}
 
@@ -724,7 +916,7 @@ public:
 	 * process.
 	 */
 	bool isTotallyBusy() const {
-		return concurrency != 0 && sessions >= concurrency;
+		return concurrencyLimit != 0 && sessions >= concurrencyLimit;
 	}
 
 	/**
@@ -760,7 +952,10 @@ public:
 			} else {
 				lastUsed = SystemTime::getUsec();
 			}
-			return createSessionObject(socket);
+			updateWarmup(lastUsed);
+			SessionPtr session = createSessionObject(socket);
+			session->startTime = lastUsed;
+			return session;
 		}
 	}
 
@@ -801,9 +996,31 @@ public:
 		assert(sessions > 0);
 
 		socket->sessions--;
+		if (socket->sessions == 0) {
+			socket->sessionsDrained();
+		}
 		this->sessions--;
 		processed++;
-		assert(!isTotallyBusy());
+		// Sessions may outnumber a lowered adaptive concurrency limit.
+		assert(adaptiveConcurrency || !isTotallyBusy());
+	}
+
+	/**
+	 * Feeds the response time of a session that has just been closed (with
+	 * `sessionClosed()`) to the adaptive concurrency limiter. This may make
+	 * the process totally busy again.
+	 */
+	void adaptConcurrencyLimit(const Session *session, unsigned long long now) {
+		if (adaptiveConcurrency && now > session->startTime) {
+			concurrencyLimiter.update(now - session->startTime, sessions + 1);
+			concurrencyLimit = concurrencyLimiter.getLimit();
+		}
+	}
+
+	void recordResponseTime(const Session *session, unsigned long long now) {
+		if (now > session->startTime) {
+			responseTimeAverage.update(now - session->startTime, now);
+		}
 	}
 
 	/**
@@ -826,9 +1043,19 @@ public:
 		stream << "<sticky_session_id>" << getStickySessionId() << "</sticky_session_id>";
 		stream << "<gupid>" << getGupid() << "</gupid>";
 		stream << "<concurrency>" << concurrency << "</concurrency>";
+		if (adaptiveConcurrency) {
+			stream << "<concurrency_limit>" << concurrencyLimit << "</concurrency_limit>";
+		}
+		if (warmingUp()) {
+			stream << "<routing_weight>" << routingWeight << "</routing_weight>";
+		}
 		stream << "<sessions>" << sessions << "</sessions>";
 		stream << "<busyness>" << busyness() << "</busyness>";
 		stream << "<processed>" << processed << "</processed>";
+		if (responseTimeAverage.available()) {
+			stream << "<response_time_average>" << (unsigned long long) responseTimeAverage.average()
+				<< "</response_time_average>";
+		}
 		stream << "<spawner_creation_time>" << spawnerCreationTime << "</spawner_creation_time>";
 		stream << "<spawn_start_time>" << spawnStartTime << "</spawn_start_time>";
 		stream << "<spawn_end_time>" << spawnEndTime << "</spawn_end_time>";
@@ -874,6 +1101,8 @@ public:
 			stream << "<pss>" << metrics.pss << "</pss>";
 			stream << "<private_dirty>" << metrics.privateDirty << "</private_dirty>";
 			stream << "<swap>" << metrics.swap << "</swap>";
+			stream << "<shared_memory>" << metrics.shared << "</shared_memory>";
+			stream << "<private_memory>" << metrics.privateMemory << "</private_memory>";
 			stream << "<real_memory>" << metrics.realMemory() << "</real_memory>";
 			stream << "<vmsize>" << metrics.vmsize << "</vmsize>";
 			stream << "<process_group_id>" << metrics.processGroupId << "</process_group_id>";
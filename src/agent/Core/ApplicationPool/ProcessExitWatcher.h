@@ -0,0 +1,150 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_APPLICATION_POOL2_PROCESS_EXIT_WATCHER_H_
+#define _PASSENGER_APPLICATION_POOL2_PROCESS_EXIT_WATCHER_H_
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <oxt/backtrace.hpp>
+#include <ev++.h>
+#include <exception>
+
+#include <FileDescriptor.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
+#include <Constants.h>
+#include <Logging.h>
+
+namespace Passenger {
+namespace ApplicationPool2 {
+
+using namespace std;
+
+
+/**
+ * Calls a callback once a process exits, by watching the process's pidfd
+ * (see Utils/PidFd.h) on a single background event loop. This works for
+ * any process, including ones that are not our children. It does not reap
+ * the process.
+ *
+ * The detached processes checker uses this to wake up as soon as a process
+ * that it's shutting down exits, instead of polling for it.
+ */
+class ProcessExitWatcher {
+private:
+	struct Watch {
+		FileDescriptor pidFd;
+		boost::function<void ()> callback;
+		struct ev_io watcher;
+	};
+
+	BackgroundEventLoop bg;
+	boost::mutex syncher;
+	unsigned int watchCount;
+
+	static void createInstance() {
+		// Never destroyed: watched processes may exit until the very end.
+		instancePointer() = new ProcessExitWatcher();
+	}
+
+	static ProcessExitWatcher *&instancePointer() {
+		static ProcessExitWatcher *instance = NULL;
+		return instance;
+	}
+
+	static void onPidFdReadable(EV_P_ struct ev_io *io, int revents) {
+		Watch *watch = static_cast<Watch *>(io->data);
+		getInstance().onExited(watch);
+	}
+
+	ProcessExitWatcher()
+		: bg(true, false),
+		  watchCount(0)
+	{
+		bg.start("Process exit watcher", POOL_HELPER_THREAD_STACK_SIZE);
+	}
+
+	void startOnEventLoop(Watch *watch) {
+		ev_io_init(&watch->watcher, onPidFdReadable, watch->pidFd, EV_READ);
+		watch->watcher.data = watch;
+		ev_io_start(bg.libev_loop, &watch->watcher);
+	}
+
+	void onExited(Watch *watch) {
+		TRACE_POINT();
+		ev_io_stop(bg.libev_loop, &watch->watcher);
+		try {
+			watch->callback();
+		} catch (const std::exception &e) {
+			P_WARN("Error in process exit callback: " << e.what());
+		}
+		delete watch;
+
+		boost::lock_guard<boost::mutex> l(syncher);
+		watchCount--;
+	}
+
+public:
+	static ProcessExitWatcher &getInstance() {
+		static boost::once_flag flag = BOOST_ONCE_INIT;
+		boost::call_once(flag, createInstance);
+		return *instancePointer();
+	}
+
+	/**
+	 * Calls `callback` from the event loop thread once the process that
+	 * `pidFd` refers to has exited, or right away if it already has. The
+	 * pidfd is kept open until then. `callback` must not block for long;
+	 * taking the pool lock is fine.
+	 *
+	 * @pre pidFd != -1
+	 */
+	void watch(const FileDescriptor &pidFd, const boost::function<void ()> &callback) {
+		assert(pidFd != -1);
+		Watch *watch = new Watch();
+		watch->pidFd = pidFd;
+		watch->callback = callback;
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			watchCount++;
+		}
+		bg.safe->runLater(boost::bind(&ProcessExitWatcher::startOnEventLoop,
+			this, watch));
+	}
+
+	/** The number of processes that are being watched and haven't exited yet. */
+	unsigned int getWatchCount() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return watchCount;
+	}
+};
+
+
+} // namespace ApplicationPool2
+} // namespace Passenger
+
+#endif /* _PASSENGER_APPLICATION_POOL2_PROCESS_EXIT_WATCHER_H_ */
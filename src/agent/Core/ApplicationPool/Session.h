@@ -117,6 +117,8 @@ private:
 public:
 	Callback onInitiateFailure;
 	Callback onClose;
+	/** The time (in microseconds) at which this session was opened. */
+	unsigned long long startTime;
 
 	Session(Context *_context, const BasicProcessInfo *_processInfo, Socket *_socket)
 		: context(_context),
@@ -125,7 +127,8 @@ public:
 		  refcount(1),
 		  closed(false),
 		  onInitiateFailure(NULL),
-		  onClose(NULL)
+		  onClose(NULL),
+		  startTime(0)
 		{ }
 
 	~Session() {
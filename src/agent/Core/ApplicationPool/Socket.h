@@ -27,10 +27,13 @@
 #define _PASSENGER_APPLICATION_POOL_SOCKET_H_
 
 #include <vector>
+#include <poll.h>
 #include <oxt/macros.hpp>
-#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
+#include <algorithm>
 #include <climits>
 #include <cassert>
 #include <SmallVector.h>
@@ -74,15 +77,168 @@ struct Connection {
 /**
  * Not thread-safe except for the connection pooling methods, so only use
  * within the ApplicationPool lock.
+ *
+ * The connection pooling methods are lock-free. Idle connections are stored
+ * in a fixed number of slots, each holding either EMPTY_SLOT or an idle
+ * connection encoded by encodeIdleConnection(). A slot is only ever claimed
+ * with a single atomic exchange and filled with a single compare-and-swap,
+ * and no operation depends on more than one slot's value, so the pool is
+ * not subject to the ABA problem.
+ *
+ * Sessions check connections out and in without holding the ApplicationPool
+ * lock, so the slot array is only reallocated while no session uses this
+ * socket. See setConcurrency().
  */
 class Socket {
 private:
-	boost::mutex connectionPoolLock;
-	vector<Connection> idleConnections;
+	static const int EMPTY_SLOT = -1;
+
+	/**
+	 * The maximum number of idle connections kept around for sockets
+	 * with unlimited concurrency (e.g. Node.js apps).
+	 */
+	static const int UNLIMITED_CONCURRENCY_CONNECTION_POOL_LIMIT = 16;
+
+	boost::scoped_array< boost::atomic<int> > idleConnections;
+	int idleConnectionSlots;
+	/** How many slots may be filled by checkinConnection(). At most `idleConnectionSlots`. */
+	boost::atomic<int> idleConnectionLimit;
 
 	OXT_FORCE_INLINE
 	int connectionPoolLimit() const {
-		return concurrency;
+		if (concurrency == 0) {
+			return UNLIMITED_CONCURRENCY_CONNECTION_POOL_LIMIT;
+		} else {
+			return concurrency;
+		}
+	}
+
+	static int encodeIdleConnection(const Connection &connection) {
+		return (connection.fd << 1) | (int) connection.blocking;
+	}
+
+	static Connection decodeIdleConnection(int value) {
+		Connection connection;
+		connection.fd = value >> 1;
+		connection.blocking = value & 1;
+		return connection;
+	}
+
+	void allocateIdleConnectionSlots(int count) {
+		idleConnections.reset(new boost::atomic<int>[count]);
+		idleConnectionSlots = count;
+		idleConnectionLimit.store(count, boost::memory_order_relaxed);
+		for (int i = 0; i < count; i++) {
+			idleConnections[i].store(EMPTY_SLOT, boost::memory_order_relaxed);
+		}
+	}
+
+	void copyIdleConnectionSlots(const Socket &other) {
+		allocateIdleConnectionSlots(other.idleConnectionSlots);
+		for (int i = 0; i < idleConnectionSlots; i++) {
+			idleConnections[i].store(
+				other.idleConnections[i].load(boost::memory_order_relaxed),
+				boost::memory_order_relaxed);
+		}
+		idleConnectionLimit.store(
+			other.idleConnectionLimit.load(boost::memory_order_relaxed),
+			boost::memory_order_relaxed);
+	}
+
+	/**
+	 * Reallocates the slot array with `count` slots, keeping as many idle
+	 * connections as fit and closing the rest. Must only be called while no
+	 * session uses this socket.
+	 */
+	void resizeIdleConnectionSlots(int count) {
+		boost::scoped_array< boost::atomic<int> > oldIdleConnections;
+		int oldIdleConnectionSlots = idleConnectionSlots;
+		int kept = 0;
+
+		oldIdleConnections.swap(idleConnections);
+		allocateIdleConnectionSlots(count);
+		for (int i = 0; i < oldIdleConnectionSlots; i++) {
+			int value = oldIdleConnections[i].load(boost::memory_order_relaxed);
+			if (value == EMPTY_SLOT) {
+				continue;
+			} else if (kept < count) {
+				idleConnections[kept].store(value, boost::memory_order_relaxed);
+				kept++;
+			} else {
+				discardIdleConnection(value);
+			}
+		}
+	}
+
+	/**
+	 * Closes the idle connections in the slots at or beyond the limit.
+	 * Safe to call while sessions check connections out and in.
+	 */
+	void discardIdleConnectionsBeyondLimit() {
+		int limit = idleConnectionLimit.load(boost::memory_order_relaxed);
+		for (int i = limit; i < idleConnectionSlots; i++) {
+			int value = idleConnections[i].exchange(EMPTY_SLOT,
+				boost::memory_order_acquire);
+			if (value != EMPTY_SLOT) {
+				discardIdleConnection(value);
+			}
+		}
+	}
+
+	void discardIdleConnection(int value) {
+		Connection connection = decodeIdleConnection(value);
+		totalIdleConnections.fetch_sub(1, boost::memory_order_relaxed);
+		totalConnections.fetch_sub(1, boost::memory_order_relaxed);
+		try {
+			connection.close();
+		} catch (const SystemException &e) {
+			P_ERROR("Cannot close a connection with socket " << address << ": " << e.what());
+		}
+	}
+
+	bool popIdleConnection(Connection &connection) {
+		for (int i = 0; i < idleConnectionSlots; i++) {
+			if (idleConnections[i].load(boost::memory_order_relaxed) != EMPTY_SLOT) {
+				int value = idleConnections[i].exchange(EMPTY_SLOT,
+					boost::memory_order_acquire);
+				if (value != EMPTY_SLOT) {
+					totalIdleConnections.fetch_sub(1, boost::memory_order_relaxed);
+					connection = decodeIdleConnection(value);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool pushIdleConnection(const Connection &connection) {
+		int value = encodeIdleConnection(connection);
+		int limit = idleConnectionLimit.load(boost::memory_order_relaxed);
+		for (int i = 0; i < limit; i++) {
+			int expected = EMPTY_SLOT;
+			if (idleConnections[i].load(boost::memory_order_relaxed) == EMPTY_SLOT
+			 && idleConnections[i].compare_exchange_strong(expected, value,
+				boost::memory_order_release, boost::memory_order_relaxed))
+			{
+				totalIdleConnections.fetch_add(1, boost::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * An idle connection must not be readable: the app is not supposed to
+	 * send anything before we send a request. If it is readable then the
+	 * app has closed it (e.g. because of an HTTP keep-alive timeout) or
+	 * the connection is in an otherwise unusable state.
+	 */
+	static bool isStale(const Connection &connection) {
+		struct pollfd pfd;
+		pfd.fd = connection.fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		return poll(&pfd, 1, 0) != 0;
 	}
 
 	Connection connect() const {
@@ -105,16 +261,21 @@ public:
 	int concurrency;
 
 	// Private. In public section as alignment optimization.
-	int totalConnections;
-	int totalIdleConnections;
+	boost::atomic<int> totalConnections;
+	boost::atomic<int> totalIdleConnections;
 
 	/** Invariant: sessions >= 0 */
 	int sessions;
 
 	Socket()
 		: pid(-1),
-		  concurrency(0)
-		{ }
+		  concurrency(0),
+		  totalConnections(0),
+		  totalIdleConnections(0),
+		  sessions(0)
+	{
+		allocateIdleConnectionSlots(connectionPoolLimit());
+	}
 
 	Socket(pid_t _pid, const StaticString &_name, const StaticString &_address,
 		const StaticString &_protocol, int _concurrency)
@@ -126,33 +287,71 @@ public:
 		  totalConnections(0),
 		  totalIdleConnections(0),
 		  sessions(0)
-		{ }
+	{
+		allocateIdleConnectionSlots(connectionPoolLimit());
+	}
 
 	Socket(const Socket &other)
-		: idleConnections(other.idleConnections),
-		  name(other.name),
+		: name(other.name),
 		  address(other.address),
 		  protocol(other.protocol),
 		  pid(other.pid),
 		  concurrency(other.concurrency),
-		  totalConnections(other.totalConnections),
-		  totalIdleConnections(other.totalIdleConnections),
+		  totalConnections(other.totalConnections.load(boost::memory_order_relaxed)),
+		  totalIdleConnections(other.totalIdleConnections.load(boost::memory_order_relaxed)),
 		  sessions(other.sessions)
-		{ }
+	{
+		copyIdleConnectionSlots(other);
+	}
 
 	Socket &operator=(const Socket &other) {
-		totalConnections = other.totalConnections;
-		totalIdleConnections = other.totalIdleConnections;
-		idleConnections = other.idleConnections;
-		name = other.name;
-		address = other.address;
-		protocol = other.protocol;
-		pid = other.pid;
-		concurrency = other.concurrency;
-		sessions = other.sessions;
+		if (this != &other) {
+			copyIdleConnectionSlots(other);
+			totalConnections.store(other.totalConnections.load(boost::memory_order_relaxed),
+				boost::memory_order_relaxed);
+			totalIdleConnections.store(other.totalIdleConnections.load(boost::memory_order_relaxed),
+				boost::memory_order_relaxed);
+			name = other.name;
+			address = other.address;
+			protocol = other.protocol;
+			pid = other.pid;
+			concurrency = other.concurrency;
+			sessions = other.sessions;
+		}
 		return *this;
 	}
 
+	/**
+	 * Changes the concurrency, and with it the number of idle connections
+	 * that are kept around. Idle connections beyond the new limit are closed.
+	 *
+	 * If sessions are open, the slot array can't be reallocated yet: the
+	 * limit is then capped to the current number of slots, and the array is
+	 * resized by sessionsDrained() once the last session has closed.
+	 */
+	void setConcurrency(int value) {
+		concurrency = value;
+		if (sessions == 0) {
+			resizeIdleConnectionSlots(connectionPoolLimit());
+		} else {
+			idleConnectionLimit.store(std::min(connectionPoolLimit(), idleConnectionSlots),
+				boost::memory_order_relaxed);
+			discardIdleConnectionsBeyondLimit();
+		}
+	}
+
+	/**
+	 * Must be called when the last session of this socket has been closed.
+	 * Finishes resizing the connection pool if setConcurrency() was called
+	 * while sessions were open.
+	 */
+	void sessionsDrained() {
+		assert(sessions == 0);
+		if (OXT_UNLIKELY(idleConnectionSlots != connectionPoolLimit())) {
+			resizeIdleConnectionSlots(connectionPoolLimit());
+		}
+	}
+
 	/**
 	 * Connect to this socket or reuse an existing connection.
 	 *
@@ -160,62 +359,57 @@ public:
 	 * Failure to do so will result in a resource leak.
 	 */
 	Connection checkoutConnection() {
-		boost::unique_lock<boost::mutex> l(connectionPoolLock);
-
-		if (!idleConnections.empty()) {
-			P_TRACE(3, "Socket " << address << ": checking out connection from connection pool (" <<
-				idleConnections.size() << " -> " << (idleConnections.size() - 1) <<
-				" items). Current total number of connections: " << totalConnections);
-			Connection connection = idleConnections.back();
-			idleConnections.pop_back();
-			totalIdleConnections--;
-			return connection;
-		} else {
-			Connection connection = connect();
-			totalConnections++;
-			P_TRACE(3, "Socket " << address << ": there are now " <<
-				totalConnections << " total connections");
-			l.unlock();
+		Connection connection;
+
+		while (popIdleConnection(connection)) {
+			if (OXT_UNLIKELY(isStale(connection))) {
+				totalConnections.fetch_sub(1, boost::memory_order_relaxed);
+				P_TRACE(3, "Socket " << address << ": discarding stale connection from "
+					"connection pool. There are now " << totalConnections.load() <<
+					" connections in total");
+				connection.close();
+				continue;
+			}
+			P_TRACE(3, "Socket " << address << ": checked out connection from connection pool. "
+				"Current total number of connections: " << totalConnections.load());
 			return connection;
 		}
+
+		connection = connect();
+		totalConnections.fetch_add(1, boost::memory_order_relaxed);
+		P_TRACE(3, "Socket " << address << ": there are now " <<
+			totalConnections.load() << " total connections");
+		return connection;
 	}
 
 	void checkinConnection(Connection &connection) {
-		boost::unique_lock<boost::mutex> l(connectionPoolLock);
-
-		if (connection.fail || !connection.wantKeepAlive || totalIdleConnections >= connectionPoolLimit()) {
-			totalConnections--;
-			assert(totalConnections >= 0);
+		if (connection.fail || !connection.wantKeepAlive || !pushIdleConnection(connection)) {
+			totalConnections.fetch_sub(1, boost::memory_order_relaxed);
+			assert(totalConnections.load() >= 0);
 			P_TRACE(3, "Socket " << address << ": connection not checked back into "
-				"connection pool. There are now " << totalConnections <<
+				"connection pool. There are now " << totalConnections.load() <<
 				" connections in total");
-			l.unlock();
 			connection.close();
 		} else {
-			P_TRACE(3, "Socket " << address << ": checking in connection into connection pool (" <<
-				totalIdleConnections << " -> " << (totalIdleConnections + 1) <<
-				" items). Current total number of connections: " << totalConnections);
-			totalIdleConnections++;
-			idleConnections.push_back(connection);
+			P_TRACE(3, "Socket " << address << ": checked in connection into connection pool. "
+				"Current total number of connections: " << totalConnections.load());
 		}
 	}
 
 	void closeAllConnections() {
-		boost::unique_lock<boost::mutex> l(connectionPoolLock);
 		assert(sessions == 0);
-		assert(totalConnections == totalIdleConnections);
-		vector<Connection>::iterator it, end = idleConnections.end();
+		assert(totalConnections.load() == totalIdleConnections.load());
+		Connection connection;
 
-		for (it = idleConnections.begin(); it != end; it++) {
+		while (popIdleConnection(connection)) {
 			try {
-				it->close();
+				connection.close();
 			} catch (const SystemException &e) {
 				P_ERROR("Cannot close a connection with socket " << address << ": " << e.what());
 			}
 		}
-		idleConnections.clear();
-		totalConnections = 0;
-		totalIdleConnections = 0;
+		totalConnections.store(0, boost::memory_order_relaxed);
+		totalIdleConnections.store(0, boost::memory_order_relaxed);
 	}
 
 
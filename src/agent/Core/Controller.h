@@ -130,10 +130,24 @@ private:
 	bool showVersionInHeader: 1;
 	bool stickySessions: 1;
 	bool gracefulExit: 1;
+	bool appKeepAlive: 1;
 
 	const VariantMap *agentsOptions;
 	psg_pool_t *stringPool;
 	StringKeyTable< boost::shared_ptr<Options> > poolOptionsCache;
+	/** In single-app mode, a handle to the only Group in the pool. Allows
+	 * checking out sessions without looking up the group. May be NULL if
+	 * the group doesn't exist (yet).
+	 */
+	GroupPtr singleAppGroup;
+	/** The error page that was rendered for `lastCircuitOpenException`. As long
+	 * as a group's circuit breaker stays open, all requests for that group fail
+	 * with the same exception object, so the page doesn't have to be rendered
+	 * again for each one of them.
+	 */
+	boost::shared_ptr<SpawnCircuitOpenException> lastCircuitOpenException;
+	string lastCircuitOpenErrorPage;
+	bool lastCircuitOpenErrorPageFriendly;
 
 	StaticString defaultRuby;
 	StaticString ustRouterAddress;
@@ -153,6 +167,7 @@ private:
 	HashedStaticString PASSENGER_STICKY_SESSIONS;
 	HashedStaticString PASSENGER_STICKY_SESSIONS_COOKIE_NAME;
 	HashedStaticString PASSENGER_REQUEST_OOB_WORK;
+	HashedStaticString PASSENGER_REQUEST_PRIORITY;
 	HashedStaticString UNION_STATION_SUPPORT;
 	HashedStaticString REMOTE_ADDR;
 	HashedStaticString REMOTE_PORT;
@@ -208,6 +223,7 @@ private:
 		const HashedStaticString &appGroupName);
 	void initializeUnionStation(Client *client, Request *req, RequestAnalysis &analysis);
 	void setStickySessionId(Client *client, Request *req);
+	void setRequestPriority(Client *client, Request *req);
 	const LString *getStickySessionCookieName(Request *req);
 
 
@@ -235,12 +251,18 @@ private:
 		const ExceptionPtr &e);
 	void writeRequestQueueFullExceptionErrorResponse(Client *client,
 		Request *req, const boost::shared_ptr<RequestQueueFullException> &e);
+	void writeRequestQueueTimeoutExceptionErrorResponse(Client *client,
+		Request *req, const boost::shared_ptr<RequestQueueTimeoutException> &e);
 	void writeSpawnExceptionErrorResponse(Client *client, Request *req,
 		const boost::shared_ptr<SpawnException> &e);
+	void writeSpawnCircuitOpenExceptionErrorResponse(Client *client, Request *req,
+		const boost::shared_ptr<SpawnCircuitOpenException> &e);
 	void writeOtherExceptionErrorResponse(Client *client, Request *req,
 		const ExceptionPtr &e);
 	void endRequestWithErrorResponse(Client **c, Request **r,
 		const StaticString &message, const SpawnException *e = NULL);
+	string renderErrorPage(Client *client, Request *req, const StaticString &message,
+		const SpawnException *e, bool friendly);
 	bool friendlyErrorPagesEnabled(Request *req);
 
 
@@ -252,10 +274,11 @@ private:
 	void sendHeaderToApp(Client *client, Request *req);
 	void sendHeaderToAppWithSessionProtocol(Client *client, Request *req);
 	static void sendBodyToAppWhenAppSinkIdle(Channel *_channel, unsigned int size);
-	unsigned int determineHeaderSizeForSessionProtocol(Request *req,
-		SessionProtocolWorkingState &state, string delta_monotonic);
+	void prepareSessionProtocolWorkingState(Request *req,
+		SessionProtocolWorkingState &state);
 	bool constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-		unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic);
+		unsigned int &size, const SessionProtocolWorkingState &state,
+		const string &delta_monotonic);
 	void sendHeaderToAppWithHttpProtocol(Client *client, Request *req);
 	bool constructHeaderBuffersForHttpProtocol(Request *req, struct iovec *buffers,
 		unsigned int maxbuffers, unsigned int & restrict_ref nbuffers,
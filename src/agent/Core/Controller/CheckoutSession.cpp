@@ -83,10 +83,26 @@ Controller::checkoutSession(Client *client, Request *req) {
 
 void
 Controller::asyncGetFromApplicationPool(Request *req, ApplicationPool2::GetCallback callback) {
-	appPool->asyncGet(req->options, callback, true,
-		req->useUnionStation()
+	UnionStation::StopwatchLog **stopwatchLog = req->useUnionStation()
 		? &req->stopwatchLogs.getFromPool
-		: NULL);
+		: NULL;
+
+	if (singleAppMode) {
+		if (singleAppGroup == NULL || !singleAppGroup->isAlive()) {
+			singleAppGroup = appPool->findGroupByName(req->options.getAppGroupName());
+		}
+		// Try to check out a session directly from the group. If that
+		// requires spawning or queueing then fall back to the normal path.
+		if (singleAppGroup != NULL
+		 && singleAppGroup->hasRoutableProcessesHint()
+		 && appPool->asyncGetFromGroupQuickly(singleAppGroup, req->options,
+			callback, stopwatchLog))
+		{
+			return;
+		}
+	}
+
+	appPool->asyncGet(req->options, callback, true, stopwatchLog);
 }
 
 void
@@ -241,6 +257,22 @@ Controller::reportSessionCheckoutError(Client *client, Request *req,
 			return;
 		}
 	}
+	{
+		boost::shared_ptr<RequestQueueTimeoutException> e2 =
+			dynamic_pointer_cast<RequestQueueTimeoutException>(e);
+		if (e2 != NULL) {
+			writeRequestQueueTimeoutExceptionErrorResponse(client, req, e2);
+			return;
+		}
+	}
+	{
+		boost::shared_ptr<SpawnCircuitOpenException> e2 =
+			dynamic_pointer_cast<SpawnCircuitOpenException>(e);
+		if (e2 != NULL) {
+			writeSpawnCircuitOpenExceptionErrorResponse(client, req, e2);
+			return;
+		}
+	}
 	{
 		boost::shared_ptr<SpawnException> e2 = dynamic_pointer_cast<SpawnException>(e);
 		if (e2 != NULL) {
@@ -275,6 +307,20 @@ Controller::writeRequestQueueFullExceptionErrorResponse(Client *client, Request
 		requestQueueOverflowStatusCode);
 }
 
+void
+Controller::writeRequestQueueTimeoutExceptionErrorResponse(Client *client, Request *req,
+	const boost::shared_ptr<RequestQueueTimeoutException> &e)
+{
+	TRACE_POINT();
+	SKC_WARN(client, "Returning HTTP 503 due to: " << e->what());
+
+	endRequestWithSimpleResponse(&client, &req,
+		"<h2>This website is under heavy load (queue timeout)</h2>"
+		"<p>We're sorry, too many people are accessing this website at the same "
+		"time. We're working on this problem. Please try again later.</p>",
+		503);
+}
+
 void
 Controller::writeSpawnExceptionErrorResponse(Client *client, Request *req,
 	const boost::shared_ptr<SpawnException> &e)
@@ -286,6 +332,24 @@ Controller::writeSpawnExceptionErrorResponse(Client *client, Request *req,
 	endRequestWithErrorResponse(&client, &req, e->getErrorPage(), e.get());
 }
 
+void
+Controller::writeSpawnCircuitOpenExceptionErrorResponse(Client *client, Request *req,
+	const boost::shared_ptr<SpawnCircuitOpenException> &e)
+{
+	TRACE_POINT();
+	SKC_WARN(client, "Returning HTTP 503 due to: " << e->what());
+
+	bool friendly = friendlyErrorPagesEnabled(req);
+	if (e != lastCircuitOpenException || friendly != lastCircuitOpenErrorPageFriendly) {
+		lastCircuitOpenErrorPage = renderErrorPage(client, req, e->getErrorPage(),
+			e.get(), friendly);
+		lastCircuitOpenException = e;
+		lastCircuitOpenErrorPageFriendly = friendly;
+	}
+	endRequestWithSimpleResponse(&client, &req,
+		psg_pstrdup(req->pool, lastCircuitOpenErrorPage), 503);
+}
+
 void
 Controller::writeOtherExceptionErrorResponse(Client *client, Request *req, const ExceptionPtr &e) {
 	TRACE_POINT();
@@ -350,10 +414,19 @@ Controller::endRequestWithErrorResponse(Client **c, Request **r, const StaticStr
 	TRACE_POINT();
 	Client *client = *c;
 	Request *req = *r;
+	string data = renderErrorPage(client, req, message, e,
+		friendlyErrorPagesEnabled(req));
+	endRequestWithSimpleResponse(c, r, psg_pstrdup(req->pool, data), 500);
+}
+
+string
+Controller::renderErrorPage(Client *client, Request *req, const StaticString &message,
+	const SpawnException *e, bool friendly)
+{
 	ErrorRenderer renderer(*resourceLocator);
 	string data;
 
-	if (friendlyErrorPagesEnabled(req)) {
+	if (friendly) {
 		try {
 			data = renderer.renderWithDetails(message, req->options, e);
 		} catch (const SystemException &e2) {
@@ -371,7 +444,7 @@ Controller::endRequestWithErrorResponse(Client **c, Request **r, const StaticStr
 		}
 	}
 
-	endRequestWithSimpleResponse(c, r, psg_pstrdup(req->pool, data), 500);
+	return data;
 }
 
 bool
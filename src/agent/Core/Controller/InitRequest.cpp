@@ -208,9 +208,23 @@ Controller::fillPoolOptionsFromAgentsOptions(Options &options) {
 	options.minProcesses = agentsOptions->getInt("min_instances");
 	options.maxPreloaderIdleTime = agentsOptions->getInt("max_preloader_idle_time");
 	options.maxRequestQueueSize = agentsOptions->getInt("max_request_queue_size");
+	options.maxRequestQueueTime = agentsOptions->getUint("max_request_queue_time", false, 0);
+	options.adaptiveLifo = agentsOptions->getBool("request_queue_adaptive_lifo", false, false);
+	options.adaptiveConcurrency = agentsOptions->getBool("adaptive_concurrency", false, false);
+	options.predictiveSpawning = agentsOptions->getBool("predictive_spawning", false, false);
+	options.warmupRequests = agentsOptions->getUint("warmup_requests", false, 0);
+	options.warmupTime = agentsOptions->getUint("warmup_time", false, 0);
+	options.warmupInitialWeight = agentsOptions->getUint("warmup_initial_weight", false, 10);
+	options.warmupUrls = agentsOptions->get("warmup_urls", false);
+	options.memoryLimit = agentsOptions->getUint("memory_limit", false, 0);
+	options.circuitBreakerThreshold = agentsOptions->getUint("circuit_breaker_threshold", false, 0);
+	options.spawnReserveSize = agentsOptions->getUint("spawn_reserve_size", false, 0);
+	options.repreloadThreshold = agentsOptions->getUint("repreload_threshold", false, 0);
+	options.spawnConcurrency = agentsOptions->getUint("spawn_concurrency", false, 1);
 	options.abortWebsocketsOnProcessShutdown = agentsOptions->getBool("abort_websockets_on_process_shutdown");
 	options.forceMaxConcurrentRequestsPerProcess = agentsOptions->getInt("force_max_concurrent_requests_per_process");
 	options.spawnMethod = agentsOptions->get("spawn_method");
+	options.routingPolicy = agentsOptions->get("routing_policy", false);
 	options.loadShellEnvvars = agentsOptions->getBool("load_shell_envvars");
 	options.statThrottleRate = statThrottleRate;
 
@@ -376,6 +390,19 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	fillPoolOptionSecToMsec(req, options.startTimeout, "!~PASSENGER_START_TIMEOUT");
 	fillPoolOption(req, options.maxPreloaderIdleTime, "!~PASSENGER_MAX_PRELOADER_IDLE_TIME");
 	fillPoolOption(req, options.maxRequestQueueSize, "!~PASSENGER_MAX_REQUEST_QUEUE_SIZE");
+	fillPoolOption(req, options.maxRequestQueueTime, "!~PASSENGER_MAX_REQUEST_QUEUE_TIME");
+	fillPoolOption(req, options.adaptiveLifo, "!~PASSENGER_REQUEST_QUEUE_ADAPTIVE_LIFO");
+	fillPoolOption(req, options.adaptiveConcurrency, "!~PASSENGER_ADAPTIVE_CONCURRENCY");
+	fillPoolOption(req, options.predictiveSpawning, "!~PASSENGER_PREDICTIVE_SPAWNING");
+	fillPoolOption(req, options.warmupRequests, "!~PASSENGER_WARMUP_REQUESTS");
+	fillPoolOption(req, options.warmupTime, "!~PASSENGER_WARMUP_TIME");
+	fillPoolOption(req, options.warmupInitialWeight, "!~PASSENGER_WARMUP_INITIAL_WEIGHT");
+	fillPoolOption(req, options.warmupUrls, "!~PASSENGER_WARMUP_URLS");
+	fillPoolOption(req, options.memoryLimit, "!~PASSENGER_MEMORY_LIMIT");
+	fillPoolOption(req, options.circuitBreakerThreshold, "!~PASSENGER_CIRCUIT_BREAKER_THRESHOLD");
+	fillPoolOption(req, options.spawnReserveSize, "!~PASSENGER_SPAWN_RESERVE_SIZE");
+	fillPoolOption(req, options.repreloadThreshold, "!~PASSENGER_REPRELOAD_THRESHOLD");
+	fillPoolOption(req, options.spawnConcurrency, "!~PASSENGER_SPAWN_CONCURRENCY");
 	fillPoolOption(req, options.abortWebsocketsOnProcessShutdown, "!~PASSENGER_ABORT_WEBSOCKETS_ON_PROCESS_SHUTDOWN");
 	fillPoolOption(req, options.forceMaxConcurrentRequestsPerProcess, "!~PASSENGER_FORCE_MAX_CONCURRENT_REQUESTS_PER_PROCESS");
 	fillPoolOption(req, options.restartDir, "!~PASSENGER_RESTART_DIR");
@@ -384,6 +411,7 @@ Controller::createNewPoolOptions(Client *client, Request *req,
 	fillPoolOption(req, options.fileDescriptorUlimit, "!~PASSENGER_APP_FILE_DESCRIPTOR_ULIMIT");
 	fillPoolOption(req, options.raiseInternalError, "!~PASSENGER_RAISE_INTERNAL_ERROR");
 	fillPoolOption(req, options.lveMinUid, "!~PASSENGER_LVE_MIN_UID");
+	fillPoolOption(req, options.routingPolicy, "!~PASSENGER_ROUTING_POLICY");
 	/******************/
 
 	boost::shared_ptr<Options> optionsCopy = boost::make_shared<Options>(options);
@@ -452,6 +480,16 @@ Controller::setStickySessionId(Client *client, Request *req) {
 	}
 }
 
+void
+Controller::setRequestPriority(Client *client, Request *req) {
+	const LString *value = req->secureHeaders.lookup(PASSENGER_REQUEST_PRIORITY);
+	if (value != NULL && value->size > 0) {
+		value = psg_lstr_make_contiguous(value, req->pool);
+		req->options.priority = stringToInt(
+			StaticString(value->start->data, value->size));
+	}
+}
+
 const LString *
 Controller::getStickySessionCookieName(Request *req) {
 	const LString *value = req->headers.lookup(PASSENGER_STICKY_SESSIONS_COOKIE_NAME);
@@ -513,6 +551,7 @@ Controller::onRequestBegin(Client *client, Request *req) {
 			return;
 		}
 		setStickySessionId(client, req);
+		setRequestPriority(client, req);
 	}
 
 	if (!req->hasBody() || !req->requestBodyBuffering) {
@@ -56,10 +56,12 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  showVersionInHeader(_agentsOptions->getBool("show_version_in_header")),
 	  stickySessions(_agentsOptions->getBool("sticky_sessions")),
 	  gracefulExit(_agentsOptions->getBool("core_graceful_exit")),
+	  appKeepAlive(_agentsOptions->getBool("app_keep_alive", false, false)),
 
 	  agentsOptions(_agentsOptions),
 	  stringPool(psg_create_pool(1024 * 4)),
 	  poolOptionsCache(4),
+	  lastCircuitOpenErrorPageFriendly(false),
 
 	  PASSENGER_APP_GROUP_NAME("!~PASSENGER_APP_GROUP_NAME"),
 	  PASSENGER_ENV_VARS("!~PASSENGER_ENV_VARS"),
@@ -68,6 +70,7 @@ Controller::Controller(ServerKit::Context *context, const VariantMap *_agentsOpt
 	  PASSENGER_STICKY_SESSIONS("!~PASSENGER_STICKY_SESSIONS"),
 	  PASSENGER_STICKY_SESSIONS_COOKIE_NAME("!~PASSENGER_STICKY_SESSIONS_COOKIE_NAME"),
 	  PASSENGER_REQUEST_OOB_WORK("!~Request-OOB-Work"),
+	  PASSENGER_REQUEST_PRIORITY("!~PASSENGER_REQUEST_PRIORITY"),
 	  UNION_STATION_SUPPORT("!~UNION_STATION_SUPPORT"),
 	  REMOTE_ADDR("!~REMOTE_ADDR"),
 	  REMOTE_PORT("!~REMOTE_PORT"),
@@ -167,33 +167,34 @@ Controller::sendHeaderToAppWithSessionProtocol(Client *client, Request *req) {
 		deltaMonotonic = boost::to_string(-diff);
 	}
 
-	unsigned int bufferSize = determineHeaderSizeForSessionProtocol(req,
-		state, deltaMonotonic);
+	prepareSessionProtocolWorkingState(req, state);
+
+	// Construct the header in a single pass, directly into an mbuf. The
+	// header almost always fits; if it doesn't, then the construction
+	// function has told us the exact size, so we retry with a buffer
+	// allocated from the request's pool.
 	MemoryKit::mbuf_pool &mbuf_pool = getContext()->mbuf_pool;
-	const unsigned int MBUF_MAX_SIZE = mbuf_pool_data_size(&mbuf_pool);
+	MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
+	unsigned int bufferSize = mbuf_pool_data_size(&mbuf_pool);
 	bool ok;
 
-	if (bufferSize <= MBUF_MAX_SIZE) {
-		MemoryKit::mbuf buffer(MemoryKit::mbuf_get(&mbuf_pool));
-		bufferSize = MBUF_MAX_SIZE;
-
-		ok = constructHeaderForSessionProtocol(req, buffer.start,
-			bufferSize, state, deltaMonotonic);
-		assert(ok);
+	ok = constructHeaderForSessionProtocol(req, buffer.start,
+		bufferSize, state, deltaMonotonic);
+	if (ok) {
 		buffer = MemoryKit::mbuf(buffer, 0, bufferSize);
 		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
 			StaticString(buffer.start, bufferSize)) << "\"");
 		req->appSink.feedWithoutRefGuard(boost::move(buffer));
 	} else {
-		char *buffer = (char *) psg_pnalloc(req->pool, bufferSize);
+		char *largeBuffer = (char *) psg_pnalloc(req->pool, bufferSize);
 
-		ok = constructHeaderForSessionProtocol(req, buffer,
+		ok = constructHeaderForSessionProtocol(req, largeBuffer,
 			bufferSize, state, deltaMonotonic);
 		assert(ok);
 		SKC_TRACE(client, 3, "Header data: \"" << cEscapeString(
-			StaticString(buffer, bufferSize)) << "\"");
+			StaticString(largeBuffer, bufferSize)) << "\"");
 		req->appSink.feedWithoutRefGuard(MemoryKit::mbuf(
-			buffer, bufferSize));
+			largeBuffer, bufferSize));
 	}
 
 	(void) ok; // Shut up compiler warning
@@ -316,12 +317,10 @@ httpHeaderToScgiUpperCase(unsigned char *data, unsigned int size) {
 	}
 }
 
-unsigned int
-Controller::determineHeaderSizeForSessionProtocol(Request *req,
-	SessionProtocolWorkingState &state, string delta_monotonic)
+void
+Controller::prepareSessionProtocolWorkingState(Request *req,
+	SessionProtocolWorkingState &state)
 {
-	unsigned int dataSize = sizeof(boost::uint32_t);
-
 	state.path        = req->getPathWithoutQueryString();
 	state.hasBaseURI  = req->options.baseURI != P_STATIC_STRING("/")
 		&& startsWith(state.path, req->options.baseURI);
@@ -358,25 +357,6 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.environmentVariablesSize = len;
 	}
 
-	dataSize += sizeof("REQUEST_URI");
-	dataSize += req->path.size + 1;
-
-	dataSize += sizeof("PATH_INFO");
-	dataSize += state.path.size() + 1;
-
-	dataSize += sizeof("SCRIPT_NAME");
-	if (state.hasBaseURI) {
-		dataSize += req->options.baseURI.size();
-	} else {
-		dataSize += sizeof("");
-	}
-
-	dataSize += sizeof("QUERY_STRING");
-	dataSize += state.queryString.size() + 1;
-
-	dataSize += sizeof("REQUEST_METHOD");
-	dataSize += state.methodStr.size() + 1;
-
 	if (req->host != NULL && req->host->size > 0) {
 		const LString *host = psg_lstr_make_contiguous(req->host, req->pool);
 		const char *sep = (const char *) memchr(host->start->data, ':', host->size);
@@ -396,86 +376,18 @@ Controller::determineHeaderSizeForSessionProtocol(Request *req,
 		state.serverName = defaultServerName;
 		state.serverPort = defaultServerPort;
 	}
-
-	dataSize += sizeof("SERVER_NAME");
-	dataSize += state.serverName.size() + 1;
-
-	dataSize += sizeof("SERVER_PORT");
-	dataSize += state.serverPort.size() + 1;
-
-	dataSize += sizeof("SERVER_SOFTWARE");
-	dataSize += serverSoftware.size() + 1;
-
-	dataSize += sizeof("SERVER_PROTOCOL");
-	dataSize += sizeof("HTTP/1.1");
-
-	dataSize += sizeof("REMOTE_ADDR");
-	if (state.remoteAddr != NULL) {
-		dataSize += state.remoteAddr->size + 1;
-	} else {
-		dataSize += sizeof("127.0.0.1");
-	}
-
-	dataSize += sizeof("REMOTE_PORT");
-	if (state.remotePort != NULL) {
-		dataSize += state.remotePort->size + 1;
-	} else {
-		dataSize += sizeof("0");
-	}
-
-	if (state.remoteUser != NULL) {
-		dataSize += sizeof("REMOTE_USER");
-		dataSize += state.remoteUser->size + 1;
-	}
-
-	if (state.contentType != NULL) {
-		dataSize += sizeof("CONTENT_TYPE");
-		dataSize += state.contentType->size + 1;
-	}
-
-	if (state.contentLength != NULL) {
-		dataSize += sizeof("CONTENT_LENGTH");
-		dataSize += state.contentLength->size + 1;
-	}
-
-	dataSize += sizeof("PASSENGER_CONNECT_PASSWORD");
-	dataSize += ApplicationPool2::ApiKey::SIZE + 1;
-
-	if (req->https) {
-		dataSize += sizeof("HTTPS");
-		dataSize += sizeof("on");
-	}
-
-	if (req->options.analytics) {
-		dataSize += sizeof("PASSENGER_TXN_ID");
-		dataSize += req->options.transaction->getTxnId().size() + 1;
-
-		dataSize += sizeof("PASSENGER_DELTA_MONOTONIC");
-		dataSize += delta_monotonic.size() + 1;
-	}
-
-	if (req->upgraded()) {
-		dataSize += sizeof("HTTP_CONNECTION");
-		dataSize += sizeof("upgrade");
-	}
-
-	ServerKit::HeaderTable::Iterator it(req->headers);
-	while (*it != NULL) {
-		dataSize += sizeof("HTTP_") - 1 + it->header->key.size + 1;
-		dataSize += it->header->val.size + 1;
-		it.next();
-	}
-
-	if (state.environmentVariablesData != NULL) {
-		dataSize += state.environmentVariablesSize;
-	}
-
-	return dataSize + 1;
 }
 
+/**
+ * Constructs the session protocol header into the given buffer in a single pass.
+ * `size` is the buffer's capacity on input. On output it is set to the total
+ * number of bytes that the header requires, even if the buffer turned out to be
+ * too small. Returns whether the header fit in the buffer.
+ */
 bool
 Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buffer,
-	unsigned int &size, const SessionProtocolWorkingState &state, string delta_monotonic)
+	unsigned int &size, const SessionProtocolWorkingState &state,
+	const string &delta_monotonic)
 {
 	char *pos = buffer;
 	const char *end = buffer + size;
@@ -581,8 +493,6 @@ Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buff
 
 	ServerKit::HeaderTable::Iterator it(req->headers);
 	while (*it != NULL) {
-		// This header-skipping is not accounted for in determineHeaderSizeForSessionProtocol(), but
-		// since we are only reducing the size it just wastes some mem bytes.
 		if ((
 				(it->header->hash == HTTP_CONTENT_LENGTH.hash()
 						|| it->header->hash == HTTP_CONTENT_TYPE.hash()
@@ -603,7 +513,11 @@ Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buff
 		while (part != NULL) {
 			char *start = pos;
 			pos = appendData(pos, end, part->data, part->size);
-			httpHeaderToScgiUpperCase((unsigned char *) start, pos - start);
+			if (start < end) {
+				// appendData() only copies what fits, so only convert that.
+				httpHeaderToScgiUpperCase((unsigned char *) start,
+					std::min<const char *>(pos, end) - start);
+			}
 			part = part->next;
 		}
 		pos = appendData(pos, end, "", 1);
@@ -622,10 +536,13 @@ Controller::constructHeaderForSessionProtocol(Request *req, char * restrict buff
 		pos = appendData(pos, end, state.environmentVariablesData, state.environmentVariablesSize);
 	}
 
-	Uint32Message::generate(buffer, pos - buffer - sizeof(boost::uint32_t));
-
 	size = pos - buffer;
-	return pos < end;
+	if (pos <= end) {
+		Uint32Message::generate(buffer, pos - buffer - sizeof(boost::uint32_t));
+		return true;
+	} else {
+		return false;
+	}
 }
 
 void
@@ -744,6 +661,10 @@ Controller::constructHeaderBuffersForHttpProtocol(Request *req, struct iovec *bu
 
 	if (req->upgraded()) {
 		PUSH_STATIC_BUFFER(" HTTP/1.1\r\nConnection: upgrade\r\n");
+	} else if (appKeepAlive) {
+		// The app connection is checked back into the Socket's connection
+		// pool if the app's response allows keep-alive.
+		PUSH_STATIC_BUFFER(" HTTP/1.1\r\nConnection: keep-alive\r\n");
 	} else {
 		PUSH_STATIC_BUFFER(" HTTP/1.1\r\nConnection: close\r\n");
 	}
@@ -649,6 +649,7 @@ initializeNonPrivilegedWorkingObjects() {
 	wo->spawningKitConfig->unionStationContext = wo->unionStationContext;
 	wo->spawningKitConfig->randomGenerator = wo->randomGenerator;
 	wo->spawningKitConfig->instanceDir = options.get("instance_dir", false);
+	wo->spawningKitConfig->appOutputRateLimit = options.getUint("app_output_rate_limit", false, 0);
 	if (!wo->spawningKitConfig->instanceDir.empty()) {
 		wo->spawningKitConfig->instanceDir = absolutizePath(
 			wo->spawningKitConfig->instanceDir);
@@ -661,6 +662,7 @@ initializeNonPrivilegedWorkingObjects() {
 	wo->appPool->initialize();
 	wo->appPool->setMax(options.getInt("max_pool_size"));
 	wo->appPool->setMaxIdleTime(options.getInt("pool_idle_time") * 1000000ULL);
+	wo->appPool->setMaxConcurrentSpawns(options.getUint("max_concurrent_spawns"));
 	wo->appPool->enableSelfChecking(options.getBool("selfchecks"));
 	wo->appPool->abortLongRunningConnectionsCallback = abortLongRunningConnections;
 
@@ -1172,6 +1174,7 @@ setAgentsOptionsDefaults() {
 	options.setDefaultBool("multi_app", false);
 	options.setDefault("environment", DEFAULT_APP_ENV);
 	options.setDefault("spawn_method", DEFAULT_SPAWN_METHOD);
+	options.setDefault("routing_policy", "least_busy");
 	options.setDefaultBool("load_shell_envvars", false);
 	options.setDefaultBool("abort_websockets_on_process_shutdown", true);
 	options.setDefaultInt("force_max_concurrent_requests_per_process", -1);
@@ -1182,6 +1185,20 @@ setAgentsOptionsDefaults() {
 	options.setDefaultInt("min_instances", 1);
 	options.setDefaultInt("max_preloader_idle_time", DEFAULT_MAX_PRELOADER_IDLE_TIME);
 	options.setDefaultUint("max_request_queue_size", DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	options.setDefaultUint("max_request_queue_time", 0);
+	options.setDefaultBool("request_queue_adaptive_lifo", false);
+	options.setDefaultBool("adaptive_concurrency", false);
+	options.setDefaultBool("predictive_spawning", false);
+	options.setDefaultUint("warmup_requests", 0);
+	options.setDefaultUint("warmup_time", 0);
+	options.setDefaultUint("warmup_initial_weight", 10);
+	options.setDefaultUint("memory_limit", 0);
+	options.setDefaultUint("circuit_breaker_threshold", 0);
+	options.setDefaultUint("spawn_reserve_size", 0);
+	options.setDefaultUint("repreload_threshold", 0);
+	options.setDefaultUint("spawn_concurrency", 1);
+	options.setDefaultUint("max_concurrent_spawns", 0);
+	options.setDefaultUint("app_output_rate_limit", 0);
 	options.setDefaultUint("stat_throttle_rate", DEFAULT_STAT_THROTTLE_RATE);
 	options.setDefault("server_software", SERVER_TOKEN_NAME "/" PASSENGER_VERSION);
 	options.setDefaultBool("show_version_in_header", true);
@@ -1193,6 +1210,7 @@ setAgentsOptionsDefaults() {
 	options.setDefaultInt("response_buffer_high_watermark", DEFAULT_RESPONSE_BUFFER_HIGH_WATERMARK);
 	options.setDefaultBool("selfchecks", false);
 	options.setDefaultBool("core_graceful_exit", true);
+	options.setDefaultBool("app_keep_alive", false);
 	options.setDefaultInt("core_threads", boost::thread::hardware_concurrency());
 	options.setDefaultBool("core_cpu_affine", false);
 	options.setDefault("friendly_error_pages", "auto");
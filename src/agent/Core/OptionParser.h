@@ -158,6 +158,54 @@ coreUsage() {
 	printf("      --max-request-queue-size NUMBER\n");
 	printf("                            Specify request queue size. Default: %d\n",
 		DEFAULT_MAX_REQUEST_QUEUE_SIZE);
+	printf("      --max-request-queue-time MSEC\n");
+	printf("                            Respond with 503 to requests that waited in the\n");
+	printf("                            queue for longer than this. Default: unlimited\n");
+	printf("      --request-queue-adaptive-lifo\n");
+	printf("                            Serve the newest queued requests first while the\n");
+	printf("                            request queue is at least half full\n");
+	printf("      --spawn-concurrency NUMBER\n");
+	printf("                            Maximum number of processes per application that\n");
+	printf("                            may be spawned at the same time. Default: 1\n");
+	printf("      --max-concurrent-spawns NUMBER\n");
+	printf("                            Maximum number of processes that may be spawned\n");
+	printf("                            at the same time, over all applications.\n");
+	printf("                            Default: 0 (unlimited)\n");
+	printf("      --adaptive-concurrency\n");
+	printf("                            Adapt the number of concurrent requests per\n");
+	printf("                            process to the process's response times\n");
+	printf("      --predictive-spawning Spawn processes ahead of time based on a forecast\n");
+	printf("                            of the request rate\n");
+	printf("      --warmup-requests NUMBER\n");
+	printf("                            Give new processes a reduced share of the traffic\n");
+	printf("                            until they have handled this many requests.\n");
+	printf("                            Default: 0 (no warm-up)\n");
+	printf("      --warmup-time SECONDS Give new processes a reduced share of the traffic\n");
+	printf("                            for this many seconds. Default: 0 (no warm-up)\n");
+	printf("      --warmup-initial-weight PERCENTAGE\n");
+	printf("                            The share of traffic that new processes start with\n");
+	printf("                            while warming up, relative to the other processes.\n");
+	printf("                            Default: 10\n");
+	printf("      --warmup-urls URIS    Space-separated URIs to request from every new\n");
+	printf("                            process before it is given traffic\n");
+	printf("      --memory-limit MB     Gracefully replace processes that use more than\n");
+	printf("                            this much memory. Default: 0 (unlimited)\n");
+	printf("      --circuit-breaker-threshold NUMBER\n");
+	printf("                            Stop spawning for a while, and fail requests\n");
+	printf("                            immediately with 503, after this many consecutive\n");
+	printf("                            spawn failures. Default: 0 (disabled)\n");
+	printf("      --spawn-reserve-size NUMBER\n");
+	printf("                            Keep this many idle processes forked off each\n");
+	printf("                            preloader, ready to be handed out immediately.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --repreload-threshold PERCENTAGE\n");
+	printf("                            Restart the preloader, and gradually replace its\n");
+	printf("                            processes, when they share less than this\n");
+	printf("                            percentage of their memory on average.\n");
+	printf("                            Default: 0 (disabled)\n");
+	printf("      --routing-policy NAME How to choose among an application's processes:\n");
+	printf("                            'least_busy', 'least_latency' or\n");
+	printf("                            'power_of_two_choices'. Default: least_busy\n");
 	printf("      --sticky-sessions     Enable sticky sessions\n");
 	printf("      --sticky-sessions-cookie-name NAME\n");
 	printf("                            Cookie name to use for sticky sessions.\n");
@@ -166,6 +214,9 @@ coreUsage() {
 	printf("                            Vary the turbocache by the cookie of the given name\n");
 	printf("      --disable-turbocaching\n");
 	printf("                            Disable turbocaching\n");
+	printf("      --app-keep-alive      Keep connections to apps that speak HTTP alive\n");
+	printf("                            between requests, instead of reconnecting for\n");
+	printf("                            every request\n");
 	printf("      --no-abort-websockets-on-process-shutdown\n");
 	printf("                            Do not abort WebSocket connections on process\n");
 	printf("                            shutdown or restart\n");
@@ -174,6 +225,10 @@ coreUsage() {
 	printf("      --log-file PATH       Log to the given file.\n");
 	printf("      --log-level LEVEL     Logging level. Default: %d\n", DEFAULT_LOG_LEVEL);
 	printf("      --fd-log-file PATH    Log file descriptor activity to the given file.\n");
+	printf("      --app-output-rate-limit LINES\n");
+	printf("                            Log at most this many lines of output per second\n");
+	printf("                            for each application process. Default: 0\n");
+	printf("                            (unlimited)\n");
 	printf("      --stat-throttle-rate SECONDS\n");
 	printf("                            Throttle filesystem restart.txt checks to at most\n");
 	printf("                            once per given seconds. Default: %d\n", DEFAULT_STAT_THROTTLE_RATE);
@@ -339,6 +394,51 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-request-queue-size")) {
 		options.setInt("max_request_queue_size", atoi(argv[i + 1]));
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-request-queue-time")) {
+		options.setUint("max_request_queue_time", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--request-queue-adaptive-lifo")) {
+		options.setBool("request_queue_adaptive_lifo", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spawn-concurrency")) {
+		options.setUint("spawn_concurrency", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--max-concurrent-spawns")) {
+		options.setUint("max_concurrent_spawns", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isFlag(argv[i], '\0', "--adaptive-concurrency")) {
+		options.setBool("adaptive_concurrency", true);
+		i++;
+	} else if (p.isFlag(argv[i], '\0', "--predictive-spawning")) {
+		options.setBool("predictive_spawning", true);
+		i++;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-requests")) {
+		options.setUint("warmup_requests", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-time")) {
+		options.setUint("warmup_time", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-initial-weight")) {
+		options.setUint("warmup_initial_weight", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--warmup-urls")) {
+		options.set("warmup_urls", argv[i + 1]);
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--memory-limit")) {
+		options.setUint("memory_limit", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--circuit-breaker-threshold")) {
+		options.setUint("circuit_breaker_threshold", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--spawn-reserve-size")) {
+		options.setUint("spawn_reserve_size", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--repreload-threshold")) {
+		options.setUint("repreload_threshold", atoi(argv[i + 1]));
+		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--routing-policy")) {
+		options.set("routing_policy", argv[i + 1]);
+		i += 2;
 	} else if (p.isFlag(argv[i], '\0', "--sticky-sessions")) {
 		options.setBool("sticky_sessions", true);
 		i++;
@@ -351,6 +451,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 	} else if (p.isFlag(argv[i], '\0', "--disable-turbocaching")) {
 		options.setBool("turbocaching", false);
 		i++;
+	} else if (p.isFlag(argv[i], '\0', "--app-keep-alive")) {
+		options.setBool("app_keep_alive", true);
+		i++;
 	} else if (p.isFlag(argv[i], '\0', "--no-abort-websockets-on-process-shutdown")) {
 		options.setBool("abort_websockets_on_process_shutdown", false);
 		i++;
@@ -393,6 +496,9 @@ parseCoreOption(int argc, const char *argv[], int &i, VariantMap &options) {
 		// the Watchdog, we don't want to affect the Watchdog's own log file.
 		options.set("core_file_descriptor_log_file", argv[i + 1]);
 		i += 2;
+	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--app-output-rate-limit")) {
+		options.setUint("app_output_rate_limit", atoi(argv[i + 1]));
+		i += 2;
 	} else if (p.isValueFlag(argc, i, argv[i], '\0', "--stat-throttle-rate")) {
 		options.setInt("stat_throttle_rate", atoi(argv[i + 1]));
 		i += 2;
@@ -31,6 +31,7 @@
 #include <boost/foreach.hpp>
 #include <oxt/backtrace.hpp>
 #include <oxt/system_calls.hpp>
+#include <ev++.h>
 #include <string>
 #include <vector>
 #include <cstring>
@@ -42,6 +43,7 @@
 #include <StaticString.h>
 #include <Utils.h>
 #include <Utils/StrIntUtils.h>
+#include <Core/SpawningKit/EventLoop.h>
 
 namespace Passenger {
 namespace SpawningKit {
@@ -50,10 +52,12 @@ using namespace std;
 
 
 /**
- * Given a file descriptor, captures its output in a background thread
- * and also forwards it immediately to a target file descriptor.
- * Call stop() to stop the background thread and to obtain the captured
- * output so far.
+ * Given a file descriptor, captures its output in the background
+ * and also forwards it immediately to the log file.
+ * Call stop() to stop capturing and to obtain the captured output so far.
+ *
+ * All BackgroundIOCapturers run on the spawn EventLoop, so that spawning
+ * doesn't need an extra thread per spawn in progress.
  */
 class BackgroundIOCapturer {
 private:
@@ -62,65 +66,85 @@ private:
 	const char *channelName;
 	boost::mutex dataSyncher;
 	string data;
-	oxt::thread *thr;
+	struct ev_io watcher;
+	bool started;
+
+	static void onReadable(EV_P_ struct ev_io *io, int revents) {
+		BackgroundIOCapturer *self = static_cast<BackgroundIOCapturer *>(io->data);
+		self->capture();
+	}
 
 	void capture() {
 		TRACE_POINT();
-		while (!boost::this_thread::interruption_requested()) {
-			char buf[1024 * 8];
-			ssize_t ret;
-
+		char buf[1024 * 8];
+		ssize_t ret;
+
+		ret = syscalls::read(fd, buf, sizeof(buf));
+		int e = errno;
+		if (ret == 0) {
+			stopWatcher();
+		} else if (ret == -1) {
+			if (e != EAGAIN && e != EWOULDBLOCK && e != EINTR) {
+				P_WARN("Background I/O capturer error: " <<
+					strerror(e) << " (errno=" << e << ")");
+				stopWatcher();
+			}
+		} else {
+			{
+				boost::lock_guard<boost::mutex> l(dataSyncher);
+				data.append(buf, ret);
+			}
 			UPDATE_TRACE_POINT();
-			ret = syscalls::read(fd, buf, sizeof(buf));
-			int e = errno;
-			boost::this_thread::disable_syscall_interruption dsi;
-			if (ret == 0) {
-				break;
-			} else if (ret == -1) {
-				if (e != EAGAIN && e != EWOULDBLOCK) {
-					P_WARN("Background I/O capturer error: " <<
-						strerror(e) << " (errno=" << e << ")");
-					break;
-				}
+			if (ret == 1 && buf[0] == '\n') {
+				printAppOutput(pid, channelName, "", 0);
 			} else {
-				{
-					boost::lock_guard<boost::mutex> l(dataSyncher);
-					data.append(buf, ret);
+				vector<StaticString> lines;
+				if (ret > 0 && buf[ret - 1] == '\n') {
+					ret--;
 				}
-				UPDATE_TRACE_POINT();
-				if (ret == 1 && buf[0] == '\n') {
-					printAppOutput(pid, channelName, "", 0);
-				} else {
-					vector<StaticString> lines;
-					if (ret > 0 && buf[ret - 1] == '\n') {
-						ret--;
-					}
-					split(StaticString(buf, ret), '\n', lines);
-					foreach (const StaticString line, lines) {
-						printAppOutput(pid, channelName, line.data(), line.size());
-					}
+				split(StaticString(buf, ret), '\n', lines);
+				foreach (const StaticString line, lines) {
+					printAppOutput(pid, channelName, line.data(), line.size());
 				}
 			}
 		}
 	}
 
+	void startWatcher() {
+		ev_io_init(&watcher, onReadable, fd, EV_READ);
+		watcher.data = this;
+		ev_io_start(EventLoop::getInstance().getLoop(), &watcher);
+	}
+
+	void stopWatcher() {
+		ev_io_stop(EventLoop::getInstance().getLoop(), &watcher);
+	}
+
+	/**
+	 * Removes the watcher from the event loop. After this returns, capture()
+	 * is not running and won't be called anymore.
+	 */
+	void unregister() {
+		if (started) {
+			boost::this_thread::disable_interruption di;
+			boost::this_thread::disable_syscall_interruption dsi;
+			EventLoop::getInstance().run(boost::bind(
+				&BackgroundIOCapturer::stopWatcher, this));
+			started = false;
+		}
+	}
+
 public:
 	BackgroundIOCapturer(const FileDescriptor &_fd, pid_t _pid, const char *_channelName)
 		: fd(_fd),
 		  pid(_pid),
 		  channelName(_channelName),
-		  thr(NULL)
+		  started(false)
 		{ }
 
 	~BackgroundIOCapturer() {
 		TRACE_POINT();
-		if (thr != NULL) {
-			boost::this_thread::disable_interruption di;
-			boost::this_thread::disable_syscall_interruption dsi;
-			thr->interrupt_and_join();
-			delete thr;
-			thr = NULL;
-		}
+		unregister();
 	}
 
 	const FileDescriptor &getFd() const {
@@ -128,19 +152,16 @@ public:
 	}
 
 	void start() {
-		assert(thr == NULL);
-		thr = new oxt::thread(boost::bind(&BackgroundIOCapturer::capture, this),
-			"Background I/O capturer", 64 * 1024);
+		assert(!started);
+		started = true;
+		EventLoop::getInstance().run(boost::bind(
+			&BackgroundIOCapturer::startWatcher, this));
 	}
 
 	string stop() {
 		TRACE_POINT();
-		assert(thr != NULL);
-		boost::this_thread::disable_interruption di;
-		boost::this_thread::disable_syscall_interruption dsi;
-		thr->interrupt_and_join();
-		delete thr;
-		thr = NULL;
+		assert(started);
+		unregister();
 		boost::lock_guard<boost::mutex> l(dataSyncher);
 		return data;
 	}
@@ -76,6 +76,9 @@ struct Config {
 
 	// Used by PipeWatcher.
 	OutputHandler outputHandler;
+	/** The maximum number of lines of output per second that are logged for
+	 * an application process. 0 means unlimited. */
+	unsigned int appOutputRateLimit;
 
 	// Other.
 	void *data;
@@ -87,6 +90,7 @@ struct Config {
 		  concurrency(1),
 		  spawnerCreationSleepTime(0),
 		  spawnTime(0),
+		  appOutputRateLimit(0),
 		  data(NULL)
 		{ }
 
@@ -0,0 +1,96 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_EVENT_LOOP_H_
+#define _PASSENGER_SPAWNING_KIT_EVENT_LOOP_H_
+
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <ev++.h>
+
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
+#include <Constants.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * The background event loop on which all I/O of spawns in progress happens:
+ * negotiations with the processes being spawned (see Negotiation) and the
+ * capturing of their stderr output (see BackgroundIOCapturer). It's shared
+ * by all spawners, so that the number of spawns in progress is not limited
+ * by the number of threads that can block on their I/O.
+ */
+class EventLoop {
+private:
+	BackgroundEventLoop bg;
+
+	static void createInstance() {
+		// Never destroyed: spawns may be cleaned up while the
+		// program is shutting down.
+		instancePointer() = new EventLoop();
+	}
+
+	static EventLoop *&instancePointer() {
+		static EventLoop *instance = NULL;
+		return instance;
+	}
+
+	EventLoop()
+		: bg(true, false)
+	{
+		bg.start("Spawn I/O", POOL_HELPER_THREAD_STACK_SIZE);
+	}
+
+public:
+	static EventLoop &getInstance() {
+		static boost::once_flag flag = BOOST_ONCE_INIT;
+		boost::call_once(flag, createInstance);
+		return *instancePointer();
+	}
+
+	struct ev_loop *getLoop() const {
+		return bg.libev_loop;
+	}
+
+	/**
+	 * Runs the callback on the event loop and waits until it's done.
+	 * If called from the event loop itself, then the callback is run
+	 * immediately.
+	 */
+	void run(const boost::function<void ()> &callback) {
+		bg.safe->run(callback);
+	}
+};
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_EVENT_LOOP_H_ */
@@ -51,6 +51,7 @@ private:
 		if (options.appType == "rack") {
 			preloaderCommand.push_back(options.ruby);
 			preloaderCommand.push_back(dir + "/rack-preloader.rb");
+			preloaderCommand.push_back(config->resourceLocator->getRubyLibDir());
 		} else {
 			return SpawnerPtr();
 		}
@@ -0,0 +1,773 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_NEGOTIATION_H_
+#define _PASSENGER_SPAWNING_KIT_NEGOTIATION_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <oxt/backtrace.hpp>
+#include <oxt/system_calls.hpp>
+#include <ev++.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+
+#include <sys/types.h>
+
+#include <Logging.h>
+#include <FileDescriptor.h>
+#include <Exceptions.h>
+#include <StaticString.h>
+#include <Utils/IOUtils.h>
+#include <Utils/StrIntUtils.h>
+#include <Utils/SystemTime.h>
+#include <Core/SpawningKit/EventLoop.h>
+#include <Core/SpawningKit/BackgroundIOCapturer.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+using namespace oxt;
+
+
+class Negotiation;
+typedef boost::shared_ptr<Negotiation> NegotiationPtr;
+
+/**
+ * Performs the spawn negotiation protocol with a process that is being
+ * spawned, as a non-blocking state machine on the spawn EventLoop. The I/O
+ * of any number of negotiations in progress is multiplexed on that one
+ * event loop. Callers can be notified through a callback with `start()`,
+ * or wait for the outcome with `run()`, which blocks the calling thread.
+ *
+ * The protocol goes as follows. Lines that the process writes over the admin
+ * socket are protocol messages if they're prefixed with "!> "; all other lines
+ * are application output.
+ *
+ *  1. The process sends the handshake "I have control 1.0" or
+ *     "I have control 1.1".
+ *  2. We send the startup request. See `createStartupRequest()`.
+ *  3. The process sends "Ready" followed by the startup response, or "Error"
+ *     followed by an error response. It may also send another handshake,
+ *     upon which we go back to step 2.
+ *
+ * The startup response is a list of keys and values, which is not interpreted
+ * here: that's up to the Spawner. An error response consists of "key: value"
+ * attribute lines, an empty line, and an error message that lasts until EOF.
+ *
+ * The negotiation fails if the process doesn't follow the protocol, if an
+ * I/O error occurs, or if the whole negotiation takes longer than the
+ * timeout.
+ *
+ * The admin socket is put in non-blocking mode during the negotiation and is
+ * put back in blocking mode afterwards.
+ */
+class Negotiation: public boost::enable_shared_from_this<Negotiation> {
+public:
+	enum State {
+		/** Waiting for the "I have control" handshake message. */
+		READING_HANDSHAKE,
+		/** Writing the startup request. */
+		SENDING_REQUEST,
+		/** Waiting for "Ready", "Error" or another handshake message. */
+		READING_RESPONSE_TYPE,
+		/** Reading the "key: value" lines of a version 1.0 startup response. */
+		READING_TEXT_RESPONSE,
+		/** Reading the block size line of a version 1.1 startup response. */
+		READING_RESPONSE_BLOCK_SIZE,
+		/** Reading the block of a version 1.1 startup response. */
+		READING_RESPONSE_BLOCK,
+		/** Reading the "key: value" attribute lines of an error response. */
+		READING_ERROR_ATTRIBUTES,
+		/** Reading the message of an error response, until EOF. */
+		READING_ERROR_MESSAGE,
+		DONE
+	};
+
+	enum Outcome {
+		IN_PROGRESS,
+		/** The process sent a startup response. See `getResponse()`. */
+		READY,
+		/** The process sent an error response. See `getErrorAttributes()`
+		 * and `getErrorMessage()`. */
+		ERROR_RESPONSE,
+		/** The process did not follow the protocol, an I/O error occurred or
+		 * the negotiation timed out. See `getErrorKind()` and `getErrorMessage()`. */
+		FAILED,
+		/** The negotiation was cancelled with `cancel()`. */
+		CANCELLED
+	};
+
+	typedef vector< pair<string, string> > Response;
+	typedef boost::function<void (const NegotiationPtr &negotiation)> Callback;
+
+	/** Protocol message lines may be at most this long. */
+	static const unsigned int MAX_LINE_SIZE = 1024 * 16;
+	/** Version 1.1 startup responses may be at most this large. */
+	static const unsigned int MAX_BLOCK_SIZE = 1024 * 128;
+
+private:
+	/****** Arguments ******/
+
+	const pid_t pid;
+	const FileDescriptor fd;
+	/** The keys and values of the startup request. */
+	const vector<string> requestArgs;
+	/** Receives the application output that the process writes over the
+	 * admin socket during the negotiation, in addition to its stderr output.
+	 * May be NULL. */
+	const BackgroundIOCapturerPtr stderrCapturer;
+
+	/****** Working state ******/
+
+	State state;
+	/** Data that has been read but not yet processed. */
+	string input;
+	bool eof;
+	/** The serialized startup request, and how much of it has been sent. */
+	string output;
+	string::size_type outputWritten;
+	unsigned int blockSize;
+	MonotonicTimeUsec deadline;
+	struct ev_io ioWatcher;
+	struct ev_timer timer;
+	Callback callback;
+	/** Keeps this object alive while the negotiation is in progress. */
+	NegotiationPtr self;
+
+	/****** Outcome ******/
+
+	Outcome outcome;
+	bool binaryProtocol;
+	Response response;
+	map<string, string> errorAttributes;
+	SpawnException::ErrorKind errorKind;
+	string errorMessage;
+	MonotonicTimeUsec handshakeTime;
+	MonotonicTimeUsec readyTime;
+	unsigned long long remainingTimeout;
+
+	static void onIoEvent(EV_P_ struct ev_io *io, int revents) {
+		// Keep this object alive until we're done: the callback may
+		// release the last reference.
+		NegotiationPtr self = static_cast<Negotiation *>(io->data)->shared_from_this();
+		if (self->state == SENDING_REQUEST) {
+			self->sendRequest();
+		} else {
+			self->receive();
+		}
+	}
+
+	static void onTimeout(EV_P_ struct ev_timer *timer, int revents) {
+		NegotiationPtr self = static_cast<Negotiation *>(timer->data)->shared_from_this();
+		self->timedOut();
+	}
+
+	static void notify(boost::mutex *syncher, boost::condition_variable *cond,
+		bool *done, const NegotiationPtr &negotiation)
+	{
+		boost::lock_guard<boost::mutex> l(*syncher);
+		*done = true;
+		cond->notify_one();
+	}
+
+	struct ev_loop *getLoop() const {
+		return EventLoop::getInstance().getLoop();
+	}
+
+	void startOnEventLoop(const Callback &callback) {
+		TRACE_POINT();
+		this->callback = callback;
+		self = shared_from_this();
+		setNonBlocking(fd);
+
+		ev_io_init(&ioWatcher, onIoEvent, fd, EV_READ);
+		ioWatcher.data = this;
+		ev_io_start(getLoop(), &ioWatcher);
+
+		// The deadline may have passed already, for example if the
+		// caller spent the whole timeout before starting us.
+		MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+		ev_timer_init(&timer, onTimeout,
+			(deadline > now) ? (deadline - now) / 1000000.0 : 0, 0);
+		timer.data = this;
+		ev_timer_start(getLoop(), &timer);
+
+		// The caller may have already read part of the
+		// process's output, so see if we can continue already.
+		process();
+	}
+
+	void cancelOnEventLoop() {
+		if (state != DONE) {
+			callback = Callback();
+			finish(CANCELLED);
+		}
+	}
+
+	void watch(int events) {
+		ev_io_stop(getLoop(), &ioWatcher);
+		ev_io_set(&ioWatcher, fd, events);
+		ev_io_start(getLoop(), &ioWatcher);
+	}
+
+	void receive() {
+		TRACE_POINT();
+		char buf[1024 * 16];
+		ssize_t ret = syscalls::read(fd, buf, sizeof(buf));
+		int e = errno;
+		if (ret > 0) {
+			input.append(buf, ret);
+		} else if (ret == 0) {
+			eof = true;
+		} else if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR) {
+			return;
+		} else {
+			ioError(e);
+			return;
+		}
+		process();
+	}
+
+	void sendRequest() {
+		TRACE_POINT();
+		ssize_t ret = syscalls::write(fd, output.data() + outputWritten,
+			output.size() - outputWritten);
+		int e = errno;
+		if (ret == -1) {
+			if (e == EAGAIN || e == EWOULDBLOCK || e == EINTR) {
+				return;
+			} else if (e != EPIPE) {
+				fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+					"An error occurred while starting the web application. "
+					"There was an I/O error while sending its startup request: " +
+					systemMessage(e));
+				return;
+			}
+			// Ignore EPIPE: the process might have written an error response
+			// before reading the request, in which case we'll want to show
+			// that instead.
+		} else {
+			outputWritten += ret;
+			if (outputWritten < output.size()) {
+				return;
+			}
+		}
+
+		output.clear();
+		state = READING_RESPONSE_TYPE;
+		watch(EV_READ);
+		process();
+	}
+
+	/**
+	 * Processes as much of the input as possible.
+	 */
+	void process() {
+		TRACE_POINT();
+		string line;
+
+		while (true) {
+			switch (state) {
+			case READING_HANDSHAKE:
+			case READING_RESPONSE_TYPE:
+				if (!readMessageLine(line)) {
+					return;
+				}
+				handleMessageType(line);
+				break;
+			case READING_TEXT_RESPONSE:
+			case READING_ERROR_ATTRIBUTES:
+				if (!readMessageLine(line)) {
+					return;
+				}
+				handleResponseLine(line);
+				break;
+			case READING_RESPONSE_BLOCK_SIZE:
+				if (!readMessageLine(line)) {
+					return;
+				}
+				handleBlockSize(line);
+				break;
+			case READING_RESPONSE_BLOCK:
+				if (input.size() >= blockSize) {
+					handleBlock();
+				} else if (eof) {
+					fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+						"An error occurred while starting the web application. "
+						"It unexpectedly closed the connection while sending "
+						"its startup response.");
+				} else {
+					return;
+				}
+				break;
+			case READING_ERROR_MESSAGE:
+				if (eof) {
+					errorMessage = input;
+					finish(ERROR_RESPONSE);
+				}
+				return;
+			case SENDING_REQUEST:
+			case DONE:
+				return;
+			}
+		}
+	}
+
+	/**
+	 * Takes the next protocol message line from the input, without the "!> "
+	 * prefix, and forwards any application output before it. Returns false
+	 * if more input is needed. At EOF, `line` is set to what's left of the
+	 * input, which is empty if the process sent nothing more.
+	 */
+	bool readMessageLine(string &line) {
+		while (true) {
+			string::size_type pos = input.find('\n');
+			if (pos == string::npos) {
+				if (input.size() > MAX_LINE_SIZE) {
+					fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+						"An error occurred while starting the web application. "
+						"It sent a line that is too long.");
+					return false;
+				} else if (!eof) {
+					return false;
+				}
+				line = input;
+				input.clear();
+			} else if (pos + 1 > MAX_LINE_SIZE) {
+				fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+					"An error occurred while starting the web application. "
+					"It sent a line that is too long.");
+				return false;
+			} else {
+				line.assign(input, 0, pos + 1);
+				input.erase(0, pos + 1);
+			}
+
+			if (line.empty()) {
+				// EOF
+				return true;
+			}
+
+			StaticString text(line);
+			if (text[text.size() - 1] == '\n') {
+				text = text.substr(0, text.size() - 1);
+			}
+			if (startsWith(line, "!> ")) {
+				P_DEBUG("[App " << pid << " stdout] " << text);
+				line.erase(0, sizeof("!> ") - 1);
+				return true;
+			} else {
+				if (stderrCapturer != NULL) {
+					stderrCapturer->appendToBuffer(line);
+				}
+				printAppOutput(pid, "stdout", text.data(), text.size());
+			}
+		}
+	}
+
+	void handleMessageType(const string &line) {
+		if (state == READING_HANDSHAKE) {
+			handshakeTime = SystemTime::getMonotonicUsec();
+		}
+
+		if (line == "I have control 1.0\n" || line == "I have control 1.1\n") {
+			binaryProtocol = line == "I have control 1.1\n";
+			output = createStartupRequest(requestArgs, binaryProtocol);
+			outputWritten = 0;
+			state = SENDING_REQUEST;
+			watch(EV_WRITE);
+		} else if (line == "Ready\n" && state == READING_RESPONSE_TYPE) {
+			readyTime = SystemTime::getMonotonicUsec();
+			state = binaryProtocol ? READING_RESPONSE_BLOCK_SIZE : READING_TEXT_RESPONSE;
+		} else if (line == "Error\n") {
+			state = READING_ERROR_ATTRIBUTES;
+		} else if (line.empty()) {
+			fail(SpawnException::APP_STARTUP_ERROR,
+				"An error occurred while starting the web application. "
+				"It exited before signalling successful startup back to "
+				PROGRAM_NAME ".");
+		} else {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It sent an unknown response type \"" + cEscapeString(line) + "\".");
+		}
+	}
+
+	void handleResponseLine(const string &line) {
+		if (line.empty()) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It unexpected closed the connection while sending its "
+				"startup response.");
+			return;
+		} else if (line[line.size() - 1] != '\n') {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It sent a line without a newline character in its "
+				"startup response.");
+			return;
+		} else if (line == "\n") {
+			if (state == READING_TEXT_RESPONSE) {
+				finish(READY);
+			} else {
+				state = READING_ERROR_MESSAGE;
+			}
+			return;
+		}
+
+		string::size_type pos = line.find(": ");
+		if (pos == string::npos) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It sent a startup response line without separator.");
+			return;
+		}
+
+		string key = line.substr(0, pos);
+		string value = line.substr(pos + 2, line.size() - pos - 3);
+		if (state == READING_TEXT_RESPONSE) {
+			response.push_back(make_pair(key, value));
+		} else {
+			errorAttributes[key] = value;
+		}
+	}
+
+	void handleBlockSize(const string &line) {
+		if (line.empty()) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It unexpectedly closed the connection while sending "
+				"its startup response.");
+		} else if (line.size() < 2 || line[line.size() - 1] != '\n'
+			|| line.find_first_not_of("0123456789") != line.size() - 1)
+		{
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It sent an invalid block size in its startup response.");
+		} else if (line.size() > 7 || stringToUint(line) > MAX_BLOCK_SIZE) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It sent a startup response that is too large.");
+		} else {
+			blockSize = stringToUint(line);
+			state = READING_RESPONSE_BLOCK;
+		}
+	}
+
+	/**
+	 * Parses the block of a version 1.1 startup response, which consists of
+	 * NUL-terminated keys and values.
+	 */
+	void handleBlock() {
+		const char *pos = input.data();
+		const char *end = input.data() + blockSize;
+		while (pos < end) {
+			const char *keyEnd = (const char *) memchr(pos, '\0', end - pos);
+			const char *valueEnd = (keyEnd == NULL)
+				? NULL
+				: (const char *) memchr(keyEnd + 1, '\0', end - keyEnd - 1);
+			if (valueEnd == NULL) {
+				fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+					"An error occurred while starting the web application. "
+					"It sent a startup response with a key that has no value.");
+				return;
+			}
+
+			response.push_back(make_pair(
+				string(pos, keyEnd - pos),
+				string(keyEnd + 1, valueEnd - keyEnd - 1)));
+			pos = valueEnd + 1;
+		}
+		input.erase(0, blockSize);
+		finish(READY);
+	}
+
+	void ioError(int e) {
+		if (state == READING_HANDSHAKE) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"There was an I/O error while reading its handshake message: " +
+				systemMessage(e));
+		} else if (state == READING_ERROR_MESSAGE) {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"It tried to report an error message, but an I/O error "
+				"occurred while reading this error message: " +
+				systemMessage(e));
+		} else {
+			fail(SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				"An error occurred while starting the web application. "
+				"There was an I/O error while reading its startup response: " +
+				systemMessage(e));
+		}
+	}
+
+	void timedOut() {
+		TRACE_POINT();
+		switch (state) {
+		case READING_HANDSHAKE:
+			fail(SpawnException::APP_STARTUP_TIMEOUT,
+				"An error occurred while starting the web application: "
+				"it did not write a handshake message in time.");
+			break;
+		case SENDING_REQUEST:
+			fail(SpawnException::APP_STARTUP_TIMEOUT,
+				"An error occurred while starting the web application: "
+				"it did not read its startup request in time.");
+			break;
+		case READING_ERROR_ATTRIBUTES:
+		case READING_ERROR_MESSAGE:
+			fail(SpawnException::APP_STARTUP_TIMEOUT,
+				"An error occurred while starting the web application. "
+				"It tried to report an error message, but it took too "
+				"much time doing that.");
+			break;
+		default:
+			fail(SpawnException::APP_STARTUP_TIMEOUT,
+				"An error occurred while starting the web application: "
+				"it did not write a startup response in time.");
+			break;
+		}
+	}
+
+	void fail(SpawnException::ErrorKind kind, const string &message) {
+		errorKind = kind;
+		errorMessage = message;
+		finish(FAILED);
+	}
+
+	void finish(Outcome outcome) {
+		TRACE_POINT();
+		MonotonicTimeUsec now = SystemTime::getMonotonicUsec();
+		ev_io_stop(getLoop(), &ioWatcher);
+		ev_timer_stop(getLoop(), &timer);
+		setBlocking(fd);
+
+		this->outcome = outcome;
+		state = DONE;
+		remainingTimeout = (now < deadline) ? deadline - now : 0;
+
+		// Releasing `self` may destroy this object.
+		NegotiationPtr negotiation;
+		negotiation.swap(self);
+		Callback callback;
+		callback.swap(this->callback);
+		if (callback) {
+			callback(negotiation);
+		}
+	}
+
+	static string systemMessage(int e) {
+		return string(strerror(e)) + " (errno=" + toString(e) + ")";
+	}
+
+public:
+	/**
+	 * @param pid The PID of the process that is being spawned.
+	 * @param fd The admin socket of that process.
+	 * @param requestArgs The keys and values of the startup request.
+	 * @param timeout The maximum duration of the negotiation, in microseconds.
+	 * @param stderrCapturer Receives the application output that the process
+	 *                       writes over the admin socket. May be NULL.
+	 * @param alreadyRead Output that the caller has already read from `fd`.
+	 */
+	Negotiation(pid_t _pid, const FileDescriptor &_fd, const vector<string> &_requestArgs,
+		unsigned long long timeout, const BackgroundIOCapturerPtr &_stderrCapturer,
+		const StaticString &alreadyRead = StaticString())
+		: pid(_pid),
+		  fd(_fd),
+		  requestArgs(_requestArgs),
+		  stderrCapturer(_stderrCapturer),
+		  state(READING_HANDSHAKE),
+		  input(alreadyRead.data(), alreadyRead.size()),
+		  eof(false),
+		  outputWritten(0),
+		  blockSize(0),
+		  deadline(SystemTime::getMonotonicUsec() + timeout),
+		  outcome(IN_PROGRESS),
+		  binaryProtocol(false),
+		  errorKind(SpawnException::UNDEFINED_ERROR),
+		  handshakeTime(0),
+		  readyTime(0),
+		  remainingTimeout(timeout)
+		{ }
+
+	~Negotiation() {
+		assert(state == DONE || self == NULL);
+	}
+
+	/**
+	 * Starts the negotiation on the spawn EventLoop. `callback` is called on
+	 * the event loop when the negotiation is done, unless it is cancelled.
+	 * It must not block.
+	 */
+	void start(const Callback &callback) {
+		assert(state == READING_HANDSHAKE && self == NULL);
+		boost::this_thread::disable_interruption di;
+		boost::this_thread::disable_syscall_interruption dsi;
+		EventLoop::getInstance().run(boost::bind(&Negotiation::startOnEventLoop,
+			this, callback));
+	}
+
+	/**
+	 * Cancels the negotiation if it's still in progress. After this returns,
+	 * the callback passed to `start()` won't be called anymore.
+	 */
+	void cancel() {
+		boost::this_thread::disable_interruption di;
+		boost::this_thread::disable_syscall_interruption dsi;
+		EventLoop::getInstance().run(boost::bind(&Negotiation::cancelOnEventLoop,
+			shared_from_this()));
+	}
+
+	/**
+	 * Performs the negotiation and waits until it's done. The negotiation is
+	 * cancelled if the calling thread is interrupted while waiting.
+	 *
+	 * @throws boost::thread_interrupted
+	 */
+	void run() {
+		TRACE_POINT();
+		boost::mutex syncher;
+		boost::condition_variable cond;
+		bool done = false;
+
+		start(boost::bind(notify, &syncher, &cond, &done,
+			boost::placeholders::_1));
+		try {
+			boost::unique_lock<boost::mutex> l(syncher);
+			while (!done) {
+				cond.wait(l);
+			}
+		} catch (const boost::thread_interrupted &) {
+			cancel();
+			throw;
+		}
+	}
+
+	/**
+	 * Serializes a startup request, consisting of alternating keys and values.
+	 *
+	 * In version 1.0 of the negotiation protocol, the request consists of
+	 * "key: value" lines terminated by an empty line. In version 1.1 it's
+	 * a line with the size of a block of NUL-terminated keys and values,
+	 * followed by that block. Version 1.1 needs no escaping and can be
+	 * parsed without scanning for separators.
+	 */
+	static string createStartupRequest(const vector<string> &args, bool binaryProtocol) {
+		vector<string>::const_iterator it, end = args.end();
+		string::size_type size = 0;
+		string block;
+
+		for (it = args.begin(); it != end; it++) {
+			size += it->size();
+		}
+		block.reserve(size + args.size() * 2 + 32);
+
+		if (binaryProtocol) {
+			block.append("You have control 1.1\n");
+			block.append(toString(size + args.size()));
+			block.append(1, '\n');
+			for (it = args.begin(); it != end; it++) {
+				block.append(*it);
+				block.append(1, '\0');
+			}
+		} else {
+			block.append("You have control 1.0\n");
+			for (it = args.begin(); it != end; it++) {
+				block.append(*it);
+				block.append(": ", 2);
+				it++;
+				block.append(*it);
+				block.append(1, '\n');
+			}
+			block.append(1, '\n');
+		}
+		return block;
+	}
+
+	/* The following may only be called when the negotiation is done. */
+
+	Outcome getOutcome() const {
+		return outcome;
+	}
+
+	/** Whether the process speaks version 1.1 of the negotiation protocol. */
+	bool isBinaryProtocol() const {
+		return binaryProtocol;
+	}
+
+	/** The keys and values of the startup response, in the order in which
+	 * the process sent them. */
+	const Response &getResponse() const {
+		return response;
+	}
+
+	const map<string, string> &getErrorAttributes() const {
+		return errorAttributes;
+	}
+
+	SpawnException::ErrorKind getErrorKind() const {
+		return errorKind;
+	}
+
+	/** The message of the error response if the outcome is ERROR_RESPONSE,
+	 * or a description of the problem if the outcome is FAILED. */
+	const string &getErrorMessage() const {
+		return errorMessage;
+	}
+
+	/** When the handshake message was received, or 0 if it wasn't. */
+	MonotonicTimeUsec getHandshakeTime() const {
+		return handshakeTime;
+	}
+
+	/** When "Ready" was received, or 0 if it wasn't. */
+	MonotonicTimeUsec getReadyTime() const {
+		return readyTime;
+	}
+
+	/** How much of the timeout was left when the negotiation was done,
+	 * in microseconds. */
+	unsigned long long getRemainingTimeout() const {
+		return remainingTimeout;
+	}
+};
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_NEGOTIATION_H_ */
@@ -31,14 +31,18 @@
 #include <boost/thread.hpp>
 #include <boost/function.hpp>
 #include <boost/bind.hpp>
-#include <boost/foreach.hpp>
-#include <oxt/thread.hpp>
 #include <oxt/backtrace.hpp>
-#include <vector>
+#include <ev++.h>
+#include <string>
+#include <set>
+#include <map>
+#include <cstring>
 
 #include <sys/types.h>
 
 #include <FileDescriptor.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
 #include <Constants.h>
 #include <Logging.h>
 #include <Utils.h>
@@ -48,99 +52,254 @@
 namespace Passenger {
 namespace SpawningKit {
 
+using namespace std;
 using namespace boost;
 
 
-/** A PipeWatcher lives until the file descriptor is closed. */
+class AppOutputMultiplexer;
+
+/**
+ * Forwards everything that an application process writes to a pipe (its
+ * stdout or stderr) to the log file and to `Config::outputHandler`.
+ *
+ * A PipeWatcher lives until the file descriptor is closed.
+ */
 class PipeWatcher: public boost::enable_shared_from_this<PipeWatcher> {
 private:
+	friend class AppOutputMultiplexer;
+
 	ConfigPtr config;
 	FileDescriptor fd;
 	const char *name;
 	pid_t pid;
-	bool started;
-	boost::mutex startSyncher;
-	boost::condition_variable startCond;
+	struct ev_io watcher;
+	/** Output that has been read, but that doesn't form a complete line yet. */
+	string partialLine;
+
+public:
+	PipeWatcher(const ConfigPtr &_config, const FileDescriptor &_fd,
+		const char *_name, pid_t _pid)
+		: config(_config),
+		  fd(_fd),
+		  name(_name),
+		  pid(_pid)
+		{ }
+
+	void start();
+};
+
+typedef boost::shared_ptr<PipeWatcher> PipeWatcherPtr;
+
+
+/**
+ * Watches the pipes of all PipeWatchers with a single background event loop,
+ * instead of with a thread per pipe, so that the number of threads and their
+ * stacks don't grow with the number of application processes.
+ *
+ * Output is reassembled into lines, rate limited per process according to
+ * `Config::appOutputRateLimit`, and the lines that are read during a single
+ * event loop iteration are written to the log file at once.
+ */
+class AppOutputMultiplexer {
+private:
+	struct ProcessState {
+		unsigned int pipes;
+		ev_tstamp windowStart;
+		unsigned int lines;
+		unsigned int linesDropped;
+
+		ProcessState()
+			: pipes(0),
+			  windowStart(0),
+			  lines(0),
+			  linesDropped(0)
+			{ }
+	};
+
+	BackgroundEventLoop bg;
+	struct ev_prepare prepareWatcher;
+	// The following fields are only accessed from the event loop thread.
+	std::set<PipeWatcherPtr> watchers;
+	std::map<pid_t, ProcessState> processStates;
+	string pendingOutput;
+
+	static BOOST_CONSTEXPR unsigned int maxLineSize() {
+		return 1024 * 64;
+	}
+
+	static BOOST_CONSTEXPR unsigned int maxPendingOutputSize() {
+		return 1024 * 64;
+	}
 
-	static void threadMain(boost::shared_ptr<PipeWatcher> self) {
+	static void createInstance() {
+		// Never destroyed, just like the threads that PipeWatchers used to have:
+		// application processes may keep writing output until the very end.
+		instancePointer() = new AppOutputMultiplexer();
+	}
+
+	static AppOutputMultiplexer *&instancePointer() {
+		static AppOutputMultiplexer *instance = NULL;
+		return instance;
+	}
+
+	static void onPrepare(EV_P_ struct ev_prepare *w, int revents) {
+		AppOutputMultiplexer *self = static_cast<AppOutputMultiplexer *>(w->data);
+		self->flush();
+	}
+
+	static void onReadable(EV_P_ struct ev_io *io, int revents) {
+		PipeWatcher *watcher = static_cast<PipeWatcher *>(io->data);
+		getInstance().onReadable(watcher);
+	}
+
+	AppOutputMultiplexer()
+		: bg(true, false)
+	{
+		ev_prepare_init(&prepareWatcher, onPrepare);
+		prepareWatcher.data = this;
+		ev_prepare_start(bg.libev_loop, &prepareWatcher);
+		bg.start("App output multiplexer", POOL_HELPER_THREAD_STACK_SIZE);
+	}
+
+	void addOnEventLoop(const PipeWatcherPtr &watcher) {
+		watchers.insert(watcher);
+		processStates[watcher->pid].pipes++;
+		ev_io_init(&watcher->watcher, onReadable, watcher->fd, EV_READ);
+		watcher->watcher.data = watcher.get();
+		ev_io_start(bg.libev_loop, &watcher->watcher);
+	}
+
+	void remove(PipeWatcher *watcher) {
 		TRACE_POINT();
-		self->threadMain();
+		ProcessState &state = processStates[watcher->pid];
+		if (!watcher->partialLine.empty()) {
+			printLine(watcher, state, watcher->partialLine.data(),
+				watcher->partialLine.size());
+		}
+		reportDroppedLines(watcher, state);
+		if (--state.pipes == 0) {
+			processStates.erase(watcher->pid);
+		}
+		ev_io_stop(bg.libev_loop, &watcher->watcher);
+		// Destroys the watcher, so this must come last.
+		watchers.erase(watcher->shared_from_this());
 	}
 
-	void threadMain() {
+	void onReadable(PipeWatcher *watcher) {
 		TRACE_POINT();
-		{
-			boost::unique_lock<boost::mutex> lock(startSyncher);
-			while (!started) {
-				startCond.wait(lock);
+		char buf[1024 * 8];
+		ssize_t ret;
+
+		ret = syscalls::read(watcher->fd, buf, sizeof(buf));
+		if (ret == 0) {
+			remove(watcher);
+		} else if (ret == -1) {
+			UPDATE_TRACE_POINT();
+			int e = errno;
+			if (e == EAGAIN || e == EINTR) {
+				return;
+			} else if (e != ECONNRESET) {
+				P_WARN("Cannot read from process " << watcher->pid << " " << watcher->name <<
+					": " << strerror(e) << " (errno=" << e << ")");
+			}
+			remove(watcher);
+		} else {
+			UPDATE_TRACE_POINT();
+			processOutput(watcher, buf, ret);
+			if (watcher->config->outputHandler) {
+				watcher->config->outputHandler(buf, ret);
 			}
 		}
+	}
 
-		UPDATE_TRACE_POINT();
-		while (!this_thread::interruption_requested()) {
-			char buf[1024 * 8];
-			ssize_t ret;
+	/** Splits output into lines, keeping incomplete lines until the rest arrives. */
+	void processOutput(PipeWatcher *watcher, const char *data, size_t size) {
+		ProcessState &state = processStates[watcher->pid];
+		const char *pos = data;
+		const char *end = data + size;
 
-			UPDATE_TRACE_POINT();
-			ret = syscalls::read(fd, buf, sizeof(buf));
-			if (ret == 0) {
-				break;
-			} else if (ret == -1) {
-				UPDATE_TRACE_POINT();
-				if (errno == ECONNRESET) {
-					break;
-				} else if (errno != EAGAIN) {
-					int e = errno;
-					P_WARN("Cannot read from process " << pid << " " << name <<
-						": " << strerror(e) << " (errno=" << e << ")");
-					break;
+		while (pos < end) {
+			const char *newline = (const char *) memchr(pos, '\n', end - pos);
+			if (newline == NULL) {
+				watcher->partialLine.append(pos, end - pos);
+				if (watcher->partialLine.size() >= maxLineSize()) {
+					printLine(watcher, state, watcher->partialLine.data(),
+						watcher->partialLine.size());
+					watcher->partialLine.clear();
 				}
-			} else if (ret == 1 && buf[0] == '\n') {
-				UPDATE_TRACE_POINT();
-				printAppOutput(pid, name, "", 0);
+				break;
+			} else if (watcher->partialLine.empty()) {
+				printLine(watcher, state, pos, newline - pos);
 			} else {
-				UPDATE_TRACE_POINT();
-				vector<StaticString> lines;
-				ssize_t ret2 = ret;
-				if (ret2 > 0 && buf[ret2 - 1] == '\n') {
-					ret2--;
-				}
-				split(StaticString(buf, ret2), '\n', lines);
-				foreach (const StaticString line, lines) {
-					printAppOutput(pid, name, line.data(), line.size());
-				}
+				watcher->partialLine.append(pos, newline - pos);
+				printLine(watcher, state, watcher->partialLine.data(),
+					watcher->partialLine.size());
+				watcher->partialLine.clear();
 			}
+			pos = newline + 1;
+		}
+	}
 
-			if (config->outputHandler) {
-				config->outputHandler(buf, ret);
+	void printLine(PipeWatcher *watcher, ProcessState &state, const char *line,
+		unsigned int size)
+	{
+		unsigned int limit = watcher->config->appOutputRateLimit;
+		if (limit > 0) {
+			ev_tstamp now = ev_now(bg.libev_loop);
+			if (now - state.windowStart >= 1) {
+				reportDroppedLines(watcher, state);
+				state.windowStart = now;
+				state.lines = 0;
+			}
+			if (state.lines >= limit) {
+				state.linesDropped++;
+				return;
 			}
+			state.lines++;
+		}
+
+		bufferAppOutput(pendingOutput, watcher->pid, watcher->name, line, size);
+		if (pendingOutput.size() >= maxPendingOutputSize()) {
+			flush();
 		}
 	}
 
-public:
-	PipeWatcher(const ConfigPtr &_config, const FileDescriptor &_fd,
-		const char *_name, pid_t _pid)
-		: config(_config),
-		  fd(_fd),
-		  name(_name),
-		  pid(_pid),
-		  started(false)
-		{ }
+	void reportDroppedLines(PipeWatcher *watcher, ProcessState &state) {
+		if (state.linesDropped > 0) {
+			string message = "(" + toString(state.linesDropped) + " lines of output "
+				"dropped because more than " + toString(watcher->config->appOutputRateLimit) +
+				" lines per second were written)";
+			bufferAppOutput(pendingOutput, watcher->pid, watcher->name,
+				message.data(), message.size());
+			state.linesDropped = 0;
+		}
+	}
+
+	void flush() {
+		if (!pendingOutput.empty()) {
+			_writeLogEntry(pendingOutput.data(), pendingOutput.size());
+			pendingOutput.clear();
+		}
+	}
 
-	void initialize() {
-		oxt::thread(boost::bind(threadMain, shared_from_this()),
-			"PipeWatcher: PID " + toString(pid) + " " + name + ", fd " + toString(fd),
-			POOL_HELPER_THREAD_STACK_SIZE);
+public:
+	static AppOutputMultiplexer &getInstance() {
+		static boost::once_flag flag = BOOST_ONCE_INIT;
+		boost::call_once(flag, createInstance);
+		return *instancePointer();
 	}
 
-	void start() {
-		boost::lock_guard<boost::mutex> lock(startSyncher);
-		started = true;
-		startCond.notify_all();
+	void add(const PipeWatcherPtr &watcher) {
+		bg.safe->runLater(boost::bind(&AppOutputMultiplexer::addOnEventLoop,
+			this, watcher));
 	}
 };
 
-typedef boost::shared_ptr<PipeWatcher> PipeWatcherPtr;
+
+inline void
+PipeWatcher::start() {
+	AppOutputMultiplexer::getInstance().add(shared_from_this());
+}
 
 
 } // namespace SpawningKit
@@ -0,0 +1,225 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_SPAWNING_KIT_PROCESS_REAPER_H_
+#define _PASSENGER_SPAWNING_KIT_PROCESS_REAPER_H_
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <oxt/backtrace.hpp>
+#include <ev++.h>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <FileDescriptor.h>
+#include <BackgroundEventLoop.h>
+#include <SafeLibev.h>
+#include <Constants.h>
+#include <Logging.h>
+#include <Utils/PidFd.h>
+
+namespace Passenger {
+namespace SpawningKit {
+
+using namespace std;
+
+
+/**
+ * Reaps child processes once they exit, so that they don't linger as
+ * zombies. Instead of every process having a thread of its own that blocks
+ * in waitpid(), all of them are watched by a single background event loop.
+ *
+ * Where pidfds are supported, every process's pidfd is registered in the
+ * event loop, so it is reaped as soon as it exits. Otherwise the processes
+ * are polled with waitid() every 100 msec, so that processes that exit at
+ * the same time are still reaped in a single pass.
+ *
+ * Only add processes that nobody else waits for: whoever reaps a process
+ * first gets its exit status.
+ */
+class ProcessReaper {
+private:
+	struct Child {
+		pid_t pid;
+		FileDescriptor pidFd;
+		struct ev_io watcher;
+
+		Child(pid_t _pid)
+			: pid(_pid),
+			  pidFd(openPidFd(_pid), __FILE__, __LINE__)
+			{ }
+	};
+
+	BackgroundEventLoop bg;
+	struct ev_timer pollTimer;
+	/** Processes without a pidfd. Only accessed from the event loop thread. */
+	vector<pid_t> polledPids;
+	boost::mutex syncher;
+	unsigned int pending;
+	unsigned long long reaped;
+
+	static BOOST_CONSTEXPR double pollInterval() {
+		return 0.1; // sec
+	}
+
+	static void createInstance() {
+		// Never destroyed: processes may exit until the very end.
+		instancePointer() = new ProcessReaper();
+	}
+
+	static ProcessReaper *&instancePointer() {
+		static ProcessReaper *instance = NULL;
+		return instance;
+	}
+
+	/** Returns whether the process has been reaped or doesn't exist. */
+	static bool reap(pid_t pid) {
+		siginfo_t info;
+		int ret;
+
+		memset(&info, 0, sizeof(info));
+		do {
+			ret = waitid(P_PID, pid, &info, WEXITED | WNOHANG);
+		} while (ret == -1 && errno == EINTR);
+		if (ret == -1) {
+			// ECHILD: someone else has already reaped it.
+			return true;
+		} else {
+			// If the process hasn't exited yet, si_pid is left at 0.
+			return info.si_pid != 0;
+		}
+	}
+
+	static void onPidFdReadable(EV_P_ struct ev_io *io, int revents) {
+		Child *child = static_cast<Child *>(io->data);
+		getInstance().onExited(child);
+	}
+
+	static void onPollTimeout(EV_P_ struct ev_timer *timer, int revents) {
+		ProcessReaper *self = static_cast<ProcessReaper *>(timer->data);
+		self->reapPolledPids();
+	}
+
+	ProcessReaper()
+		: bg(true, false),
+		  pending(0),
+		  reaped(0)
+	{
+		ev_timer_init(&pollTimer, onPollTimeout, pollInterval(), pollInterval());
+		pollTimer.data = this;
+		bg.start("Process reaper", POOL_HELPER_THREAD_STACK_SIZE);
+	}
+
+	void addOnEventLoop(Child *child) {
+		if (child->pidFd != -1) {
+			ev_io_init(&child->watcher, onPidFdReadable, child->pidFd, EV_READ);
+			child->watcher.data = child;
+			ev_io_start(bg.libev_loop, &child->watcher);
+		} else {
+			pollPid(child->pid);
+			delete child;
+		}
+	}
+
+	void onExited(Child *child) {
+		TRACE_POINT();
+		ev_io_stop(bg.libev_loop, &child->watcher);
+		if (reap(child->pid)) {
+			markReaped(child->pid);
+		} else {
+			// Shouldn't happen, but don't leave a zombie behind if it does.
+			pollPid(child->pid);
+		}
+		delete child;
+	}
+
+	void pollPid(pid_t pid) {
+		polledPids.push_back(pid);
+		if (!ev_is_active(&pollTimer)) {
+			ev_timer_start(bg.libev_loop, &pollTimer);
+		}
+	}
+
+	void reapPolledPids() {
+		TRACE_POINT();
+		unsigned int i = 0;
+		while (i < polledPids.size()) {
+			if (reap(polledPids[i])) {
+				markReaped(polledPids[i]);
+				polledPids[i] = polledPids.back();
+				polledPids.pop_back();
+			} else {
+				i++;
+			}
+		}
+		if (polledPids.empty()) {
+			ev_timer_stop(bg.libev_loop, &pollTimer);
+		}
+	}
+
+	void markReaped(pid_t pid) {
+		P_TRACE(2, "Reaped process " << pid);
+		boost::lock_guard<boost::mutex> l(syncher);
+		pending--;
+		reaped++;
+	}
+
+public:
+	static ProcessReaper &getInstance() {
+		static boost::once_flag flag = BOOST_ONCE_INIT;
+		boost::call_once(flag, createInstance);
+		return *instancePointer();
+	}
+
+	void add(pid_t pid) {
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			pending++;
+		}
+		bg.safe->runLater(boost::bind(&ProcessReaper::addOnEventLoop,
+			this, new Child(pid)));
+	}
+
+	/** The number of processes that have been added but not reaped yet. */
+	unsigned int getPendingCount() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return pending;
+	}
+
+	unsigned long long getReapedCount() {
+		boost::lock_guard<boost::mutex> l(syncher);
+		return reaped;
+	}
+};
+
+
+} // namespace SpawningKit
+} // namespace Passenger
+
+#endif /* _PASSENGER_SPAWNING_KIT_PROCESS_REAPER_H_ */
@@ -36,11 +36,41 @@ namespace SpawningKit {
 /**
  * Represents the result of a spawning operation. It is a JSON document
  * containing information about the spawned process, such as its PID,
- * GUPID, etc. In addition, it contains two file descriptors.
+ * GUPID, etc. In addition, it contains the process's admin socket and
+ * error pipe, and a pidfd for the process.
+ *
+ * The "spawn_timeline" member describes the phases of the spawn, in order.
+ * Each phase has a "phase" name and a "start_time" and "end_time" in
+ * monotonic microseconds (see `SystemTime::getMonotonicUsec()`). Possible
+ * phases are:
+ *
+ *  - preparation: determining the user to run as, creating the command, etc.
+ *  - preloader_start: starting the preloader, if a smart spawn needed one.
+ *  - fork: forking the process, or having the preloader fork it.
+ *  - handshake: until the process announces it's ready for the startup
+ *    request. For direct spawns this includes exec()ing SpawnPreparer
+ *    and the loader.
+ *  - app_boot: from sending the startup request until the process reports
+ *    that the app is loaded.
+ *  - socket_advertisement: reading the sockets that the process listens on.
+ *  - reserve: the process was taken from the SmartSpawner's reserve.
  */
 struct Result: public Json::Value {
 	FileDescriptor adminSocket;
 	FileDescriptor errorPipe;
+	/** Opened right after the process was forked, or right after the
+	 * preloader reported the PID, so that it refers to the right process
+	 * even if the PID is reused later. -1 if pidfds are not supported.
+	 * See Utils/PidFd.h. */
+	FileDescriptor pidFd;
+	/** Whether PipeWatchers have already been started for `adminSocket`
+	 * and `errorPipe`, because the process sat in a SmartSpawner's reserve
+	 * before it was handed out. */
+	bool outputWatched;
+
+	Result()
+		: outputWatched(false)
+		{ }
 };
 
 
@@ -34,6 +34,9 @@
 
 #include <adhoc_lve.h>
 
+#include <deque>
+#include <climits>
+
 namespace Passenger {
 namespace SpawningKit {
 
@@ -59,10 +62,12 @@ private:
 
 		/****** Working state ******/
 		unsigned long long timeout;
+		bool binaryProtocol;
 
 		StartupDetails() {
 			options = NULL;
 			timeout = 0;
+			binaryProtocol = false;
 		}
 	};
 
@@ -84,6 +89,18 @@ private:
 	// for future reference.
 	SpawnPreparationInfo preparation;
 
+	// Protects reserve, reserveLimit, reserveRefiller and refillingReserve.
+	mutable boost::mutex reserveSyncher;
+	// Processes that have been forked off the preloader, and that have
+	// completed the startup negotiation, but that haven't been handed out
+	// by spawn() yet. See `Options::spawnReserveSize`.
+	deque<Result> reserve;
+	// Set by the pool so that the reserve doesn't exceed the remaining
+	// pool capacity. See `setReserveLimit()`.
+	unsigned int reserveLimit;
+	oxt::thread *reserveRefiller;
+	bool refillingReserve;
+
 	string getPreloaderCommandString() const {
 		string result;
 		unsigned int i;
@@ -220,6 +237,7 @@ private:
 		Pipe errorPipe = createPipe(__FILE__, __LINE__);
 		DebugDirPtr debugDir = boost::make_shared<DebugDir>(preparation.userSwitching.uid,
 			preparation.userSwitching.gid);
+		bool dumpSpawnInformation = shouldDumpSpawnInformation();
 
 		adhoc_lve::LveEnter scopedLveEnter(LveLoggingDecorator::lveInitOnce(),
 		                                   preparation.userSwitching.uid,
@@ -231,6 +249,9 @@ private:
 		pid_t pid = syscalls::fork();
 		if (pid == 0) {
 			setenv("PASSENGER_DEBUG_DIR", debugDir->getPath().c_str(), 1);
+			if (dumpSpawnInformation) {
+				setenv("PASSENGER_DUMP_SPAWN_INFORMATION", "1", 1);
+			}
 			purgeStdio(stdout);
 			purgeStdio(stderr);
 			resetSignalHandlersAndMask();
@@ -311,12 +332,10 @@ private:
 
 			watcher = boost::make_shared<PipeWatcher>(config,
 				adminSocket.second, "stdout", pid);
-			watcher->initialize();
 			watcher->start();
 
 			watcher = boost::make_shared<PipeWatcher>(config,
 				errorPipe.first, "stderr", pid);
-			watcher->initialize();
 			watcher->start();
 
 			preloaderAnnotations = debugDir->readAll();
@@ -359,36 +378,26 @@ private:
 		TRACE_POINT();
 		try {
 			const size_t UNIX_PATH_MAX = sizeof(((struct sockaddr_un *) 0)->sun_path);
-			string data = "You have control 1.0\n"
-				"passenger_root: " + config->resourceLocator->getInstallSpec() + "\n"
-				"ruby_libdir: " + config->resourceLocator->getRubyLibDir() + "\n"
-				"passenger_version: " PASSENGER_VERSION "\n"
-				"UNIX_PATH_MAX: " + toString(UNIX_PATH_MAX) + "\n";
+			vector<string> args;
+
+			args.reserve(64);
+			appendStartupRequestValue(args, "passenger_root", config->resourceLocator->getInstallSpec());
+			appendStartupRequestValue(args, "ruby_libdir", config->resourceLocator->getRubyLibDir());
+			appendStartupRequestValue(args, "passenger_version", PASSENGER_VERSION);
+			appendStartupRequestValue(args, "UNIX_PATH_MAX", toString(UNIX_PATH_MAX));
 			if (!details.options->apiKey.empty()) {
-				data.append("connect_password: " + details.options->apiKey + "\n");
+				appendStartupRequestValue(args, "connect_password", details.options->apiKey);
 			}
 			if (!config->instanceDir.empty()) {
-				data.append("instance_dir: " + config->instanceDir + "\n");
-				data.append("socket_dir: " + config->instanceDir + "/apps.s\n");
+				appendStartupRequestValue(args, "instance_dir", config->instanceDir);
+				appendStartupRequestValue(args, "socket_dir", config->instanceDir + "/apps.s");
 			}
-
-			vector<string> args;
-			vector<string>::const_iterator it, end;
 			details.options->toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
-			for (it = args.begin(); it != args.end(); it++) {
-				const string &key = *it;
-				it++;
-				const string &value = *it;
-				data.append(key + ": " + value + "\n");
-			}
 
-			vector<StaticString> lines;
-			split(data, '\n', lines);
-			foreach (const StaticString line, lines) {
-				P_DEBUG("[App " << details.pid << " stdin >>] " << line);
-			}
-			writeExact(details.adminSocket, data, &details.timeout);
-			writeExact(details.adminSocket, "\n", &details.timeout);
+			logStartupRequest(details.pid, args);
+			writeExact(details.adminSocket,
+				Negotiation::createStartupRequest(args, details.binaryProtocol),
+				&details.timeout);
 		} catch (const SystemException &e) {
 			if (e.code() == EPIPE) {
 				/* Ignore this. Process might have written an
@@ -594,8 +603,9 @@ private:
 				details);
 		}
 
-		if (result == "I have control 1.0\n") {
+		if (result == "I have control 1.0\n" || result == "I have control 1.1\n") {
 			UPDATE_TRACE_POINT();
+			details.binaryProtocol = result == "I have control 1.1\n";
 			sendStartupRequest(details);
 			try {
 				result = readMessageLine(details);
@@ -657,6 +667,8 @@ private:
 		const Options &options = *details.options;
 		FileDescriptor fd;
 
+		details.annotations = preloaderAnnotations;
+
 		try {
 			fd.assign(connectToServer(socketAddress, __FILE__, __LINE__), NULL, 0);
 		} catch (const SystemException &e) {
@@ -676,18 +688,11 @@ private:
 		BufferedIO io(fd);
 		unsigned long long timeout = options.startTimeout * 1000;
 		string result;
-		vector<string> args;
-		vector<string>::const_iterator it;
 
-		writeExact(fd, "spawn\n", &timeout);
-		options.toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
-		for (it = args.begin(); it != args.end(); it++) {
-			const string &key = *it;
-			it++;
-			const string &value = *it;
-			writeExact(fd, key + ": " + value + "\n", &timeout);
-		}
-		writeExact(fd, "\n", &timeout);
+		// The 'spawn' command may be followed by "key: value" lines, but the
+		// preloader ignores them: the forked process receives the spawn
+		// options during the startup negotiation. So don't bother sending any.
+		writeExact(fd, "spawn\n\n", &timeout);
 
 		result = io.readLine(1024 * 8, &timeout);
 		if (result == "OK\n") {
@@ -706,6 +711,9 @@ private:
 					options,
 					DebugDirPtr());
 			}
+			// Open a pidfd right away, so that it refers to this process
+			// even if the PID is reused later.
+			FileDescriptor spawnedPidFd(openPidFd(spawnedPid), __FILE__, __LINE__);
 			// TODO: we really should be checking UID.
 			// FIXME: for Passenger 4 we *must* check the UID otherwise this is a gaping security hole.
 			if (getsid(spawnedPid) != getsid(pid)) {
@@ -723,6 +731,7 @@ private:
 			P_LOG_FILE_DESCRIPTOR_PURPOSE(fd, "App " << spawnedPid
 				<< " (" << options.appRoot << ") adminSocket[1]");
 			details.pid = spawnedPid;
+			details.pidFd = spawnedPidFd;
 			details.adminSocket = fd;
 			details.io = io;
 
@@ -750,10 +759,202 @@ private:
 		guard.clear();
 	}
 
-protected:
-	virtual void annotateAppSpawnException(SpawnException &e, NegotiationDetails &details) {
-		Spawner::annotateAppSpawnException(e, details);
-		e.addAnnotations(preloaderAnnotations);
+	Result spawnFromPreloader(const Options &options) {
+		TRACE_POINT();
+		NegotiationDetails details;
+		SpawnPreparationInfo preparation;
+		Json::Value spawnTimeline;
+		{
+			boost::lock_guard<boost::mutex> l(syncher);
+			MonotonicTimeUsec phaseStartTime = SystemTime::getMonotonicUsec();
+			if (!preloaderStarted()) {
+				UPDATE_TRACE_POINT();
+				startPreloader();
+				phaseStartTime = recordSpawnPhase(spawnTimeline, "preloader_start",
+					phaseStartTime);
+			}
+
+			UPDATE_TRACE_POINT();
+			details = sendSpawnCommandAndGetNegotiationDetails(options);
+			recordSpawnPhase(spawnTimeline, "fork", phaseStartTime);
+			// The preloader is not involved in the rest of the negotiation,
+			// so we do that outside the lock. This allows multiple processes
+			// to be spawned concurrently. The preloader may be restarted in
+			// the mean time, so keep a copy of its preparation info.
+			preparation = this->preparation;
+		}
+
+		details.preparation = &preparation;
+		details.spawnTimeline = spawnTimeline;
+		return negotiateSpawn(details);
+	}
+
+	/**
+	 * Pops a process from the reserve. Processes that have exited while
+	 * sitting in the reserve are discarded.
+	 */
+	bool takeFromReserve(Result &result) {
+		boost::lock_guard<boost::mutex> l(reserveSyncher);
+		while (!reserve.empty()) {
+			Result candidate = reserve.front();
+			reserve.pop_front();
+
+			pid_t pid = (pid_t) candidate["pid"].asInt();
+			if (reservedProcessAlive(candidate)) {
+				result = candidate;
+				return true;
+			} else {
+				P_WARN("Process " << pid << " from the spawn reserve of " <<
+					options.appRoot << " has exited while idling; discarding it");
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * Whether a process in the reserve is still alive. Pinging its PID isn't
+	 * enough: the process may have become a zombie, or its PID may have been
+	 * reused by now. The pidfd doesn't have these problems. Without one, we
+	 * ask waitid() without reaping the process, which only works if it is
+	 * our own child.
+	 */
+	static bool reservedProcessAlive(const Result &result) {
+		if (result.pidFd != -1) {
+			return !pidFdProcessExited(result.pidFd);
+		}
+
+		pid_t pid = (pid_t) result["pid"].asInt();
+		int exited = childProcessExited(pid);
+		if (exited != -1) {
+			return !exited;
+		} else if (errno == ECHILD) {
+			// Not our child, e.g. forked by the preloader. The PID is all
+			// we have.
+			return syscalls::kill(pid, 0) == 0 || errno == EPERM;
+		} else {
+			return false;
+		}
+	}
+
+	/**
+	 * Nobody reads the output of a process while it sits in the reserve, so
+	 * its pipes would fill up and block it. Start the PipeWatchers that
+	 * Process would otherwise start once the process is handed out.
+	 */
+	void watchOutput(Result &result) {
+		pid_t pid = (pid_t) result["pid"].asInt();
+		if (result.adminSocket != -1) {
+			PipeWatcherPtr watcher = boost::make_shared<PipeWatcher>(
+				config, result.adminSocket, "stdout", pid);
+			watcher->start();
+		}
+		if (result.errorPipe != -1) {
+			PipeWatcherPtr watcher = boost::make_shared<PipeWatcher>(
+				config, result.errorPipe, "stderr", pid);
+			watcher->start();
+		}
+		result.outputWatched = true;
+	}
+
+	/** Must be called while holding `reserveSyncher`. */
+	unsigned int maxReserveSize(const Options &options) const {
+		return std::min(options.spawnReserveSize, reserveLimit);
+	}
+
+	void shutdownReservedProcess(const Result &result) {
+		// Like Process::triggerShutdown(), closing the writing end of
+		// the admin socket tells the process to exit.
+		P_DEBUG("Shutting down process " << result["pid"].asInt() <<
+			" from the spawn reserve of " << options.appRoot);
+		syscalls::shutdown(result.adminSocket, SHUT_WR);
+	}
+
+	void refillReserveInBackground(const Options &options) {
+		boost::lock_guard<boost::mutex> l(reserveSyncher);
+		if (refillingReserve || reserve.size() >= maxReserveSize(options)) {
+			return;
+		}
+		if (reserveRefiller != NULL) {
+			// The previous refill has already finished.
+			reserveRefiller->join();
+			delete reserveRefiller;
+		}
+		refillingReserve = true;
+		reserveRefiller = new oxt::thread(
+			boost::bind(&SmartSpawner::refillReserve, this,
+				options.copyAndPersist().detachFromUnionStationTransaction()),
+			"Spawn reserve refiller",
+			POOL_HELPER_THREAD_STACK_SIZE);
+	}
+
+	void refillReserve(Options options) {
+		TRACE_POINT();
+		try {
+			while (true) {
+				{
+					boost::lock_guard<boost::mutex> l(reserveSyncher);
+					if (reserve.size() >= maxReserveSize(options)) {
+						break;
+					}
+				}
+
+				UPDATE_TRACE_POINT();
+				Result result = spawnFromPreloader(options);
+				watchOutput(result);
+				boost::unique_lock<boost::mutex> l(reserveSyncher);
+				if (reserve.size() >= maxReserveSize(options)) {
+					// The limit was lowered while we were spawning.
+					l.unlock();
+					shutdownReservedProcess(result);
+					break;
+				}
+				P_DEBUG("Process " << result["pid"].asInt() <<
+					" added to the spawn reserve of " << options.appRoot);
+				reserve.push_back(result);
+			}
+		} catch (const boost::thread_interrupted &) {
+			// Stopped by stopReserve().
+		} catch (const tracable_exception &e) {
+			// Spawn errors are reported to the user by the next regular
+			// spawn, so a warning is enough here.
+			P_WARN("Could not fill the spawn reserve of " << options.appRoot <<
+				": " << e.what());
+		}
+
+		boost::lock_guard<boost::mutex> l(reserveSyncher);
+		refillingReserve = false;
+	}
+
+	/**
+	 * Stops refilling the reserve, and tells all processes in the reserve
+	 * to shut down. Must be called without holding `syncher`, because the
+	 * refiller thread may be waiting for it.
+	 */
+	void stopReserve() {
+		TRACE_POINT();
+		boost::this_thread::disable_interruption di;
+		boost::this_thread::disable_syscall_interruption dsi;
+		oxt::thread *refiller;
+		deque<Result> processes;
+
+		{
+			boost::lock_guard<boost::mutex> l(reserveSyncher);
+			refiller = reserveRefiller;
+			reserveRefiller = NULL;
+		}
+		if (refiller != NULL) {
+			refiller->interrupt_and_join();
+			delete refiller;
+		}
+
+		{
+			boost::lock_guard<boost::mutex> l(reserveSyncher);
+			processes.swap(reserve);
+		}
+		while (!processes.empty()) {
+			shutdownReservedProcess(processes.front());
+			processes.pop_front();
+		}
 	}
 
 public:
@@ -770,9 +971,13 @@ public:
 		options    = _options.copyAndPersist().detachFromUnionStationTransaction();
 		pid        = -1;
 		m_lastUsed = SystemTime::getUsec();
+		reserveLimit     = UINT_MAX;
+		reserveRefiller  = NULL;
+		refillingReserve = false;
 	}
 
 	virtual ~SmartSpawner() {
+		stopReserve();
 		boost::lock_guard<boost::mutex> l(syncher);
 		stopPreloader();
 	}
@@ -790,17 +995,25 @@ public:
 			m_lastUsed = SystemTime::getUsec();
 		}
 		UPDATE_TRACE_POINT();
-		boost::lock_guard<boost::mutex> l(syncher);
-		if (!preloaderStarted()) {
-			UPDATE_TRACE_POINT();
-			startPreloader();
+		Result result;
+		if (options.spawnReserveSize > 0 && takeFromReserve(result)) {
+			// The caller didn't have to wait for this process, so its spawn
+			// time starts now.
+			result["spawn_start_time"] = (Json::UInt64) SystemTime::getUsec();
+			result["spawn_timeline"] = Json::Value(Json::arrayValue);
+			recordSpawnPhase(result["spawn_timeline"], "reserve",
+				SystemTime::getMonotonicUsec());
+			P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
+				", pid=" << result["pid"].asInt() << " (taken from the spawn reserve)");
+		} else {
+			result = spawnFromPreloader(options);
+			P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
+				", pid=" << result["pid"].asInt());
 		}
 
-		UPDATE_TRACE_POINT();
-		NegotiationDetails details = sendSpawnCommandAndGetNegotiationDetails(options);
-		Result result = negotiateSpawn(details);
-		P_DEBUG("Process spawning done: appRoot=" << options.appRoot <<
-			", pid=" << result["pid"].asInt());
+		if (options.spawnReserveSize > 0) {
+			refillReserveInBackground(options);
+		}
 		return result;
 	}
 
@@ -814,10 +1027,58 @@ public:
 			boost::lock_guard<boost::mutex> l(simpleFieldSyncher);
 			m_lastUsed = SystemTime::getUsec();
 		}
+		stopReserve();
 		boost::lock_guard<boost::mutex> lock(syncher);
 		stopPreloader();
 	}
 
+	virtual void setReserveLimit(unsigned int limit) {
+		deque<Result> excess;
+		{
+			boost::lock_guard<boost::mutex> lock(reserveSyncher);
+			reserveLimit = limit;
+			while (reserve.size() > limit) {
+				excess.push_back(reserve.back());
+				reserve.pop_back();
+			}
+		}
+		while (!excess.empty()) {
+			shutdownReservedProcess(excess.front());
+			excess.pop_front();
+		}
+	}
+
+	virtual unsigned int getReserveSize() const {
+		boost::lock_guard<boost::mutex> lock(reserveSyncher);
+		return reserve.size();
+	}
+
+	virtual void getReservedPids(vector<pid_t> &pids) const {
+		boost::lock_guard<boost::mutex> lock(reserveSyncher);
+		deque<Result>::const_iterator it, end = reserve.end();
+		for (it = reserve.begin(); it != end; it++) {
+			pids.push_back((pid_t) (*it)["pid"].asInt());
+		}
+	}
+
+	virtual void discardFromReserve(pid_t pid) {
+		Result discarded;
+		{
+			boost::lock_guard<boost::mutex> lock(reserveSyncher);
+			deque<Result>::iterator it, end = reserve.end();
+			for (it = reserve.begin(); it != end; it++) {
+				if ((pid_t) (*it)["pid"].asInt() == pid) {
+					discarded = *it;
+					reserve.erase(it);
+					break;
+				}
+			}
+		}
+		if (discarded.adminSocket != -1) {
+			shutdownReservedProcess(discarded);
+		}
+	}
+
 	virtual unsigned long long lastUsed() const {
 		boost::lock_guard<boost::mutex> lock(simpleFieldSyncher);
 		return m_lastUsed;
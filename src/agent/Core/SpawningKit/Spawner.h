@@ -64,6 +64,7 @@
 #include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/move/move.hpp>
+#include <boost/thread.hpp>
 #include <oxt/system_calls.hpp>
 #include <oxt/backtrace.hpp>
 #include <sys/types.h>
@@ -88,17 +89,21 @@
 #include <Utils/ScopeGuard.h>
 #include <Utils/Timer.h>
 #include <Utils/IOUtils.h>
+#include <Utils/JsonUtils.h>
 #include <Utils/StrIntUtils.h>
 #include <Utils/ProcessMetricsCollector.h>
+#include <Utils/PidFd.h>
 #include <Core/SpawningKit/Config.h>
 #include <Core/SpawningKit/Options.h>
 #include <Core/SpawningKit/Result.h>
 #include <Core/SpawningKit/BackgroundIOCapturer.h>
+#include <Core/SpawningKit/Negotiation.h>
 #include <Core/SpawningKit/UserSwitchingRules.h>
 
 namespace tut {
 	struct ApplicationPool2_DirectSpawnerTest;
 	struct ApplicationPool2_SmartSpawnerTest;
+	struct Core_SpawningKit_SpawnerTest;
 }
 
 namespace Passenger {
@@ -113,6 +118,7 @@ class Spawner {
 protected:
 	friend struct tut::ApplicationPool2_DirectSpawnerTest;
 	friend struct tut::ApplicationPool2_SmartSpawnerTest;
+	friend struct tut::Core_SpawningKit_SpawnerTest;
 
 	/**
 	 * A temporary directory for spawned child processes to write
@@ -233,16 +239,28 @@ protected:
 		BackgroundIOCapturerPtr stderrCapturer;
 		/** The PID of the process we're negotiating with. */
 		pid_t pid;
+		/** A pidfd for `pid`, or -1. See `Result::pidFd`. */
+		FileDescriptor pidFd;
 		FileDescriptor adminSocket;
 		FileDescriptor errorPipe;
 		const Options *options;
 		DebugDirPtr debugDir;
+		/** Annotations to add to SpawnExceptions, in addition to the ones
+		 * in `debugDir`. */
+		map<string, string> annotations;
 
 		/****** Working state ******/
+		/** Any output in this object's buffer has already been read from
+		 * `adminSocket`, and is processed before anything else. */
 		BufferedIO io;
 		string gupid;
 		unsigned long long spawnStartTime;
 		unsigned long long timeout;
+		/** Whether the process speaks version 1.1 of the negotiation protocol.
+		 * See `Negotiation::createStartupRequest()`. */
+		bool binaryProtocol;
+		/** The phases of the spawn so far. See `recordSpawnPhase()`. */
+		Json::Value spawnTimeline;
 
 		NegotiationDetails() {
 			preparation = NULL;
@@ -250,6 +268,7 @@ protected:
 			options = NULL;
 			spawnStartTime = 0;
 			timeout = 0;
+			binaryProtocol = false;
 		}
 	};
 
@@ -266,155 +285,39 @@ private:
 		output.append(1, '\0');
 	}
 
-	void sendSpawnRequest(NegotiationDetails &details) {
-		TRACE_POINT();
-		try {
-			const size_t UNIX_PATH_MAX = sizeof(((struct sockaddr_un *) 0)->sun_path);
-			string data = "You have control 1.0\n"
-				"passenger_root: " + config->resourceLocator->getInstallSpec() + "\n"
-				"passenger_version: " PASSENGER_VERSION "\n"
-				"ruby_libdir: " + config->resourceLocator->getRubyLibDir() + "\n"
-				"gupid: " + details.gupid + "\n"
-				"UNIX_PATH_MAX: " + toString(UNIX_PATH_MAX) + "\n";
-			if (!details.options->apiKey.empty()) {
-				data.append("connect_password: " + details.options->apiKey + "\n");
-			}
-			if (!config->instanceDir.empty()) {
-				data.append("instance_dir: " + config->instanceDir + "\n");
-				data.append("socket_dir: " + config->instanceDir + "/apps.s\n");
-			}
-
-			vector<string> args;
-			vector<string>::const_iterator it, end;
-			details.options->toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
-			for (it = args.begin(); it != args.end(); it++) {
-				const string &key = *it;
-				it++;
-				const string &value = *it;
-				data.append(key + ": " + value + "\n");
-			}
-
-			vector<StaticString> lines;
-			split(data, '\n', lines);
-			foreach (const StaticString line, lines) {
-				P_DEBUG("[App " << details.pid << " stdin >>] " << line);
-			}
-			writeExact(details.adminSocket, data, &details.timeout);
-			writeExact(details.adminSocket, "\n", &details.timeout);
-		} catch (const SystemException &e) {
-			if (e.code() == EPIPE) {
-				/* Ignore this. Process might have written an
-				 * error response before reading the arguments,
-				 * in which case we'll want to show that instead.
-				 */
-			} else {
-				throw;
-			}
+	vector<string> createStartupRequestArgs(const NegotiationDetails &details) const {
+		const size_t UNIX_PATH_MAX = sizeof(((struct sockaddr_un *) 0)->sun_path);
+		vector<string> args;
+
+		args.reserve(64);
+		appendStartupRequestValue(args, "passenger_root", config->resourceLocator->getInstallSpec());
+		appendStartupRequestValue(args, "passenger_version", PASSENGER_VERSION);
+		appendStartupRequestValue(args, "ruby_libdir", config->resourceLocator->getRubyLibDir());
+		appendStartupRequestValue(args, "gupid", details.gupid);
+		appendStartupRequestValue(args, "UNIX_PATH_MAX", toString(UNIX_PATH_MAX));
+		if (!details.options->apiKey.empty()) {
+			appendStartupRequestValue(args, "connect_password", details.options->apiKey);
+		}
+		if (!config->instanceDir.empty()) {
+			appendStartupRequestValue(args, "instance_dir", config->instanceDir);
+			appendStartupRequestValue(args, "socket_dir", config->instanceDir + "/apps.s");
 		}
+		details.options->toVector(args, *config->resourceLocator, Options::SPAWN_OPTIONS);
+
+		logStartupRequest(details.pid, args);
+		return args;
 	}
 
-	Result handleSpawnResponse(NegotiationDetails &details) {
+	Result handleSpawnResponse(NegotiationDetails &details,
+		const Negotiation::Response &response)
+	{
 		TRACE_POINT();
 		Json::Value sockets;
 		Result result;
+		Negotiation::Response::const_iterator it, end = response.end();
 
-		while (true) {
-			string line;
-
-			try {
-				line = readMessageLine(details);
-			} catch (const SystemException &e) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. There was an I/O error while reading its "
-					"startup response: " + e.sys(),
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} catch (const TimeoutException &) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application: it did not write a startup response in time.",
-					SpawnException::APP_STARTUP_TIMEOUT,
-					details);
-			}
-
-			if (line.empty()) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It unexpected closed the connection while "
-					"sending its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line[line.size() - 1] != '\n') {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a line without a newline character "
-					"in its startup response.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} else if (line == "\n") {
-				break;
-			}
-
-			string::size_type pos = line.find(": ");
-			if (pos == string::npos) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent a startup response line without "
-					"separator.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			}
-
-			string key = line.substr(0, pos);
-			string value = line.substr(pos + 2, line.size() - pos - 3);
-			if (key == "socket") {
-				// socket: <name>;<address>;<protocol>;<concurrency>
-				// TODO: in case of TCP sockets, check whether it points to localhost
-				// TODO: in case of unix sockets, check whether filename is absolute
-				// and whether owner is correct
-				vector<string> args;
-				split(value, ';', args);
-				if (args.size() == 4) {
-					string error = validateSocketAddress(details, args[1]);
-					if (!error.empty()) {
-						throwAppSpawnException(
-							"An error occurred while starting the web application. " + error,
-							SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-							details);
-					}
-
-					Json::Value socket;
-					socket["name"] = args[0];
-					socket["address"] = fixupSocketAddress(*details.options, args[1]);
-					socket["protocol"] = args[2];
-					socket["concurrency"] = atoi(args[3]);
-					sockets.append(socket);
-				} else {
-					throwAppSpawnException("An error occurred while starting the "
-						"web application. It reported a wrongly formatted 'socket'"
-						"response value: '" + value + "'",
-						SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-						details);
-				}
-			} else if (key == "pid") {
-				// pid: <PID>
-				pid_t pid = atoi(value);
-				ProcessMetricsCollector collector;
-				vector<pid_t> pids;
-
-				pids.push_back(pid);
-				ProcessMetricMap metrics = collector.collect(pids);
-				if (metrics[pid].uid != details.preparation->userSwitching.uid) {
-					throwAppSpawnException("An error occurred while starting the "
-						"web application. The PID that the loader has returned does "
-						"not have the same UID as the loader itself.",
-						SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-						details);
-				}
-				details.pid = pid;
-			} else {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. It sent an unknown startup response line "
-					"called '" + key + "'.",
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			}
+		for (it = response.begin(); it != end; it++) {
+			handleSpawnResponseValue(details, sockets, it->first, it->second);
 		}
 
 		if (!hasSessionSockets(sockets)) {
@@ -433,9 +336,68 @@ private:
 		result["spawn_start_time"] = (Json::UInt64) details.spawnStartTime;
 		result.adminSocket = details.adminSocket;
 		result.errorPipe = details.errorPipe;
+		result.pidFd = details.pidFd;
 		return result;
 	}
 
+	void handleSpawnResponseValue(NegotiationDetails &details, Json::Value &sockets,
+		const StaticString &key, const StaticString &value)
+	{
+		if (key == "socket") {
+			// socket: <name>;<address>;<protocol>;<concurrency>
+			// TODO: in case of TCP sockets, check whether it points to localhost
+			// TODO: in case of unix sockets, check whether filename is absolute
+			// and whether owner is correct
+			vector<string> args;
+			split(value, ';', args);
+			if (args.size() == 4) {
+				string error = validateSocketAddress(details, args[1]);
+				if (!error.empty()) {
+					throwAppSpawnException(
+						"An error occurred while starting the web application. " + error,
+						SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+						details);
+				}
+
+				Json::Value socket;
+				socket["name"] = args[0];
+				socket["address"] = fixupSocketAddress(*details.options, args[1]);
+				socket["protocol"] = args[2];
+				socket["concurrency"] = atoi(args[3]);
+				sockets.append(socket);
+			} else {
+				throwAppSpawnException("An error occurred while starting the "
+					"web application. It reported a wrongly formatted 'socket'"
+					"response value: '" + value.toString() + "'",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+					details);
+			}
+		} else if (key == "pid") {
+			// pid: <PID>
+			pid_t pid = stringToInt(value);
+			ProcessMetricsCollector collector;
+			vector<pid_t> pids;
+
+			pids.push_back(pid);
+			ProcessMetricMap metrics = collector.collect(pids);
+			if (metrics[pid].uid != details.preparation->userSwitching.uid) {
+				throwAppSpawnException("An error occurred while starting the "
+					"web application. The PID that the loader has returned does "
+					"not have the same UID as the loader itself.",
+					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+					details);
+			}
+			details.pid = pid;
+			details.pidFd = FileDescriptor(openPidFd(pid), __FILE__, __LINE__);
+		} else {
+			throwAppSpawnException("An error occurred while starting the "
+				"web application. It sent an unknown startup response line "
+				"called '" + key.toString() + "'.",
+				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
+				details);
+		}
+	}
+
 	bool hasSessionSockets(const Json::Value &sockets) const {
 		Json::Value::const_iterator it, end = sockets.end();
 
@@ -451,6 +413,57 @@ private:
 protected:
 	ConfigPtr config;
 
+	/** Cache for serializeEnvvarsFromPoolOptions(). */
+	mutable boost::mutex envvarsCacheSyncher;
+	mutable string envvarsCacheKey;
+	mutable string envvarsCache;
+
+	/**
+	 * Appends to `timeline` that the spawn phase `name` lasted from
+	 * `startTime` until `endTime`, or until now if `endTime` is 0. Returns
+	 * the end time, so that it can be used as the start time of the next phase.
+	 */
+	static MonotonicTimeUsec recordSpawnPhase(Json::Value &timeline,
+		const char *name, MonotonicTimeUsec startTime, MonotonicTimeUsec endTime = 0)
+	{
+		if (endTime == 0) {
+			endTime = SystemTime::getMonotonicUsec();
+		}
+		Json::Value phase;
+		phase["phase"] = name;
+		phase["start_time"] = (Json::UInt64) startTime;
+		phase["end_time"] = (Json::UInt64) endTime;
+		timeline.append(phase);
+		return endTime;
+	}
+
+	/**
+	 * Appends to `timeline` the negotiation phases that a failed spawn got
+	 * through, the last of which lasted until now.
+	 */
+	static void recordFailedNegotiationPhases(Json::Value &timeline,
+		const Negotiation &negotiation, MonotonicTimeUsec phaseStartTime)
+	{
+		if (negotiation.getHandshakeTime() == 0) {
+			recordSpawnPhase(timeline, "handshake", phaseStartTime);
+		} else {
+			phaseStartTime = recordSpawnPhase(timeline, "handshake",
+				phaseStartTime, negotiation.getHandshakeTime());
+			recordSpawnPhase(timeline, "app_boot", phaseStartTime);
+		}
+	}
+
+	/**
+	 * Whether SpawnPreparer should dump diagnostics (environment variables,
+	 * user info, ulimits, system metrics) into the debug directory, so that
+	 * SpawnExceptions are annotated with them. They involve forking helper
+	 * commands and sampling the CPU for 50 msec, so they're only collected
+	 * when debugging.
+	 */
+	static bool shouldDumpSpawnInformation() {
+		return Passenger::getLogLevel() >= LVL_DEBUG;
+	}
+
 	static void nonInterruptableKillAndWaitpid(pid_t pid) {
 		boost::this_thread::disable_syscall_interruption dsi;
 		syscalls::kill(pid, SIGKILL);
@@ -462,18 +475,7 @@ protected:
 	 * <em>timeout</em> miliseconds for the process to exit.
 	 */
 	static int timedWaitpid(pid_t pid, int *status, unsigned long long timeout) {
-		Timer<SystemTime::GRAN_10MSEC> timer;
-		int ret;
-
-		do {
-			ret = syscalls::waitpid(pid, status, WNOHANG);
-			if (ret > 0 || ret == -1) {
-				return ret;
-			} else {
-				syscalls::usleep(10000);
-			}
-		} while (timer.elapsed() < timeout);
-		return 0; // timed out
+		return timedWaitpidUsingPidFd(pid, status, timeout);
 	}
 
 	static string fixupSocketAddress(const Options &options, const string &address) {
@@ -654,6 +656,10 @@ protected:
 		if (details.debugDir != NULL) {
 			e.addAnnotations(details.debugDir->readAll());
 		}
+		if (!details.spawnTimeline.empty()) {
+			details.annotations["spawn_timeline"] = stringifyJson(details.spawnTimeline);
+		}
+		e.addAnnotations(details.annotations);
 	}
 
 	string createErrorPageFromStderrOutput(const string &msg,
@@ -713,6 +719,22 @@ protected:
 		}
 	}
 
+	static void appendStartupRequestValue(vector<string> &args, const StaticString &key,
+		const StaticString &value)
+	{
+		args.push_back(key.toString());
+		args.push_back(value.toString());
+	}
+
+	static void logStartupRequest(pid_t pid, const vector<string> &args) {
+		if (OXT_UNLIKELY(getLogLevel() >= LVL_DEBUG)) {
+			vector<string>::const_iterator it, end = args.end();
+			for (it = args.begin(); it != end; it += 2) {
+				P_DEBUG("[App " << pid << " stdin >>] " << *it << ": " << *(it + 1));
+			}
+		}
+	}
+
 	SpawnPreparationInfo prepareSpawn(const Options &options) {
 		TRACE_POINT();
 		SpawnPreparationInfo info;
@@ -828,8 +850,30 @@ protected:
 		}
 	}
 
+	/**
+	 * Serializes the environment variables that SpawnPreparer must set into
+	 * a base64-encoded image. The result only depends on a few per-group
+	 * options, so it's cached and reused for subsequent spawns.
+	 */
 	string serializeEnvvarsFromPoolOptions(const Options &options) const {
-		vector< pair<StaticString, StaticString> >::const_iterator it, end;
+		string key;
+		key.reserve(options.environment.size() + options.baseURI.size()
+			+ options.environmentVariables.size() + 2);
+		key.append(options.environment.data(), options.environment.size());
+		key.append(1, '\0');
+		key.append(options.baseURI.data(), options.baseURI.size());
+		key.append(1, '\0');
+		key.append(options.environmentVariables.data(), options.environmentVariables.size());
+
+		boost::lock_guard<boost::mutex> l(envvarsCacheSyncher);
+		if (envvarsCache.empty() || envvarsCacheKey != key) {
+			envvarsCache = reallySerializeEnvvarsFromPoolOptions(options);
+			envvarsCacheKey = key;
+		}
+		return envvarsCache;
+	}
+
+	string reallySerializeEnvvarsFromPoolOptions(const Options &options) const {
 		string result;
 
 		appendNullTerminatedKeyValue(result, "IN_PASSENGER", "1");
@@ -1094,69 +1138,67 @@ protected:
 	}
 
 	/**
-	 * Execute the process spawning negotiation protocol.
+	 * Execute the process spawning negotiation protocol. The negotiation's
+	 * I/O runs on the spawn EventLoop, together with all other negotiations
+	 * in progress. The calling thread still blocks until the outcome is
+	 * known, because `spawn()` returns its result synchronously.
 	 */
 	Result negotiateSpawn(NegotiationDetails &details) {
 		TRACE_POINT();
+		MonotonicTimeUsec phaseStartTime = SystemTime::getMonotonicUsec();
 		details.spawnStartTime = SystemTime::getUsec();
 		details.gupid = integerToHex(SystemTime::get() / 60) + "-" +
 			config->randomGenerator->generateAsciiString(10);
 		details.timeout = details.options->startTimeout * 1000;
 
-		string result;
-		try {
-			result = readMessageLine(details);
-		} catch (const SystemException &e) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application. There was an I/O error while reading its "
-				"handshake message: " + e.sys(),
-				SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-				details);
-		} catch (const TimeoutException &) {
-			throwAppSpawnException("An error occurred while starting the "
-				"web application: it did not write a handshake message in time.",
-				SpawnException::APP_STARTUP_TIMEOUT,
-				details);
+		NegotiationPtr negotiation = boost::make_shared<Negotiation>(
+			details.pid,
+			details.adminSocket,
+			createStartupRequestArgs(details),
+			details.timeout,
+			details.stderrCapturer,
+			details.io.getBuffer());
+		negotiation->run();
+		details.timeout = negotiation->getRemainingTimeout();
+		details.binaryProtocol = negotiation->isBinaryProtocol();
+
+		UPDATE_TRACE_POINT();
+		switch (negotiation->getOutcome()) {
+		case Negotiation::READY: {
+			phaseStartTime = recordSpawnPhase(details.spawnTimeline, "handshake",
+				phaseStartTime, negotiation->getHandshakeTime());
+			phaseStartTime = recordSpawnPhase(details.spawnTimeline, "app_boot",
+				phaseStartTime, negotiation->getReadyTime());
+			Result spawnResult = handleSpawnResponse(details, negotiation->getResponse());
+			recordSpawnPhase(details.spawnTimeline, "socket_advertisement",
+				phaseStartTime);
+			spawnResult["spawn_timeline"] = details.spawnTimeline;
+			return spawnResult;
 		}
-
-		protocol_begin:
-		if (result == "I have control 1.0\n") {
-			UPDATE_TRACE_POINT();
-			sendSpawnRequest(details);
-			try {
-				result = readMessageLine(details);
-			} catch (const SystemException &e) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application. There was an I/O error while reading its "
-					"startup response: " + e.sys(),
-					SpawnException::APP_STARTUP_PROTOCOL_ERROR,
-					details);
-			} catch (const TimeoutException &) {
-				throwAppSpawnException("An error occurred while starting the "
-					"web application: it did not write a startup response in time.",
-					SpawnException::APP_STARTUP_TIMEOUT,
-					details);
-			}
-			if (result == "Ready\n") {
-				return handleSpawnResponse(details);
-			} else if (result == "Error\n") {
-				handleSpawnErrorResponse(details);
-			} else if (result == "I have control 1.0\n") {
-				goto protocol_begin;
-			} else {
-				handleInvalidSpawnResponseType(result, details);
-			}
-		} else {
-			UPDATE_TRACE_POINT();
-			if (result == "Error\n") {
-				handleSpawnErrorResponse(details);
-			} else {
-				handleInvalidSpawnResponseType(result, details);
-			}
+		case Negotiation::ERROR_RESPONSE: {
+			recordFailedNegotiationPhases(details.spawnTimeline, *negotiation,
+				phaseStartTime);
+			map<string, string>::const_iterator it =
+				negotiation->getErrorAttributes().find("html");
+			throwSpawnErrorResponse(details, negotiation->getErrorMessage(),
+				it != negotiation->getErrorAttributes().end() && it->second == "true");
+			break;
+		}
+		default:
+			recordFailedNegotiationPhases(details.spawnTimeline, *negotiation,
+				phaseStartTime);
+			throwAppSpawnException(negotiation->getErrorMessage(),
+				negotiation->getErrorKind(),
+				details);
+			break;
 		}
 		return Result(); // Never reached.
 	}
 
+	/**
+	 * Reads an error response after the process has sent "Error", and
+	 * throws it as a SpawnException.
+	 */
 	void handleSpawnErrorResponse(NegotiationDetails &details) {
 		TRACE_POINT();
 		map<string, string> attributes;
@@ -1193,14 +1235,9 @@ protected:
 			attributes[key] = value;
 		}
 
+		string message;
 		try {
-			string message = details.io.readAll(&details.timeout);
-			SpawnException e("An error occured while starting the web application.",
-				message,
-				attributes["html"] == "true",
-				SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
-			annotateAppSpawnException(e, details);
-			throwSpawnException(e, *details.options);
+			message = details.io.readAll(&details.timeout);
 		} catch (const SystemException &e) {
 			throwAppSpawnException("An error occurred while starting the "
 				"web application. It tried to report an error message, but "
@@ -1215,6 +1252,18 @@ protected:
 				SpawnException::APP_STARTUP_TIMEOUT,
 				details);
 		}
+		throwSpawnErrorResponse(details, message, attributes["html"] == "true");
+	}
+
+	void throwSpawnErrorResponse(NegotiationDetails &details, const string &message,
+		bool html)
+	{
+		SpawnException e("An error occured while starting the web application.",
+			message,
+			html,
+			SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
+		annotateAppSpawnException(e, details);
+		throwSpawnException(e, *details.options);
 	}
 
 	void handleInvalidSpawnResponseType(const string &line, NegotiationDetails &details) {
@@ -1260,6 +1309,33 @@ public:
 		return 0;
 	}
 
+	/**
+	 * Limits the number of processes that this spawner may keep in reserve,
+	 * on top of `Options::spawnReserveSize`. Processes in excess of the limit
+	 * are shut down. Spawners without a reserve ignore this.
+	 */
+	virtual void setReserveLimit(unsigned int limit) {
+		// Do nothing.
+	}
+
+	/** The number of processes that this spawner currently keeps in reserve. */
+	virtual unsigned int getReserveSize() const {
+		return 0;
+	}
+
+	/** Appends the PIDs of the processes in reserve to `pids`. */
+	virtual void getReservedPids(vector<pid_t> &pids) const {
+		// Do nothing.
+	}
+
+	/**
+	 * Removes the given process from the reserve, if it's in there, and
+	 * shuts it down.
+	 */
+	virtual void discardFromReserve(pid_t pid) {
+		// Do nothing.
+	}
+
 	ConfigPtr getConfig() const {
 		return config;
 	}
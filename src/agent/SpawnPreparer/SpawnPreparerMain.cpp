@@ -25,8 +25,11 @@
  */
 
 /*
- * Sets given environment variables, dumps the entire environment to
- * a given file (for diagnostics purposes), then execs the given command.
+ * Sets given environment variables, dumps the entire environment, user
+ * info, ulimits and system metrics to a given directory (for diagnostics
+ * purposes), then execs the given command. The dumps are expensive to
+ * collect, so they're only made if PASSENGER_DUMP_SPAWN_INFORMATION is set,
+ * which the Core only does when debugging.
  *
  * This is a separate executable because it does quite
  * some non-async-signal-safe stuff that we can't do after
@@ -97,16 +100,8 @@ setGivenEnvVars(const char *envvarsData) {
 }
 
 static void
-dumpInformation() {
-	const char *c_dir;
-	if ((c_dir = getenv("PASSENGER_DEBUG_DIR")) == NULL) {
-		return;
-	}
-
-	FILE *f;
-	string dir = c_dir;
-
-	f = fopen((dir + "/envvars").c_str(), "w");
+dumpEnvvars(const string &dir) {
+	FILE *f = fopen((dir + "/envvars").c_str(), "w");
 	if (f != NULL) {
 		int i = 0;
 		while (environ[i] != NULL) {
@@ -116,6 +111,11 @@ dumpInformation() {
 		}
 		fclose(f);
 	}
+}
+
+static void
+dumpSystemInformation(const string &dir) {
+	FILE *f;
 
 	f = fopen((dir + "/user_info").c_str(), "w");
 	if (f != NULL) {
@@ -175,6 +175,20 @@ dumpInformation() {
 	}
 }
 
+static void
+dumpInformation() {
+	const char *dir = getenv("PASSENGER_DEBUG_DIR");
+	bool dump = getenv("PASSENGER_DUMP_SPAWN_INFORMATION") != NULL;
+
+	unsetenv("PASSENGER_DUMP_SPAWN_INFORMATION");
+	if (dir == NULL || !dump) {
+		return;
+	}
+
+	dumpEnvvars(dir);
+	dumpSystemInformation(dir);
+}
+
 // Usage: PassengerAgent spawn-preparer <working directory> <envvars> <executable> <exec args...>
 int
 spawnPreparerMain(int argc, char *argv[]) {
@@ -51,15 +51,15 @@ private:
 				if (ret == -1 && errno == ECHILD) {
 					/* If the agent is attached to gdb then waitpid()
 					 * here can return -1 with errno == ECHILD.
-					 * Fallback to kill() polling for checking
-					 * whether the agent is alive.
+					 * Fallback to waiting on a pidfd, or to kill()
+					 * polling, for checking whether the agent is alive.
 					 */
 					ret = pid;
 					status = 0;
 					P_WARN("waitpid() on " << name() << " (pid=" << pid <<
 						") returned -1 with " <<
-						"errno = ECHILD, falling back to kill polling");
-					waitpidUsingKillPolling(pid);
+						"errno = ECHILD, waiting for it to exit in another way");
+					waitUntilProcessExits(pid);
 					e = 0;
 				} else {
 					e = errno;
@@ -203,21 +203,21 @@ protected:
 	 * <em>timeout</em> miliseconds for the process to exit.
 	 */
 	static int timedWaitPid(pid_t pid, int *status, unsigned long long timeout) {
-		Timer<SystemTime::GRAN_10MSEC> timer;
-		int ret;
-
-		do {
-			ret = syscalls::waitpid(pid, status, WNOHANG);
-			if (ret > 0 || ret == -1) {
-				return ret;
-			} else {
-				syscalls::usleep(10000);
-			}
-		} while (timer.elapsed() < timeout);
-		return 0; // timed out
+		return timedWaitpidUsingPidFd(pid, status, timeout);
 	}
 
-	static void waitpidUsingKillPolling(pid_t pid) {
+	/**
+	 * Waits until the given process exits, even if it isn't our child.
+	 * Waits on a pidfd if possible, and polls with kill(pid, 0) otherwise.
+	 */
+	static void waitUntilProcessExits(pid_t pid) {
+		FileDescriptor pidFd(openPidFd(pid), __FILE__, __LINE__);
+		if (pidFd != -1) {
+			// Doesn't require the agent to be our child, and doesn't poll.
+			waitPidFd(pidFd, -1);
+			return;
+		}
+
 		bool done = false;
 
 		while (!done) {
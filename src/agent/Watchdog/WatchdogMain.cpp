@@ -85,6 +85,7 @@
 #include <Utils/MessageIO.h>
 #include <Utils/OptionParsing.h>
 #include <Utils/VariantMap.h>
+#include <Utils/PidFd.h>
 
 using namespace std;
 using namespace boost;
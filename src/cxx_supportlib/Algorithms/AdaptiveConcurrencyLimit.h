@@ -0,0 +1,120 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_ALGORITHMS_ADAPTIVE_CONCURRENCY_LIMIT_H_
+#define _PASSENGER_ALGORITHMS_ADAPTIVE_CONCURRENCY_LIMIT_H_
+
+#include <Algorithms/MovingAverage.h>
+#include <algorithm>
+#include <cmath>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Estimates how many requests a server can handle concurrently before it
+ * starts queueing them internally, by looking at how its response times
+ * change. Call `update()` every time a request finishes.
+ *
+ * This is a gradient algorithm. A short-term average of the response time
+ * is compared with a long-term average. If the short-term average rises
+ * significantly above the long-term one, then requests are apparently
+ * waiting inside the server, and the limit is decreased in proportion.
+ * Otherwise the limit is increased by a small allowance (the square root
+ * of the limit), so that it keeps probing for more capacity.
+ *
+ * The limit is only increased while the server is actually using at least
+ * half of it: response times tell nothing about capacity that is not used.
+ */
+class AdaptiveConcurrencyLimit {
+private:
+	static BOOST_CONSTEXPR double nullValue() {
+		return -1;
+	}
+
+	double limit;
+	double shortTermResponseTime;
+	double longTermResponseTime;
+	unsigned int minLimit, maxLimit;
+
+public:
+	/** How much the short-term response time may exceed the long-term one
+	 * before the limit is decreased. */
+	static BOOST_CONSTEXPR double tolerance() {
+		return 1.5;
+	}
+
+	AdaptiveConcurrencyLimit(unsigned int initialLimit = 1, unsigned int _minLimit = 1,
+		unsigned int _maxLimit = 1)
+		: limit(initialLimit),
+		  shortTermResponseTime(nullValue()),
+		  longTermResponseTime(nullValue()),
+		  minLimit(_minLimit),
+		  maxLimit(_maxLimit)
+		{ }
+
+	unsigned int getLimit() const {
+		return std::max<unsigned int>(minLimit, (unsigned int) limit);
+	}
+
+	unsigned int getMaxLimit() const {
+		return maxLimit;
+	}
+
+	/**
+	 * Feeds the response time of a request that just finished.
+	 * `inflight` is the number of requests that the server was handling,
+	 * including this one.
+	 */
+	void update(double responseTime, unsigned int inflight) {
+		shortTermResponseTime = expMovingAverage(shortTermResponseTime,
+			responseTime, 0.1, nullValue());
+		longTermResponseTime = expMovingAverage(longTermResponseTime,
+			responseTime, 0.01, nullValue());
+
+		if (longTermResponseTime > 2 * shortTermResponseTime) {
+			// Response times have gone down permanently. Let the
+			// long-term average catch up faster.
+			longTermResponseTime *= 0.95;
+		}
+
+		if (inflight < limit / 2 || shortTermResponseTime <= 0) {
+			return;
+		}
+
+		double gradient = tolerance() * longTermResponseTime / shortTermResponseTime;
+		gradient = std::max(0.5, std::min(1.0, gradient));
+		double newLimit = limit * gradient + sqrt(limit);
+		limit = std::max<double>(minLimit, std::min<double>(maxLimit,
+			0.8 * limit + 0.2 * newLimit));
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_ALGORITHMS_ADAPTIVE_CONCURRENCY_LIMIT_H_ */
@@ -0,0 +1,188 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_ALGORITHMS_DEMAND_PREDICTOR_H_
+#define _PASSENGER_ALGORITHMS_DEMAND_PREDICTOR_H_
+
+#include <Algorithms/MovingAverage.h>
+#include <algorithm>
+#include <cmath>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * Predicts how many requests a server will be handling concurrently in the
+ * near future, so that capacity can be added before requests start queueing.
+ *
+ * Arrivals are counted per fixed interval. The resulting arrival rates are
+ * smoothed with Holt's double exponential smoothing, which tracks both the
+ * rate and its trend, so that a traffic ramp is extrapolated instead of
+ * lagged behind. The rate is forecasted one lead time ahead (the time it
+ * takes to add capacity, e.g. to spawn a process), and multiplied by the
+ * average time that a request holds on to the server (Little's law).
+ *
+ * All times are in microseconds. Call `tick()` regularly, even when no
+ * requests arrive, so that the rate decays when the traffic stops.
+ */
+class DemandPredictor {
+private:
+	static BOOST_CONSTEXPR double nullValue() {
+		return -1;
+	}
+
+	/** After this many idle intervals, the rate and trend are simply reset. */
+	static BOOST_CONSTEXPR unsigned int maxIdleIntervals() {
+		return 40;
+	}
+
+	unsigned long long intervalStart;
+	unsigned int arrivals;
+	double rate, trend;
+	double holdTime;
+	double leadTime;
+
+	void closeInterval(double observedRate) {
+		if (rate == nullValue()) {
+			rate = observedRate;
+			trend = 0;
+		} else {
+			double prevRate = rate;
+			rate = 0.5 * observedRate + 0.5 * (rate + trend);
+			trend = 0.3 * (rate - prevRate) + 0.7 * trend;
+		}
+	}
+
+public:
+	/** The length of the intervals in which arrivals are counted. */
+	static BOOST_CONSTEXPR unsigned long long interval() {
+		return 250000;
+	}
+
+	DemandPredictor()
+		: intervalStart(0),
+		  arrivals(0),
+		  rate(nullValue()),
+		  trend(0),
+		  holdTime(nullValue()),
+		  leadTime(nullValue())
+		{ }
+
+	/** Closes the intervals that ended before `now`. */
+	void tick(unsigned long long now) {
+		if (intervalStart == 0 || now < intervalStart) {
+			intervalStart = now;
+			return;
+		}
+
+		unsigned long long elapsed = (now - intervalStart) / interval();
+		if (elapsed == 0) {
+			return;
+		}
+		closeInterval(arrivals * 1000000.0 / interval());
+		arrivals = 0;
+		if (elapsed > maxIdleIntervals()) {
+			rate = 0;
+			trend = 0;
+		} else {
+			for (unsigned long long i = 1; i < elapsed; i++) {
+				closeInterval(0);
+			}
+		}
+		intervalStart += elapsed * interval();
+	}
+
+	void registerArrival(unsigned long long now) {
+		tick(now);
+		arrivals++;
+	}
+
+	/** Feeds the time that a request held on to the server. */
+	void registerHoldTime(unsigned long long time) {
+		holdTime = expMovingAverage(holdTime, time, 0.1, nullValue());
+	}
+
+	/** Feeds the time that it took to add capacity. */
+	void registerLeadTime(unsigned long long time) {
+		leadTime = expMovingAverage(leadTime, time, 0.3, nullValue());
+	}
+
+	/** The smoothed arrival rate, in requests per second. */
+	double getArrivalRate() const {
+		return std::max(0.0, rate);
+	}
+
+	/** By how much the arrival rate changes per interval. */
+	double getArrivalRateTrend() const {
+		return (rate == nullValue()) ? 0 : trend;
+	}
+
+	/** The average time that a request holds on to the server. */
+	double getHoldTime() const {
+		return std::max(0.0, holdTime);
+	}
+
+	/** The average time that it takes to add capacity. */
+	double getLeadTime() const {
+		return std::max(0.0, leadTime);
+	}
+
+	/** The arrival rate forecasted one lead time from now. */
+	double forecastArrivalRate() const {
+		if (rate == nullValue()) {
+			return 0;
+		}
+		double intervals = std::max<double>(getLeadTime(), interval())
+			/ interval();
+		return std::max(0.0, rate + trend * intervals);
+	}
+
+	/**
+	 * The number of requests that the server is predicted to be
+	 * handling concurrently one lead time from now.
+	 */
+	double predictDemand() const {
+		return forecastArrivalRate() * getHoldTime() / 1000000.0;
+	}
+
+	/**
+	 * The number of servers, each able to handle `concurrency` requests
+	 * at the same time, that the predicted demand calls for. `headroom`
+	 * asks for that much more capacity (e.g. 1.2 for 20% more), but only
+	 * in whole servers: a steady demand that exactly fits N servers needs
+	 * N servers, not N + 1.
+	 */
+	unsigned int predictServerCount(unsigned int concurrency, double headroom) const {
+		double load = predictDemand() / concurrency;
+		return (unsigned int) std::max(ceil(load), floor(load * headroom));
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_ALGORITHMS_DEMAND_PREDICTOR_H_ */
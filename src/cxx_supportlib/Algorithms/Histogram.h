@@ -0,0 +1,183 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_ALGORITHMS_HISTOGRAM_H_
+#define _PASSENGER_ALGORITHMS_HISTOGRAM_H_
+
+#include <boost/config.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <jsoncpp/json.h>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * A histogram of non-negative values, e.g. durations in microseconds, with
+ * exponentially growing buckets: bucket `i` counts the values that are at
+ * most `firstBucketBound * 2^i`, and the last bucket counts all values that
+ * are larger than that. Memory usage is constant, values from milliseconds
+ * up to hours can be recorded, and percentiles are estimated with a relative
+ * error of at most a factor 2.
+ */
+class Histogram {
+public:
+	enum {
+		/** The number of buckets, excluding the one for values that are too large. */
+		BUCKET_COUNT = 24
+	};
+
+private:
+	unsigned long long firstBucketBound;
+	unsigned long long buckets[BUCKET_COUNT + 1];
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long min;
+	unsigned long long max;
+
+public:
+	Histogram(unsigned long long _firstBucketBound = 1000)
+		: firstBucketBound(_firstBucketBound),
+		  count(0),
+		  sum(0),
+		  min(0),
+		  max(0)
+	{
+		memset(buckets, 0, sizeof(buckets));
+	}
+
+	void add(unsigned long long value) {
+		unsigned int i = 0;
+		unsigned long long bound = firstBucketBound;
+		while (i < BUCKET_COUNT && value > bound) {
+			bound *= 2;
+			i++;
+		}
+		buckets[i]++;
+
+		if (count == 0) {
+			min = max = value;
+		} else {
+			min = std::min(min, value);
+			max = std::max(max, value);
+		}
+		count++;
+		sum += value;
+	}
+
+	/** The upper bound of bucket `i`, which must be smaller than `BUCKET_COUNT`. */
+	unsigned long long getBucketBound(unsigned int i) const {
+		return firstBucketBound << i;
+	}
+
+	unsigned long long getBucketCount(unsigned int i) const {
+		return buckets[i];
+	}
+
+	unsigned long long getCount() const {
+		return count;
+	}
+
+	unsigned long long getSum() const {
+		return sum;
+	}
+
+	unsigned long long getMin() const {
+		return min;
+	}
+
+	unsigned long long getMax() const {
+		return max;
+	}
+
+	double getAverage() const {
+		if (count == 0) {
+			return 0;
+		} else {
+			return (double) sum / count;
+		}
+	}
+
+	/**
+	 * Estimates the value below which the given fraction (between 0 and 1)
+	 * of the recorded values fall, as the upper bound of the bucket that
+	 * contains it. The estimate never exceeds the largest recorded value.
+	 */
+	unsigned long long getPercentile(double fraction) const {
+		if (count == 0) {
+			return 0;
+		}
+
+		unsigned long long rank = (unsigned long long) ceil(fraction * count);
+		unsigned long long seen = 0;
+		rank = std::max<unsigned long long>(rank, 1);
+		for (unsigned int i = 0; i < BUCKET_COUNT; i++) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				return std::min(getBucketBound(i), max);
+			}
+		}
+		return max;
+	}
+
+	/**
+	 * Returns the summary statistics and the non-empty buckets. The bucket
+	 * for values that are too large has no "le" (less than or equal) member.
+	 */
+	Json::Value toJson() const {
+		Json::Value doc;
+		doc["count"] = (Json::UInt64) count;
+		doc["sum"] = (Json::UInt64) sum;
+		doc["min"] = (Json::UInt64) min;
+		doc["max"] = (Json::UInt64) max;
+		doc["average"] = getAverage();
+		doc["p50"] = (Json::UInt64) getPercentile(0.5);
+		doc["p90"] = (Json::UInt64) getPercentile(0.9);
+		doc["p99"] = (Json::UInt64) getPercentile(0.99);
+
+		Json::Value bucketsDoc(Json::arrayValue);
+		for (unsigned int i = 0; i <= BUCKET_COUNT; i++) {
+			if (buckets[i] == 0) {
+				continue;
+			}
+			Json::Value bucket;
+			if (i < BUCKET_COUNT) {
+				bucket["le"] = (Json::UInt64) getBucketBound(i);
+			}
+			bucket["count"] = (Json::UInt64) buckets[i];
+			bucketsDoc.append(bucket);
+		}
+		doc["buckets"] = bucketsDoc;
+		return doc;
+	}
+};
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_ALGORITHMS_HISTOGRAM_H_ */
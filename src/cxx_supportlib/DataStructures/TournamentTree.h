@@ -0,0 +1,168 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_DATA_STRUCTURES_TOURNAMENT_TREE_H_
+#define _PASSENGER_DATA_STRUCTURES_TOURNAMENT_TREE_H_
+
+#include <boost/container/vector.hpp>
+#include <cassert>
+
+namespace Passenger {
+
+using namespace std;
+
+
+/**
+ * An array of values that keeps track of which element has the smallest value.
+ * Finding that element is O(1), changing a value or appending one is O(log n)
+ * (amortized, for appending).
+ *
+ * The values are the leaves of a complete binary tree in which every inner
+ * node stores the index of the smallest value in its subtree. When multiple
+ * elements have the smallest value, the one with the lowest index wins, so
+ * `minIndex()` gives the same answer as a linear scan using `<`.
+ *
+ * Removing elements from the middle is not supported: `clear()` and
+ * rebuild the array instead.
+ */
+template<typename T>
+class TournamentTree {
+private:
+	static const unsigned int NONE = ~0u;
+
+	boost::container::vector<T> values;
+	/** nodes[1] is the root. The children of node i are 2i and 2i + 1.
+	 * The leaves are nodes[capacity .. 2 * capacity - 1].
+	 * Empty leaves contain NONE.
+	 */
+	boost::container::vector<unsigned int> nodes;
+	unsigned int capacity;
+
+	unsigned int winner(unsigned int a, unsigned int b) const {
+		if (b == NONE) {
+			return a;
+		} else if (a == NONE) {
+			return b;
+		} else if (values[b] < values[a]) {
+			return b;
+		} else {
+			return a;
+		}
+	}
+
+	void updatePath(unsigned int index) {
+		unsigned int node = (capacity + index) / 2;
+		while (node > 0) {
+			nodes[node] = winner(nodes[2 * node], nodes[2 * node + 1]);
+			node /= 2;
+		}
+	}
+
+	void rebuild(unsigned int newCapacity) {
+		capacity = newCapacity;
+		nodes.assign(2 * capacity, NONE);
+		for (unsigned int i = 0; i < values.size(); i++) {
+			nodes[capacity + i] = i;
+		}
+		for (unsigned int node = capacity - 1; node > 0; node--) {
+			nodes[node] = winner(nodes[2 * node], nodes[2 * node + 1]);
+		}
+	}
+
+public:
+	TournamentTree()
+		: capacity(0)
+		{ }
+
+	unsigned int size() const {
+		return values.size();
+	}
+
+	bool empty() const {
+		return values.empty();
+	}
+
+	const T &operator[](unsigned int index) const {
+		assert(index < values.size());
+		return values[index];
+	}
+
+	/**
+	 * Returns the index of the element with the smallest value.
+	 * The array must not be empty.
+	 */
+	unsigned int minIndex() const {
+		assert(!values.empty());
+		return nodes[1];
+	}
+
+	void set(unsigned int index, const T &value) {
+		assert(index < values.size());
+		values[index] = value;
+		updatePath(index);
+	}
+
+	void push_back(const T &value) {
+		values.push_back(value);
+		if (values.size() > capacity) {
+			rebuild(capacity == 0 ? 1 : capacity * 2);
+		} else {
+			nodes[capacity + values.size() - 1] = values.size() - 1;
+			updatePath(values.size() - 1);
+		}
+	}
+
+	/** Removes all elements, but keeps the allocated memory. */
+	void clear() {
+		values.clear();
+		nodes.assign(nodes.size(), NONE);
+	}
+
+	void shrink_to_fit() {
+		values.shrink_to_fit();
+		if (values.empty()) {
+			nodes.clear();
+			nodes.shrink_to_fit();
+			capacity = 0;
+		} else {
+			unsigned int newCapacity = 1;
+			while (newCapacity < values.size()) {
+				newCapacity *= 2;
+			}
+			if (newCapacity < capacity) {
+				rebuild(newCapacity);
+				nodes.shrink_to_fit();
+			}
+		}
+	}
+};
+
+template<typename T>
+const unsigned int TournamentTree<T>::NONE;
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_DATA_STRUCTURES_TOURNAMENT_TREE_H_ */
@@ -366,6 +366,34 @@ public:
 	}
 };
 
+/**
+ * Indicates that a Pool::get() or Pool::asyncGet() request was denied without
+ * even trying to spawn a process, because spawning failed repeatedly for the
+ * application and its circuit breaker is open. Contains the error page of the
+ * last spawn failure.
+ */
+class SpawnCircuitOpenException: public SpawnException {
+private:
+	string msg;
+
+public:
+	SpawnCircuitOpenException(const SpawnException &lastError, unsigned int failures,
+		unsigned long long backoff)
+		: SpawnException(lastError)
+		{
+			stringstream str;
+			str << "Not spawning for " << (backoff / 1000) << " msec because the last " <<
+				failures << " spawn attempts failed. Last error: " << lastError.what();
+			msg = str.str();
+		}
+
+	virtual ~SpawnCircuitOpenException() throw() {}
+
+	virtual const char *what() const throw() {
+		return msg.c_str();
+	}
+};
+
 /**
  * Indicates that a Pool::get() or Pool::asyncGet() request was denied.
  * The request never reached a process. This could be because, before the
@@ -416,6 +444,31 @@ public:
 	}
 };
 
+/**
+ * Indicates that a Pool::get() or Pool::asyncGet() request was denied because
+ * it waited in the getWaitlist queue for longer than allowed.
+ */
+class RequestQueueTimeoutException: public GetAbortedException {
+private:
+	string msg;
+
+public:
+	RequestQueueTimeoutException(unsigned int maxQueueTime)
+		: GetAbortedException(oxt::tracable_exception::no_backtrace())
+		{
+			stringstream str;
+			str << "Request waited in queue for too long (configured max. time: "
+				<< maxQueueTime << " msec)";
+			msg = str.str();
+		}
+
+	virtual ~RequestQueueTimeoutException() throw() {}
+
+	virtual const char *what() const throw() {
+		return msg.c_str();
+	}
+};
+
 /**
  * Indicates that a specified argument is incorrect or violates a requirement.
  *
@@ -233,8 +233,19 @@ _strdupFastStringStream(const FastStringStream<> &stream) {
 	return buf;
 }
 
-static void
-realPrintAppOutput(char *buf, unsigned int bufSize,
+static unsigned int
+formatPidForAppOutput(pid_t pid, char *pidStr, unsigned int bufSize) {
+	try {
+		return integerToOtherBase<pid_t, 10>(pid, pidStr, bufSize);
+	} catch (const std::length_error &) {
+		pidStr[0] = '?';
+		pidStr[1] = '\0';
+		return 1;
+	}
+}
+
+static char *
+formatAppOutput(char *buf, unsigned int bufSize,
 	const char *pidStr, unsigned int pidStrLen,
 	const char *channelName, unsigned int channelNameLen,
 	const char *message, unsigned int messageLen)
@@ -249,6 +260,17 @@ realPrintAppOutput(char *buf, unsigned int bufSize,
 	pos = appendData(pos, end, ": ");
 	pos = appendData(pos, end, message, messageLen);
 	pos = appendData(pos, end, "\n");
+	return pos;
+}
+
+static void
+realPrintAppOutput(char *buf, unsigned int bufSize,
+	const char *pidStr, unsigned int pidStrLen,
+	const char *channelName, unsigned int channelNameLen,
+	const char *message, unsigned int messageLen)
+{
+	char *pos = formatAppOutput(buf, bufSize, pidStr, pidStrLen,
+		channelName, channelNameLen, message, messageLen);
 	_writeLogEntry(buf, pos - buf);
 }
 
@@ -260,14 +282,7 @@ printAppOutput(pid_t pid, const char *channelName, const char *message, unsigned
 		char pidStr[sizeof("4294967295")];
 		unsigned int pidStrLen, channelNameLen, totalLen;
 
-		try {
-			pidStrLen = integerToOtherBase<pid_t, 10>(pid, pidStr, sizeof(pidStr));
-		} catch (const std::length_error &) {
-			pidStr[0] = '?';
-			pidStr[1] = '\0';
-			pidStrLen = 1;
-		}
-
+		pidStrLen = formatPidForAppOutput(pid, pidStr, sizeof(pidStr));
 		channelNameLen = strlen(channelName);
 		totalLen = (sizeof("App X Y: \n") - 2) + pidStrLen + channelNameLen + size;
 		if (totalLen < 1024) {
@@ -286,6 +301,29 @@ printAppOutput(pid_t pid, const char *channelName, const char *message, unsigned
 	}
 }
 
+void
+bufferAppOutput(string &buffer, pid_t pid, const char *channelName,
+	const char *message, unsigned int size)
+{
+	if (printAppOutputAsDebuggingMessages) {
+		P_DEBUG("App " << pid << " " << channelName << ": " << StaticString(message, size));
+	} else {
+		char pidStr[sizeof("4294967295")];
+		unsigned int pidStrLen, channelNameLen, totalLen;
+		string::size_type oldSize = buffer.size();
+
+		pidStrLen = formatPidForAppOutput(pid, pidStr, sizeof(pidStr));
+		channelNameLen = strlen(channelName);
+		totalLen = (sizeof("App X Y: \n") - 2) + pidStrLen + channelNameLen + size;
+		buffer.resize(oldSize + totalLen);
+		char *pos = formatAppOutput(&buffer[oldSize], totalLen,
+			pidStr, pidStrLen,
+			channelName, channelNameLen,
+			message, size);
+		buffer.resize(pos - buffer.data());
+	}
+}
+
 void
 setPrintAppOutputAsDebuggingMessages(bool enabled) {
 	printAppOutputAsDebuggingMessages = enabled;
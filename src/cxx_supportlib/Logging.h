@@ -326,6 +326,16 @@ enum PassengerLogLevel {
  */
 void printAppOutput(pid_t pid, const char *channelName, const char *message, unsigned int size);
 
+/**
+ * Like printAppOutput(), but appends the formatted message to `buffer` instead
+ * of writing it to the log file immediately, so that multiple messages can be
+ * written at once with `_writeLogEntry()`. If messages are printed as
+ * debugging messages (see `setPrintAppOutputAsDebuggingMessages()`) then the
+ * message is printed immediately and `buffer` is left alone.
+ */
+void bufferAppOutput(string &buffer, pid_t pid, const char *channelName,
+	const char *message, unsigned int size);
+
 /**
  * Controls how messages that are received from applications are printed.
  *
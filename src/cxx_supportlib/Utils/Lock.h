@@ -11,6 +11,11 @@ using namespace boost;
 typedef boost::lock_guard<boost::mutex> LockGuard;
 typedef boost::unique_lock<boost::mutex> ScopedLock;
 
+/** Shortcut typedefs for locking a boost::shared_mutex. */
+typedef boost::lock_guard<boost::shared_mutex> ExclusiveLockGuard;
+typedef boost::unique_lock<boost::shared_mutex> ExclusiveScopedLock;
+typedef boost::shared_lock<boost::shared_mutex> SharedScopedLock;
+
 /** Nicer syntax for conditionally locking the mutex during construction. */
 class DynamicScopedLock: public boost::unique_lock<boost::mutex> {
 public:
@@ -23,6 +28,30 @@ public:
 	}
 };
 
+/** Like DynamicScopedLock, but for exclusively locking a boost::shared_mutex. */
+class DynamicExclusiveScopedLock: public boost::unique_lock<boost::shared_mutex> {
+public:
+	DynamicExclusiveScopedLock(boost::shared_mutex &m, bool lockNow = true)
+		: boost::unique_lock<boost::shared_mutex>(m, boost::defer_lock)
+	{
+		if (lockNow) {
+			lock();
+		}
+	}
+};
+
+/** Like DynamicScopedLock, but for locking a boost::shared_mutex in shared mode. */
+class DynamicSharedScopedLock: public boost::shared_lock<boost::shared_mutex> {
+public:
+	DynamicSharedScopedLock(boost::shared_mutex &m, bool lockNow = true)
+		: boost::shared_lock<boost::shared_mutex>(m, boost::defer_lock)
+	{
+		if (lockNow) {
+			lock();
+		}
+	}
+};
+
 } // namespace Passenger
 
 #endif /* _PASSENGER_LOCK_H_ */
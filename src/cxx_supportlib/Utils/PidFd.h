@@ -0,0 +1,201 @@
+/*
+ *  Phusion Passenger - https://www.phusionpassenger.com/
+ *  Copyright (c) 2017 Phusion Holding B.V.
+ *
+ *  "Passenger", "Phusion Passenger" and "Union Station" are registered
+ *  trademarks of Phusion Holding B.V.
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in
+ *  all copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ *  THE SOFTWARE.
+ */
+#ifndef _PASSENGER_UTILS_PID_FD_H_
+#define _PASSENGER_UTILS_PID_FD_H_
+
+#include <oxt/system_calls.hpp>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <Exceptions.h>
+#include <FileDescriptor.h>
+#include <Utils/Timer.h>
+
+#if defined(__linux__)
+	#include <sys/syscall.h>
+	// The syscall numbers are the same on all architectures except Alpha.
+	// Define them ourselves in case the system headers predate pidfds.
+	#if !defined(SYS_pidfd_open) && !defined(__alpha__)
+		#define SYS_pidfd_open 434
+	#endif
+	#if !defined(SYS_pidfd_send_signal) && !defined(__alpha__)
+		#define SYS_pidfd_send_signal 424
+	#endif
+#endif
+
+namespace Passenger {
+
+using namespace std;
+
+
+/*
+ * A pidfd (Linux >= 5.3) is a file descriptor that refers to a process, and
+ * that becomes readable once that process exits. Unlike a PID it can never
+ * refer to another process after the original one has been reaped, so pidfds
+ * allow waiting for and signalling processes without polling and without PID
+ * reuse races. They work for any process, not just for child processes.
+ *
+ * openPidFd() fails on other systems and on older kernels; callers must then
+ * fall back to using the PID.
+ */
+
+
+inline bool &
+_pidFdsEnabled() {
+	static bool enabled = true;
+	return enabled;
+}
+
+/** Allows tests to exercise the fallback code paths. Not thread-safe. */
+inline void
+setPidFdsEnabled(bool enabled) {
+	_pidFdsEnabled() = enabled;
+}
+
+/**
+ * Returns a close-on-exec pidfd for the given process, or -1 with errno
+ * set. errno is ENOSYS if pidfds are not supported.
+ */
+inline int
+openPidFd(pid_t pid) {
+	#ifdef SYS_pidfd_open
+		if (_pidFdsEnabled()) {
+			return (int) syscall(SYS_pidfd_open, pid, 0);
+		}
+	#endif
+	errno = ENOSYS;
+	return -1;
+}
+
+/**
+ * Waits at most `timeout` msec (or forever if -1) until the process that
+ * the pidfd refers to has exited. Returns whether it has.
+ *
+ * @throws SystemException
+ * @throws boost::thread_interrupted
+ */
+inline bool
+waitPidFd(int fd, int timeout) {
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int ret = oxt::syscalls::poll(&pfd, 1, timeout);
+	if (ret == -1) {
+		int e = errno;
+		throw SystemException("Cannot poll a pidfd", e);
+	}
+	return ret > 0;
+}
+
+/** Returns whether the process that the pidfd refers to has exited. */
+inline bool
+pidFdProcessExited(int fd) {
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	do {
+		ret = poll(&pfd, 1, 0);
+	} while (ret == -1 && errno == EINTR);
+	return ret > 0;
+}
+
+/**
+ * For when there is no pidfd: returns whether the given child process has
+ * exited, without reaping it, so that its PID can't be reused in the
+ * meantime. Unlike kill(pid, 0), this doesn't mistake a zombie for a running
+ * process. Returns -1 with errno set to ECHILD if it isn't our child.
+ */
+inline int
+childProcessExited(pid_t pid) {
+	siginfo_t info;
+	int ret;
+
+	memset(&info, 0, sizeof(info));
+	do {
+		ret = waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT);
+	} while (ret == -1 && errno == EINTR);
+	if (ret == -1) {
+		return -1;
+	} else {
+		// If the process hasn't exited yet, si_pid is left at 0.
+		return info.si_pid != 0;
+	}
+}
+
+/**
+ * Behaves like `waitpid(pid, status, WNOHANG)`, but waits at most `timeout`
+ * msec for the child process to exit. Waits on a pidfd if possible, and
+ * polls waitpid() otherwise.
+ *
+ * @throws SystemException
+ * @throws boost::thread_interrupted
+ */
+inline int
+timedWaitpidUsingPidFd(pid_t pid, int *status, unsigned long long timeout) {
+	FileDescriptor pidFd(openPidFd(pid), __FILE__, __LINE__);
+	if (pidFd != -1) {
+		// The pidfd becomes readable as soon as the process exits.
+		waitPidFd(pidFd, (int) timeout);
+		return oxt::syscalls::waitpid(pid, status, WNOHANG);
+	}
+
+	Timer<SystemTime::GRAN_10MSEC> timer;
+	int ret;
+
+	do {
+		ret = oxt::syscalls::waitpid(pid, status, WNOHANG);
+		if (ret > 0 || ret == -1) {
+			return ret;
+		} else {
+			oxt::syscalls::usleep(10000);
+		}
+	} while (timer.elapsed() < timeout);
+	return 0; // timed out
+}
+
+/** Like kill(), but through a pidfd. */
+inline int
+signalPidFd(int fd, int signo) {
+	#ifdef SYS_pidfd_send_signal
+		return (int) syscall(SYS_pidfd_send_signal, fd, signo, NULL, 0);
+	#else
+		errno = ENOSYS;
+		return -1;
+	#endif
+}
+
+
+} // namespace Passenger
+
+#endif /* _PASSENGER_UTILS_PID_FD_H_ */
@@ -49,10 +49,12 @@
 #endif
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <cstdlib>
 #include <cerrno>
@@ -92,6 +94,15 @@ struct ProcessMetrics {
 	 * -1 if unknown, 0 if no swap used.
 	 */
 	ssize_t  swap;
+	/** Resident memory that is shared with other processes, e.g. pages that
+	 * a process forked off a preloader hasn't written to yet (Shared_Clean +
+	 * Shared_Dirty). -1 if unknown.
+	 */
+	ssize_t  shared;
+	/** Resident memory that is private to this process (Private_Clean +
+	 * Private_Dirty). -1 if unknown.
+	 */
+	ssize_t  privateMemory;
 	/** OS X Snow Leopard does not report the VM size correctly, so don't use this. */
 	ssize_t  vmsize;
 	pid_t   processGroupId;
@@ -106,6 +117,8 @@ struct ProcessMetrics {
 		pss = -1;
 		privateDirty = -1;
 		swap = -1;
+		shared = -1;
+		privateMemory = -1;
 		vmsize = -1;
 		processGroupId = (pid_t) -1;
 		uid = (uid_t) -1;
@@ -115,6 +128,18 @@ struct ProcessMetrics {
 		return pid != (pid_t) -1;
 	}
 
+	/**
+	 * The percentage of this process's resident memory that is shared with
+	 * other processes, or -1 if unknown.
+	 */
+	int sharedPercentage() const {
+		if (shared == -1 || privateMemory == -1 || shared + privateMemory == 0) {
+			return -1;
+		} else {
+			return (int) (shared * 100 / (shared + privateMemory));
+		}
+	}
+
 	/**
 	 * Returns an estimate of the "real" memory usage of a process in KB.
 	 * We don't use the PSS here because that would mean if another
@@ -193,6 +218,7 @@ public:
 class ProcessMetricsCollector {
 private:
 	bool canMeasureRealMemory;
+	bool canUseProc;
 	string psOutput;
 
 	template<typename Collection, typename ConstIterator>
@@ -249,6 +275,147 @@ private:
 		return result;
 	}
 
+	/**
+	 * Reads a small file from /proc into `buf`, which is NUL-terminated.
+	 * Returns the number of bytes read, or -1 on error.
+	 */
+	static ssize_t readProcFile(const char *filename, char *buf, size_t size) {
+		int fd = syscalls::open(filename, O_RDONLY);
+		if (fd == -1) {
+			return -1;
+		}
+
+		ssize_t ret = syscalls::read(fd, buf, size - 1);
+		syscalls::close(fd);
+		if (ret == -1) {
+			return -1;
+		}
+		buf[ret] = '\0';
+		return ret;
+	}
+
+	/** Returns the system uptime in clock ticks, or 0 if unknown. */
+	static unsigned long long readUptimeTicks(long ticksPerSecond) {
+		char buf[128];
+		if (readProcFile("/proc/uptime", buf, sizeof(buf)) <= 0) {
+			return 0;
+		}
+		return (unsigned long long) (atof(buf) * ticksPerSecond);
+	}
+
+	/**
+	 * Reads the metrics of a single process from /proc/<pid>/stat, statm,
+	 * status and cmdline. Returns false if the process doesn't exist.
+	 */
+	static bool readProcMetrics(pid_t pid, unsigned long long uptime,
+		long pageSizeKb, ProcessMetrics &metrics)
+	{
+		char filename[64];
+		char buf[1024 * 4];
+		const char *pos;
+
+		// /proc/<pid>/stat: "pid (comm) state ppid pgrp session tty_nr tpgid
+		// flags minflt cminflt majflt cmajflt utime stime cutime cstime
+		// priority nice num_threads itrealvalue starttime ..."
+		snprintf(filename, sizeof(filename), "/proc/%d/stat", (int) pid);
+		if (readProcFile(filename, buf, sizeof(buf)) <= 0) {
+			return false;
+		}
+		// The command name may contain spaces and parentheses.
+		pos = strrchr(buf, ')');
+		if (pos == NULL) {
+			return false;
+		}
+		pos++;
+
+		unsigned long long utime, stime, startTime;
+		try {
+			readNextWord(&pos); // state
+			metrics.ppid = (pid_t) readNextWordAsLongLong(&pos);
+			metrics.processGroupId = (pid_t) readNextWordAsLongLong(&pos);
+			for (int i = 0; i < 8; i++) {
+				readNextWord(&pos);
+			}
+			utime = readNextWordAsLongLong(&pos);
+			stime = readNextWordAsLongLong(&pos);
+			for (int i = 0; i < 6; i++) {
+				readNextWord(&pos);
+			}
+			startTime = readNextWordAsLongLong(&pos);
+		} catch (const ParseException &) {
+			return false;
+		}
+
+		// Like `ps`, report the CPU usage averaged over the process's lifetime.
+		if (uptime > startTime) {
+			metrics.cpu = (boost::uint8_t) std::min<unsigned long long>(255,
+				(utime + stime) * 100 / (uptime - startTime));
+		} else {
+			metrics.cpu = 0;
+		}
+
+		// /proc/<pid>/statm: "size resident shared text lib data dt", in pages.
+		snprintf(filename, sizeof(filename), "/proc/%d/statm", (int) pid);
+		if (readProcFile(filename, buf, sizeof(buf)) <= 0) {
+			return false;
+		}
+		pos = buf;
+		try {
+			metrics.vmsize = (ssize_t) readNextWordAsLongLong(&pos) * pageSizeKb;
+			metrics.rss = (ssize_t) readNextWordAsLongLong(&pos) * pageSizeKb;
+		} catch (const ParseException &) {
+			return false;
+		}
+
+		// /proc/<pid>/status contains "Uid: <real> <effective> <saved> <fs>".
+		// Like `ps`, report the effective UID. We can't use the owner of
+		// /proc/<pid>, because that becomes root if the process has switched
+		// users and is therefore not dumpable.
+		snprintf(filename, sizeof(filename), "/proc/%d/status", (int) pid);
+		if (readProcFile(filename, buf, sizeof(buf)) <= 0) {
+			return false;
+		}
+		pos = strstr(buf, "\nUid:");
+		if (pos == NULL) {
+			return false;
+		}
+		pos += sizeof("\nUid:") - 1;
+		{
+			// The fields are separated by tabs, which readNextWord()
+			// doesn't support.
+			char *end;
+			strtoul(pos, &end, 10);
+			if (end == pos) {
+				return false;
+			}
+			pos = end;
+			metrics.uid = (uid_t) strtoul(pos, &end, 10);
+			if (end == pos) {
+				return false;
+			}
+		}
+
+		// /proc/<pid>/cmdline: NUL-separated arguments.
+		snprintf(filename, sizeof(filename), "/proc/%d/cmdline", (int) pid);
+		ssize_t size = readProcFile(filename, buf, sizeof(buf));
+		if (size > 0) {
+			while (size > 0 && buf[size - 1] == '\0') {
+				size--;
+			}
+			for (ssize_t i = 0; i < size; i++) {
+				if (buf[i] == '\0') {
+					buf[i] = ' ';
+				}
+			}
+			metrics.command.assign(buf, size);
+		} else {
+			metrics.command.clear();
+		}
+
+		metrics.pid = pid;
+		return true;
+	}
+
 public:
 	ProcessMetricsCollector() {
 		#ifdef __APPLE__
@@ -256,6 +423,51 @@ public:
 		#else
 			canMeasureRealMemory = fileExists("/proc/self/smaps");
 		#endif
+		canUseProc = procAvailable();
+	}
+
+	/**
+	 * Whether collectFromProc() is supported on this system.
+	 */
+	static bool procAvailable() {
+		#ifdef __linux__
+			return fileExists("/proc/self/statm");
+		#else
+			return false;
+		#endif
+	}
+
+	/**
+	 * Like collect(), but reads the metrics directly from /proc instead of
+	 * running `ps`. This is a lot cheaper because it doesn't fork, and it
+	 * reads `/proc/<pid>/smaps_rollup` for the real memory usage when the
+	 * kernel supports it (Linux >= 4.14). Only use this if `procAvailable()`.
+	 */
+	template<typename Collection, typename ConstIterator>
+	ProcessMetricMap collectFromProc(const Collection &pids) const {
+		ProcessMetricMap result;
+		if (pids.empty()) {
+			return result;
+		}
+
+		long pageSizeKb = sysconf(_SC_PAGESIZE) / 1024;
+		unsigned long long uptime = readUptimeTicks(sysconf(_SC_CLK_TCK));
+		ConstIterator it;
+
+		for (it = pids.begin(); it != pids.end(); it++) {
+			ProcessMetrics metrics;
+			if (readProcMetrics(*it, uptime, pageSizeKb, metrics)) {
+				if (canMeasureRealMemory) {
+					measureRealMemory(metrics);
+				}
+				result[metrics.pid] = metrics;
+			}
+		}
+		return result;
+	}
+
+	ProcessMetricMap collectFromProc(const vector<pid_t> &pids) const {
+		return collectFromProc< vector<pid_t>, vector<pid_t>::const_iterator >(pids);
 	}
 
 	/** Mock 'ps' output, used by unit tests. */
@@ -269,11 +481,34 @@ public:
 	 *
 	 * Returns a map which maps a given PID to its collected metrics.
 	 *
+	 * The metrics are read from /proc if `procAvailable()`, because that's
+	 * a lot cheaper than running `ps`. Otherwise, or if mock `ps` output
+	 * has been set with `setPsOutput()`, this is the same as `collectFromPs()`.
+	 *
 	 * @throws ParseException The ps output cannot be parsed.
 	 * @throws SystemException Error collecting the ps output or error querying memory usage.
 	 */
 	template<typename Collection, typename ConstIterator>
 	ProcessMetricMap collect(const Collection &pids) const {
+		if (canUseProc && psOutput.empty()) {
+			return collectFromProc<Collection, ConstIterator>(pids);
+		} else {
+			return collectFromPs<Collection, ConstIterator>(pids);
+		}
+	}
+
+	ProcessMetricMap collect(const vector<pid_t> &pids) const {
+		return collect< vector<pid_t>, vector<pid_t>::const_iterator >(pids);
+	}
+
+	/**
+	 * Like collect(), but always runs `ps` (or uses the mock `ps` output).
+	 *
+	 * @throws ParseException The ps output cannot be parsed.
+	 * @throws SystemException Error collecting the ps output or error querying memory usage.
+	 */
+	template<typename Collection, typename ConstIterator>
+	ProcessMetricMap collectFromPs(const Collection &pids) const {
 		if (pids.empty()) {
 			return ProcessMetricMap();
 		}
@@ -321,15 +556,14 @@ public:
 			ProcessMetricMap::iterator it;
 			for (it = result.begin(); it != result.end(); it++) {
 				ProcessMetrics &metric = it->second;
-				measureRealMemory(metric.pid, metric.pss,
-					metric.privateDirty, metric.swap);
+				measureRealMemory(metric);
 			}
 		}
 		return result;
 	}
 
-	ProcessMetricMap collect(const vector<pid_t> &pids) const {
-		return collect< vector<pid_t>, vector<pid_t>::const_iterator >(pids);
+	ProcessMetricMap collectFromPs(const vector<pid_t> &pids) const {
+		return collectFromPs< vector<pid_t>, vector<pid_t>::const_iterator >(pids);
 	}
 
 	/**
@@ -344,17 +578,36 @@ public:
 	 *
 	 * At this time only OS X and recent Linux versions (>= 2.6.25) support
 	 * measuring the proportional set size. Usually root privileges are required.
+	 * On Linux >= 4.14, the totals are read from `/proc/<pid>/smaps_rollup`,
+	 * which is much cheaper than summing up all mappings in `/proc/<pid>/smaps`.
 	 *
 	 * pss, privateDirty and swap can each be individually set to -1 if that
 	 * part cannot be measured, e.g. because we do not have permission
 	 * to do so or because the OS does not support measuring it.
 	 */
 	static void measureRealMemory(pid_t pid, ssize_t &pss, ssize_t &privateDirty, ssize_t &swap) {
+		ssize_t shared, privateMemory;
+		measureRealMemory(pid, pss, privateDirty, swap, shared, privateMemory);
+	}
+
+	/**
+	 * Like measureRealMemory(pid, pss, privateDirty, swap), but also measures
+	 * the amount of resident memory that is shared with other processes and
+	 * the amount that is private. Only supported on Linux. Like the other
+	 * values, these come from the Shared_* and Private_* totals in
+	 * `/proc/<pid>/smaps_rollup`, or are summed up from `/proc/<pid>/smaps`
+	 * on kernels that don't have smaps_rollup.
+	 */
+	static void measureRealMemory(pid_t pid, ssize_t &pss, ssize_t &privateDirty,
+		ssize_t &swap, ssize_t &shared, ssize_t &privateMemory)
+	{
 		#ifdef __APPLE__
 			kern_return_t ret;
 			mach_port_t task;
 
 			swap = -1;
+			shared = -1;
+			privateMemory = -1;
 
 			ret = task_for_pid(mach_task_self(), pid, &task);
 			if (ret != KERN_SUCCESS) {
@@ -407,14 +660,20 @@ public:
 		#else
 			string smapsFilename = "/proc/";
 			smapsFilename.append(toString(pid));
-			smapsFilename.append("/smaps");
+			smapsFilename.append("/smaps_rollup");
 
 			FILE *f = syscalls::fopen(smapsFilename.c_str(), "r");
+			if (f == NULL && errno == ENOENT) {
+				smapsFilename.resize(smapsFilename.size() - sizeof("_rollup") + 1);
+				f = syscalls::fopen(smapsFilename.c_str(), "r");
+			}
 			if (f == NULL) {
 				error:
 				pss = -1;
 				privateDirty = -1;
 				swap = -1;
+				shared = -1;
+				privateMemory = -1;
 				return;
 			}
 
@@ -422,11 +681,15 @@ public:
 			bool hasPss = false;
 			bool hasPrivateDirty = false;
 			bool hasSwap = false;
+			bool hasShared = false;
+			bool hasPrivate = false;
 
 			// In KB.
 			pss = 0;
 			privateDirty = 0;
 			swap = 0;
+			shared = 0;
+			privateMemory = 0;
 
 			while (!feof(f)) {
 				char line[1024 * 4];
@@ -453,8 +716,27 @@ public:
 						}
 					} else if (startsWith(line, "Private_Dirty:")) {
 						hasPrivateDirty = true;
+						hasPrivate = true;
 						readNextWord(&buf);
-						privateDirty += readNextWordAsLongLong(&buf);
+						long long size = readNextWordAsLongLong(&buf);
+						privateDirty += size;
+						privateMemory += size;
+						if (readNextWord(&buf) != "kB") {
+							goto error;
+						}
+					} else if (startsWith(line, "Private_Clean:")) {
+						hasPrivate = true;
+						readNextWord(&buf);
+						privateMemory += readNextWordAsLongLong(&buf);
+						if (readNextWord(&buf) != "kB") {
+							goto error;
+						}
+					} else if (startsWith(line, "Shared_Clean:")
+						|| startsWith(line, "Shared_Dirty:"))
+					{
+						hasShared = true;
+						readNextWord(&buf);
+						shared += readNextWordAsLongLong(&buf);
 						if (readNextWord(&buf) != "kB") {
 							goto error;
 						}
@@ -480,8 +762,19 @@ public:
 			if (!hasSwap) {
 				swap = -1;
 			}
+			if (!hasShared) {
+				shared = -1;
+			}
+			if (!hasPrivate) {
+				privateMemory = -1;
+			}
 		#endif
 	}
+
+	static void measureRealMemory(ProcessMetrics &metrics) {
+		measureRealMemory(metrics.pid, metrics.pss, metrics.privateDirty,
+			metrics.swap, metrics.shared, metrics.privateMemory);
+	}
 };
 
 } // namespace Passenger
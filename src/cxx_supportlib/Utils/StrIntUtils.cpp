@@ -584,8 +584,12 @@ timeToNextMultipleD(unsigned int multiple, double now) {
 
 char *
 appendData(char *pos, const char *end, const char *data, size_t size) {
-	size_t maxToCopy = std::min<size_t>(end - pos, size);
-	memcpy(pos, data, maxToCopy);
+	// Once the buffer is full, `pos` may point beyond `end` so that callers
+	// can still compute the required size. Never write there.
+	if (pos < end) {
+		size_t maxToCopy = std::min<size_t>(end - pos, size);
+		memcpy(pos, data, maxToCopy);
+	}
 	return pos + size;
 }
 
@@ -459,7 +459,9 @@ double timeToNextMultipleD(unsigned int multiple, double now);
 
 /**
  * Append the given data to the address at 'pos', but do not cross 'end'.
- * Returns the end of the appended string.
+ * Returns the end of the appended string, which is beyond 'end' if the data
+ * didn't fit. It may be passed to subsequent calls, which then copy nothing,
+ * so that the total required size can be computed in a single pass.
  */
 char *appendData(char *pos, const char *end, const char *data, size_t size);
 char *appendData(char *pos, const char *end, const StaticString &data);
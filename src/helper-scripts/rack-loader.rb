@@ -55,26 +55,23 @@ def self.exit_code_for_exception(e)
       end
     end
 
+    # Core passes the Ruby support library directory as the first argument,
+    # so that the startup request can be read with LoaderSharedHelpers.
     def self.handshake_and_read_startup_request
       STDOUT.sync = true
       STDERR.sync = true
-      puts "!> I have control 1.0"
-      abort "Invalid initialization header" if STDIN.readline != "You have control 1.0\n"
-
-      @@options = {}
-      while (line = STDIN.readline) != "\n"
-        name, value = line.strip.split(/: */, 2)
-        @@options[name] = value
-      end
+      require "#{ARGV[0]}/phusion_passenger"
+      PhusionPassenger.locate_directories
+      PhusionPassenger.require_passenger_lib 'loader_shared_helpers'
+      puts "!> I have control 1.1"
+      @@options, @@binary_protocol = LoaderSharedHelpers.read_startup_request(STDIN)
     end
 
     def self.init_passenger
-      require "#{options["ruby_libdir"]}/phusion_passenger"
       PhusionPassenger.locate_directories(options["passenger_root"])
       PhusionPassenger.require_passenger_lib 'native_support'
       PhusionPassenger.require_passenger_lib 'ruby_core_enhancements'
       PhusionPassenger.require_passenger_lib 'ruby_core_io_enhancements'
-      PhusionPassenger.require_passenger_lib 'loader_shared_helpers'
       PhusionPassenger.require_passenger_lib 'request_handler'
       PhusionPassenger.require_passenger_lib 'rack/thread_handler_extension'
       @@options = LoaderSharedHelpers.init(@@options)
@@ -125,9 +122,7 @@ def self.load_app
     load_app
     LoaderSharedHelpers.before_handling_requests(false, options)
     handler = RequestHandler.new(STDIN, options.merge("app" => app))
-    LoaderSharedHelpers.advertise_readiness
-    LoaderSharedHelpers.advertise_sockets(STDOUT, handler)
-    puts "!> "
+    LoaderSharedHelpers.advertise_readiness_and_sockets(STDOUT, handler, @@binary_protocol)
     handler.main_loop
     handler.cleanup
     LoaderSharedHelpers.after_handling_requests
@@ -57,27 +57,24 @@ def self.exit_code_for_exception(e)
       end
     end
 
+    # Core passes the Ruby support library directory as the first argument,
+    # so that the startup request can be read with LoaderSharedHelpers.
     def self.handshake_and_read_startup_request
       STDOUT.sync = true
       STDERR.sync = true
-      puts "!> I have control 1.0"
-      abort "Invalid initialization header" if STDIN.readline != "You have control 1.0\n"
-
-      @@options = {}
-      while (line = STDIN.readline) != "\n"
-        name, value = line.strip.split(/: */, 2)
-        @@options[name] = value
-      end
+      require "#{ARGV[0]}/phusion_passenger"
+      PhusionPassenger.locate_directories
+      PhusionPassenger.require_passenger_lib 'loader_shared_helpers'
+      puts "!> I have control 1.1"
+      @@options, @@binary_protocol = LoaderSharedHelpers.read_startup_request(STDIN)
     end
 
     def self.init_passenger
-      require "#{options["ruby_libdir"]}/phusion_passenger"
       PhusionPassenger.locate_directories(options["passenger_root"])
       PhusionPassenger.require_passenger_lib 'native_support'
       PhusionPassenger.require_passenger_lib 'ruby_core_enhancements'
       PhusionPassenger.require_passenger_lib 'ruby_core_io_enhancements'
       PhusionPassenger.require_passenger_lib 'preloader_shared_helpers'
-      PhusionPassenger.require_passenger_lib 'loader_shared_helpers'
       PhusionPassenger.require_passenger_lib 'request_handler'
       PhusionPassenger.require_passenger_lib 'rack/thread_handler_extension'
       @@options = LoaderSharedHelpers.init(@@options)
@@ -121,14 +118,11 @@ def self.preload_app
     end
 
     def self.negotiate_spawn_command
-      puts "!> I have control 1.0"
-      abort "Invalid initialization header" if STDIN.readline != "You have control 1.0\n"
+      puts "!> I have control 1.1"
+      request, @@binary_protocol = LoaderSharedHelpers.read_startup_request(STDIN)
 
       begin
-        while (line = STDIN.readline) != "\n"
-          name, value = line.strip.split(/: */, 2)
-          options[name] = value
-        end
+        options.merge!(request)
         @@options = LoaderSharedHelpers.sanitize_spawn_options(@@options)
 
         LoaderSharedHelpers.before_handling_requests(true, options)
@@ -141,9 +135,7 @@ def self.negotiate_spawn_command
         exit exit_code_for_exception(e)
       end
 
-      LoaderSharedHelpers.advertise_readiness
-      LoaderSharedHelpers.advertise_sockets(STDOUT, handler)
-      puts "!> "
+      LoaderSharedHelpers.advertise_readiness_and_sockets(STDOUT, handler, @@binary_protocol)
       handler
     end
 
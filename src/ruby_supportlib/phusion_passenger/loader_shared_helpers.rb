@@ -357,6 +357,63 @@ def advertise_sockets(output, request_handler)
       end
     end
 
+    # Reads the startup request from +input+, either in the text format of
+    # version 1.0 of the negotiation protocol, or in the binary format of
+    # version 1.1: the size of a block of NUL-terminated keys and values,
+    # followed by that block. Returns the options, and whether the binary
+    # format was used.
+    def read_startup_request(input)
+      result = {}
+      case input.readline
+      when "You have control 1.1\n"
+        binary_protocol = true
+        data = input.read(Integer(input.readline))
+        if data.respond_to?(:force_encoding)
+          data.force_encoding(Encoding.default_external)
+        end
+        values = data.split("\0", -1)
+        values.pop
+        0.step(values.size - 2, 2) do |i|
+          result[values[i]] = values[i + 1]
+        end
+      when "You have control 1.0\n"
+        binary_protocol = false
+        while (line = input.readline) != "\n"
+          name, value = line.strip.split(/: */, 2)
+          result[name] = value
+        end
+      else
+        abort "Invalid initialization header"
+      end
+      [result, binary_protocol]
+    end
+
+    # Advertises readiness and the sockets of +request_handler+, in the format
+    # of the protocol version that the startup request was read in.
+    def advertise_readiness_and_sockets(output, request_handler, binary_protocol)
+      if binary_protocol
+        advertise_readiness_and_sockets_in_binary(output, request_handler)
+      else
+        advertise_readiness
+        advertise_sockets(output, request_handler)
+        output.puts "!> "
+      end
+    end
+
+    # Does the same as advertise_readiness followed by advertise_sockets, but
+    # in the format of version 1.1 of the negotiation protocol: the size of a
+    # block of NUL-terminated keys and values, followed by that block.
+    # Everything is written at once.
+    def advertise_readiness_and_sockets_in_binary(output, request_handler)
+      block = ""
+      request_handler.server_sockets.each_pair do |name, options|
+        concurrency = PhusionPassenger.advertised_concurrency_level || options[:concurrency]
+        block << "socket\0#{name};#{options[:address]};#{options[:protocol]};#{concurrency}\0"
+      end
+      # The leading newline is for the same reason as in advertise_readiness.
+      output.write("\n!> Ready\n!> #{block.bytesize}\n#{block}")
+    end
+
     # To be called before the request handler main loop is entered, but after the app
     # startup file has been loaded. This function will fire off necessary events
     # and perform necessary preparation tasks.
@@ -0,0 +1,102 @@
+#include <TestSupport.h>
+#include <Algorithms/AdaptiveConcurrencyLimit.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct Algorithms_AdaptiveConcurrencyLimitTest {
+		// Feeds `count` requests with the given response time, each finishing
+		// while the server uses its entire limit.
+		static void feed(AdaptiveConcurrencyLimit &limit, unsigned int count,
+			double responseTime)
+		{
+			for (unsigned int i = 0; i < count; i++) {
+				limit.update(responseTime, limit.getLimit());
+			}
+		}
+	};
+
+	DEFINE_TEST_GROUP(Algorithms_AdaptiveConcurrencyLimitTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Initial state");
+		AdaptiveConcurrencyLimit limit(4, 1, 10);
+		ensure_equals("(1)", limit.getLimit(), 4u);
+		ensure_equals("(2)", limit.getMaxLimit(), 10u);
+
+		AdaptiveConcurrencyLimit limit2(1, 3, 10);
+		ensure_equals("(3) the limit is never below the minimum", limit2.getLimit(), 3u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Steady response times make the limit increase");
+		AdaptiveConcurrencyLimit limit(2, 1, 100);
+		unsigned int prevLimit = limit.getLimit();
+		for (unsigned int i = 0; i < 10; i++) {
+			feed(limit, 5, 1000);
+			ensure("(1)", limit.getLimit() >= prevLimit);
+			prevLimit = limit.getLimit();
+		}
+		ensure("(2)", limit.getLimit() > 2);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The limit increases up to the maximum and no further");
+		AdaptiveConcurrencyLimit limit(1, 1, 20);
+		for (unsigned int i = 0; i < 500; i++) {
+			limit.update(1000, limit.getLimit());
+			ensure("(1)", limit.getLimit() <= 20);
+		}
+		ensure_equals("(2)", limit.getLimit(), 20u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("The limit is not increased while less than half of it is used");
+		AdaptiveConcurrencyLimit limit(10, 1, 100);
+		for (unsigned int i = 0; i < 100; i++) {
+			limit.update(1000, 4);
+		}
+		ensure_equals(limit.getLimit(), 10u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Rising response times make the limit decrease, "
+			"and it recovers once they go back to normal");
+		AdaptiveConcurrencyLimit limit(10, 1, 10);
+		feed(limit, 100, 1000);
+		ensure_equals("(1)", limit.getLimit(), 10u);
+
+		// Requests start waiting inside the server.
+		feed(limit, 10, 10000);
+		unsigned int decreasedLimit = limit.getLimit();
+		ensure("(2)", decreasedLimit < 10);
+
+		feed(limit, 1000, 1000);
+		ensure("(3)", limit.getLimit() > decreasedLimit);
+		ensure_equals("(4)", limit.getLimit(), 10u);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A small rise of the response times is tolerated");
+		AdaptiveConcurrencyLimit limit(10, 1, 10);
+		feed(limit, 100, 1000);
+		feed(limit, 100, 1000 * AdaptiveConcurrencyLimit::tolerance() * 0.9);
+		ensure_equals(limit.getLimit(), 10u);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("The limit decreases down to the minimum and no further");
+		AdaptiveConcurrencyLimit limit(8, 5, 8);
+		double responseTime = 1000;
+		feed(limit, 100, responseTime);
+		// Response times keep growing, so the short-term average stays
+		// far above the long-term one.
+		for (unsigned int i = 0; i < 200; i++) {
+			responseTime *= 1.05;
+			limit.update(responseTime, limit.getLimit());
+			ensure("(1)", limit.getLimit() >= 5);
+		}
+		ensure_equals("(2)", limit.getLimit(), 5u);
+	}
+}
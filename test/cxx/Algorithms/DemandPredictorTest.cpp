@@ -0,0 +1,151 @@
+#include <TestSupport.h>
+#include <Algorithms/DemandPredictor.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct Algorithms_DemandPredictorTest {
+		DemandPredictor predictor;
+		unsigned long long now;
+
+		Algorithms_DemandPredictorTest() {
+			now = 1000000000;
+			predictor.tick(now);
+		}
+
+		// Registers `arrivalsPerInterval` arrivals in each of the next
+		// `intervals` intervals, and closes the last one.
+		void feedArrivals(unsigned int intervals, unsigned int arrivalsPerInterval) {
+			for (unsigned int i = 0; i < intervals; i++) {
+				for (unsigned int j = 0; j < arrivalsPerInterval; j++) {
+					predictor.registerArrival(now + j);
+				}
+				now += DemandPredictor::interval();
+			}
+			predictor.tick(now);
+		}
+	};
+
+	DEFINE_TEST_GROUP(Algorithms_DemandPredictorTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Initial state");
+		ensure_equals("(1)", predictor.getArrivalRate(), 0.0);
+		ensure_equals("(2)", predictor.getArrivalRateTrend(), 0.0);
+		ensure_equals("(3)", predictor.forecastArrivalRate(), 0.0);
+		ensure_equals("(4)", predictor.predictDemand(), 0.0);
+		ensure_equals("(5)", predictor.predictServerCount(1, 1.2), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Arrivals are counted per interval and converted to a rate per second");
+		// 4 arrivals per 250 msec.
+		feedArrivals(10, 4);
+		ensure_equals("(1)", predictor.getArrivalRate(), 16.0);
+		ensure_equals("(2)", predictor.getArrivalRateTrend(), 0.0);
+		ensure_equals("(3)", predictor.forecastArrivalRate(), 16.0);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Arrivals in an interval that hasn't ended yet are not counted");
+		feedArrivals(4, 4);
+		predictor.registerArrival(now + 1);
+		predictor.registerArrival(now + 2);
+		predictor.tick(now + DemandPredictor::interval() - 1);
+		ensure_equals(predictor.getArrivalRate(), 16.0);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Demand follows Little's law");
+		feedArrivals(10, 4);
+		ensure_equals("(1) without a hold time there is no demand",
+			predictor.predictDemand(), 0.0);
+		predictor.registerHoldTime(250000);
+		ensure_equals("(2)", predictor.getHoldTime(), 250000.0);
+		// 16 requests per second, each held for 250 msec.
+		ensure_equals("(3)", predictor.predictDemand(), 4.0);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("A rising arrival rate is extrapolated one lead time ahead");
+		for (unsigned int i = 1; i <= 10; i++) {
+			feedArrivals(1, i * 2);
+		}
+		double rate = predictor.getArrivalRate();
+		ensure("(1)", predictor.getArrivalRateTrend() > 0);
+		ensure("(2)", predictor.forecastArrivalRate() > rate);
+
+		// A longer spawn time looks further ahead.
+		double shortForecast = predictor.forecastArrivalRate();
+		predictor.registerLeadTime(4 * DemandPredictor::interval());
+		ensure_equals("(3)", predictor.getLeadTime(),
+			4.0 * DemandPredictor::interval());
+		ensure_equals("(4)", predictor.forecastArrivalRate(),
+			rate + 4 * predictor.getArrivalRateTrend());
+		ensure("(5)", predictor.forecastArrivalRate() > shortForecast);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A falling arrival rate is never forecasted below zero");
+		for (unsigned int i = 10; i > 0; i--) {
+			feedArrivals(1, i * 2);
+		}
+		predictor.registerLeadTime(100 * DemandPredictor::interval());
+		ensure("(1)", predictor.getArrivalRateTrend() < 0);
+		ensure_equals("(2)", predictor.forecastArrivalRate(), 0.0);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("The arrival rate decays when traffic stops, "
+			"and is reset after a long idle period");
+		feedArrivals(10, 4);
+		now += 2 * DemandPredictor::interval();
+		predictor.tick(now);
+		double rate = predictor.getArrivalRate();
+		ensure("(1)", rate > 0);
+		ensure("(2)", rate < 16);
+
+		now += 100 * DemandPredictor::interval();
+		predictor.tick(now);
+		ensure_equals("(3)", predictor.getArrivalRate(), 0.0);
+		ensure_equals("(4)", predictor.getArrivalRateTrend(), 0.0);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("Hold times and lead times are smoothed");
+		predictor.registerHoldTime(1000);
+		predictor.registerHoldTime(2000);
+		ensure("(1)", predictor.getHoldTime() > 1000);
+		ensure("(2)", predictor.getHoldTime() < 2000);
+		predictor.registerLeadTime(1000);
+		predictor.registerLeadTime(2000);
+		ensure("(3)", predictor.getLeadTime() > 1000);
+		ensure("(4)", predictor.getLeadTime() < 2000);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("A steady demand that exactly fits gets no headroom server");
+		// 4 requests per second, each held for 250 msec: a demand of 1.
+		feedArrivals(10, 1);
+		predictor.registerHoldTime(250000);
+		ensure_equals("(1)", predictor.predictDemand(), 1.0);
+		ensure_equals("(2)", predictor.predictServerCount(1, 1.2), 1u);
+		ensure_equals("(3)", predictor.predictServerCount(1, 1.5), 1u);
+		ensure_equals("(4)", predictor.predictServerCount(2, 1.2), 1u);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("Headroom adds servers once it amounts to a whole server");
+		// 40 requests per second, each held for 250 msec: a demand of 10.
+		feedArrivals(10, 10);
+		predictor.registerHoldTime(250000);
+		ensure_equals("(1)", predictor.predictDemand(), 10.0);
+		ensure_equals("(2)", predictor.predictServerCount(1, 1), 10u);
+		ensure_equals("(3)", predictor.predictServerCount(1, 1.2), 12u);
+		ensure_equals("(4)", predictor.predictServerCount(1, 1.5), 15u);
+		// 10 / 3 rounds up to 4 servers. 20% of 10 / 3 is less than a server.
+		ensure_equals("(5)", predictor.predictServerCount(3, 1.2), 4u);
+		ensure_equals("(6)", predictor.predictServerCount(3, 1.5), 5u);
+	}
+}
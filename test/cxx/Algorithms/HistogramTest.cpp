@@ -0,0 +1,132 @@
+#include <TestSupport.h>
+#include <Algorithms/Histogram.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct Algorithms_HistogramTest {
+		Histogram histogram;
+	};
+
+	DEFINE_TEST_GROUP(Algorithms_HistogramTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Initial state");
+		ensure_equals("(1)", histogram.getCount(), 0u);
+		ensure_equals("(2)", histogram.getSum(), 0u);
+		ensure_equals("(3)", histogram.getMin(), 0u);
+		ensure_equals("(4)", histogram.getMax(), 0u);
+		ensure_equals("(5)", histogram.getAverage(), 0.0);
+		ensure_equals("(6)", histogram.getPercentile(0.5), 0u);
+		ensure_equals("(7)", histogram.toJson()["buckets"].size(), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Bucket bounds grow exponentially from the first bucket bound");
+		ensure_equals("(1)", histogram.getBucketBound(0), 1000u);
+		ensure_equals("(2)", histogram.getBucketBound(1), 2000u);
+		ensure_equals("(3)", histogram.getBucketBound(10), 1024000u);
+
+		Histogram histogram2(50);
+		ensure_equals("(4)", histogram2.getBucketBound(0), 50u);
+		ensure_equals("(5)", histogram2.getBucketBound(3), 400u);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("Values go into the first bucket whose bound they don't exceed");
+		histogram.add(0);
+		histogram.add(1000);
+		histogram.add(1001);
+		histogram.add(2000);
+		histogram.add(2001);
+		ensure_equals("(1)", histogram.getBucketCount(0), 2u);
+		ensure_equals("(2)", histogram.getBucketCount(1), 2u);
+		ensure_equals("(3)", histogram.getBucketCount(2), 1u);
+		ensure_equals("(4)", histogram.getBucketCount(3), 0u);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Values larger than the last bound go into the overflow bucket");
+		unsigned long long lastBound = histogram.getBucketBound(Histogram::BUCKET_COUNT - 1);
+		histogram.add(lastBound);
+		histogram.add(lastBound + 1);
+		histogram.add(lastBound * 100);
+		ensure_equals("(1)", histogram.getBucketCount(Histogram::BUCKET_COUNT - 1), 1u);
+		ensure_equals("(2)", histogram.getBucketCount(Histogram::BUCKET_COUNT), 2u);
+		ensure_equals("(3)", histogram.getMax(), lastBound * 100);
+		ensure_equals("(4) the overflow bucket's percentile is the largest value",
+			histogram.getPercentile(1), lastBound * 100);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("It keeps track of the count, sum, minimum, maximum and average");
+		histogram.add(3000);
+		histogram.add(1000);
+		histogram.add(5000);
+		histogram.add(3000);
+		ensure_equals("(1)", histogram.getCount(), 4u);
+		ensure_equals("(2)", histogram.getSum(), 12000u);
+		ensure_equals("(3)", histogram.getMin(), 1000u);
+		ensure_equals("(4)", histogram.getMax(), 5000u);
+		ensure_equals("(5)", histogram.getAverage(), 3000.0);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("Percentiles are the bound of the bucket that contains the given rank");
+		// 50 values of at most 1000, 40 of at most 4000 and 10 of at most 16000.
+		for (unsigned int i = 0; i < 50; i++) {
+			histogram.add(500);
+		}
+		for (unsigned int i = 0; i < 40; i++) {
+			histogram.add(3000);
+		}
+		for (unsigned int i = 0; i < 10; i++) {
+			histogram.add(10000);
+		}
+		ensure_equals("(1)", histogram.getPercentile(0), 1000u);
+		ensure_equals("(2)", histogram.getPercentile(0.5), 1000u);
+		ensure_equals("(3) rank 51 is in the next bucket",
+			histogram.getPercentile(0.501), 4000u);
+		ensure_equals("(4)", histogram.getPercentile(0.9), 4000u);
+		ensure_equals("(5)", histogram.getPercentile(0.91), 10000u);
+		ensure_equals("(6) the estimate never exceeds the largest value",
+			histogram.getPercentile(0.99), 10000u);
+		ensure_equals("(7)", histogram.getPercentile(1), 10000u);
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("A single value is its own percentile");
+		histogram.add(1500);
+		ensure_equals("(1)", histogram.getPercentile(0), 1500u);
+		ensure_equals("(2)", histogram.getPercentile(0.5), 1500u);
+		ensure_equals("(3)", histogram.getPercentile(1), 1500u);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("The JSON representation contains the statistics and the non-empty buckets");
+		unsigned long long lastBound = histogram.getBucketBound(Histogram::BUCKET_COUNT - 1);
+		histogram.add(500);
+		histogram.add(500);
+		histogram.add(3000);
+		histogram.add(lastBound + 1);
+
+		Json::Value doc = histogram.toJson();
+		ensure_equals("(1)", doc["count"].asUInt64(), 4u);
+		ensure_equals("(2)", doc["sum"].asUInt64(), 4000 + lastBound + 1);
+		ensure_equals("(3)", doc["min"].asUInt64(), 500u);
+		ensure_equals("(4)", doc["max"].asUInt64(), lastBound + 1);
+		ensure_equals("(5)", doc["p50"].asUInt64(), 1000u);
+		ensure_equals("(6)", doc["p90"].asUInt64(), lastBound + 1);
+		ensure_equals("(7)", doc["p99"].asUInt64(), lastBound + 1);
+
+		const Json::Value &buckets = doc["buckets"];
+		ensure_equals("(8)", buckets.size(), 3u);
+		ensure_equals("(9)", buckets[0u]["le"].asUInt64(), 1000u);
+		ensure_equals("(10)", buckets[0u]["count"].asUInt64(), 2u);
+		ensure_equals("(11)", buckets[1u]["le"].asUInt64(), 4000u);
+		ensure_equals("(12)", buckets[1u]["count"].asUInt64(), 1u);
+		ensure("(13) the overflow bucket has no bound", !buckets[2u].isMember("le"));
+		ensure_equals("(14)", buckets[2u]["count"].asUInt64(), 1u);
+	}
+}
@@ -3,8 +3,10 @@
 #include <Core/ApplicationPool/Pool.h>
 #include <Utils/IOUtils.h>
 #include <Utils/StrIntUtils.h>
+#include <Utils/PidFd.h>
 #include <MessageReadersWriters.h>
 #include <map>
+#include <set>
 #include <vector>
 #include <cerrno>
 #include <signal.h>
@@ -14,6 +16,177 @@ using namespace Passenger;
 using namespace Passenger::ApplicationPool2;
 
 namespace tut {
+	class ReserveRecordingSpawner: public SpawningKit::DummySpawner {
+	public:
+		unsigned int reserveLimit;
+		unsigned int reserveSize;
+
+		ReserveRecordingSpawner(const SpawningKit::ConfigPtr &config)
+			: SpawningKit::DummySpawner(config),
+			  reserveLimit(UINT_MAX),
+			  reserveSize(0)
+			{ }
+
+		virtual void setReserveLimit(unsigned int limit) {
+			reserveLimit = limit;
+		}
+
+		virtual unsigned int getReserveSize() const {
+			return reserveSize;
+		}
+	};
+
+	/**
+	 * Spawns real OS processes, which exit once their admin socket is
+	 * shut down, just like application processes do.
+	 */
+	class OsProcessSpawner: public SpawningKit::DummySpawner {
+	public:
+		/** If false, spawned processes never exit by themselves. */
+		bool exitOnShutdown;
+
+		OsProcessSpawner(const SpawningKit::ConfigPtr &config)
+			: SpawningKit::DummySpawner(config),
+			  exitOnShutdown(true)
+			{ }
+
+		virtual SpawningKit::Result spawn(const Options &options) {
+			SpawningKit::Result result = SpawningKit::DummySpawner::spawn(options);
+			SocketPair adminSocket = createUnixSocketPair(__FILE__, __LINE__);
+			pid_t pid = fork();
+			if (pid == 0) {
+				char buf;
+				while (read(adminSocket.second, &buf, 1) > 0) {
+					// Do nothing.
+				}
+				while (!exitOnShutdown) {
+					pause();
+				}
+				_exit(0);
+			} else if (pid == -1) {
+				int e = errno;
+				throw SystemException("Cannot fork a new process", e);
+			}
+			result["type"] = "os_process";
+			result["pid"] = (Json::Int) pid;
+			result.adminSocket = adminSocket.first;
+			return result;
+		}
+	};
+
+	/**
+	 * Like OsProcessSpawner, but points the processes' session socket to
+	 * a server that the test runs itself.
+	 */
+	class AppSocketSpawner: public OsProcessSpawner {
+	private:
+		string address;
+
+	public:
+		AppSocketSpawner(const SpawningKit::ConfigPtr &config, const string &address)
+			: OsProcessSpawner(config),
+			  address(address)
+			{ }
+
+		virtual SpawningKit::Result spawn(const Options &options) {
+			SpawningKit::Result result = OsProcessSpawner::spawn(options);
+			result["sockets"][0]["address"] = address;
+			return result;
+		}
+	};
+
+	/**
+	 * Spawns processes only as far as the test allows it to, so that tests
+	 * can observe how many spawns are in progress at the same time.
+	 */
+	class GatedSpawner: public SpawningKit::DummySpawner {
+	private:
+		mutable boost::mutex syncher;
+		boost::condition_variable cond;
+		unsigned int inProgress;
+		unsigned int maxInProgress;
+		unsigned int allowed;
+
+		void finishSpawn() {
+			boost::lock_guard<boost::mutex> l(syncher);
+			inProgress--;
+		}
+
+	public:
+		GatedSpawner(const SpawningKit::ConfigPtr &config)
+			: SpawningKit::DummySpawner(config),
+			  inProgress(0),
+			  maxInProgress(0),
+			  allowed(0)
+			{ }
+
+		virtual SpawningKit::Result spawn(const Options &options) {
+			{
+				boost::unique_lock<boost::mutex> l(syncher);
+				inProgress++;
+				maxInProgress = std::max(maxInProgress, inProgress);
+				while (allowed == 0) {
+					cond.wait(l);
+				}
+				allowed--;
+			}
+			ScopeGuard guard(boost::bind(&GatedSpawner::finishSpawn, this));
+			return SpawningKit::DummySpawner::spawn(options);
+		}
+
+		void allow(unsigned int count) {
+			boost::lock_guard<boost::mutex> l(syncher);
+			allowed += count;
+			cond.notify_all();
+		}
+
+		unsigned int getInProgress() const {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return inProgress;
+		}
+
+		unsigned int getMaxInProgress() const {
+			boost::lock_guard<boost::mutex> l(syncher);
+			return maxInProgress;
+		}
+	};
+
+	/**
+	 * Fails every spawn with a SpawnException that carries a spawn timeline,
+	 * like the ones that SpawningKit's spawners raise.
+	 */
+	class FailingSpawner: public SpawningKit::DummySpawner {
+	public:
+		FailingSpawner(const SpawningKit::ConfigPtr &config)
+			: SpawningKit::DummySpawner(config)
+			{ }
+
+		virtual SpawningKit::Result spawn(const Options &options) {
+			SpawnException e("Simulated failure");
+			e.set("spawn_timeline",
+				"[{\"phase\":\"fork\",\"start_time\":1000,\"end_time\":2000},"
+				"{\"phase\":\"handshake\",\"start_time\":2000,\"end_time\":5000}]");
+			throw e;
+		}
+	};
+
+	/** Hands out the given spawner to every group. */
+	class TestSpawnerFactory: public SpawningKit::Factory {
+	private:
+		SpawningKit::SpawnerPtr spawner;
+
+	public:
+		TestSpawnerFactory(const SpawningKit::ConfigPtr &config,
+			const SpawningKit::SpawnerPtr &spawner)
+			: SpawningKit::Factory(config),
+			  spawner(spawner)
+			{ }
+
+		virtual SpawningKit::SpawnerPtr create(const Options &options) {
+			return spawner;
+		}
+	};
+
 	struct Core_ApplicationPool_PoolTest {
 		SpawningKit::ConfigPtr spawningKitConfig;
 		SpawningKit::FactoryPtr spawningKitFactory;
@@ -57,6 +230,21 @@ namespace tut {
 			SystemTime::releaseAll();
 		}
 
+		void recreatePool(const SpawningKit::SpawnerPtr &spawner) {
+			pool->destroy();
+			pool = boost::make_shared<Pool>(
+				boost::make_shared<TestSpawnerFactory>(spawningKitConfig, spawner));
+			pool->initialize();
+		}
+
+		FileDescriptor acceptConnection(int server) {
+			unsigned long long timeout = 5000000;
+			if (!waitUntilReadable(server, &timeout)) {
+				throw TimeoutException("No connection to accept");
+			}
+			return FileDescriptor(syscalls::accept(server, NULL, NULL), __FILE__, __LINE__);
+		}
+
 		void initPoolDebugging() {
 			pool->initDebugging();
 			debug = pool->debugSupport;
@@ -186,9 +374,38 @@ namespace tut {
 		void disableProcess(ProcessPtr process, AtomicInt *result) {
 			*result = (int) pool->disableProcess(process->getGupid());
 		}
+
+		// Checks out and closes sessions in a loop, while verifying that no
+		// process ever has more sessions than its concurrency allows, and that
+		// the pool never has more processes than its capacity allows.
+		static void getAndCloseSessions(Pool *pool, Options options, int count,
+			int concurrency, boost::mutex *syncher, map<Process *, int> *openSessions, AtomicInt *errors)
+		{
+			Ticket ticket;
+			for (int i = 0; i < count; i++) {
+				SessionPtr session = pool->get(options, &ticket);
+				Process *process = session->getProcess();
+				{
+					boost::lock_guard<boost::mutex> l(*syncher);
+					int &n = (*openSessions)[process];
+					n++;
+					if (n > concurrency) {
+						(*errors)++;
+					}
+				}
+				if (pool->getProcessCount() > pool->max) {
+					(*errors)++;
+				}
+				{
+					boost::lock_guard<boost::mutex> l(*syncher);
+					(*openSessions)[process]--;
+				}
+				session.reset();
+			}
+		}
 	};
 
-	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ApplicationPool_PoolTest, 100);
+	DEFINE_TEST_GROUP_WITH_LIMIT(Core_ApplicationPool_PoolTest, 130);
 
 	TEST_METHOD(1) {
 		// Test initial state.
@@ -205,7 +422,7 @@ namespace tut {
 		// as the new process is done spawning.
 		Options options = createOptions();
 
-		ScopedLock l(pool->syncher);
+		ExclusiveScopedLock l(pool->syncher);
 		pool->asyncGet(options, callback, false);
 		ensure_equals("(1)", number, 0);
 		ensure("(2)", pool->getWaitlist.empty());
@@ -240,7 +457,7 @@ namespace tut {
 		ensure(!process->isTotallyBusy());
 
 		// Verify test assertion.
-		ScopedLock l(pool->syncher);
+		ExclusiveScopedLock l(pool->syncher);
 		pool->asyncGet(options, callback, false);
 		ensure_equals("callback is immediately called", number, 2);
 	}
@@ -361,7 +578,7 @@ namespace tut {
 
 		// Now open another session. It should complete immediately
 		// and should not use the first process.
-		ScopedLock l(pool->syncher);
+		ExclusiveScopedLock l(pool->syncher);
 		pool->asyncGet(options, callback, false);
 		ensure_equals("asyncGet() completed immediately", number, 2);
 		SessionPtr session2 = currentSession;
@@ -394,7 +611,7 @@ namespace tut {
 		GroupPtr group = pool->findOrCreateGroup(options);
 		spawningKitConfig->concurrency = 2;
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			group->spawn();
 		}
 		EVENTUALLY(5,
@@ -513,7 +730,7 @@ namespace tut {
 		);
 
 		// The next asyncGet() should spawn a new process and the action should be queued.
-		ScopedLock l(pool->syncher);
+		ExclusiveScopedLock l(pool->syncher);
 		spawningKitConfig->spawnTime = 5000000;
 		pool->asyncGet(options, callback, false);
 		ensure(group->spawning());
@@ -814,7 +1031,7 @@ namespace tut {
 		SystemTime::force(2);
 		GroupPtr barGroup = pool->get(options2, &ticket)->getGroup()->shared_from_this();
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals("(1)", barGroup->spawn(), SR_OK);
 		}
 		debug->debugger->recv("Begin spawn loop iteration 1");
@@ -837,7 +1054,7 @@ namespace tut {
 		debug->messages->send("Proceed with spawn loop iteration 2");
 		debug->debugger->recv("Spawn loop done");
 		EVENTUALLY(5,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			vector<ProcessPtr> processes = pool->getProcesses(false);
 			if (processes.size() == 1) {
 				GroupPtr group = processes[0]->getGroup()->shared_from_this();
@@ -899,7 +1116,7 @@ namespace tut {
 		debug->messages->send("Proceed with spawn loop iteration 2");
 		debug->debugger->recv("Spawn loop done");
 		EVENTUALLY(5,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			vector<ProcessPtr> processes = pool->getProcesses(false);
 			if (processes.size() == 1) {
 				GroupPtr group = processes[0]->getGroup()->shared_from_this();
@@ -934,7 +1151,7 @@ namespace tut {
 		ProcessPtr process = currentSession->getProcess()->shared_from_this();
 		pool->detachProcess(process);
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure(process->enabled == Process::DETACHED);
 		}
 		EVENTUALLY(5,
@@ -965,13 +1182,13 @@ namespace tut {
 		pool->asyncGet(options, callback);
 
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(pool->groups.lookupCopy("test")->getWaitlist.size(), 1u);
 		}
 
 		pool->detachProcess(session1->getProcess()->shared_from_this());
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure(pool->groups.lookupCopy("test")->spawning());
 			ensure_equals(pool->groups.lookupCopy("test")->enabledCount, 0);
 			ensure_equals(pool->groups.lookupCopy("test")->getWaitlist.size(), 1u);
@@ -1003,7 +1220,7 @@ namespace tut {
 		spawningKitConfig->spawnTime = 90000;
 		pool->asyncGet(options2, callback);
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(pool->getWaitlist.size(), 1u);
 		}
 
@@ -1016,7 +1233,7 @@ namespace tut {
 		currentSession.reset();
 		pool->detachProcess(session1->getProcess()->shared_from_this());
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure(pool->groups.lookupCopy("test2") != NULL);
 			ensure_equals(pool->getWaitlist.size(), 0u);
 		}
@@ -1037,7 +1254,7 @@ namespace tut {
 		currentSession.reset();
 		GroupPtr group = process->getGroup()->shared_from_this();
 		pool->detachProcess(process);
-		LockGuard l(pool->syncher);
+		ExclusiveLockGuard l(pool->syncher);
 		ensure_equals(pool->groups.size(), 1u);
 		ensure(group->isAlive());
 		ensure(!group->garbageCollectable());
@@ -1054,18 +1271,18 @@ namespace tut {
 
 		ensure(pool->detachProcess(process));
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(process->enabled, Process::DETACHED);
 		}
 		SHOULD_NEVER_HAPPEN(100,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = !process->isAlive()
 				|| !process->osProcessExists();
 		);
 
 		session.reset();
 		EVENTUALLY(1,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = process->enabled == Process::DETACHED
 				&& !process->osProcessExists()
 				&& process->isDead();
@@ -1085,7 +1302,7 @@ namespace tut {
 
 		ensure(pool->detachProcess(process));
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(process->enabled, Process::DETACHED);
 		}
 		EVENTUALLY(1,
@@ -1093,7 +1310,7 @@ namespace tut {
 		);
 
 		SHOULD_NEVER_HAPPEN(100,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = process->isDead()
 				|| !process->osProcessExists();
 		);
@@ -1102,7 +1319,7 @@ namespace tut {
 		g.clear();
 
 		EVENTUALLY(1,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = process->enabled == Process::DETACHED
 				&& !process->osProcessExists()
 				&& process->isDead();
@@ -1129,24 +1346,25 @@ namespace tut {
 		);
 
 		ProcessPtr process = currentSession->getProcess()->shared_from_this();
+		// detachProcess() will spawn a new process. Prevent it from being
+		// spawned until the process has been detached twice.
+		debug->spawning = true;
 		pool->detachProcess(process);
 		debug->debugger->recv("About to start detached processes checker");
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure(process->enabled == Process::DETACHED);
 		}
 
-		// detachProcess() will spawn a new process. Prevent it from being
-		// spawned too soon.
-		debug->spawning = true;
-
 		pool->detachProcess(process);
 		debug->messages->send("Proceed with starting detached processes checker");
 		debug->messages->send("Proceed with starting detached processes checker");
-		debug->messages->send("Proceed with spawn loop iteration 2");
+		ensure_equals(pool->getProcessCount(), 0u);
 
+		debug->debugger->recv("Begin spawn loop iteration 1");
+		debug->messages->send("Proceed with spawn loop iteration 1");
 		EVENTUALLY(5,
-			result = pool->getProcessCount() == 0;
+			result = pool->getProcessCount() == 1;
 		);
 		currentSession.reset();
 		EVENTUALLY(5,
@@ -1164,7 +1382,7 @@ namespace tut {
 		ensure_equals("Disabling succeeds",
 			pool->disableProcess(processes[0]->getGupid()), DR_SUCCESS);
 
-		LockGuard l(pool->syncher);
+		ExclusiveLockGuard l(pool->syncher);
 		ensure(processes[0]->isAlive());
 		ensure_equals("Process is disabled",
 			processes[0]->enabled,
@@ -1238,7 +1456,7 @@ namespace tut {
 		TempThread thr2(boost::bind(&Core_ApplicationPool_PoolTest::disableProcess,
 			this, process2, &code2));
 		EVENTUALLY(5,
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = group->enabledCount == 0
 				&& group->disablingCount == 2
 				&& group->disabledCount == 0;
@@ -1257,7 +1475,7 @@ namespace tut {
 			result = code2 == DR_SUCCESS;
 		);
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(group->enabledCount, 1);
 			ensure_equals(group->disablingCount, 0);
 			ensure_equals(group->disabledCount, 2);
@@ -1285,7 +1503,7 @@ namespace tut {
 			this, session2->getProcess()->shared_from_this(), &code2));
 		EVENTUALLY(2,
 			GroupPtr group = session1->getGroup()->shared_from_this();
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			result = group->enabledCount == 0
 				&& group->disablingCount == 2
 				&& group->disabledCount == 0;
@@ -1304,7 +1522,7 @@ namespace tut {
 		);
 		{
 			GroupPtr group = session1->getGroup()->shared_from_this();
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(group->enabledCount, 2);
 			ensure_equals(group->disablingCount, 0);
 			ensure_equals(group->disabledCount, 0);
@@ -1363,7 +1581,7 @@ namespace tut {
 		ensure_equals(result, DR_SUCCESS);
 
 		{
-			ScopedLock l(pool->syncher);
+			ExclusiveScopedLock l(pool->syncher);
 			GroupPtr group = processes[0]->getGroup()->shared_from_this();
 			ensure_equals(group->enabledCount, 1);
 			ensure_equals(group->disablingCount, 0);
@@ -1911,7 +2129,7 @@ namespace tut {
 		}
 		ensure_equals(number, 0);
 		{
-			LockGuard l(pool->syncher);
+			ExclusiveLockGuard l(pool->syncher);
 			ensure_equals(group->getWaitlist.size(),
 				3u);
 		}
@@ -2007,6 +2225,173 @@ namespace tut {
 	//       when the session's connection has been released by the app.
 
 
+	/*********** Test concurrent routing ***********/
+
+	TEST_METHOD(80) {
+		// Concurrent asyncGet() calls on a single group never check out more
+		// sessions from a process than its concurrency allows.
+		spawningKitConfig->concurrency = 2;
+		pool->setMax(2);
+		Options options = ensureMinProcesses(2);
+		boost::mutex syncher;
+		map<Process *, int> openSessions;
+		AtomicInt errors;
+		vector< boost::shared_ptr<TempThread> > threads;
+
+		for (int i = 0; i < 8; i++) {
+			threads.push_back(boost::make_shared<TempThread>(boost::bind(
+				getAndCloseSessions, pool.get(), options, 250, 2, &syncher,
+				&openSessions, &errors)));
+		}
+		for (int i = 0; i < 8; i++) {
+			threads[i]->join();
+		}
+
+		ensure_equals("(1)", errors.get(), 0);
+		ensure_equals("(2)", pool->getProcessCount(), 2u);
+		ExclusiveLockGuard l(pool->syncher);
+		GroupPtr group = pool->groups.lookupCopy(options.getAppGroupName());
+		ensure("(3)", group->getWaitlist.empty());
+		ensure_equals("(4)", group->nEnabledProcessesTotallyBusy, 0);
+		foreach (const ProcessPtr &process, group->enabledProcesses) {
+			ensure_equals("(5)", process->sessions, 0);
+			ensure_equals("(6)", process->busyness(), 0);
+		}
+	}
+
+	TEST_METHOD(81) {
+		// Concurrent asyncGet() calls on multiple groups respect the pool's
+		// capacity, even when groups have to take capacity away from each other.
+		Options options1 = createOptions();
+		options1.appGroupName = "test1";
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		pool->setMax(2);
+		boost::mutex syncher;
+		map<Process *, int> openSessions;
+		AtomicInt errors;
+		vector< boost::shared_ptr<TempThread> > threads;
+
+		for (int i = 0; i < 8; i++) {
+			threads.push_back(boost::make_shared<TempThread>(boost::bind(
+				getAndCloseSessions, pool.get(), (i % 2 == 0) ? options1 : options2,
+				50, 1, &syncher, &openSessions, &errors)));
+		}
+		for (int i = 0; i < 8; i++) {
+			threads[i]->join();
+		}
+
+		ensure_equals("(1)", errors.get(), 0);
+		ensure("(2)", pool->getProcessCount() <= 2);
+		ExclusiveLockGuard l(pool->syncher);
+		ensure("(3)", pool->getWaitlist.empty());
+	}
+
+	TEST_METHOD(82) {
+		// asyncGetFromGroupQuickly() checks out a session from a group that the
+		// caller holds a handle to, as long as no spawning or queueing is needed.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure("(1)", group != NULL);
+		ensure("(2)", group->hasRoutableProcessesHint());
+
+		ensure("(3)", pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(4)", number, 2);
+		SessionPtr session = currentSession;
+		currentSession.reset();
+
+		// The only process is now totally busy.
+		ensure("(5)", !group->hasRoutableProcessesHint());
+		ensure("(6)", !pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(7)", number, 2);
+		session.reset();
+		ensure("(8)", group->hasRoutableProcessesHint());
+
+		// Detached groups are not used.
+		ensure("(9)", pool->detachGroupByName(options.getAppGroupName()));
+		ensure("(10)", !pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(11)", number, 2);
+		ensure("(12)", pool->findGroupByName(options.getAppGroupName()) == NULL);
+	}
+
+
+	/*********** Test routing policies ***********/
+
+	TEST_METHOD(83) {
+		// The least_latency routing policy prefers processes with a lower
+		// response time, as long as they aren't too busy.
+		spawningKitConfig->concurrency = 4;
+		pool->setMax(2);
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ProcessPtr fast, slow;
+		unsigned int fastProcessed, slowProcessed;
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->routingPolicy = RP_LEAST_LATENCY;
+			fast = group->enabledProcesses[0];
+			slow = group->enabledProcesses[1];
+			fastProcessed = fast->processed;
+			slowProcessed = slow->processed;
+			unsigned long long oneSecondAgo = SystemTime::getUsec() - 1000000;
+			fast->responseTimeAverage.update(1000, oneSecondAgo);
+			slow->responseTimeAverage.update(10000, oneSecondAgo);
+		}
+
+		vector<SessionPtr> sessions;
+		for (int i = 0; i < 4; i++) {
+			sessions.push_back(pool->get(options, &ticket));
+			ensure_equals("(1)", sessions.back()->getProcess(), fast.get());
+		}
+		// The fast process is now totally busy.
+		sessions.push_back(pool->get(options, &ticket));
+		ensure_equals("(2)", sessions.back()->getProcess(), slow.get());
+
+		sessions.clear();
+		ExclusiveLockGuard l(pool->syncher);
+		ensure_equals("(3)", fast->processed - fastProcessed, 4u);
+		ensure_equals("(4)", slow->processed - slowProcessed, 1u);
+		// Closing the sessions updated the response time averages.
+		ensure("(5)", slow->responseTimeAverage.average() < 10000);
+		ensure("(6)", fast->responseTimeAverage.average() < slow->responseTimeAverage.average());
+	}
+
+	TEST_METHOD(84) {
+		// The power_of_two_choices routing policy only leaves a request
+		// unrouted if all processes are totally busy.
+		pool->setMax(4);
+		Options options = createOptions();
+		options.minProcesses = 4;
+		options.routingPolicy = "power_of_two_choices";
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 4;
+		);
+		currentSession.reset();
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure_equals("(1)", group->routingPolicy, RP_POWER_OF_TWO_CHOICES);
+
+		vector<SessionPtr> sessions;
+		set<Process *> processes;
+		for (int i = 0; i < 4; i++) {
+			sessions.push_back(pool->get(options, &ticket));
+			processes.insert(sessions.back()->getProcess());
+		}
+		ensure_equals("(2)", processes.size(), 4u);
+
+		pool->asyncGet(options, callback);
+		ensure_equals("(3)", number, 1);
+		sessions.pop_back();
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+	}
+
+
 	/*********** Test previously discovered bugs ***********/
 
 	TEST_METHOD(85) {
@@ -2027,6 +2412,1287 @@ namespace tut {
 		pool->get(options, &ticket).reset();
 	}
 
+	/*********** Test get waitlist ordering ***********/
+
+	static vector<string> getWaitlistHostNames(Pool *pool, const GroupPtr &group) {
+		ExclusiveLockGuard l(pool->syncher);
+		vector<string> result;
+		deque<GetWaiter>::const_iterator it, end = group->getWaitlist.end();
+		for (it = group->getWaitlist.begin(); it != end; it++) {
+			result.push_back(it->options.hostName);
+		}
+		return result;
+	}
+
+	TEST_METHOD(86) {
+		// Requests with a higher priority are queued in front of requests with
+		// a lower priority. Requests with the same priority are served FIFO.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		SessionPtr session = pool->get(options, &ticket);
+
+		const char *hostNames[] = { "a", "b", "c", "d" };
+		const int priorities[] = { 0, 5, 0, 5 };
+		for (int i = 0; i < 4; i++) {
+			Options options2 = options;
+			options2.hostName = hostNames[i];
+			options2.priority = priorities[i];
+			pool->asyncGet(options2, callback);
+		}
+
+		vector<string> order = getWaitlistHostNames(pool.get(), group);
+		ensure_equals("(1)", order.size(), 4u);
+		ensure_equals("(2)", order[0], "b");
+		ensure_equals("(3)", order[1], "d");
+		ensure_equals("(4)", order[2], "a");
+		ensure_equals("(5)", order[3], "c");
+
+		session.reset();
+		for (int i = 2; i <= 5; i++) {
+			EVENTUALLY(5,
+				result = number == i;
+			);
+			currentSession.reset();
+		}
+	}
+
+	TEST_METHOD(87) {
+		// Requests that have been in the queue for longer than
+		// maxRequestQueueTime are dropped with a RequestQueueTimeoutException.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		SessionPtr session = pool->get(options, &ticket);
+
+		options.maxRequestQueueTime = 1;
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		ensure("(1)", currentSession == NULL);
+		ensure("(2)", dynamic_pointer_cast<RequestQueueTimeoutException>(currentException) != NULL);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure("(3)", getWaitlistHostNames(pool.get(), group).empty());
+	}
+
+	TEST_METHOD(88) {
+		// With adaptive LIFO enabled, the newest requests are served first
+		// once the queue is at least half full.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		SessionPtr session = pool->get(options, &ticket);
+
+		const char *hostNames[] = { "a", "b", "c", "d" };
+		for (int i = 0; i < 4; i++) {
+			Options options2 = options;
+			options2.hostName = hostNames[i];
+			options2.maxRequestQueueSize = 4;
+			options2.adaptiveLifo = true;
+			pool->asyncGet(options2, callback);
+		}
+
+		vector<string> order = getWaitlistHostNames(pool.get(), group);
+		ensure_equals("(1)", order.size(), 4u);
+		ensure_equals("(2)", order[0], "d");
+		ensure_equals("(3)", order[1], "c");
+		ensure_equals("(4)", order[2], "a");
+		ensure_equals("(5)", order[3], "b");
+
+		session.reset();
+		for (int i = 2; i <= 5; i++) {
+			EVENTUALLY(5,
+				result = number == i;
+			);
+			currentSession.reset();
+		}
+	}
+
+
+	/*********** Test parallel spawning ***********/
+
+	TEST_METHOD(89) {
+		// Up to spawnConcurrency processes in a group are spawned in parallel.
+		// This makes reaching minProcesses a lot faster.
+		initPoolDebugging();
+		debug->spawning = true;
+		pool->setMax(8);
+		Options options = createOptions();
+		options.minProcesses = 8;
+		options.spawnConcurrency = 4;
+		pool->asyncGet(options, callback);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+
+		for (int i = 1; i <= 4; i++) {
+			debug->debugger->recv("Begin spawn loop iteration " + toString(i));
+		}
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(1)", group->processesBeingSpawned, 4);
+		}
+		SHOULD_NEVER_HAPPEN(100,
+			result = debug->debugger->peek("Begin spawn loop iteration 5") != NULL;
+		);
+
+		// As spawns finish, their threads take on the remaining processes,
+		// still four at a time.
+		for (int i = 1; i <= 4; i++) {
+			debug->messages->send("Proceed with spawn loop iteration " + toString(i));
+		}
+		for (int i = 5; i <= 8; i++) {
+			debug->debugger->recv("Begin spawn loop iteration " + toString(i));
+		}
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(2)", group->processesBeingSpawned, 4);
+			ensure_equals("(3)", group->getProcessCount(), 4u);
+		}
+		for (int i = 5; i <= 8; i++) {
+			debug->messages->send("Proceed with spawn loop iteration " + toString(i));
+		}
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+		ensure_equals("(4)", pool->getProcessCount(), 8u);
+		ensure("(5)", debug->debugger->peek("Begin spawn loop iteration 9") == NULL);
+	}
+
+	TEST_METHOD(90) {
+		// The pool-wide spawn concurrency limit takes precedence.
+		boost::shared_ptr<GatedSpawner> spawner =
+			boost::make_shared<GatedSpawner>(spawningKitConfig);
+		recreatePool(spawner);
+		pool->setMax(4);
+		pool->setMaxConcurrentSpawns(1);
+		Options options = createOptions();
+		options.minProcesses = 4;
+		options.spawnConcurrency = 4;
+		pool->asyncGet(options, callback);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+
+		EVENTUALLY(5,
+			result = spawner->getInProgress() == 1;
+		);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(1)", group->processesBeingSpawned, 4);
+		}
+		SHOULD_NEVER_HAPPEN(100,
+			result = spawner->getInProgress() > 1;
+		);
+
+		spawner->allow(4);
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 4;
+		);
+		ensure_equals("(2)", spawner->getMaxInProgress(), 1u);
+	}
+
+	TEST_METHOD(91) {
+		// Get waiters cause additional processes to be spawned in parallel,
+		// but no more than there are get waiters.
+		pool->setMax(8);
+		spawningKitConfig->spawnTime = 100000;
+		Options options = createOptions();
+		options.spawnConcurrency = 8;
+
+		for (int i = 0; i < 4; i++) {
+			pool->asyncGet(options, callback);
+		}
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(1)", group->processesBeingSpawned, 4);
+		}
+		EVENTUALLY(5,
+			result = number == 4;
+		);
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+		ensure("(2)", pool->getProcessCount() <= 4);
+	}
+
+
+	/*********** Test predictive spawning ***********/
+
+	// Makes the group's demand predictor see `arrivalsPerInterval` arrivals
+	// in each of the 10 intervals before `now`, each holding on to a process
+	// for `holdTime` microseconds. The pool lock must be held exclusively.
+	static void feedDemand(const GroupPtr &group, unsigned long long now,
+		unsigned int arrivalsPerInterval, unsigned long long holdTime)
+	{
+		DemandPredictor &predictor = group->demandPredictor;
+		unsigned long long time = now - 10 * DemandPredictor::interval();
+
+		predictor = DemandPredictor();
+		predictor.tick(time);
+		for (unsigned int i = 0; i < 10; i++) {
+			for (unsigned int j = 0; j < arrivalsPerInterval; j++) {
+				predictor.registerArrival(time);
+				predictor.registerHoldTime(holdTime);
+			}
+			time += DemandPredictor::interval();
+		}
+		predictor.tick(now);
+	}
+
+	// Spawns the first process of the group for `options`, and waits until
+	// the session that get() checked out from it has been closed everywhere.
+	static GroupPtr spawnFirstProcess(const PoolPtr &pool, const Options &options,
+		Ticket &ticket)
+	{
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		session.reset();
+		EVENTUALLY(5,
+			result = process->busyness() == 0;
+		);
+		return pool->findGroupByName(options.getAppGroupName());
+	}
+
+	TEST_METHOD(92) {
+		// With predictive spawning, the processes that the predicted demand
+		// calls for are spawned before requests have to wait for one.
+		unsigned long long now = 1000000000;
+		SystemTime::forceAll(now);
+		pool->setMax(4);
+		Options options = createOptions();
+		options.predictiveSpawning = true;
+		GroupPtr group = spawnFirstProcess(pool, options, ticket);
+
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			// 16 requests per second, each taking 150 msec: a demand of 2.4
+			// concurrent requests, which 3 processes can handle.
+			feedDemand(group, now, 4, 150000);
+			ensure_equals("(1)", group->predictedProcessCount(1.2), 3u);
+		}
+		SessionPtr session = pool->get(options, &ticket);
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+
+		stringstream xml;
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(2)", group->getProcessCount(), 3u);
+			ensure_equals("(3)", group->predictiveSpawns, 2u);
+			ensure("(4)", group->getWaitlist.empty());
+			group->inspectXml(xml);
+		}
+		ensure("(5)", containsSubstring(xml.str(), "<predicted_demand>2.4"));
+		ensure("(6)", containsSubstring(xml.str(),
+			"<desired_process_count>3</desired_process_count>"));
+		ensure("(7)", containsSubstring(xml.str(),
+			"<predictive_spawns>2</predictive_spawns>"));
+	}
+
+	TEST_METHOD(93) {
+		// Without predictive spawning, the predicted demand is ignored.
+		unsigned long long now = 1000000000;
+		SystemTime::forceAll(now);
+		pool->setMax(4);
+		Options options = createOptions();
+		GroupPtr group = spawnFirstProcess(pool, options, ticket);
+
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			feedDemand(group, now, 4, 150000);
+			ensure_equals("(1)", group->predictedProcessCount(1.2), 0u);
+		}
+		SessionPtr session = pool->get(options, &ticket);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(2)", !group->spawning());
+			ensure_equals("(3)", group->getProcessCount(), 1u);
+			ensure_equals("(4)", group->predictiveSpawns, 0u);
+		}
+	}
+
+	TEST_METHOD(94) {
+		// The garbage collector does not shut down idle processes that
+		// the predicted demand calls for, but does so after the requests stop.
+		unsigned long long now = 1000000000;
+		SystemTime::forceAll(now);
+		pool->setMax(4);
+		pool->setMaxIdleTime(1000000);
+		Options options = createOptions();
+		options.predictiveSpawning = true;
+		GroupPtr group = spawnFirstProcess(pool, options, ticket);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			feedDemand(group, now, 4, 150000);
+		}
+		pool->get(options, &ticket).reset();
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+		ensure_equals("(1)", pool->getProcessCount(), 3u);
+
+		// All processes have been idle for longer than the max idle time,
+		// but the demand still calls for them.
+		now += 2000000;
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			SystemTime::forceAll(now);
+			feedDemand(group, now, 4, 150000);
+		}
+		EVENTUALLY(5,
+			pool->wakeupGarbageCollector();
+			ExclusiveLockGuard l(pool->syncher);
+			result = group->idleProcessesKept >= 2;
+		);
+		ensure_equals("(2)", pool->getProcessCount(), 3u);
+
+		// The requests stopped long ago.
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			SystemTime::forceAll(now + 100 * DemandPredictor::interval());
+		}
+		EVENTUALLY(5,
+			pool->wakeupGarbageCollector();
+			result = pool->getProcessCount() == 1;
+		);
+	}
+
+
+	/*********** Test warm-up ***********/
+
+	TEST_METHOD(95) {
+		// A newly spawned process that is warming up gets less traffic
+		// than the processes that are already warm.
+		spawningKitConfig->concurrency = 0;
+		Options options = createOptions();
+		options.warmupRequests = 20;
+		options.warmupInitialWeight = 10;
+
+		for (int i = 0; i < 20; i++) {
+			SessionPtr session = pool->get(options, &ticket);
+		}
+		options.minProcesses = 2;
+		pool->get(options, &ticket).reset();
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+
+		vector<SessionPtr> heldSessions;
+		for (int i = 0; i < 5; i++) {
+			heldSessions.push_back(pool->get(options, &ticket));
+		}
+
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ExclusiveLockGuard l(pool->syncher);
+		ProcessPtr warmProcess = group->enabledProcesses[0];
+		ProcessPtr newProcess = group->enabledProcesses[1];
+		ensure("(1)", !warmProcess->warmingUp());
+		ensure("(2)", newProcess->warmingUp());
+		ensure_equals("(3)", warmProcess->sessions, 5);
+		ensure_equals("(4)", newProcess->sessions, 0);
+	}
+
+	TEST_METHOD(96) {
+		// A process that exceeds the memory limit is detached immediately
+		// if it isn't handling any requests.
+		Options options = ensureMinProcesses(2);
+		vector<ProcessPtr> processes = pool->getProcesses();
+		vector<ProcessPtr> processesToDetach;
+		boost::container::vector<Callback> actions;
+
+		setLogLevel(LVL_ERROR);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			pool->disableProcessOverMemoryLimit(processes[0], processesToDetach);
+			ensure_equals("(1)", processesToDetach.size(), 1u);
+			ensure_equals("(2)", processesToDetach[0], processes[0]);
+			ensure_equals("(3)", processes[0]->enabled, Process::DISABLED);
+			pool->detachProcessUnlocked(processes[0], actions);
+			ensure_equals("(4)", processes[0]->enabled, Process::DETACHED);
+			ensure_equals("(5)", processes[1]->enabled, Process::ENABLED);
+		}
+		Pool::runAllActions(actions);
+	}
+
+	TEST_METHOD(97) {
+		// A process that exceeds the memory limit while handling a request
+		// is detached after that request has finished.
+		Options options = ensureMinProcesses(2);
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		vector<ProcessPtr> processesToDetach;
+
+		setLogLevel(LVL_ERROR);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			pool->disableProcessOverMemoryLimit(process, processesToDetach);
+			ensure("(1)", processesToDetach.empty());
+			ensure_equals("(2)", process->enabled, Process::DISABLING);
+		}
+
+		session.reset();
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = process->enabled == Process::DETACHED;
+		);
+	}
+
+
+	/*********** Test state snapshots ***********/
+
+	TEST_METHOD(98) {
+		// Rendering a state snapshot yields the same output as rendering
+		// the pool state directly.
+		ensureMinProcesses(2);
+		Pool::InspectOptions inspectOptions = Pool::InspectOptions::makeAuthorized();
+		Pool::ToXmlOptions xmlOptions = Pool::ToXmlOptions::makeAuthorized();
+		inspectOptions.verbose = true;
+		xmlOptions.secrets = false;
+
+		// Retry in case a time description changes in between.
+		EVENTUALLY(5,
+			result = pool->inspectFromSnapshot(inspectOptions) == pool->inspect(inspectOptions);
+		);
+		EVENTUALLY(5,
+			result = pool->toXmlFromSnapshot(xmlOptions) == pool->toXml(xmlOptions);
+		);
+		ensure(pool->toXml(xmlOptions).find("<secret>") == string::npos);
+	}
+
+	TEST_METHOD(99) {
+		// A recently published snapshot is handed out without locking the pool.
+		ensureMinProcesses(1);
+		pool->stateSnapshotMaxAge = 60 * 1000000;
+		Pool::StateSnapshotPtr snapshot = pool->getStateSnapshot(Pool::SSV_XML);
+		ensure("(1)", snapshot->version > 0);
+		ensure_equals("(2)", snapshot->processCount, 1u);
+
+		ExclusiveLockGuard l(pool->syncher);
+		ensure_equals("(3)", pool->getStateSnapshot(Pool::SSV_XML), snapshot);
+	}
+
+	TEST_METHOD(100) {
+		// A new snapshot is published when the last one is too old, and it
+		// reflects the changes in the pool state.
+		ensureMinProcesses(1);
+		Pool::StateSnapshotPtr snapshot = pool->getStateSnapshot(Pool::SSV_TEXT);
+		ensure_equals("(1)", snapshot->processCount, 1u);
+
+		Options options = createOptions();
+		options.minProcesses = 2;
+		pool->get(options, &ticket).reset();
+		EVENTUALLY(5,
+			result = pool->getProcessCount() == 2;
+		);
+		pool->stateSnapshotMaxAge = 0;
+		Pool::StateSnapshotPtr snapshot2 = pool->getStateSnapshot(Pool::SSV_TEXT);
+		ensure("(2)", snapshot2->version > snapshot->version);
+		ensure_equals("(3)", snapshot2->processCount, 2u);
+		ensure("(4)", snapshot2->inspect(Pool::InspectOptions::makeAuthorized())
+			.find("Processes     : 2") != string::npos);
+	}
+
+	TEST_METHOD(101) {
+		// After circuitBreakerThreshold consecutive spawn failures, the group's
+		// circuit breaker opens. get() then fails immediately with the last
+		// spawn error, without trying to spawn.
+		initPoolDebugging();
+		Options options = createOptions();
+		options.circuitBreakerThreshold = 2;
+		setLogLevel(LVL_CRIT);
+
+		debug->messages->send("Fail spawn loop iteration 1");
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		ensure("(1)", dynamic_pointer_cast<SpawnException>(currentException) != NULL);
+		ensure("(2)", dynamic_pointer_cast<SpawnCircuitOpenException>(currentException) == NULL);
+
+		debug->messages->send("Fail spawn loop iteration 2");
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		ensure("(3)", dynamic_pointer_cast<SpawnCircuitOpenException>(currentException) == NULL);
+
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(4)", group->circuitOpen());
+			ensure_equals("(5)", group->spawnFailures, 2u);
+			ensure_equals("(6)", group->circuitBreakerBackoff,
+				Group::minCircuitBreakerBackoff());
+		}
+
+		pool->asyncGet(options, callback);
+		ensure_equals("(7)", (int) number, 3);
+		boost::shared_ptr<SpawnCircuitOpenException> e =
+			dynamic_pointer_cast<SpawnCircuitOpenException>(currentException);
+		ensure("(8)", e != NULL);
+		ensure("(9)", containsSubstring(e->what(), "Simulated failure"));
+		{
+			LockGuard l(debug->syncher);
+			ensure_equals("(10)", debug->spawnLoopIteration, 2u);
+		}
+		ensure_equals("(11)", group->getWaitlist.size(), 0u);
+	}
+
+	TEST_METHOD(102) {
+		// Once the circuit breaker's backoff time has passed, a single probe
+		// process is spawned. If that fails, the circuit opens again for twice
+		// as long. If it succeeds, the circuit closes.
+		initPoolDebugging();
+		Options options = createOptions();
+		options.circuitBreakerThreshold = 1;
+		options.spawnConcurrency = 3;
+		setLogLevel(LVL_CRIT);
+
+		debug->messages->send("Fail spawn loop iteration 1");
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(1)", group->circuitOpen());
+			group->circuitOpenUntil = 1;
+		}
+		debug->messages->send("Fail spawn loop iteration 2");
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		ensure("(2)", dynamic_pointer_cast<SpawnCircuitOpenException>(currentException) == NULL);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(3)", group->circuitOpen());
+			ensure_equals("(4)", group->circuitBreakerBackoff,
+				2 * Group::minCircuitBreakerBackoff());
+			group->circuitOpenUntil = 1;
+		}
+
+		pool->asyncGet(options, callback);
+		pool->asyncGet(options, callback);
+		pool->asyncGet(options, callback);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(5)", group->processesBeingSpawned, 1);
+			ensure_equals("(6)", group->getWaitlist.size(), 3u);
+		}
+		for (unsigned int i = 3; i <= 5; i++) {
+			debug->messages->send("Proceed with spawn loop iteration " + toString(i));
+		}
+		EVENTUALLY(5,
+			result = number >= 3;
+		);
+		ensure("(7)", currentException == NULL);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(8)", !group->circuitOpen());
+			ensure_equals("(9)", group->circuitOpenUntil, 0ull);
+			ensure_equals("(10)", group->spawnFailures, 0u);
+		}
+	}
+
+
+	/*********** Test re-preloading ***********/
+
+	TEST_METHOD(103) {
+		// If the average shared memory percentage of a group's processes
+		// drops below the re-preload threshold, the preloader is restarted,
+		// but not more often than Group::minRepreloadInterval().
+		Options options = ensureMinProcesses(2);
+		vector<ProcessPtr> processes = pool->getProcesses();
+		vector<ProcessPtr> processesToReplace;
+		boost::container::vector<Callback> actions;
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		SpawningKit::DummySpawnerPtr spawner =
+			static_pointer_cast<SpawningKit::DummySpawner>(group->spawner);
+		unsigned int cleanCount = spawner->cleanCount;
+		unsigned long long now = SystemTime::getUsec();
+
+		setLogLevel(LVL_ERROR);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->options.repreloadThreshold = 50;
+			processes[0]->metrics.shared = 60;
+			processes[0]->metrics.privateMemory = 40;
+			processes[1]->metrics.shared = 45;
+			processes[1]->metrics.privateMemory = 55;
+			pool->maybeRepreload(group, now, processesToReplace, actions);
+			ensure_equals("(1)", group->lastRepreloadTime, 0ull);
+			ensure_equals("(2)", actions.size(), 0u);
+
+			processes[0]->metrics.shared = 40;
+			processes[0]->metrics.privateMemory = 60;
+			pool->maybeRepreload(group, now, processesToReplace, actions);
+			ensure_equals("(3)", group->lastRepreloadTime, now);
+			ensure_equals("(4)", actions.size(), 1u);
+			ensure("(5)", processesToReplace.empty());
+		}
+		Pool::runAllActions(actions);
+		actions.clear();
+		ensure("(6)", spawner->cleanCount > cleanCount);
+
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			pool->maybeRepreload(group, now + 1, processesToReplace, actions);
+			ensure_equals("(7)", group->lastRepreloadTime, now);
+			ensure_equals("(8)", actions.size(), 0u);
+		}
+	}
+
+	TEST_METHOD(104) {
+		// After re-preloading, processes that were spawned before the
+		// preloader was restarted and that are below the threshold are
+		// gracefully replaced one by one, worst first.
+		Options options = ensureMinProcesses(3);
+		vector<ProcessPtr> processes = pool->getProcesses();
+		vector<ProcessPtr> processesToReplace;
+		vector<ProcessPtr> processesToDetach;
+		boost::container::vector<Callback> actions;
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		unsigned long long now = SystemTime::getUsec();
+
+		setLogLevel(LVL_ERROR);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->options.repreloadThreshold = 50;
+			group->lastRepreloadTime = now;
+			processes[0]->metrics.shared = 60;
+			processes[0]->metrics.privateMemory = 40;
+			processes[1]->metrics.shared = 20;
+			processes[1]->metrics.privateMemory = 80;
+			processes[2]->metrics.shared = 40;
+			processes[2]->metrics.privateMemory = 60;
+			pool->maybeRepreload(group, now + 1, processesToReplace, actions);
+			ensure_equals("(1)", processesToReplace.size(), 1u);
+			ensure_equals("(2)", processesToReplace[0], processes[1]);
+			ensure_equals("(3)", actions.size(), 0u);
+
+			pool->replaceProcessForRepreload(processes[1], processesToDetach);
+			ensure_equals("(4)", processesToDetach.size(), 1u);
+			ensure_equals("(5)", processes[1]->enabled, Process::DISABLED);
+			pool->detachProcessUnlocked(processes[1], actions);
+
+			processesToReplace.clear();
+			pool->maybeRepreload(group, now + 2, processesToReplace, actions);
+			ensure_equals("(6)", processesToReplace.size(), 1u);
+			ensure_equals("(7)", processesToReplace[0], processes[2]);
+		}
+		Pool::runAllActions(actions);
+	}
+
+
+	/*********** Test spawn timings ***********/
+
+	TEST_METHOD(105) {
+		// The phases of successful spawns are aggregated into per-group
+		// histograms, which are exposed through state snapshots.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			for (unsigned int i = 1; i <= 10; i++) {
+				Json::Value timeline(Json::arrayValue);
+				Json::Value phase;
+				phase["phase"] = "fork";
+				phase["start_time"] = 100000;
+				phase["end_time"] = 100000 + 1000;
+				timeline.append(phase);
+				phase["phase"] = "app_boot";
+				phase["start_time"] = 100000 + 1000;
+				phase["end_time"] = 100000 + 1000 + i * 100000;
+				timeline.append(phase);
+				group->recordSpawnTimeline(timeline);
+			}
+			group->recordSpawnTimeline(Json::Value());
+
+			ensure_equals("(1)", group->spawnPhaseHistograms.size(), 3u);
+			ensure_equals("(2)", group->spawnPhaseHistograms["fork"].getCount(), 10u);
+			ensure_equals("(3)", group->spawnPhaseHistograms["fork"].getMax(), 1000u);
+			ensure_equals("(4)", group->spawnPhaseHistograms["total"].getMax(), 1001000u);
+			ensure_equals("(5)", group->spawnPhaseHistograms["app_boot"].getPercentile(0.5),
+				512000u);
+			ensure_equals("(6)", group->spawnPhaseHistograms["app_boot"].getPercentile(1),
+				1000000u);
+			ensure_equals("(7)", group->lastSpawnTimeline[1u]["end_time"].asUInt64(),
+				1101000u);
+		}
+
+		Json::Value doc;
+		Json::Reader reader;
+		ensure("(8)", reader.parse(pool->spawnTimingsToJsonFromSnapshot(
+			Pool::AuthenticationOptions::makeAuthorized()), doc));
+		const Json::Value &groupDoc = doc["groups"][options.getAppGroupName()];
+		ensure_equals("(9)", groupDoc["phases"]["app_boot"]["count"].asUInt(), 10u);
+		ensure_equals("(10)", groupDoc["phases"]["fork"]["p99"].asUInt(), 1000u);
+		ensure_equals("(11)", groupDoc["last_spawn_timeline"].size(), 2u);
+	}
+
+	TEST_METHOD(106) {
+		// When a group is restarted, the shutdown of its old processes is
+		// recorded as a single batch.
+		Options options = ensureMinProcesses(3);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure(pool->restartGroupByName(options.getAppGroupName()));
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = group->detachedProcesses.empty()
+				&& !group->detachedProcessesCheckerActive;
+		);
+
+		ExclusiveLockGuard l(pool->syncher);
+		ensure_equals("(1)", group->lastShutdownBatch.processes, 3u);
+		ensure_equals("(2)", group->lastShutdownBatch.killed, 0u);
+		ensure("(3)", group->lastShutdownBatch.endTime >= group->lastShutdownBatch.startTime);
+		ensure("(4)", group->lastShutdownBatch.slowestShutdown
+			<= group->lastShutdownBatch.endTime - group->lastShutdownBatch.startTime);
+	}
+
+	TEST_METHOD(107) {
+		// Destroying the pool shuts down all groups at the same time.
+		Options options = createOptions();
+		options.minProcesses = 0;
+		SessionPtr session1 = pool->get(options, &ticket);
+		options.appGroupName = "test";
+		SessionPtr session2 = pool->get(options, &ticket);
+		ensure_equals(pool->getGroupCount(), 2u);
+
+		// The groups can only finish shutting down once the sessions are closed.
+		// Close them only after both groups have started shutting down.
+		TempThread thr(boost::bind(&Pool::destroy, pool.get()));
+		EVENTUALLY(5,
+			result = pool->getGroupCount() == 0;
+		);
+		session1.reset();
+		session2.reset();
+		thr.join();
+
+		// The destructor destroys the pool too.
+		pool = boost::make_shared<Pool>(spawningKitFactory);
+		pool->initialize();
+	}
+
+	TEST_METHOD(108) {
+		// The garbage collector wakes up in time to drop a waiter whose
+		// deadline is earlier than that of the waiters that were queued
+		// before it.
+		Options options = ensureMinProcesses(1);
+		pool->setMax(1);
+		SessionPtr session = pool->get(options, &ticket);
+
+		Options options2 = options;
+		options2.maxRequestQueueTime = 60000;
+		pool->asyncGet(options2, callback);
+		// The garbage collector is going to run much later than the
+		// deadline of the next waiter.
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = pool->nextGarbageCollectionTime > SystemTime::getUsec() + 2000000;
+		);
+
+		options2.maxRequestQueueTime = 100;
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(2,
+			result = number == 2;
+		);
+		ensure("(1)", currentSession == NULL);
+		ensure("(2)", dynamic_pointer_cast<RequestQueueTimeoutException>(currentException) != NULL);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure_equals("(3)", getWaitlistHostNames(pool.get(), group).size(), 1u);
+	}
+
+	TEST_METHOD(109) {
+		// asyncGetFromGroupQuickly() doesn't change the group's options. If
+		// the options that get() merges into the group have changed, then it
+		// leaves the get action to the exclusively locked path.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ensure("(1)", pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(2)", number, 2);
+		currentSession.reset();
+
+		options.maxRequests = 1234;
+		ensure("(3)", !pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(4)", number, 2);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(5)", group->options.maxRequests, 0u);
+		}
+
+		SessionPtr session = pool->get(options, &ticket);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(6)", group->options.maxRequests, 1234u);
+		}
+		session.reset();
+		ensure("(7)", pool->asyncGetFromGroupQuickly(group, options, callback));
+		ensure_equals("(8)", number, 3);
+		currentSession.reset();
+	}
+
+	TEST_METHOD(110) {
+		// The groups in a state snapshot are rendered with the caller's
+		// inspection options.
+		Options options = ensureMinProcesses(1);
+		Pool::InspectOptions inspectOptions = Pool::InspectOptions::makeAuthorized();
+		inspectOptions.colorize = true;
+		Pool::StateSnapshotPtr snapshot = pool->getStateSnapshot(
+			Pool::StateSnapshot::variantFor(inspectOptions));
+		ensure("(1)", snapshot->variants & Pool::SSV_COLORIZED_TEXT);
+		ensure_equals("(2)", snapshot->groups.size(), 1u);
+		ensure("(3)", containsSubstring(snapshot->groups[0].colorizedText,
+			options.getAppGroupName()));
+
+		string text = pool->inspectFromSnapshot(inspectOptions);
+		ensure("(4)", containsSubstring(text, ANSI_COLOR_RESET));
+		ensure("(5)", containsSubstring(text, options.getAppGroupName()));
+		inspectOptions.colorize = false;
+		text = pool->inspect(inspectOptions);
+		ensure("(6)", !containsSubstring(text, ANSI_COLOR_RESET));
+		ensure("(7)", containsSubstring(text, options.getAppGroupName()));
+	}
+
+	TEST_METHOD(111) {
+		// The group's user switching information is looked up once, and
+		// again after the group's options have been reset.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		boost::shared_ptr<const SpawningKit::UserSwitchingInfo> info =
+			group->getUserSwitchingInfo();
+		ensure_equals("(1)", info->uid,
+			SpawningKit::prepareUserSwitching(group->options).uid);
+		ensure("(2)", group->getUserSwitchingInfo() == info);
+		pool->inspect(Pool::InspectOptions::makeAuthorized());
+		pool->toXml(Pool::ToXmlOptions::makeAuthorized());
+		ensure("(3)", group->getUserSwitchingInfo() == info);
+
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->resetOptions(options);
+		}
+		ensure("(4)", group->getUserSwitchingInfo() != info);
+	}
+
+	TEST_METHOD(112) {
+		// Processes in a spawn reserve are kept within the remaining pool
+		// capacity, and are shown by inspection.
+		Options options = createOptions();
+		options.appGroupName = "test1";
+		options.spawnReserveSize = 2;
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+
+		retainSessions = true;
+		pool->setMax(4);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		GroupPtr group = pool->findGroupByName("test1");
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = !group->spawning();
+		);
+
+		boost::shared_ptr<ReserveRecordingSpawner> spawner =
+			boost::make_shared<ReserveRecordingSpawner>(spawningKitConfig);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->spawner = spawner;
+			pool->updateSpawnReserveLimits();
+		}
+		ensure_equals("(1)", spawner->reserveLimit, 3u);
+
+		spawner->reserveSize = 2;
+		ensure("(2)", pool->inspect().find("Processes in spawn reserve: 2") != string::npos);
+		ensure("(3)", pool->toXml().find("<reserved_process_count>2</reserved_process_count>")
+			!= string::npos);
+
+		// The other group's process leaves room for 2 processes.
+		pool->asyncGet(options2, callback);
+		EVENTUALLY(5,
+			result = number == 2;
+		);
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = spawner->reserveLimit == 2;
+		);
+
+		// A reserve doesn't exceed the group's own limit either.
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->options.maxProcesses = 2;
+			pool->updateSpawnReserveLimits();
+		}
+		ensure_equals("(4)", spawner->reserveLimit, 1u);
+	}
+
+
+	TEST_METHOD(113) {
+		// A detached process that has a pidfd is cleaned up as soon as it
+		// exits, without waiting for the detached processes checker's
+		// safety net timeout.
+		if (openPidFd(getpid()) == -1) {
+			// pidfds are not supported on this system.
+			return;
+		}
+		recreatePool(boost::make_shared<OsProcessSpawner>(spawningKitConfig));
+
+		Options options = createOptions();
+		options.minProcesses = 0;
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		pid_t pid = process->getPid();
+		ensure("(1)", process->hasPidFd());
+		session.reset();
+
+		MonotonicTimeUsec startTime = SystemTime::getMonotonicUsec();
+		pool->detachProcess(process);
+		EVENTUALLY(5,
+			result = process->isDead();
+		);
+		// Without a wakeup, the checker sleeps for a second.
+		ensure("(2)", SystemTime::getMonotonicUsec() - startTime < 500000);
+		waitpid(pid, NULL, 0);
+	}
+
+	TEST_METHOD(114) {
+		// Spawn reserves may grow again when capacity is freed because
+		// processes or groups are detached.
+		Options options = createOptions();
+		options.appGroupName = "test1";
+		options.spawnReserveSize = 2;
+		Options options2 = createOptions();
+		options2.appGroupName = "test2";
+		options2.minProcesses = 0;
+
+		pool->setMax(4);
+		pool->get(options, &ticket).reset();
+		GroupPtr group = pool->findGroupByName("test1");
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = !group->spawning();
+		);
+
+		boost::shared_ptr<ReserveRecordingSpawner> spawner =
+			boost::make_shared<ReserveRecordingSpawner>(spawningKitConfig);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			group->spawner = spawner;
+		}
+
+		SessionPtr session1 = pool->get(options2, &ticket);
+		SessionPtr session2 = pool->get(options2, &ticket);
+		ProcessPtr process = session2->getProcess()->shared_from_this();
+		ensure("(1)", session1->getProcess() != process.get());
+		session1.reset();
+		session2.reset();
+		EVENTUALLY(5,
+			result = !pool->isSpawning();
+		);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(2)", spawner->reserveLimit, 1u);
+		}
+
+		// The other process in test2 is idle, so nothing replaces the
+		// detached one.
+		pool->detachProcess(process);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(3)", spawner->reserveLimit, 2u);
+		}
+
+		pool->detachGroupByName("test2");
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure_equals("(4)", spawner->reserveLimit, 3u);
+		}
+	}
+
+	TEST_METHOD(115) {
+		// The warm-up URLs are requested from a new process before it is
+		// attached to the group.
+		DeleteFileEventually d("tmp.warmup");
+		FileDescriptor server(createUnixServer("tmp.warmup"), NULL, 0);
+		recreatePool(boost::make_shared<AppSocketSpawner>(spawningKitConfig,
+			"unix:tmp.warmup"));
+
+		Options options = createOptions();
+		options.warmupUrls = "/warm1 /warm2?foo=bar";
+		pool->asyncGet(options, callback);
+
+		// The warm-up doesn't finish until we close the connection.
+		FileDescriptor connection = acceptConnection(server);
+		string request = readAll(connection);
+		ensure("(1)", containsSubstring(request,
+			P_STATIC_STRING("REQUEST_URI\0/warm1\0")));
+		ensure_equals("(2)", pool->getProcessCount(), 0u);
+		connection.close();
+
+		connection = acceptConnection(server);
+		request = readAll(connection);
+		ensure("(3)", containsSubstring(request,
+			P_STATIC_STRING("REQUEST_URI\0/warm2?foo=bar\0")));
+		ensure("(4)", containsSubstring(request,
+			P_STATIC_STRING("PATH_INFO\0/warm2\0")));
+		ensure("(5)", containsSubstring(request,
+			P_STATIC_STRING("QUERY_STRING\0foo=bar\0")));
+		ensure_equals("(6)", pool->getProcessCount(), 0u);
+		ensure_equals("(7)", number, 0);
+		connection.close();
+
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		ensure("(8)", currentSession != NULL);
+		ensure_equals("(9)", pool->getProcessCount(), 1u);
+	}
+
+	TEST_METHOD(116) {
+		// A failed warm-up doesn't prevent the process from being attached.
+		DeleteFileEventually d("tmp.warmup");
+		recreatePool(boost::make_shared<AppSocketSpawner>(spawningKitConfig,
+			"unix:tmp.warmup"));
+
+		Options options = createOptions();
+		options.warmupUrls = "/warm";
+		setLogLevel(LVL_ERROR);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		ensure("(1)", currentSession != NULL);
+		ensure_equals("(2)", pool->getProcessCount(), 1u);
+	}
+
+	static vector<pid_t> collectPids(const GroupPtr &group, unsigned long long now) {
+		vector<pid_t> pids;
+		Pool::collectPids(group->enabledProcesses, pids, now);
+		std::sort(pids.begin(), pids.end());
+		return pids;
+	}
+
+	TEST_METHOD(117) {
+		// Process metrics are only sampled for processes that handled requests
+		// since the last time, that are handling requests, or that haven't
+		// been sampled for a minute.
+		Options options = ensureMinProcesses(2);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		vector<ProcessPtr> processes = pool->getProcesses();
+		unsigned long long now = 1000000000;
+		vector<pid_t> pids;
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			// Processes without metrics are always sampled.
+			pids = collectPids(group, now);
+			ensure_equals("(1)", pids.size(), 2u);
+			foreach (const ProcessPtr &process, processes) {
+				process->metrics.pid = process->getPid();
+			}
+			pids = collectPids(group, now + 5000000);
+			ensure("(2)", pids.empty());
+		}
+
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr busyProcess = session->getProcess()->shared_from_this();
+		ProcessPtr idleProcess = (processes[0] == busyProcess) ? processes[1] : processes[0];
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			pids = collectPids(group, now + 10000000);
+			ensure_equals("(3)", pids.size(), 1u);
+			ensure_equals("(4)", pids[0], busyProcess->getPid());
+		}
+
+		session.reset();
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			// The busy process handled a request since the last sample.
+			pids = collectPids(group, now + 15000000);
+			ensure_equals("(5)", pids.size(), 1u);
+			ensure_equals("(6)", pids[0], busyProcess->getPid());
+			pids = collectPids(group, now + 20000000);
+			ensure("(7)", pids.empty());
+
+			// The idle process is refreshed a minute after its last sample.
+			pids = collectPids(group, now + 59999999);
+			ensure("(8)", pids.empty());
+			pids = collectPids(group, now + 60000000);
+			ensure_equals("(9)", pids.size(), 1u);
+			ensure_equals("(10)", pids[0], idleProcess->getPid());
+		}
+	}
+
+	static ProcessMetrics createMetrics(pid_t pid, ssize_t privateDirty) {
+		ProcessMetrics metrics;
+		metrics.pid = pid;
+		metrics.rss = privateDirty;
+		metrics.privateDirty = privateDirty;
+		metrics.swap = 0;
+		return metrics;
+	}
+
+	TEST_METHOD(118) {
+		// A sampled, enabled process whose real memory usage exceeds the
+		// memory limit is reported as such.
+		recreatePool(boost::make_shared<OsProcessSpawner>(spawningKitConfig));
+		Options options = ensureMinProcesses(4);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		vector<ProcessPtr> processes = pool->getProcesses();
+		unsigned long long now = 1000000000;
+
+		ExclusiveLockGuard l(pool->syncher);
+		group->options.memoryLimit = 100;
+		ProcessMetricMap allMetrics;
+		// Right at the limit.
+		allMetrics[processes[0]->getPid()] = createMetrics(processes[0]->getPid(), 100 * 1024);
+		// Over the limit.
+		allMetrics[processes[1]->getPid()] = createMetrics(processes[1]->getPid(), 100 * 1024 + 1);
+		// Over the limit, but not sampled during this run.
+		allMetrics[processes[2]->getPid()] = createMetrics(processes[2]->getPid(), 200 * 1024);
+		// Over the limit, but swap counts too.
+		allMetrics[processes[3]->getPid()] = createMetrics(processes[3]->getPid(), 100 * 1024);
+		allMetrics[processes[3]->getPid()].swap = 1;
+		processes[0]->metricsCollectionTime = now;
+		processes[1]->metricsCollectionTime = now;
+		processes[2]->metricsCollectionTime = now - 5000000;
+		processes[3]->metricsCollectionTime = now;
+
+		vector<ProcessPtr> processesToDetach;
+		vector<ProcessPtr> processesOverMemoryLimit;
+		Pool::updateProcessMetrics(group->enabledProcesses, allMetrics, now,
+			processesToDetach, processesOverMemoryLimit);
+		ensure("(1)", processesToDetach.empty());
+		ensure_equals("(2)", processesOverMemoryLimit.size(), 2u);
+		set<ProcessPtr> over(processesOverMemoryLimit.begin(), processesOverMemoryLimit.end());
+		ensure("(3)", over.count(processes[1]) == 1);
+		ensure("(4)", over.count(processes[3]) == 1);
+		ensure_equals("(5)", processes[0]->metrics.realMemory(), 100u * 1024);
+		ensure("(6)", !processes[2]->metrics.isValid());
+
+		// Without a memory limit, nothing is reported.
+		group->options.memoryLimit = 0;
+		processesOverMemoryLimit.clear();
+		Pool::updateProcessMetrics(group->enabledProcesses, allMetrics, now,
+			processesToDetach, processesOverMemoryLimit);
+		ensure("(7)", processesOverMemoryLimit.empty());
+	}
+
+	TEST_METHOD(119) {
+		// A detached process that doesn't exit within the shutdown timeout
+		// is killed, and counted as such in the shutdown batch.
+		boost::shared_ptr<OsProcessSpawner> spawner =
+			boost::make_shared<OsProcessSpawner>(spawningKitConfig);
+		spawner->exitOnShutdown = false;
+		recreatePool(spawner);
+		Options options = createOptions();
+		options.minProcesses = 0;
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		GroupPtr group = process->getGroup()->shared_from_this();
+		pid_t pid = process->getPid();
+		session.reset();
+		// Any replacement process may exit normally.
+		spawner->exitOnShutdown = true;
+
+		SystemTime::force(1000);
+		setLogLevel(LVL_ERROR);
+		pool->detachProcess(process);
+		EVENTUALLY(5,
+			ExclusiveLockGuard l(pool->syncher);
+			result = process->getLifeStatus() == Process::SHUTDOWN_TRIGGERED;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = process->isDead();
+		);
+
+		SystemTime::force(1000 + PROCESS_SHUTDOWN_TIMEOUT);
+		EVENTUALLY(5,
+			result = process->isDead();
+		);
+		{
+			ExclusiveLockGuard l(pool->syncher);
+			ensure("(1)", process->forcefullyKilled);
+			ensure_equals("(2)", group->lastShutdownBatch.processes, 1u);
+			ensure_equals("(3)", group->lastShutdownBatch.killed, 1u);
+		}
+		waitpid(pid, NULL, 0);
+	}
+
+	TEST_METHOD(120) {
+		// Without pidfds, a detached child process that has exited is
+		// noticed without reaping it.
+		setPidFdsEnabled(false);
+		ScopeGuard guard(boost::bind(setPidFdsEnabled, true));
+		recreatePool(boost::make_shared<OsProcessSpawner>(spawningKitConfig));
+		Options options = createOptions();
+		options.minProcesses = 0;
+		SessionPtr session = pool->get(options, &ticket);
+		ProcessPtr process = session->getProcess()->shared_from_this();
+		pid_t pid = process->getPid();
+		ensure("(1)", !process->hasPidFd());
+		session.reset();
+
+		pool->detachProcess(process);
+		EVENTUALLY(5,
+			result = process->isDead();
+		);
+		// The process is still a zombie, so its PID can't have been reused.
+		ensure_equals("(2)", waitpid(pid, NULL, WNOHANG), pid);
+	}
+
+
+	TEST_METHOD(121) {
+		// The timeline of a failed spawn is recorded in its own total series.
+		recreatePool(boost::make_shared<FailingSpawner>(spawningKitConfig));
+		Options options = createOptions();
+		setLogLevel(LVL_CRIT);
+		pool->asyncGet(options, callback);
+		EVENTUALLY(5,
+			result = number == 1;
+		);
+		ensure("(1)", dynamic_pointer_cast<SpawnException>(currentException) != NULL);
+
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ExclusiveLockGuard l(pool->syncher);
+		ensure_equals("(2)", group->spawnPhaseHistograms["fork"].getMax(), 1000u);
+		ensure_equals("(3)", group->spawnPhaseHistograms["handshake"].getMax(), 3000u);
+		ensure_equals("(4)", group->spawnPhaseHistograms["failed_total"].getMax(), 4000u);
+		ensure_equals("(5)", group->spawnPhaseHistograms.count("total"), 0u);
+		ensure_equals("(6)", group->lastSpawnTimeline.size(), 2u);
+		ensure("(7)", group->lastSpawnFailed);
+	}
+
+	TEST_METHOD(122) {
+		// Processes taken from the spawn reserve don't count towards the
+		// total spawn time, which would otherwise be dragged down by them.
+		Options options = ensureMinProcesses(1);
+		GroupPtr group = pool->findGroupByName(options.getAppGroupName());
+		ExclusiveLockGuard l(pool->syncher);
+		group->spawnPhaseHistograms.clear();
+
+		Json::Value timeline(Json::arrayValue);
+		Json::Value phase;
+		phase["phase"] = "reserve";
+		phase["start_time"] = 100000;
+		phase["end_time"] = 100000 + 10;
+		timeline.append(phase);
+		phase["phase"] = "warmup";
+		phase["start_time"] = 100000 + 10;
+		phase["end_time"] = 100000 + 10 + 5000;
+		timeline.append(phase);
+		group->recordSpawnTimeline(timeline);
+
+		ensure_equals("(1)", group->spawnPhaseHistograms.count("total"), 0u);
+		ensure_equals("(2)", group->spawnPhaseHistograms["reserve"].getMax(), 10u);
+		ensure_equals("(3)", group->spawnPhaseHistograms["warmup"].getMax(), 5000u);
+		ensure_equals("(4)", group->spawnPhaseHistograms["reserve_total"].getMax(), 5010u);
+		ensure("(5)", !group->lastSpawnFailed);
+	}
 
 	/*****************************/
 }
@@ -0,0 +1,92 @@
+#include <TestSupport.h>
+#include <Core/ApplicationPool/ProcessExitWatcher.h>
+#include <Utils/PidFd.h>
+#include <boost/atomic.hpp>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+
+using namespace Passenger;
+using namespace Passenger::ApplicationPool2;
+
+namespace tut {
+	struct Core_ApplicationPool_ProcessExitWatcherTest {
+		vector<pid_t> children;
+		boost::atomic<unsigned int> called;
+
+		Core_ApplicationPool_ProcessExitWatcherTest()
+			: called(0)
+			{ }
+
+		~Core_ApplicationPool_ProcessExitWatcherTest() {
+			for (unsigned int i = 0; i < children.size(); i++) {
+				kill(children[i], SIGKILL);
+				waitpid(children[i], NULL, 0);
+			}
+		}
+
+		pid_t spawnChild() {
+			pid_t pid = fork();
+			if (pid == 0) {
+				pause();
+				_exit(0);
+			} else if (pid == -1) {
+				int e = errno;
+				throw SystemException("Cannot fork", e);
+			}
+			children.push_back(pid);
+			return pid;
+		}
+
+		void onExited() {
+			called++;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_ApplicationPool_ProcessExitWatcherTest);
+
+	TEST_METHOD(1) {
+		// It calls the callback once the process exits, and not before.
+		pid_t pid = spawnChild();
+		FileDescriptor pidFd(openPidFd(pid), __FILE__, __LINE__);
+		if (pidFd == -1) {
+			// pidfds are not supported on this system.
+			return;
+		}
+		ProcessExitWatcher &watcher = ProcessExitWatcher::getInstance();
+		watcher.watch(pidFd, boost::bind(
+			&Core_ApplicationPool_ProcessExitWatcherTest::onExited, this));
+
+		SHOULD_NEVER_HAPPEN(200,
+			result = called != 0;
+		);
+
+		kill(pid, SIGTERM);
+		EVENTUALLY(5,
+			result = called == 1;
+		);
+		SHOULD_NEVER_HAPPEN(100,
+			result = called != 1;
+		);
+	}
+
+	TEST_METHOD(2) {
+		// It calls the callback right away if the process has already exited.
+		pid_t pid = spawnChild();
+		FileDescriptor pidFd(openPidFd(pid), __FILE__, __LINE__);
+		if (pidFd == -1) {
+			// pidfds are not supported on this system.
+			return;
+		}
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		children.clear();
+
+		ProcessExitWatcher::getInstance().watch(pidFd, boost::bind(
+			&Core_ApplicationPool_ProcessExitWatcherTest::onExited, this));
+		EVENTUALLY(5,
+			result = called == 1;
+		);
+	}
+}
@@ -1,6 +1,12 @@
 #include <TestSupport.h>
 #include <Core/ApplicationPool/Process.h>
 #include <Utils/IOUtils.h>
+#include <Utils/ScopeGuard.h>
+#include <Utils/PidFd.h>
+#include <boost/thread/barrier.hpp>
+#include <boost/scoped_array.hpp>
+#include <sys/wait.h>
+#include <signal.h>
 
 using namespace Passenger;
 using namespace Passenger::ApplicationPool2;
@@ -39,7 +45,7 @@ namespace tut {
 			server1.assign(createTcpServer("127.0.0.1", 0, 0, __FILE__, __LINE__), NULL, 0);
 			getsockname(server1, (struct sockaddr *) &addr, &len);
 			socket["name"] = "main1";
-			socket["address"] = "tcp://127.0.0.1:" + toString(addr.sin_port);
+			socket["address"] = "tcp://127.0.0.1:" + toString(ntohs(addr.sin_port));
 			socket["protocol"] = "session";
 			socket["concurrency"] = 3;
 			sockets.append(socket);
@@ -48,7 +54,7 @@ namespace tut {
 			getsockname(server2, (struct sockaddr *) &addr, &len);
 			socket = Json::Value();
 			socket["name"] = "main2";
-			socket["address"] = "tcp://127.0.0.1:" + toString(addr.sin_port);
+			socket["address"] = "tcp://127.0.0.1:" + toString(ntohs(addr.sin_port));
 			socket["protocol"] = "session";
 			socket["concurrency"] = 3;
 			sockets.append(socket);
@@ -57,7 +63,7 @@ namespace tut {
 			getsockname(server3, (struct sockaddr *) &addr, &len);
 			socket = Json::Value();
 			socket["name"] = "main3";
-			socket["address"] = "tcp://127.0.0.1:" + toString(addr.sin_port);
+			socket["address"] = "tcp://127.0.0.1:" + toString(ntohs(addr.sin_port));
 			socket["protocol"] = "session";
 			socket["concurrency"] = 3;
 			sockets.append(socket);
@@ -95,6 +101,34 @@ namespace tut {
 			process->shutdownNotRequired();
 			return process;
 		}
+
+		ProcessPtr createOsProcess(pid_t pid, int pidFd = -1) {
+			SpawningKit::Result result;
+
+			result["type"] = "os_process";
+			result["pid"] = pid;
+			result["gupid"] = toString(pid);
+			result["sockets"] = Json::Value(Json::arrayValue);
+			result["spawner_creation_time"] = 0;
+			result["spawn_start_time"] = 0;
+			if (pidFd != -1) {
+				result.pidFd = FileDescriptor(pidFd, __FILE__, __LINE__);
+			}
+
+			ProcessPtr process(context.getProcessObjectPool().construct(
+				&groupInfo, result), false);
+			process->shutdownNotRequired();
+			return process;
+		}
+
+		static pid_t forkChild() {
+			pid_t pid = fork();
+			if (pid == 0) {
+				pause();
+				_exit(0);
+			}
+			return pid;
+		}
 	};
 
 	DEFINE_TEST_GROUP(Core_ApplicationPool_ProcessTest);
@@ -204,4 +238,412 @@ namespace tut {
 				&& gatheredOutput.find("errorPipe 2\n") != string::npos;
 		);
 	}
+
+	TEST_METHOD(6) {
+		set_test_name("Idle connections that have been closed by the app are not reused");
+		ProcessPtr process = createProcess();
+		SessionPtr session = process->newSession();
+		Socket *socket = session->getSocket();
+		ensure_equals(socket->name, "main1");
+
+		session->initiate();
+		FileDescriptor serverSide(syscalls::accept(server1, NULL, NULL), NULL, 0);
+		process->sessionClosed(session.get());
+		session->close(true, true);
+		ensure_equals("(1)", socket->totalConnections, 1);
+		ensure_equals("(2)", socket->totalIdleConnections, 1);
+
+		// The app closes the idle connection.
+		serverSide.close();
+		EVENTUALLY(2,
+			int fd = socket->checkoutConnection().fd;
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			result = poll(&pfd, 1, 0) == 0;
+			Connection connection;
+			connection.fd = fd;
+			connection.wantKeepAlive = true;
+			connection.fail = false;
+			socket->checkinConnection(connection);
+		);
+		ensure_equals("(3)", socket->totalConnections, 1);
+		ensure_equals("(4)", socket->totalIdleConnections, 1);
+	}
+
+	static void acceptConnections(int server, vector<FileDescriptor> *accepted) {
+		while (true) {
+			int fd = syscalls::accept(server, NULL, NULL);
+			if (fd == -1) {
+				int e = errno;
+				throw SystemException("Cannot accept a connection", e);
+			}
+			accepted->push_back(FileDescriptor(fd, NULL, 0));
+		}
+	}
+
+	static void checkoutAndCheckinConnections(Socket *socket, int id,
+		boost::barrier *barrier, boost::atomic<int> *owners, int maxFd,
+		int maxConnections, AtomicInt *errors)
+	{
+		// Start all threads at the same time so that they contend.
+		barrier->wait();
+		for (int i = 0; i < 2000; i++) {
+			Connection connection = socket->checkoutConnection();
+			if (connection.fd < 0 || connection.fd >= maxFd) {
+				(*errors)++;
+				return;
+			}
+			if (owners[connection.fd].exchange(id) != 0) {
+				(*errors)++;
+			}
+			if (socket->totalConnections.load() > maxConnections) {
+				(*errors)++;
+			}
+			// Hold on to the connection for a while, giving other threads
+			// the chance to check it out as well if the pool is broken.
+			boost::this_thread::yield();
+			if (owners[connection.fd].exchange(0) != id) {
+				(*errors)++;
+			}
+			connection.fail = false;
+			connection.wantKeepAlive = true;
+			socket->checkinConnection(connection);
+		}
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("The connection pool never hands out the same connection "
+			"to multiple threads");
+		const int threadCount = 8;
+		const int maxFd = 65536;
+		FileDescriptor server(createUnixServer("tmp.socket", 1024), NULL, 0);
+		Socket socket(123, "main", "unix:tmp.socket", "session", 4);
+		vector<FileDescriptor> accepted;
+		boost::scoped_array< boost::atomic<int> > owners(new boost::atomic<int>[maxFd]);
+		boost::barrier barrier(threadCount);
+		AtomicInt errors;
+		vector< boost::shared_ptr<TempThread> > threads;
+
+		for (int i = 0; i < maxFd; i++) {
+			owners[i].store(0);
+		}
+		boost::shared_ptr<TempThread> acceptor = boost::make_shared<TempThread>(
+			boost::bind(acceptConnections, (int) server, &accepted));
+		for (int i = 0; i < threadCount; i++) {
+			// Every thread holds at most one connection, the pool at most 4.
+			threads.push_back(boost::make_shared<TempThread>(boost::bind(
+				checkoutAndCheckinConnections, &socket, i + 1, &barrier,
+				owners.get(), maxFd, threadCount + 4, &errors)));
+		}
+		for (int i = 0; i < threadCount; i++) {
+			threads[i]->join();
+		}
+
+		ensure_equals("(1)", errors.get(), 0);
+		ensure("(2)", socket.totalIdleConnections.load() <= 4);
+		ensure_equals("(3)", socket.totalConnections.load(),
+			socket.totalIdleConnections.load());
+		socket.closeAllConnections();
+		ensure_equals("(4)", socket.totalConnections.load(), 0);
+
+		// Wait until the acceptor has caught up with the connections made.
+		EVENTUALLY(5,
+			unsigned long long timeout = 0;
+			result = !waitUntilReadable(server, &timeout);
+		);
+		acceptor.reset();
+		ensure("(5) connections were reused",
+			accepted.size() < (size_t) threadCount * 2000);
+		unlink("tmp.socket");
+	}
+
+	static void closeSessionsWithResponseTime(Process *process, vector<SessionPtr> &sessions,
+		unsigned int count, unsigned long long responseTime)
+	{
+		for (unsigned int i = 0; i < count; i++) {
+			SessionPtr &session = sessions[i % sessions.size()];
+			process->sessionClosed(session.get());
+			process->adaptConcurrencyLimit(session.get(),
+				session->startTime + responseTime);
+			session = process->newSession();
+			ensure(session != NULL);
+		}
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("With adaptive concurrency, the concurrency limit goes down "
+			"when the response times go up");
+		ProcessPtr process = createProcess();
+		process->enableAdaptiveConcurrency();
+		ensure_equals("(1)", process->concurrencyLimit, 9);
+
+		vector<SessionPtr> sessions;
+		for (int i = 0; i < 9; i++) {
+			sessions.push_back(process->newSession());
+		}
+		closeSessionsWithResponseTime(process.get(), sessions, 50, 1000);
+		ensure_equals("(2)", process->concurrencyLimit, 9);
+
+		closeSessionsWithResponseTime(process.get(), sessions, 50, 100000);
+		ensure("(3)", process->concurrencyLimit < 9);
+		ensure("(4)", process->concurrencyLimit >= 1);
+		ensure("(5)", process->isTotallyBusy());
+		ensure_equals("(6)", process->busyness(), INT_MAX);
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("With adaptive concurrency, the concurrency limit recovers "
+			"when the response times go back down");
+		ProcessPtr process = createProcess();
+		process->enableAdaptiveConcurrency();
+
+		vector<SessionPtr> sessions;
+		for (int i = 0; i < 9; i++) {
+			sessions.push_back(process->newSession());
+		}
+		closeSessionsWithResponseTime(process.get(), sessions, 50, 1000);
+		closeSessionsWithResponseTime(process.get(), sessions, 50, 100000);
+		int lowered = process->concurrencyLimit;
+		ensure("(1)", lowered < 9);
+
+		closeSessionsWithResponseTime(process.get(), sessions, 200, 1000);
+		ensure("(2)", process->concurrencyLimit > lowered);
+		ensure_equals("(3)", process->concurrencyLimit, 9);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("A process that is warming up looks busier than it is, until it "
+			"has processed the given number of requests");
+		ProcessPtr process = createProcess();
+		ProcessPtr warmProcess = createProcess();
+		process->startWarmup(0.1, 10, 0, 1000000);
+		ensure("(1)", process->warmingUp());
+		ensure("(2)", process->busyness() > warmProcess->busyness());
+		ensure("(3)", process->busyness() < INT_MAX);
+		ensure("(4)", !process->isTotallyBusy());
+
+		for (int i = 0; i < 5; i++) {
+			SessionPtr session = process->newSession();
+			process->sessionClosed(session.get());
+			process->updateWarmup(SystemTime::getUsec());
+		}
+		ensure("(5)", fabs(process->routingWeight - 0.55) < 0.001);
+
+		for (int i = 0; i < 5; i++) {
+			SessionPtr session = process->newSession();
+			process->sessionClosed(session.get());
+			process->updateWarmup(SystemTime::getUsec());
+		}
+		ensure("(6)", !process->warmingUp());
+		ensure_equals("(7)", process->busyness(), warmProcess->busyness());
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("A process that is warming up gets its full routing weight "
+			"after the given amount of time");
+		ProcessPtr process = createProcess();
+		process->startWarmup(0.5, 0, 1000000, 1000000);
+		process->updateWarmup(1500000);
+		ensure("(1)", fabs(process->routingWeight - 0.75) < 0.001);
+		process->updateWarmup(2000000);
+		ensure("(2)", !process->warmingUp());
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("Output is logged line by line, even if lines arrive in pieces, "
+			"and it is rate limited per process");
+		DeleteFileEventually d("tmp.log");
+		setPrintAppOutputAsDebuggingMessages(false);
+		setLogFileWithoutRedirectingStderr("tmp.log");
+		ScopeGuard g(boost::bind(setLogFileWithoutRedirectingStderr,
+			string("/dev/stderr"), (int *) NULL));
+		context.getSpawningKitConfig()->appOutputRateLimit = 3;
+		context.getSpawningKitConfig()->outputHandler = gatherOutput;
+		ProcessPtr process = createProcess();
+
+		writeExact(adminSocket[1], "hel");
+		EVENTUALLY(2,
+			boost::lock_guard<boost::mutex> l(gatheredOutputSyncher);
+			result = gatheredOutput == "hel";
+		);
+		writeExact(adminSocket[1], "lo\nwor");
+		writeExact(adminSocket[1], "ld\n");
+		EVENTUALLY(2,
+			boost::lock_guard<boost::mutex> l(gatheredOutputSyncher);
+			result = gatheredOutput == "hello\nworld\n";
+		);
+		writeExact(errorPipe[1], "a\nb\nc\nd\ne\nf\ng\nh\n");
+		adminSocket[1].close();
+		errorPipe[1].close();
+
+		string log;
+		EVENTUALLY(2,
+			log = readAll("tmp.log");
+			result = containsSubstring(log, "dropped");
+		);
+		ensure("(1)", containsSubstring(log, "App 123 stdout: hello\n"));
+		ensure("(2)", containsSubstring(log, "App 123 stdout: world\n"));
+		ensure("(3)", containsSubstring(log, "App 123 stderr: a\n"));
+		ensure("(4)", !containsSubstring(log, "App 123 stderr: h\n"));
+		// The rate limit is per process, so the summary may be logged
+		// on either channel.
+		ensure("(5)", containsSubstring(log, "lines of output dropped because more than "
+			"3 lines per second were written)"));
+	}
+
+	TEST_METHOD(13) {
+		set_test_name("The OS process can be signalled, and its exit is noticed, "
+			"both with and without pidfds");
+		ScopeGuard g(boost::bind(setPidFdsEnabled, true));
+		for (int i = 0; i < 2; i++) {
+			setPidFdsEnabled(i == 0);
+			pid_t pid = forkChild();
+			ensure("(1)", pid > 0);
+			ScopeGuard g2(boost::bind(::kill, pid, SIGKILL));
+			ProcessPtr process = createOsProcess(pid);
+			ensure_equals("(2)", process->hasPidFd(), i == 0 && openPidFd(pid) != -1);
+			ensure("(3)", process->osProcessExists());
+
+			ensure_equals("(4)", process->kill(SIGTERM), 0);
+			// The process may linger as a zombie until it's reaped, which
+			// counts as having exited.
+			EVENTUALLY(5,
+				result = !process->osProcessExists();
+			);
+			waitpid(pid, NULL, 0);
+			g2.clear();
+			ensure_equals("(5)", process->kill(SIGTERM), 0);
+		}
+	}
+
+	TEST_METHOD(14) {
+		set_test_name("The pidfd opened by the spawner is used");
+		pid_t pid = forkChild();
+		ensure("(1)", pid > 0);
+		ScopeGuard g(boost::bind(::kill, pid, SIGKILL));
+		int pidFd = openPidFd(pid);
+		if (pidFd == -1) {
+			// pidfds are not supported on this system.
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+			g.clear();
+			return;
+		}
+
+		// With pidfds disabled, the Process can only have a pidfd if it
+		// took the one from the spawn result.
+		ScopeGuard g2(boost::bind(setPidFdsEnabled, true));
+		setPidFdsEnabled(false);
+		ProcessPtr process = createOsProcess(pid, pidFd);
+		ensure("(2)", process->hasPidFd());
+		ensure("(3)", process->osProcessExists());
+
+		ensure_equals("(4)", process->kill(SIGTERM), 0);
+		EVENTUALLY(5,
+			result = !process->osProcessExists();
+		);
+		waitpid(pid, NULL, 0);
+		g.clear();
+	}
+
+	TEST_METHOD(15) {
+		set_test_name("Keep-alive connections to apps with unlimited concurrency "
+			"are reused by the next session");
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		getsockname(server1, (struct sockaddr *) &addr, &len);
+		sockets = Json::Value(Json::arrayValue);
+		Json::Value socket;
+		socket["name"] = "main";
+		socket["address"] = "tcp://127.0.0.1:" + toString(ntohs(addr.sin_port));
+		socket["protocol"] = "http_session";
+		socket["concurrency"] = 0;
+		sockets.append(socket);
+
+		ProcessPtr process = createProcess();
+		SessionPtr session = process->newSession();
+		Socket *appSocket = session->getSocket();
+		session->initiate();
+		FileDescriptor serverSide(syscalls::accept(server1, NULL, NULL), NULL, 0);
+		process->sessionClosed(session.get());
+		session->close(true, true);
+		ensure_equals("(1)", appSocket->totalIdleConnections, 1);
+
+		session = process->newSession();
+		session->initiate();
+		ensure_equals("(2)", appSocket->totalConnections, 1);
+		ensure_equals("(3)", appSocket->totalIdleConnections, 0);
+		unsigned long long timeout = 0;
+		ensure("(4) no new connection was made",
+			!waitUntilReadable(server1, &timeout));
+
+		// The app receives the second request on the first connection.
+		writeExact(session->fd(), "hello", 5);
+		char buf[5];
+		timeout = 1000000;
+		ensure_equals("(5)", readExact(serverSide, buf, 5, &timeout), 5u);
+		ensure_equals("(6)", StaticString(buf, 5), StaticString("hello"));
+
+		process->sessionClosed(session.get());
+		session->close(true, false);
+	}
+
+	TEST_METHOD(16) {
+		set_test_name("The concurrency can be changed while connections exist");
+		FileDescriptor server(createUnixServer("tmp.socket", 1024), NULL, 0);
+		Socket socket(123, "main", "unix:tmp.socket", "session", 4);
+		Connection connections[4];
+
+		for (int i = 0; i < 4; i++) {
+			connections[i] = socket.checkoutConnection();
+		}
+		for (int i = 0; i < 4; i++) {
+			connections[i].fail = false;
+			connections[i].wantKeepAlive = true;
+			socket.checkinConnection(connections[i]);
+		}
+		ensure_equals("(1)", socket.totalIdleConnections.load(), 4);
+
+		// Without sessions, idle connections beyond the new limit are
+		// closed right away.
+		socket.setConcurrency(2);
+		ensure_equals("(2)", socket.totalConnections.load(), 2);
+		ensure_equals("(3)", socket.totalIdleConnections.load(), 2);
+
+		// With a session open, the pool can shrink but not grow yet.
+		socket.sessions = 1;
+		connections[0] = socket.checkoutConnection();
+		socket.setConcurrency(1);
+		ensure_equals("(4)", socket.totalConnections.load(), 1);
+		ensure_equals("(5)", socket.totalIdleConnections.load(), 0);
+		socket.setConcurrency(3);
+		connections[1] = socket.checkoutConnection();
+		connections[2] = socket.checkoutConnection();
+		for (int i = 0; i < 3; i++) {
+			connections[i].fail = false;
+			connections[i].wantKeepAlive = true;
+			socket.checkinConnection(connections[i]);
+		}
+		ensure_equals("(6)", socket.totalConnections.load(), 2);
+		ensure_equals("(7)", socket.totalIdleConnections.load(), 2);
+
+		// Once the last session is gone, the pool grows to the new limit.
+		socket.sessions = 0;
+		socket.sessionsDrained();
+		for (int i = 0; i < 3; i++) {
+			connections[i] = socket.checkoutConnection();
+		}
+		for (int i = 0; i < 3; i++) {
+			connections[i].fail = false;
+			connections[i].wantKeepAlive = true;
+			socket.checkinConnection(connections[i]);
+		}
+		ensure_equals("(8)", socket.totalConnections.load(), 3);
+		ensure_equals("(9)", socket.totalIdleConnections.load(), 3);
+
+		socket.closeAllConnections();
+		unlink("tmp.socket");
+	}
 }
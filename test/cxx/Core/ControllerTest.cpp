@@ -292,6 +292,64 @@ namespace tut {
 			"GET /hello?foo=bar HTTP/1.1\r\n"));
 	}
 
+	TEST_METHOD(3) {
+		set_test_name("Session protocol: headers larger than a single mbuf");
+
+		init();
+		useTestSessionObject();
+
+		string value(6000, 'x');
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"X-Large-Header: " + value + "\r\n"
+			"X-Foo: bar\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		ensure("(1)", containsSubstring(peerRequestHeader,
+			"HTTP_X_LARGE_HEADER" + string("\0", 1) + value + string("\0", 1)));
+		ensure("(2)", containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("HTTP_X_FOO\0bar\0")));
+		ensure("(3)", containsSubstring(peerRequestHeader,
+			P_STATIC_STRING("REQUEST_URI\0/hello\0")));
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("HTTP protocol: app connection keep-alive");
+
+		options.setBool("app_keep_alive", true);
+		init();
+		useTestSessionObject();
+		testSession.setProtocol("http_session");
+
+		connectToServer();
+		sendRequest(
+			"GET /hello HTTP/1.1\r\n"
+			"Host: localhost\r\n"
+			"Connection: close\r\n"
+			"\r\n");
+		waitUntilSessionInitiated();
+
+		readPeerRequestHeader();
+		ensure("(1)", containsSubstring(peerRequestHeader,
+			"GET /hello HTTP/1.1\r\nConnection: keep-alive\r\n"));
+		ensure("(2)", !containsSubstring(peerRequestHeader, "Connection: close"));
+
+		// The app connection is handed back to be reused by the next request.
+		sendPeerResponse(
+			"HTTP/1.1 200 OK\r\n"
+			"Content-Type: text/plain\r\n"
+			"Content-Length: 2\r\n\r\n"
+			"ok");
+		waitUntilSessionClosed();
+		ensure("(3)", testSession.isSuccessful());
+		ensure("(4)", testSession.wantsKeepAlive());
+	}
+
 
 	/***** Application response body handling *****/
 
@@ -853,4 +911,31 @@ namespace tut {
 		string header = readResponseHeader();
 		ensure(containsSubstring(header, "HTTP/1.1 502"));
 	}
+
+	/***** Session checkout errors *****/
+
+	TEST_METHOD(50) {
+		set_test_name("If the app's circuit breaker is open, it responds with 503 "
+			"and the error page of the last spawn failure");
+
+		options.set("friendly_error_pages", "true");
+		init();
+		controller->resourceLocator = resourceLocator;
+		controller->exceptionToReturn = boost::make_shared<SpawnCircuitOpenException>(
+			SpawnException("Oops", "<p>Something went wrong!</p>", true), 3, 1000000);
+
+		setLogLevel(LVL_CRIT);
+		for (unsigned int i = 0; i < 2; i++) {
+			connectToServer();
+			sendRequest(
+				"GET /hello HTTP/1.1\r\n"
+				"Host: localhost\r\n"
+				"Connection: close\r\n"
+				"\r\n");
+			string header = readResponseHeader();
+			string body = readResponseBody();
+			ensure(containsSubstring(header, "HTTP/1.1 503"));
+			ensure(containsSubstring(body, "Something went wrong!"));
+		}
+	}
 }
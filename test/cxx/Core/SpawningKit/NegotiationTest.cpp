@@ -0,0 +1,297 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/Negotiation.h>
+#include <FileDescriptor.h>
+#include <Utils/IOUtils.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+
+namespace tut {
+	struct Core_SpawningKit_NegotiationTest {
+		vector<string> args;
+		boost::mutex syncher;
+		boost::condition_variable cond;
+		unsigned int finished;
+
+		Core_SpawningKit_NegotiationTest() {
+			args.push_back("foo");
+			args.push_back("bar");
+			finished = 0;
+			setLogLevel(LVL_CRIT);
+		}
+
+		~Core_SpawningKit_NegotiationTest() {
+			setLogLevel(DEFAULT_LOG_LEVEL);
+		}
+
+		static void onFinished(Core_SpawningKit_NegotiationTest *self,
+			const NegotiationPtr &negotiation)
+		{
+			boost::lock_guard<boost::mutex> l(self->syncher);
+			self->finished++;
+			self->cond.notify_all();
+		}
+
+		/**
+		 * Creates a Negotiation over the first socket of `sockets`. The tests
+		 * play the part of the application on the second socket.
+		 */
+		NegotiationPtr createNegotiation(const SocketPair &sockets,
+			unsigned long long timeout = 5000000,
+			const BackgroundIOCapturerPtr &stderrCapturer = BackgroundIOCapturerPtr(),
+			const StaticString &alreadyRead = StaticString())
+		{
+			return boost::make_shared<Negotiation>(getpid(), sockets.first, args,
+				timeout, stderrCapturer, alreadyRead);
+		}
+
+		void start(const NegotiationPtr &negotiation) {
+			negotiation->start(boost::bind(onFinished, this, boost::placeholders::_1));
+		}
+
+		void waitUntilFinished(unsigned int count) {
+			boost::unique_lock<boost::mutex> l(syncher);
+			while (finished < count) {
+				if (!cond.timed_wait(l, boost::posix_time::seconds(10))) {
+					fail("Timed out waiting for the negotiations to finish");
+				}
+			}
+		}
+
+		string readRequest(int fd, const StaticString &expected) {
+			string request(expected.size(), '\0');
+			unsigned long long timeout = 5000000;
+			readExact(fd, &request[0], request.size(), &timeout);
+			return request;
+		}
+
+		static bool isBlocking(int fd) {
+			return (fcntl(fd, F_GETFL) & O_NONBLOCK) == 0;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_NegotiationTest);
+
+	TEST_METHOD(1) {
+		set_test_name("All negotiations in progress are multiplexed on the "
+			"spawn event loop");
+		const unsigned int COUNT = 32;
+		vector<SocketPair> sockets;
+		vector<NegotiationPtr> negotiations;
+		unsigned int i;
+
+		for (i = 0; i < COUNT; i++) {
+			sockets.push_back(createUnixSocketPair(__FILE__, __LINE__));
+			negotiations.push_back(createNegotiation(sockets.back()));
+			start(negotiations.back());
+		}
+
+		// Every negotiation waits for its process's handshake
+		// without holding up the others.
+		for (i = 0; i < COUNT; i++) {
+			writeExact(sockets[i].second, "!> I have control 1.0\n");
+		}
+		for (i = 0; i < COUNT; i++) {
+			ensure_equals(readRequest(sockets[i].second, "You have control 1.0\nfoo: bar\n\n"),
+				"You have control 1.0\nfoo: bar\n\n");
+		}
+		for (i = COUNT; i > 0; i--) {
+			writeExact(sockets[i - 1].second, "!> Ready\n!> key: " + toString(i - 1) + "\n!> \n");
+		}
+
+		waitUntilFinished(COUNT);
+		for (i = 0; i < COUNT; i++) {
+			ensure_equals(negotiations[i]->getOutcome(), Negotiation::READY);
+			ensure_equals(negotiations[i]->getResponse().size(), 1u);
+			ensure_equals(negotiations[i]->getResponse()[0].first, "key");
+			ensure_equals(negotiations[i]->getResponse()[0].second, toString(i));
+		}
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("Input that arrives one byte at a time is handled");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		start(negotiation);
+
+		StaticString handshake = "!> I have control 1.1\n";
+		for (unsigned int i = 0; i < handshake.size(); i++) {
+			writeExact(sockets.second, handshake.substr(i, 1));
+			usleep(1000);
+		}
+		readRequest(sockets.second, StaticString("You have control 1.1\n8\nfoo\0bar\0", 31));
+
+		StaticString response("!> Ready\n!> 8\nkey\0val\0", 22);
+		for (unsigned int i = 0; i < response.size(); i++) {
+			ensure_equals(negotiation->getOutcome(), Negotiation::IN_PROGRESS);
+			writeExact(sockets.second, response.substr(i, 1));
+			usleep(1000);
+		}
+
+		waitUntilFinished(1);
+		ensure_equals(negotiation->getOutcome(), Negotiation::READY);
+		ensure(negotiation->isBinaryProtocol());
+		ensure_equals(negotiation->getResponse().size(), 1u);
+		ensure_equals(negotiation->getResponse()[0].first, "key");
+		ensure_equals(negotiation->getResponse()[0].second, "val");
+		ensure(negotiation->getHandshakeTime() != 0);
+		ensure(negotiation->getReadyTime() >= negotiation->getHandshakeTime());
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("The negotiation fails if the process doesn't respond in time");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets, 50000);
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::FAILED);
+		ensure_equals(negotiation->getErrorKind(), SpawnException::APP_STARTUP_TIMEOUT);
+		ensure(containsSubstring(negotiation->getErrorMessage(), "handshake message in time"));
+		ensure_equals(negotiation->getRemainingTimeout(), 0ull);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Lines without the protocol prefix are application output");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		Pipe stderrPipe = createPipe(__FILE__, __LINE__);
+		BackgroundIOCapturerPtr stderrCapturer = boost::make_shared<BackgroundIOCapturer>(
+			stderrPipe.first, getpid(), "stderr");
+		stderrCapturer->start();
+		NegotiationPtr negotiation = createNegotiation(sockets, 5000000, stderrCapturer);
+
+		writeExact(sockets.second, "hello\n!> I have control 1.0\nworld\n"
+			"!> Ready\n!> \n");
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::READY);
+		ensure_equals(negotiation->getResponse().size(), 0u);
+		ensure_equals(stderrCapturer->stop(), "hello\nworld\n");
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Output that the caller has already read is processed first");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets, 5000000,
+			BackgroundIOCapturerPtr(), "!> I have control 1.0\n!> Re");
+		writeExact(sockets.second, "ady\n!> \n");
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::READY);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("If the process sends another handshake instead of a response, "
+			"then the startup request is sent again");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		start(negotiation);
+
+		writeExact(sockets.second, "!> I have control 1.0\n");
+		readRequest(sockets.second, "You have control 1.0\nfoo: bar\n\n");
+		writeExact(sockets.second, "!> I have control 1.1\n");
+		ensure_equals(readRequest(sockets.second,
+				StaticString("You have control 1.1\n8\nfoo\0bar\0", 31)),
+			string("You have control 1.1\n8\nfoo\0bar\0", 31));
+		writeExact(sockets.second, StaticString("!> Ready\n!> 0\n", 14));
+
+		waitUntilFinished(1);
+		ensure_equals(negotiation->getOutcome(), Negotiation::READY);
+		ensure(negotiation->isBinaryProtocol());
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("A startup request that doesn't fit in the socket buffer "
+			"is sent in parts");
+		args.push_back("large");
+		args.push_back(string(1024 * 1024, 'x'));
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		start(negotiation);
+
+		writeExact(sockets.second, "!> I have control 1.0\n");
+		string expected = Negotiation::createStartupRequest(args, false);
+		ensure_equals(readRequest(sockets.second, expected), expected);
+		writeExact(sockets.second, "!> Ready\n!> \n");
+
+		waitUntilFinished(1);
+		ensure_equals(negotiation->getOutcome(), Negotiation::READY);
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("An error response consists of attributes and a message "
+			"that lasts until EOF");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		writeExact(sockets.second, "!> Error\n!> html: true\n!> \nSomething\nwent wrong");
+		shutdown(sockets.second, SHUT_WR);
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::ERROR_RESPONSE);
+		ensure_equals(negotiation->getErrorAttributes().find("html")->second, "true");
+		ensure_equals(negotiation->getErrorMessage(), "Something\nwent wrong");
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("The negotiation fails if the process exits before "
+			"signalling successful startup");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		sockets.second.close();
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::FAILED);
+		ensure_equals(negotiation->getErrorKind(), SpawnException::APP_STARTUP_ERROR);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("The negotiation fails if the process sends a protocol "
+			"message line that is too long");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		writeExact(sockets.second, "!> " + string(Negotiation::MAX_LINE_SIZE, 'x'));
+		negotiation->run();
+		ensure_equals(negotiation->getOutcome(), Negotiation::FAILED);
+		ensure_equals(negotiation->getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+		ensure(containsSubstring(negotiation->getErrorMessage(), "too long"));
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("A cancelled negotiation doesn't call its callback, and puts "
+			"the admin socket back in blocking mode");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		start(negotiation);
+		ensure("(1)", !isBlocking(sockets.first));
+
+		negotiation->cancel();
+		ensure_equals("(2)", negotiation->getOutcome(), Negotiation::CANCELLED);
+		ensure("(3)", isBlocking(sockets.first));
+		writeExact(sockets.second, "!> I have control 1.0\n");
+		SHOULD_NEVER_HAPPEN(100,
+			boost::lock_guard<boost::mutex> l(syncher);
+			result = finished > 0;
+		);
+	}
+
+	TEST_METHOD(12) {
+		set_test_name("Interrupting a thread that waits in run() cancels the negotiation");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets);
+		oxt::thread thr(boost::bind(&Negotiation::run, negotiation.get()));
+		EVENTUALLY(5,
+			result = !isBlocking(sockets.first);
+		);
+		thr.interrupt_and_join();
+		ensure_equals(negotiation->getOutcome(), Negotiation::CANCELLED);
+	}
+
+	TEST_METHOD(13) {
+		set_test_name("The negotiation times out immediately if its deadline "
+			"has already passed when it is started");
+		SocketPair sockets = createUnixSocketPair(__FILE__, __LINE__);
+		NegotiationPtr negotiation = createNegotiation(sockets, 0);
+		usleep(1000);
+		start(negotiation);
+		waitUntilFinished(1);
+		ensure_equals(negotiation->getOutcome(), Negotiation::FAILED);
+		ensure_equals(negotiation->getErrorKind(), SpawnException::APP_STARTUP_TIMEOUT);
+		ensure_equals(negotiation->getRemainingTimeout(), 0ull);
+	}
+}
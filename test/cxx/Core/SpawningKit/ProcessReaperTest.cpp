@@ -0,0 +1,124 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/ProcessReaper.h>
+#include <Utils/ScopeGuard.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cerrno>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+
+namespace tut {
+	struct Core_SpawningKit_ProcessReaperTest {
+		vector<pid_t> children;
+
+		~Core_SpawningKit_ProcessReaperTest() {
+			for (unsigned int i = 0; i < children.size(); i++) {
+				kill(children[i], SIGKILL);
+			}
+		}
+
+		pid_t spawnChild() {
+			pid_t pid = fork();
+			if (pid == 0) {
+				pause();
+				_exit(0);
+			} else if (pid == -1) {
+				int e = errno;
+				throw SystemException("Cannot fork", e);
+			}
+			children.push_back(pid);
+			return pid;
+		}
+
+		static bool isReaped(pid_t pid) {
+			return waitpid(pid, NULL, WNOHANG) == -1 && errno == ECHILD;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_ProcessReaperTest);
+
+	TEST_METHOD(1) {
+		// It reaps processes once they exit, and not before.
+		ProcessReaper &reaper = ProcessReaper::getInstance();
+		unsigned long long reaped = reaper.getReapedCount();
+		pid_t pid1 = spawnChild();
+		pid_t pid2 = spawnChild();
+		reaper.add(pid1);
+		reaper.add(pid2);
+
+		SHOULD_NEVER_HAPPEN(200,
+			result = reaper.getReapedCount() != reaped;
+		);
+
+		kill(pid1, SIGTERM);
+		EVENTUALLY(5,
+			result = reaper.getReapedCount() == reaped + 1;
+		);
+		ensure("(1)", isReaped(pid1));
+		ensure_equals("(2)", kill(pid2, 0), 0);
+
+		kill(pid2, SIGTERM);
+		EVENTUALLY(5,
+			result = reaper.getReapedCount() == reaped + 2;
+		);
+		ensure("(3)", isReaped(pid2));
+	}
+
+	TEST_METHOD(2) {
+		// Processes that exit at the same time are all reaped.
+		ProcessReaper &reaper = ProcessReaper::getInstance();
+		unsigned long long reaped = reaper.getReapedCount();
+		for (unsigned int i = 0; i < 20; i++) {
+			reaper.add(spawnChild());
+		}
+		for (unsigned int i = 0; i < children.size(); i++) {
+			kill(children[i], SIGKILL);
+		}
+		EVENTUALLY(5,
+			result = reaper.getReapedCount() == reaped + 20;
+		);
+		ensure_equals(reaper.getPendingCount(), 0u);
+	}
+
+	TEST_METHOD(3) {
+		// Processes that someone else has reaped are forgotten.
+		ProcessReaper &reaper = ProcessReaper::getInstance();
+		pid_t pid = spawnChild();
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		reaper.add(pid);
+		EVENTUALLY(5,
+			result = reaper.getPendingCount() == 0;
+		);
+	}
+
+	TEST_METHOD(4) {
+		// It falls back to polling if pidfds are not supported.
+		ProcessReaper &reaper = ProcessReaper::getInstance();
+		unsigned long long reaped = reaper.getReapedCount();
+		ScopeGuard guard(boost::bind(setPidFdsEnabled, true));
+		setPidFdsEnabled(false);
+		pid_t pid1 = spawnChild();
+		pid_t pid2 = spawnChild();
+		reaper.add(pid1);
+		reaper.add(pid2);
+
+		SHOULD_NEVER_HAPPEN(200,
+			result = reaper.getReapedCount() != reaped;
+		);
+
+		kill(pid1, SIGTERM);
+		EVENTUALLY(5,
+			result = reaper.getReapedCount() == reaped + 1;
+		);
+		ensure("(1)", isReaped(pid1));
+
+		kill(pid2, SIGTERM);
+		EVENTUALLY(5,
+			result = reaper.getReapedCount() == reaped + 2;
+		);
+		ensure("(2)", isReaped(pid2));
+	}
+}
@@ -180,7 +180,7 @@ namespace tut {
 
 	TEST_METHOD(84) {
 		set_test_name("If the preloader encountered an error, then the resulting SpawnException "
-			"takes note of the process's environment variables");
+			"takes note of the process's environment variables when debugging");
 		string envvars = modp::b64_encode("PASSENGER_FOO\0foo\0",
 			sizeof("PASSENGER_FOO\0foo\0") - 1);
 		Options options = createOptions();
@@ -194,7 +194,7 @@ namespace tut {
 		preloaderCommand.push_back("-c");
 		preloaderCommand.push_back("echo hello world >&2");
 		SmartSpawner spawner(preloaderCommand, options, config);
-		setLogLevel(LVL_CRIT);
+		setLogLevel(LVL_DEBUG);
 
 		try {
 			spawner.spawn(options);
@@ -218,6 +218,7 @@ namespace tut {
 			preloaderCommand.push_back("ruby");
 			preloaderCommand.push_back(resourceLocator->getHelperScriptsDir() +
 				"/rack-preloader.rb");
+			preloaderCommand.push_back(resourceLocator->getRubyLibDir());
 			SmartSpawner spawner(preloaderCommand, options, config);
 			result = spawner.spawn(options);
 		}
@@ -236,4 +237,78 @@ namespace tut {
 			result = gatheredOutput.find("hello world!\n") != string::npos;
 		);
 	}
+
+	TEST_METHOD(86) {
+		set_test_name("If spawnReserveSize > 0 then SmartSpawner keeps that many "
+			"processes in reserve, and hands them out upon spawning");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		options.spawnReserveSize = 2;
+		boost::shared_ptr<SmartSpawner> spawner = createSpawner(options);
+		SpawningKit::Result first = spawner->spawn(options);
+		EVENTUALLY(10,
+			result = spawner->getReserveSize() == 2;
+		);
+
+		SpawningKit::Result second = spawner->spawn(options);
+		ensure(second["pid"].asInt() != first["pid"].asInt());
+		ensure_equals(kill(second["pid"].asInt(), 0), 0);
+		ensure("The output of the reserved process is being watched",
+			second.outputWatched);
+		ensure(!first.outputWatched);
+		EVENTUALLY(10,
+			result = spawner->getReserveSize() == 2;
+		);
+
+		spawner->cleanup();
+		ensure_equals(spawner->getReserveSize(), 0u);
+	}
+
+	static bool processExited(pid_t pid) {
+		string stat;
+		try {
+			stat = readAll("/proc/" + toString(pid) + "/stat");
+		} catch (const FileSystemException &) {
+			return true;
+		}
+		// The state follows the parenthesized command name.
+		string::size_type pos = stat.rfind(')');
+		return pos != string::npos && stat.size() > pos + 2 && stat[pos + 2] == 'Z';
+	}
+
+	TEST_METHOD(87) {
+		set_test_name("SmartSpawner discards reserved processes that have exited, "
+			"even if they haven't been reaped yet");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		options.spawnReserveSize = 2;
+		boost::shared_ptr<SmartSpawner> spawner = createSpawner(options);
+		spawner->spawn(options);
+		EVENTUALLY(10,
+			result = spawner->getReserveSize() == 2;
+		);
+
+		vector<pid_t> pids;
+		spawner->getReservedPids(pids);
+		ensure_equals(pids.size(), 2u);
+		// A process becomes a zombie before all its threads are gone.
+		FileDescriptor pidFd(openPidFd(pids[0]), __FILE__, __LINE__);
+		kill(pids[0], SIGKILL);
+		EVENTUALLY(5,
+			if (pidFd != -1) {
+				result = pidFdProcessExited(pidFd);
+			} else {
+				result = processExited(pids[0]);
+			}
+		);
+
+		setLogLevel(LVL_ERROR);
+		SpawningKit::Result spawned = spawner->spawn(options);
+		ensure_equals(spawned["pid"].asInt(), (int) pids[1]);
+		spawner->cleanup();
+	}
 }
@@ -0,0 +1,269 @@
+#include <TestSupport.h>
+#include <Core/SpawningKit/DummySpawner.h>
+#include <FileDescriptor.h>
+#include <Utils/IOUtils.h>
+#include <sys/socket.h>
+
+using namespace Passenger;
+using namespace Passenger::SpawningKit;
+
+namespace tut {
+	struct Core_SpawningKit_SpawnerTest {
+		ConfigPtr config;
+		boost::shared_ptr<DummySpawner> dummySpawner;
+		Options options;
+		Spawner::SpawnPreparationInfo preparation;
+		Spawner::NegotiationDetails details;
+		// The spawner reads from and writes to the first socket of this
+		// pair; the tests play the part of the application on the second.
+		SocketPair sockets;
+
+		Core_SpawningKit_SpawnerTest() {
+			config = boost::make_shared<Config>();
+			config->resourceLocator = resourceLocator;
+			config->finalize();
+			dummySpawner = boost::make_shared<DummySpawner>(config);
+
+			options.appRoot = "stub/rack";
+			options.startTimeout = 1000;
+
+			sockets = createUnixSocketPair(__FILE__, __LINE__);
+			details.preparation = &preparation;
+			details.pid = getpid();
+			details.adminSocket = sockets.first;
+			details.io = BufferedIO(sockets.first);
+			details.options = &options;
+			details.timeout = 1000000;
+			details.binaryProtocol = true;
+			setLogLevel(LVL_CRIT);
+		}
+
+		~Core_SpawningKit_SpawnerTest() {
+			setLogLevel(DEFAULT_LOG_LEVEL);
+		}
+
+		// Test methods aren't friends of Spawner, so they go through these.
+
+		Result negotiateSpawn() {
+			return dummySpawner->negotiateSpawn(details);
+		}
+
+		string serializeEnvvars() {
+			return dummySpawner->serializeEnvvarsFromPoolOptions(options);
+		}
+
+		// Replaces the cached result, so that a cache hit can be told
+		// apart from a result that was serialized again.
+		void tamperWithEnvvarsCache() {
+			dummySpawner->envvarsCache = "cached";
+		}
+
+		static bool containsEnvvar(const string &envvars, const StaticString &name,
+			const StaticString &value)
+		{
+			return containsSubstring(modp::b64_decode(envvars),
+				name.toString() + '\0' + value.toString() + '\0');
+		}
+
+		/**
+		 * Sends `data` as the application, and then closes the connection.
+		 * Protocol message lines are prefixed with "!> ", like
+		 * `readMessageLine()` expects.
+		 */
+		void respond(const StaticString &data) {
+			writeExact(sockets.second, data);
+			shutdown(sockets.second, SHUT_WR);
+		}
+
+		string readStartupRequest() {
+			string request;
+			char buf[1024 * 16];
+			ssize_t ret;
+			shutdown(sockets.first, SHUT_WR);
+			while ((ret = syscalls::read(sockets.second, buf, sizeof(buf))) > 0) {
+				request.append(buf, ret);
+			}
+			return request;
+		}
+	};
+
+	DEFINE_TEST_GROUP(Core_SpawningKit_SpawnerTest);
+
+	TEST_METHOD(1) {
+		set_test_name("A version 1.1 startup response consists of a block of "
+			"NUL-terminated keys and values of the advertised size");
+		respond(StaticString("!> I have control 1.1\n"
+			"!> Ready\n"
+			"!> 83\n"
+			"socket\0main;tcp://127.0.0.1:1234;session;1\0"
+			"socket\0http;tcp://127.0.0.1:1235;http;1\0", 22 + 9 + 6 + 83));
+		Result result = negotiateSpawn();
+		ensure_equals(result["sockets"].size(), 2u);
+		ensure_equals(result["sockets"][0]["name"].asString(), "main");
+		ensure_equals(result["sockets"][0]["address"].asString(), "tcp://127.0.0.1:1234");
+		ensure_equals(result["sockets"][1]["name"].asString(), "http");
+		ensure_equals(result["sockets"][1]["protocol"].asString(), "http");
+		ensure_equals(result["spawn_timeline"].size(), 3u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("A SpawnException is thrown if the block of a version 1.1 "
+			"startup response is shorter than advertised");
+		respond("!> I have control 1.1\n!> Ready\n!> 10\nkey");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			ensure(containsSubstring(e.what(), "unexpectedly closed the connection"));
+		}
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("A SpawnException is thrown if the block size line of a "
+			"version 1.1 startup response is not terminated");
+		respond("!> I have control 1.1\n!> Ready\n!> 10");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			ensure(containsSubstring(e.what(), "invalid block size"));
+		}
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("A SpawnException is thrown if the block size of a version "
+			"1.1 startup response is not a number");
+		respond("!> I have control 1.1\n!> Ready\n!> 10a\n");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			ensure(containsSubstring(e.what(), "invalid block size"));
+		}
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("Version 1.1 startup responses larger than 128 KB are refused "
+			"without reading them");
+		respond("!> I have control 1.1\n!> Ready\n!> 131073\n");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			ensure(containsSubstring(e.what(), "too large"));
+		}
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("A version 1.0 startup response consists of \"key: value\" "
+			"lines terminated by an empty line");
+		respond("!> I have control 1.0\n"
+			"!> Ready\n"
+			"!> socket: main;tcp://127.0.0.1:1234;session;1\n"
+			"!> \n");
+		Result result = negotiateSpawn();
+		ensure_equals(result["sockets"].size(), 1u);
+		ensure_equals(result["sockets"][0]["name"].asString(), "main");
+		ensure_equals(result["sockets"][0]["protocol"].asString(), "session");
+	}
+
+	TEST_METHOD(7) {
+		set_test_name("A SpawnException is thrown if the last value of a version 1.1 "
+			"startup response is not NUL-terminated");
+		respond(StaticString("!> I have control 1.1\n"
+			"!> Ready\n"
+			"!> 42\n"
+			"socket\0main;tcp://127.0.0.1:1234;session;1", 22 + 9 + 6 + 42));
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_PROTOCOL_ERROR);
+			ensure(containsSubstring(e.what(), "key that has no value"));
+		}
+	}
+
+	TEST_METHOD(8) {
+		set_test_name("If the application sends an error response, then its message "
+			"is thrown as a SpawnException");
+		respond("!> I have control 1.1\n"
+			"!> Error\n"
+			"!> html: true\n"
+			"!> \n"
+			"<p>Something went wrong</p>\n");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure_equals(e.getErrorKind(), SpawnException::APP_STARTUP_EXPLAINABLE_ERROR);
+			ensure_equals(e.getErrorPage(), "<p>Something went wrong</p>\n");
+			ensure(e.isHTML());
+		}
+	}
+
+	TEST_METHOD(9) {
+		set_test_name("If the application only speaks version 1.0 of the negotiation "
+			"protocol, then the startup request is sent in the version 1.0 format");
+		respond("!> I have control 1.0\n");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &) {
+			// The application closed the connection after the handshake.
+		}
+		ensure("(1)", !details.binaryProtocol);
+
+		string request = readStartupRequest();
+		ensure("(2)", startsWith(request, "You have control 1.0\n"));
+		ensure("(3)", containsSubstring(request, "passenger_version: " PASSENGER_VERSION "\n"));
+		ensure("(4)", request.find('\0') == string::npos);
+	}
+
+	TEST_METHOD(10) {
+		set_test_name("If the application speaks version 1.1 of the negotiation "
+			"protocol, then the startup request is sent as a binary block");
+		details.binaryProtocol = false;
+		respond("!> I have control 1.1\n");
+		try {
+			negotiateSpawn();
+			fail("SpawnException expected");
+		} catch (const SpawnException &) {
+			// The application closed the connection after the handshake.
+		}
+		ensure("(1)", details.binaryProtocol);
+
+		string request = readStartupRequest();
+		ensure("(2)", startsWith(request, "You have control 1.1\n"));
+		ensure("(3)", containsSubstring(request,
+			string("passenger_version\0" PASSENGER_VERSION "\0",
+				sizeof("passenger_version") + sizeof(PASSENGER_VERSION))));
+	}
+
+	TEST_METHOD(11) {
+		set_test_name("The serialized environment variables are cached until "
+			"the options that they're derived from change");
+		options.environment = "production";
+		ensure("(1)", containsEnvvar(serializeEnvvars(), "RAILS_ENV", "production"));
+		tamperWithEnvvarsCache();
+		ensure_equals("(2)", serializeEnvvars(), "cached");
+
+		options.environment = "staging";
+		ensure("(3)", containsEnvvar(serializeEnvvars(), "RAILS_ENV", "staging"));
+
+		tamperWithEnvvarsCache();
+		options.baseURI = "/foo";
+		ensure("(4)", containsEnvvar(serializeEnvvars(), "PASSENGER_BASE_URI", "/foo"));
+
+		tamperWithEnvvarsCache();
+		string customEnvvars = modp::b64_encode("PASSENGER_FOO\0foo\0",
+			sizeof("PASSENGER_FOO\0foo\0") - 1);
+		options.environmentVariables = customEnvvars;
+		ensure("(5)", containsEnvvar(serializeEnvvars(), "PASSENGER_FOO", "foo"));
+		tamperWithEnvvarsCache();
+		ensure_equals("(6)", serializeEnvvars(), "cached");
+	}
+}
@@ -213,7 +213,8 @@
 	}
 
 	TEST_METHOD(8) {
-		set_test_name("Any raised SpawnExceptions take note of the process's environment variables");
+		set_test_name("When debugging, any raised SpawnExceptions take note of the "
+			"process's environment variables");
 		string envvars = modp::b64_encode("PASSENGER_FOO\0foo\0",
 			sizeof("PASSENGER_FOO\0foo\0") - 1);
 		Options options = createOptions();
@@ -222,12 +223,13 @@
 		options.startupFile  = ".";
 		options.environmentVariables = envvars;
 		SpawnerPtr spawner = createSpawner(options);
-		setLogLevel(LVL_CRIT);
+		setLogLevel(LVL_DEBUG);
 		try {
 			spawner->spawn(options);
 			fail("SpawnException expected");
 		} catch (const SpawnException &e) {
-			ensure(containsSubstring(e["envvars"], "PASSENGER_FOO=foo\n"));
+			ensure("(1)", containsSubstring(e["envvars"], "PASSENGER_FOO=foo\n"));
+			ensure("(2)", !e["user_info"].empty());
 		}
 	}
 
@@ -316,6 +318,111 @@
 		ensure_equals(result["code_revision"].asString(), "today");
 	}
 
+	TEST_METHOD(13) {
+		set_test_name("It reports a timeline of the spawn phases");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		result = spawner->spawn(options);
+
+		const Json::Value &timeline = result["spawn_timeline"];
+		set<string> phases;
+		unsigned long long prevEndTime = 0;
+		ensure(timeline.size() >= 4);
+		for (unsigned int i = 0; i < timeline.size(); i++) {
+			phases.insert(timeline[i]["phase"].asString());
+			ensure(timeline[i]["start_time"].asUInt64() >= prevEndTime);
+			ensure(timeline[i]["end_time"].asUInt64() >= timeline[i]["start_time"].asUInt64());
+			prevEndTime = timeline[i]["end_time"].asUInt64();
+		}
+		ensure(phases.count("fork"));
+		ensure(phases.count("handshake"));
+		ensure(phases.count("app_boot"));
+		ensure(phases.count("socket_advertisement"));
+	}
+
+	TEST_METHOD(14) {
+		set_test_name("It negotiates with version 1.1 of the protocol if the app announces it");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		result = spawner->spawn(options);
+		ensure_equals(result["sockets"].size(), 1u);
+		ensure_equals(result["sockets"][0]["protocol"].asString(), "session");
+
+		FileDescriptor fd(connectToServer(result["sockets"][0]["address"].asCString(),
+			__FILE__, __LINE__), NULL, 0);
+		writeExact(fd, "protocol_version\n");
+		ensure_equals(readAll(fd), "1.1\n");
+	}
+
+	TEST_METHOD(15) {
+		set_test_name("It negotiates with version 1.0 of the protocol if the app announces it");
+		Options options = createOptions();
+		options.appRoot      = "stub/rack";
+		options.startCommand = "ruby\t" "start.rb\t" "--protocol-1.0";
+		options.startupFile  = "start.rb";
+		SpawnerPtr spawner = createSpawner(options);
+		result = spawner->spawn(options);
+		ensure_equals(result["sockets"].size(), 1u);
+		ensure_equals(result["sockets"][0]["protocol"].asString(), "session");
+
+		FileDescriptor fd(connectToServer(result["sockets"][0]["address"].asCString(),
+			__FILE__, __LINE__), NULL, 0);
+		writeExact(fd, "protocol_version\n");
+		ensure_equals(readAll(fd), "1.0\n");
+	}
+
+	TEST_METHOD(16) {
+		set_test_name("When not debugging, no spawn information is dumped");
+		string envvars = modp::b64_encode("PASSENGER_FOO\0foo\0",
+			sizeof("PASSENGER_FOO\0foo\0") - 1);
+		Options options = createOptions();
+		options.appRoot      = "stub";
+		options.startCommand = "echo\t" "!> hello world";
+		options.startupFile  = ".";
+		options.environmentVariables = envvars;
+		SpawnerPtr spawner = createSpawner(options);
+		setLogLevel(LVL_CRIT);
+		try {
+			spawner->spawn(options);
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			ensure("(1)", e["envvars"].empty());
+			ensure("(2)", e["user_info"].empty());
+			ensure("(3)", e["system_metrics"].empty());
+		}
+	}
+
+	TEST_METHOD(17) {
+		set_test_name("A failed spawn reports a timeline of the phases it got through");
+		Options options = createOptions();
+		options.appRoot      = "stub";
+		options.startCommand = "perl\t" "start_error.pl";
+		options.startupFile  = "start_error.pl";
+		SpawnerPtr spawner = createSpawner(options);
+		setLogLevel(LVL_CRIT);
+		try {
+			spawner->spawn(options);
+			fail("SpawnException expected");
+		} catch (const SpawnException &e) {
+			Json::Value timeline;
+			Json::Reader reader;
+			ensure("(1)", reader.parse(e["spawn_timeline"], timeline));
+			set<string> phases;
+			for (unsigned int i = 0; i < timeline.size(); i++) {
+				phases.insert(timeline[i]["phase"].asString());
+			}
+			ensure("(2)", phases.count("fork"));
+			ensure("(3)", phases.count("handshake"));
+			ensure("(4)", phases.count("app_boot"));
+		}
+	}
+
 	/******* User switching tests *******/
 
 	// If 'user' is set
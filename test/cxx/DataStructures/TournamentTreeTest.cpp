@@ -0,0 +1,106 @@
+#include <TestSupport.h>
+#include <cstdlib>
+#include <vector>
+#include <DataStructures/TournamentTree.h>
+
+using namespace Passenger;
+using namespace std;
+
+namespace tut {
+	struct DataStructures_TournamentTreeTest {
+		TournamentTree<int> tree;
+
+		// The index that a linear scan would return.
+		static unsigned int linearMinIndex(const vector<int> &values) {
+			unsigned int result = 0;
+			for (unsigned int i = 1; i < values.size(); i++) {
+				if (values[i] < values[result]) {
+					result = i;
+				}
+			}
+			return result;
+		}
+	};
+
+	DEFINE_TEST_GROUP(DataStructures_TournamentTreeTest);
+
+	TEST_METHOD(1) {
+		set_test_name("Initial state");
+		ensure(tree.empty());
+		ensure_equals(tree.size(), 0u);
+	}
+
+	TEST_METHOD(2) {
+		set_test_name("minIndex() returns the index of the smallest value");
+		tree.push_back(5);
+		ensure_equals("(1)", tree.minIndex(), 0u);
+		tree.push_back(3);
+		ensure_equals("(2)", tree.minIndex(), 1u);
+		tree.push_back(7);
+		ensure_equals("(3)", tree.minIndex(), 1u);
+		tree.push_back(1);
+		ensure_equals("(4)", tree.minIndex(), 3u);
+		tree.push_back(2);
+		ensure_equals("(5)", tree.minIndex(), 3u);
+		ensure_equals("(6)", tree.size(), 5u);
+		ensure_equals("(7)", tree[2], 7);
+	}
+
+	TEST_METHOD(3) {
+		set_test_name("set() updates the smallest value");
+		tree.push_back(5);
+		tree.push_back(3);
+		tree.push_back(7);
+		tree.set(1, 9);
+		ensure_equals("(1)", tree.minIndex(), 0u);
+		tree.set(2, 0);
+		ensure_equals("(2)", tree.minIndex(), 2u);
+		ensure_equals("(3)", tree[1], 9);
+	}
+
+	TEST_METHOD(4) {
+		set_test_name("Among equal values, the one with the lowest index wins");
+		tree.push_back(4);
+		tree.push_back(2);
+		tree.push_back(2);
+		tree.push_back(2);
+		ensure_equals("(1)", tree.minIndex(), 1u);
+		tree.set(1, 3);
+		ensure_equals("(2)", tree.minIndex(), 2u);
+		tree.set(1, 2);
+		ensure_equals("(3)", tree.minIndex(), 1u);
+	}
+
+	TEST_METHOD(5) {
+		set_test_name("clear() and shrink_to_fit() allow rebuilding the tree");
+		for (int i = 0; i < 9; i++) {
+			tree.push_back(10 - i);
+		}
+		ensure_equals("(1)", tree.minIndex(), 8u);
+		tree.clear();
+		ensure("(2)", tree.empty());
+		tree.push_back(3);
+		tree.push_back(1);
+		tree.shrink_to_fit();
+		ensure_equals("(3)", tree.minIndex(), 1u);
+		tree.push_back(0);
+		ensure_equals("(4)", tree.minIndex(), 2u);
+	}
+
+	TEST_METHOD(6) {
+		set_test_name("It agrees with a linear scan after random updates");
+		vector<int> values;
+		srand(1234);
+		for (unsigned int i = 0; i < 100; i++) {
+			values.push_back(rand() % 10);
+			tree.push_back(values.back());
+			ensure_equals("(1)", tree.minIndex(), linearMinIndex(values));
+		}
+		for (unsigned int i = 0; i < 1000; i++) {
+			unsigned int index = rand() % values.size();
+			values[index] = rand() % 10;
+			tree.set(index, values[index]);
+			ensure_equals("(2)", tree.minIndex(), linearMinIndex(values));
+		}
+	}
+}
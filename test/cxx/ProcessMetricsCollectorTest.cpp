@@ -13,6 +13,7 @@ namespace tut {
 	struct ProcessMetricsCollectorTest {
 		ProcessMetricsCollector collector;
 		pid_t child;
+		vector<pid_t> children;
 
 		ProcessMetricsCollectorTest() {
 			child = -1;
@@ -23,6 +24,10 @@ namespace tut {
 				kill(child, SIGKILL);
 				waitpid(child, NULL, 0);
 			}
+			for (unsigned int i = 0; i < children.size(); i++) {
+				kill(children[i], SIGKILL);
+				waitpid(children[i], NULL, 0);
+			}
 		}
 
 		pid_t spawnChild(int memory) {
@@ -120,4 +125,125 @@ namespace tut {
 			ensure(swap < 10000 || swap == -1);
 		#endif
 	}
+
+	TEST_METHOD(4) {
+		// collectFromProc() collects the same metrics as collectFromPs().
+		if (!ProcessMetricsCollector::procAvailable()) {
+			return;
+		}
+		child = spawnChild(50);
+		usleep(500000);
+		vector<pid_t> pids;
+		pids.push_back(child);
+		ProcessMetricMap psResult = collector.collectFromPs(pids);
+		ProcessMetricMap procResult = collector.collectFromProc(pids);
+
+		ensure_equals(psResult.size(), 1u);
+		ensure_equals(procResult.size(), 1u);
+		const ProcessMetrics &ps = psResult[child];
+		const ProcessMetrics &proc = procResult[child];
+		ensure_equals(proc.pid, child);
+		ensure_equals(proc.ppid, getpid());
+		ensure_equals(proc.ppid, ps.ppid);
+		ensure_equals(proc.processGroupId, ps.processGroupId);
+		ensure_equals(proc.uid, ps.uid);
+		ensure_equals(proc.command, ps.command);
+		ensure("RSS is correct", proc.rss > 50000 && proc.rss < 60000);
+		ensure("VM size is correct", proc.vmsize >= proc.rss);
+		ensure("Private dirty is correct",
+			proc.privateDirty > 50000 && proc.privateDirty < 60000);
+	}
+
+	TEST_METHOD(5) {
+		// collectFromProc() does not collect the metrics for PIDs that don't exist.
+		if (!ProcessMetricsCollector::procAvailable()) {
+			return;
+		}
+		child = spawnChild(1);
+		pid_t deadChild = spawnChild(1);
+		kill(deadChild, SIGKILL);
+		waitpid(deadChild, NULL, 0);
+
+		vector<pid_t> pids;
+		pids.push_back(child);
+		pids.push_back(deadChild);
+		ProcessMetricMap result = collector.collectFromProc(pids);
+
+		ensure_equals(result.size(), 1u);
+		ensure(result.find(child) != result.end());
+		ensure(result.find(deadChild) == result.end());
+	}
+
+	TEST_METHOD(6) {
+		// collectFromProc() returns the same processes and metrics as
+		// collectFromPs() when there are many processes.
+		// dev/benchmark_process_metrics_collector.cpp compares their speed.
+		if (!ProcessMetricsCollector::procAvailable()) {
+			return;
+		}
+		for (int i = 0; i < 50; i++) {
+			children.push_back(spawnChild(1));
+		}
+		usleep(500000);
+
+		ProcessMetricMap psResult = collector.collectFromPs(children);
+		ProcessMetricMap procResult = collector.collectFromProc(children);
+		ensure_equals(psResult.size(), children.size());
+		ensure_equals(procResult.size(), children.size());
+		for (unsigned int i = 0; i < children.size(); i++) {
+			ensure("PID " + toString(children[i]) + " is collected",
+				procResult.find(children[i]) != procResult.end());
+			const ProcessMetrics &ps = psResult[children[i]];
+			const ProcessMetrics &proc = procResult[children[i]];
+			ensure_equals(proc.pid, children[i]);
+			ensure_equals(proc.ppid, ps.ppid);
+			ensure_equals(proc.processGroupId, ps.processGroupId);
+			ensure_equals(proc.uid, ps.uid);
+			ensure_equals(proc.command, ps.command);
+		}
+	}
+
+	TEST_METHOD(7) {
+		// On Linux, collect() reads from /proc and returns the same metrics
+		// for a single process (as done upon spawning) as collectFromPs().
+		// dev/benchmark_process_metrics_collector.cpp compares their speed.
+		if (!ProcessMetricsCollector::procAvailable()) {
+			return;
+		}
+		child = spawnChild(1);
+		usleep(500000);
+		vector<pid_t> pids;
+		pids.push_back(child);
+
+		ProcessMetricMap psResult = collector.collectFromPs(pids);
+		ProcessMetricMap result = collector.collect(pids);
+		ensure_equals(psResult.size(), 1u);
+		ensure_equals(result.size(), 1u);
+		ensure_equals(result[child].pid, child);
+		ensure_equals(result[child].uid, geteuid());
+		ensure_equals(result[child].uid, psResult[child].uid);
+		ensure_equals(result[child].ppid, psResult[child].ppid);
+		ensure_equals(result[child].command, psResult[child].command);
+	}
+
+	TEST_METHOD(8) {
+		// Measuring shared and private memory usage works.
+		ssize_t pss, privateDirty, swap, shared, privateMemory;
+		child = spawnChild(50);
+		usleep(500000);
+		collector.measureRealMemory(child, pss, privateDirty, swap,
+			shared, privateMemory);
+		#if defined(__linux__)
+			ensure("Private memory is correct", privateMemory > 50000 && privateMemory < 60000);
+			ensure("Shared memory is correct", shared >= 0);
+
+			ProcessMetrics metrics;
+			metrics.shared = shared;
+			metrics.privateMemory = privateMemory;
+			ensure("Most memory is private", metrics.sharedPercentage() < 50);
+		#else
+			ensure_equals(shared, (ssize_t) -1);
+			ensure_equals(privateMemory, (ssize_t) -1);
+		#endif
+	}
 }
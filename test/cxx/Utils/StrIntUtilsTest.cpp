@@ -41,5 +41,23 @@ namespace tut {
 		snprintf(s, 10, "h\xeallo"); // hêllo
 		string result = escapeHTML(s);
 		ensure_equals(result, "h?llo");
+	} TEST_METHOD(5) {
+		set_test_name("appendData never writes beyond 'end', also when called "
+			"again after the buffer is full");
+		char buffer[16 + 16];
+		char *end = buffer + 16;
+		memset(buffer, '.', sizeof(buffer));
+
+		char *pos = appendData(buffer, end, "0123456789", 10);
+		ensure_equals("(1)", pos - buffer, 10);
+		pos = appendData(pos, end, "abcdefghij", 10);
+		ensure_equals("(2)", pos - buffer, 20);
+		pos = appendData(pos, end, "klmnopqrstuvwxyz", 16);
+		ensure_equals("(3)", pos - buffer, 36);
+		pos = appendData(pos, end, P_STATIC_STRING("ABCDEFGHIJ"));
+		ensure_equals("(4)", pos - buffer, 46);
+
+		ensure_equals("(5)", string(buffer, 16), "0123456789abcdef");
+		ensure_equals("(6)", string(end, 16), string(16, '.'));
 	}
 }
@@ -11,9 +11,10 @@ module PhusionPassenger
     @stub = register_stub(RackStub.new("rack"))
   end
 
-  def start(options = {})
-    @loader = Loader.new(["ruby", "#{PhusionPassenger.helper_scripts_dir}/rack-loader.rb"], @stub.app_root)
-    return @loader.start(options)
+  def start(options = {}, protocol_version = "1.1")
+    @loader = Loader.new(["ruby", "#{PhusionPassenger.helper_scripts_dir}/rack-loader.rb",
+      PhusionPassenger.ruby_libdir], @stub.app_root)
+    return @loader.start(options, protocol_version)
   end
 
   it_should_behave_like "a loader"
@@ -11,12 +11,13 @@ module PhusionPassenger
     @stub = register_stub(RackStub.new("rack"))
   end
 
-  def start(options = {})
-    @preloader = Preloader.new(["ruby", "#{PhusionPassenger.helper_scripts_dir}/rack-preloader.rb"], @stub.app_root)
-    result = @preloader.start(options)
+  def start(options = {}, protocol_version = "1.1")
+    @preloader = Preloader.new(["ruby", "#{PhusionPassenger.helper_scripts_dir}/rack-preloader.rb",
+      PhusionPassenger.ruby_libdir], @stub.app_root)
+    result = @preloader.start(options, protocol_version)
     if result[:status] == "Ready"
       @loader = @preloader.spawn(options)
-      return @loader.start(options)
+      return @loader.start(options, protocol_version)
     else
       return result
     end
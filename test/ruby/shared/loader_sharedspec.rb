@@ -55,12 +55,16 @@ def close
     end
   end
 
-  def start(options = {})
+  # Negotiates with the loader, using the given version of the protocol.
+  # Loaders announce version 1.1, but must fall back to 1.0 if that is
+  # what the other side replies with.
+  def start(options = {}, protocol_version = "1.1")
     init_message = read_response_line
-    if init_message != "I have control 1.0\n"
+    if init_message != "I have control 1.1\n"
       raise "Unknown response initialization message: #{init_message.inspect}"
     end
-    write_request_line "You have control 1.0"
+    @binary_protocol = protocol_version == "1.1"
+    write_request_line "You have control #{protocol_version}"
     write_start_request(options)
     return process_response
   end
@@ -98,30 +102,55 @@ def read_response_line
   end
 
   def write_start_request(options)
-    write_request_line "passenger_root: #{PhusionPassenger.install_spec}"
-    write_request_line "ruby_libdir: #{PhusionPassenger.ruby_libdir}"
-    write_request_line "app_root: #{File.expand_path(@app_root)}"
-    write_request_line "keepalive: false"
-    write_request_line "log_level: 6" if DEBUG
-    options.each_pair do |key, value|
-      write_request_line "#{key}: #{value}"
+    request = {
+      "passenger_root" => PhusionPassenger.install_spec,
+      "ruby_libdir" => PhusionPassenger.ruby_libdir,
+      "app_root" => File.expand_path(@app_root),
+      "keepalive" => "false"
+    }
+    request["log_level"] = "6" if DEBUG
+    request.merge!(options)
+
+    if @binary_protocol
+      block = ""
+      request.each_pair do |key, value|
+        block << "#{key}\0#{value}\0"
+      end
+      STDERR.puts "---> #{block.inspect}" if DEBUG
+      @input.write("#{block.bytesize}\n#{block}")
+    else
+      request.each_pair do |key, value|
+        write_request_line "#{key}: #{value}"
+      end
+      write_request_line
     end
-    write_request_line
+  end
+
+  # Whether a "Ready" response is sent as a binary block. Only spawned
+  # processes do that; a preloader's startup response is always text.
+  def binary_response?
+    @binary_protocol
   end
 
   def process_response
     status = read_response_line
 
     headers = {}
-    line = read_response_line
-    while line != "\n"
-      key, value = line.strip.split(/ *: */, 2)
-      if key == "socket"
-        process_socket(value)
-      else
-        headers[key] = value
+    if status == "Ready\n" && binary_response?
+      format = :binary
+      block = @output.read(Integer(read_response_line))
+      STDERR.puts "<--- #{block.inspect}" if DEBUG
+      block.split("\0").each_slice(2) do |key, value|
+        process_response_value(headers, key, value)
       end
+    else
+      format = :text
       line = read_response_line
+      while line != "\n"
+        key, value = line.strip.split(/ *: */, 2)
+        process_response_value(headers, key, value)
+        line = read_response_line
+      end
     end
 
     if status == "Error\n"
@@ -129,7 +158,16 @@ def process_response
       STDERR.puts "<--- #{body}" if DEBUG
     end
 
-    return { :status => status.strip, :headers => headers, :body => body }
+    return { :status => status.strip, :format => format,
+      :headers => headers, :body => body }
+  end
+
+  def process_response_value(headers, key, value)
+    if key == "socket"
+      process_socket(value)
+    else
+      headers[key] = value
+    end
   end
 
   def process_socket(spec)
@@ -144,7 +182,7 @@ def spawn(options = {})
     loader = Loader.new_with_sockets(socket, socket.dup, @app_root)
     begin
       loader.send(:write_request_line, "spawn")
-      loader.send(:write_start_request, options)
+      loader.send(:write_request_line)
 
       line = loader.output.readline
       puts "<--- #{line.strip}" if DEBUG
@@ -164,6 +202,10 @@ def spawn(options = {})
   end
 
 private
+  def binary_response?
+    false
+  end
+
   def process_socket(spec)
     sockets["spawn"] = spec
   end
@@ -243,6 +285,31 @@ def perform_request(headers)
     headers["Status"].should == "200"
     body.should == "front page"
   end
+
+  it "advertises its readiness and sockets in a binary block in version 1.1 of the protocol" do
+    result = start
+    result[:status].should == "Ready"
+    result[:format].should == :binary
+    @loader.sockets["main"][:protocol].should == "session"
+    @loader.sockets["main"][:concurrency].should_not be_nil
+    headers, body = perform_request(
+      "REQUEST_METHOD" => "GET",
+      "PATH_INFO" => "/"
+    )
+    body.should == "front page"
+  end
+
+  it "falls back to version 1.0 of the protocol if the startup request is in that version" do
+    result = start({}, "1.0")
+    result[:status].should == "Ready"
+    result[:format].should == :text
+    @loader.sockets["main"][:protocol].should == "session"
+    headers, body = perform_request(
+      "REQUEST_METHOD" => "GET",
+      "PATH_INFO" => "/"
+    )
+    body.should == "front page"
+  end
 end
 
 end # module PhusionPassenger
@@ -3,13 +3,22 @@
 
 STDOUT.sync = true
 STDERR.sync = true
-puts "!> I have control 1.0"
-abort "Invalid initialization header" if STDIN.readline != "You have control 1.0\n"
+# Speaks version 1.1 of the negotiation protocol, unless
+# --protocol-1.0 is passed.
+protocol_version = ARGV.include?("--protocol-1.0") ? "1.0" : "1.1"
+puts "!> I have control #{protocol_version}"
+abort "Invalid initialization header" if STDIN.readline != "You have control #{protocol_version}\n"
 
 options = {}
-while (line = STDIN.readline) != "\n"
-  name, value = line.strip.split(/: */, 2)
-  options[name] = value
+if protocol_version == "1.1"
+  STDIN.read(Integer(STDIN.readline)).split("\0").each_slice(2) do |name, value|
+    options[name] = value
+  end
+else
+  while (line = STDIN.readline) != "\n"
+    name, value = line.strip.split(/: */, 2)
+    options[name] = value
+  end
 end
 
 if ARGV[0] == "--execself"
@@ -18,9 +27,15 @@
 end
 
 server = TCPServer.new('127.0.0.1', 0)
-puts "!> Ready"
-puts "!> socket: main;tcp://127.0.0.1:#{server.addr[1]};session;1"
-puts "!> "
+socket = "main;tcp://127.0.0.1:#{server.addr[1]};session;1"
+if protocol_version == "1.1"
+  block = "socket\0#{socket}\0"
+  STDOUT.write("!> Ready\n!> #{block.bytesize}\n#{block}")
+else
+  puts "!> Ready"
+  puts "!> socket: #{socket}"
+  puts "!> "
+end
 
 while true
   ios = select([server, STDIN])[0]
@@ -31,6 +46,8 @@
       client.write("pong\n")
     elsif line == "pid\n"
       client.write("#{Process.pid}\n")
+    elsif line == "protocol_version\n"
+      client.write("#{protocol_version}\n")
     elsif line == "envvars\n"
       str = ""
       ENV.each_pair do |key, value|
@@ -10,13 +10,12 @@
 
 STDOUT.sync = true
 STDERR.sync = true
-puts "!> I have control 1.0"
-abort "Invalid initialization header" if STDIN.readline != "You have control 1.0\n"
+puts "!> I have control 1.1"
+abort "Invalid initialization header" if STDIN.readline != "You have control 1.1\n"
 
-options = {}
-while (line = STDIN.readline) != "\n"
-  name, value = line.strip.split(/: */, 2)
-  options[name] = value
+OPTIONS = {}
+STDIN.read(Integer(STDIN.readline)).split("\0").each_slice(2) do |name, value|
+  OPTIONS[name] = value
 end
 
 socket_filename = "/tmp/placebo-preloader.sock.#{Process.pid}"
@@ -27,14 +26,13 @@
 
 def process_client_command(server, client, command)
   if command == "spawn\n"
-    options = {}
-    while (line = client.readline) != "\n"
-      name, value = line.strip.split(/: */, 2)
-      options[name] = value
+    while client.readline != "\n"
+      # The spawn command carries no options; the preloader's
+      # own startup request has them.
     end
 
-    command = options["start_command"].split("\t")
-    process_title = options["process_title"]
+    command = OPTIONS["start_command"].split("\t")
+    process_title = OPTIONS["process_title"]
     process_title = command[0] if !process_title || process_title.empty?
     command[0] = [command[0], process_title]
 